@@ -0,0 +1,146 @@
+#include "audio_arena.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+const AudioArena::SizeClass DEFAULT_CLASSES[] = {
+    {4 * 1024, 8},
+    {16 * 1024, 4},
+    {64 * 1024, 2},
+    {256 * 1024, 1},
+};
+
+// keeps every chunk suitably aligned for int16_t/int32_t samples and SIMD loads
+const size_t CHUNK_ALIGN = 64;
+
+size_t align_up(size_t n) {
+    return (n + CHUNK_ALIGN - 1) & ~(CHUNK_ALIGN - 1);
+}
+
+} // namespace
+
+AudioArena::AudioArena() {
+    init(DEFAULT_CLASSES, sizeof(DEFAULT_CLASSES) / sizeof(DEFAULT_CLASSES[0]));
+}
+
+AudioArena::AudioArena(const SizeClass *classes, size_t class_count) {
+    init(classes, class_count);
+}
+
+void AudioArena::init(const SizeClass *classes, size_t class_count) {
+    if (class_count > MAX_CLASSES) {
+        class_count = MAX_CLASSES;
+    }
+
+    // classes are expected in ascending chunk size, the lookup in acquire() relies on it
+    size_t total_chunks = 0;
+    for (size_t i = 0; i < class_count; i++) {
+        Class& c = m_classes[i];
+        c.chunk_size = align_up(classes[i].chunk_size);
+        c.chunk_count = classes[i].chunk_count;
+        c.offset = m_slab_size;
+        m_slab_size += c.chunk_size * c.chunk_count;
+        total_chunks += c.chunk_count;
+    }
+    m_class_count = class_count;
+
+    // one block for every chunk, one for the free lists; pages are only touched as chunks get used
+    m_slab = static_cast<uint8_t *>(malloc(m_slab_size + CHUNK_ALIGN));
+    m_free_lists = static_cast<uint32_t *>(malloc(total_chunks * sizeof(uint32_t)));
+    if (!m_slab || !m_free_lists) {
+        free(m_slab);
+        free(m_free_lists);
+        m_slab = nullptr;
+        m_free_lists = nullptr;
+        m_slab_size = 0;
+        m_class_count = 0;
+        return;
+    }
+
+    m_base = m_slab + (CHUNK_ALIGN - reinterpret_cast<uintptr_t>(m_slab) % CHUNK_ALIGN) % CHUNK_ALIGN;
+
+    uint32_t *list = m_free_lists;
+    for (size_t i = 0; i < m_class_count; i++) {
+        Class& c = m_classes[i];
+        c.free_list = list;
+        c.free_top = c.chunk_count;
+        for (size_t k = 0; k < c.chunk_count; k++) {
+            // hand out low addresses first
+            c.free_list[k] = static_cast<uint32_t>(c.chunk_count - 1 - k);
+        }
+        list += c.chunk_count;
+    }
+}
+
+AudioArena::~AudioArena() {
+    free(m_slab);
+    free(m_free_lists);
+}
+
+void *AudioArena::acquire(size_t bytes, size_t *capacity) {
+    for (size_t i = 0; i < m_class_count; i++) {
+        Class& c = m_classes[i];
+        if (c.chunk_size >= bytes && c.free_top > 0) {
+            uint32_t index = c.free_list[--c.free_top];
+            *capacity = c.chunk_size;
+            return m_base + c.offset + static_cast<size_t>(index) * c.chunk_size;
+        }
+    }
+
+    m_heap_allocations++;
+    void *chunk = malloc(bytes);
+    *capacity = chunk ? bytes : 0;
+    return chunk;
+}
+
+void AudioArena::release(void *chunk) {
+    if (!chunk) {
+        return;
+    }
+    uint8_t *p = static_cast<uint8_t *>(chunk);
+    if (!m_base || p < m_base || p >= m_base + m_slab_size) {
+        free(chunk);
+        return;
+    }
+
+    size_t offset = static_cast<size_t>(p - m_base);
+    for (size_t i = 0; i < m_class_count; i++) {
+        Class& c = m_classes[i];
+        if (offset < c.offset + c.chunk_size * c.chunk_count) {
+            c.free_list[c.free_top++] = static_cast<uint32_t>((offset - c.offset) / c.chunk_size);
+            return;
+        }
+    }
+}
+
+ArenaBuffer::ArenaBuffer(AudioArena& arena, size_t initial_capacity) : m_arena(arena) {
+    if (initial_capacity > 0) {
+        reserve(initial_capacity);
+    }
+}
+
+ArenaBuffer::~ArenaBuffer() {
+    m_arena.release(m_data);
+}
+
+bool ArenaBuffer::reserve(size_t bytes) {
+    if (bytes <= m_capacity) {
+        return true;
+    }
+    // grow geometrically so a buffer that keeps growing settles quickly
+    size_t wanted = bytes > m_capacity + m_capacity / 2 ? bytes : m_capacity + m_capacity / 2;
+    size_t capacity = 0;
+    uint8_t *data = static_cast<uint8_t *>(m_arena.acquire(wanted, &capacity));
+    if (!data) {
+        return false;
+    }
+    if (m_size > 0) {
+        memcpy(data, m_data, m_size);
+    }
+    m_arena.release(m_data);
+    m_data = data;
+    m_capacity = capacity;
+    return true;
+}
@@ -0,0 +1,130 @@
+#ifndef AUDIO_ARENA_H
+#define AUDIO_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+
+//
+// Slab of fixed-size chunks backing the scratch buffers of one session.
+//
+// Every chunk is carved out of a single block reserved at construction, split
+// into size classes (4, 16, 64 and 256 KiB by default). acquire() returns the
+// smallest free chunk that fits; only when none does it falls back to the heap,
+// and those fallbacks are counted so the hot paths can be checked for general
+// purpose allocations.
+//
+// Only buffers carved from an arena are counted. The queues between threads
+// (SendQueue, DecodeQueue) and the DebugAudioWriter keep heap storage of their
+// own, recycled from one message to the next rather than allocated for each.
+//
+// An arena is not thread safe: it belongs to one thread, or to callers that
+// already serialize on a lock.
+//
+class AudioArena {
+  public:
+    struct SizeClass {
+        size_t chunk_size;
+        size_t chunk_count;
+    };
+
+    AudioArena();
+    AudioArena(const SizeClass *classes, size_t class_count);
+    ~AudioArena();
+
+    AudioArena(const AudioArena&) = delete;
+    AudioArena& operator=(const AudioArena&) = delete;
+
+    // Returns a chunk of at least bytes bytes and stores its real size in *capacity.
+    void *acquire(size_t bytes, size_t *capacity);
+
+    // Gives back a chunk returned by acquire(). nullptr is ignored.
+    void release(void *chunk);
+
+    // Chunks that did not fit in the slab and were taken from the heap.
+    uint64_t heap_allocations() const {
+        return m_heap_allocations;
+    }
+
+    // Bytes reserved for the slab.
+    size_t reserved() const {
+        return m_slab_size;
+    }
+
+  private:
+    static const size_t MAX_CLASSES = 8;
+
+    struct Class {
+        size_t chunk_size;
+        size_t chunk_count;
+        size_t offset;   // of the first chunk in the slab
+        size_t free_top; // number of entries in free_list
+        uint32_t *free_list;
+    };
+
+    void init(const SizeClass *classes, size_t class_count);
+
+    Class m_classes[MAX_CLASSES];
+    size_t m_class_count = 0;
+    uint8_t *m_slab = nullptr;
+    uint8_t *m_base = nullptr; // m_slab rounded up to the chunk alignment
+    size_t m_slab_size = 0;
+    uint32_t *m_free_lists = nullptr;
+    uint64_t m_heap_allocations = 0;
+};
+
+//
+// Growable byte buffer whose storage comes from an AudioArena. Growing keeps
+// the current contents; memory goes back to the arena on destruction.
+//
+class ArenaBuffer {
+  public:
+    explicit ArenaBuffer(AudioArena& arena, size_t initial_capacity = 0);
+    ~ArenaBuffer();
+
+    ArenaBuffer(const ArenaBuffer&) = delete;
+    ArenaBuffer& operator=(const ArenaBuffer&) = delete;
+
+    uint8_t *data() {
+        return m_data;
+    }
+    const uint8_t *data() const {
+        return m_data;
+    }
+    template <typename T> T *as() {
+        return reinterpret_cast<T *>(m_data);
+    }
+
+    size_t size() const {
+        return m_size;
+    }
+    size_t capacity() const {
+        return m_capacity;
+    }
+    bool empty() const {
+        return m_size == 0;
+    }
+
+    void clear() {
+        m_size = 0;
+    }
+
+    // Makes room for at least bytes bytes without changing size().
+    // Returns false, leaving the buffer untouched, if no memory is left.
+    bool reserve(size_t bytes);
+
+    bool resize(size_t bytes) {
+        if (!reserve(bytes)) {
+            return false;
+        }
+        m_size = bytes;
+        return true;
+    }
+
+  private:
+    AudioArena& m_arena;
+    uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_capacity = 0;
+};
+
+#endif // AUDIO_ARENA_H
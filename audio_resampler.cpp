@@ -0,0 +1,329 @@
+#include "audio_resampler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RESAMPLER_SIMD_X86 1
+#include <immintrin.h>
+#define RESAMPLER_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define RESAMPLER_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+const uint32_t MAX_POLYPHASE_TERM = 6; // L and M of the reduced ratio
+const int COEF_BITS = 14;              // Q14: upsampling phases have taps close to 1.0
+const size_t TAP_ALIGN = 8;
+
+// Per quality: stop band attenuation in dB and transition width, as a fraction
+// of the lower rate's Nyquist frequency.
+struct FilterSpec {
+    double attenuation;
+    double transition;
+};
+
+const FilterSpec kFilterSpecs[11] = {
+    {45, 0.30}, {50, 0.28}, {55, 0.26}, {60, 0.24}, {65, 0.22}, {70, 0.20},
+    {75, 0.18}, {80, 0.16}, {85, 0.14}, {90, 0.12}, {95, 0.10},
+};
+
+uint32_t gcd(uint32_t a, uint32_t b) {
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// zeroth order modified Bessel function of the first kind
+double bessel_i0(double x) {
+    double sum = 1, term = 1;
+    for (int k = 1; k < 50; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+double kaiser_beta(double attenuation) {
+    if (attenuation > 50) {
+        return 0.1102 * (attenuation - 8.7);
+    }
+    if (attenuation > 21) {
+        return 0.5842 * std::pow(attenuation - 21, 0.4) + 0.07886 * (attenuation - 21);
+    }
+    return 0;
+}
+
+inline int16_t saturate(int32_t acc) {
+    int32_t v = (acc + (1 << (COEF_BITS - 1))) >> COEF_BITS;
+    return static_cast<int16_t>(std::min<int32_t>(std::max<int32_t>(v, INT16_MIN), INT16_MAX));
+}
+
+// Dot products of taps (a multiple of 8) samples with one phase, then rounded back to PCM16.
+
+int16_t dot_scalar(const int16_t *x, const int16_t *h, size_t taps) {
+    int32_t acc = 0;
+    for (size_t k = 0; k < taps; k++) {
+        acc += static_cast<int32_t>(x[k]) * h[k];
+    }
+    return saturate(acc);
+}
+
+#if defined(RESAMPLER_SIMD_X86)
+inline int32_t hsum_epi32(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(v);
+}
+
+int16_t dot_sse2(const int16_t *x, const int16_t *h, size_t taps) {
+    __m128i acc = _mm_setzero_si128();
+    for (size_t k = 0; k < taps; k += 8) {
+        __m128i xv = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + k));
+        __m128i hv = _mm_loadu_si128(reinterpret_cast<const __m128i *>(h + k));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(xv, hv));
+    }
+    return saturate(hsum_epi32(acc));
+}
+
+RESAMPLER_TARGET_AVX2 int16_t dot_avx2(const int16_t *x, const int16_t *h, size_t taps) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t k = 0;
+    for (; k + 16 <= taps; k += 16) {
+        __m256i xv = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + k));
+        __m256i hv = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(h + k));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(xv, hv));
+    }
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    if (k < taps) {
+        __m128i xv = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + k));
+        __m128i hv = _mm_loadu_si128(reinterpret_cast<const __m128i *>(h + k));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(xv, hv));
+    }
+    return saturate(hsum_epi32(sum));
+}
+#elif defined(RESAMPLER_SIMD_NEON)
+int16_t dot_neon(const int16_t *x, const int16_t *h, size_t taps) {
+    int32x4_t acc = vdupq_n_s32(0);
+    for (size_t k = 0; k < taps; k += 8) {
+        int16x8_t xv = vld1q_s16(x + k);
+        int16x8_t hv = vld1q_s16(h + k);
+        acc = vmlal_s16(acc, vget_low_s16(xv), vget_low_s16(hv));
+        acc = vmlal_s16(acc, vget_high_s16(xv), vget_high_s16(hv));
+    }
+    int32x2_t pair = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+    return saturate(vget_lane_s32(vpadd_s32(pair, pair), 0));
+}
+#endif
+
+struct kernel_t {
+    const char *name;
+    const char *polyphase_name;
+    int16_t (*dot)(const int16_t *, const int16_t *, size_t);
+};
+
+const kernel_t kScalarKernel = {"scalar", "polyphase/scalar", dot_scalar};
+#if defined(RESAMPLER_SIMD_X86)
+const kernel_t kSse2Kernel = {"sse2", "polyphase/sse2", dot_sse2};
+const kernel_t kAvx2Kernel = {"avx2", "polyphase/avx2", dot_avx2};
+#elif defined(RESAMPLER_SIMD_NEON)
+const kernel_t kNeonKernel = {"neon", "polyphase/neon", dot_neon};
+#endif
+
+bool kernel_supported(const kernel_t *kernel) {
+#if defined(RESAMPLER_SIMD_X86)
+    __builtin_cpu_init();
+    if (kernel == &kAvx2Kernel) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (kernel == &kSse2Kernel) {
+        return __builtin_cpu_supports("sse2");
+    }
+#endif
+    return kernel != nullptr;
+}
+
+const kernel_t *detect_kernel() {
+#if defined(RESAMPLER_SIMD_X86)
+    if (kernel_supported(&kAvx2Kernel)) {
+        return &kAvx2Kernel;
+    }
+    if (kernel_supported(&kSse2Kernel)) {
+        return &kSse2Kernel;
+    }
+#elif defined(RESAMPLER_SIMD_NEON)
+    return &kNeonKernel;
+#endif
+    return &kScalarKernel;
+}
+
+std::atomic<const kernel_t *> g_kernel(nullptr);
+
+inline const kernel_t *active_kernel() {
+    const kernel_t *kernel = g_kernel.load(std::memory_order_acquire);
+    if (!kernel) {
+        kernel = detect_kernel();
+        g_kernel.store(kernel, std::memory_order_release);
+    }
+    return kernel;
+}
+
+} // namespace
+
+AudioResampler::AudioResampler(uint32_t channels, uint32_t in_rate, uint32_t out_rate,
+                               const ResamplerOptions& options)
+    : m_channels(channels) {
+    const int quality = std::min(std::max(options.quality, 0), 10);
+    if (options.polyphase && channels == 1 && init_polyphase(in_rate, out_rate, quality)) {
+        return;
+    }
+    m_speex = speex_resampler_init(channels, in_rate, out_rate, quality, &m_init_error);
+}
+
+AudioResampler::~AudioResampler() {
+    if (m_speex) {
+        speex_resampler_destroy(m_speex);
+    }
+}
+
+// Kaiser windowed sinc at L times the input rate, cut at the lower rate's Nyquist frequency, then
+// split in L phases. Each phase is normalized to a DC gain of exactly 1.0 in Q14, so a constant
+// input comes out unchanged whatever the phase.
+bool AudioResampler::init_polyphase(uint32_t in_rate, uint32_t out_rate, int quality) {
+    if (in_rate == 0 || out_rate == 0) {
+        return false;
+    }
+    const uint32_t g = gcd(in_rate, out_rate);
+    const uint32_t up = out_rate / g;
+    const uint32_t down = in_rate / g;
+    if (up > MAX_POLYPHASE_TERM || down > MAX_POLYPHASE_TERM) {
+        return false;
+    }
+
+    // frequencies in cycles per sample at the upsampled rate
+    const FilterSpec& spec = kFilterSpecs[quality];
+    const double nyquist = 0.5 / std::max(up, down);
+    const double width = spec.transition * nyquist;
+    // the stop band starts a quarter of the transition past Nyquist: what aliases there lands
+    // at the very top of the band, while the pass band keeps as much of the voice as possible
+    const double cutoff = nyquist * (1 + spec.transition / 4) - width / 2;
+    const double beta = kaiser_beta(spec.attenuation);
+    size_t length = static_cast<size_t>(std::ceil((spec.attenuation - 7.95) / (2.285 * 2 * M_PI * width))) + 1;
+    length |= 1; // odd, symmetric around a center tap
+
+    std::vector<double> prototype(length);
+    const double center = (length - 1) / 2.0;
+    const double i0_beta = bessel_i0(beta);
+    for (size_t j = 0; j < length; j++) {
+        const double t = j - center;
+        const double sinc = t == 0 ? 2 * cutoff : std::sin(2 * M_PI * cutoff * t) / (M_PI * t);
+        const double ratio = t / center;
+        prototype[j] = sinc * bessel_i0(beta * std::sqrt(std::max(0.0, 1 - ratio * ratio))) / i0_beta;
+    }
+
+    const size_t phase_taps = (length + up - 1) / up;
+    m_taps = (phase_taps + TAP_ALIGN - 1) / TAP_ALIGN * TAP_ALIGN;
+    m_coefs.assign(static_cast<size_t>(up) * m_taps, 0);
+    for (uint32_t p = 0; p < up; p++) {
+        double sum = 0;
+        for (size_t k = 0; k < phase_taps && p + k * up < length; k++) {
+            sum += prototype[p + k * up];
+        }
+        int16_t *phase = &m_coefs[p * m_taps];
+        int32_t total = 0;
+        size_t largest = m_taps - 1;
+        for (size_t k = 0; k < phase_taps && p + k * up < length; k++) {
+            // reversed: tap k applies to the sample k steps before the newest one
+            int16_t c = static_cast<int16_t>(std::lround(prototype[p + k * up] / sum * (1 << COEF_BITS)));
+            phase[m_taps - 1 - k] = c;
+            total += c;
+            if (std::abs(c) > std::abs(phase[largest])) {
+                largest = m_taps - 1 - k;
+            }
+        }
+        phase[largest] = static_cast<int16_t>(phase[largest] + (1 << COEF_BITS) - total); // rounding leftovers
+    }
+
+    m_up = up;
+    m_down = down;
+    m_work.assign(m_taps - 1, 0);
+    m_work.reserve(m_taps - 1 + in_rate / 10); // 100 ms of input without reallocating
+    return true;
+}
+
+int AudioResampler::process(const int16_t *in, uint32_t *in_len, int16_t *out, uint32_t *out_len) {
+    if (m_speex) {
+        return m_channels == 1 ? speex_resampler_process_int(m_speex, 0, in, in_len, out, out_len)
+                               : speex_resampler_process_interleaved_int(m_speex, in, in_len, out, out_len);
+    }
+    if (!m_up) {
+        *in_len = 0;
+        *out_len = 0;
+        return m_init_error != RESAMPLER_ERR_SUCCESS ? m_init_error : RESAMPLER_ERR_ALLOC_FAILED;
+    }
+
+    const size_t history = m_taps - 1;
+    const size_t count = *in_len;
+    m_work.resize(history + count);
+    memcpy(&m_work[history], in, count * sizeof(int16_t));
+
+    // output n reads the taps samples ending with input floor(position / L), with phase position % L
+    const kernel_t *kernel = active_kernel();
+    const int16_t *work = m_work.data();
+    uint32_t produced = 0;
+    while (produced < *out_len) {
+        const uint64_t newest = m_position / m_up;
+        if (newest >= count) {
+            break;
+        }
+        const int16_t *phase = &m_coefs[(m_position % m_up) * m_taps];
+        out[produced++] = kernel->dot(work + newest, phase, m_taps);
+        m_position += m_down;
+    }
+
+    const size_t consumed = static_cast<size_t>(std::min<uint64_t>(count, m_position / m_up));
+    m_position -= static_cast<uint64_t>(consumed) * m_up;
+    memmove(&m_work[0], &m_work[consumed], history * sizeof(int16_t));
+    m_work.resize(history);
+
+    *in_len = static_cast<uint32_t>(consumed);
+    *out_len = produced;
+    return RESAMPLER_ERR_SUCCESS;
+}
+
+const char *AudioResampler::kernel() const {
+    return m_speex ? "speex" : active_kernel()->polyphase_name;
+}
+
+const char *resampler_simd_backend() {
+    return active_kernel()->name;
+}
+
+bool resampler_simd_set_backend(const char *name) {
+    const kernel_t *candidates[] = {
+#if defined(RESAMPLER_SIMD_X86)
+        &kAvx2Kernel,
+        &kSse2Kernel,
+#elif defined(RESAMPLER_SIMD_NEON)
+        &kNeonKernel,
+#endif
+        &kScalarKernel,
+    };
+    for (const kernel_t *kernel : candidates) {
+        if (strcmp(kernel->name, name) == 0 && kernel_supported(kernel)) {
+            g_kernel.store(kernel, std::memory_order_release);
+            return true;
+        }
+    }
+    return false;
+}
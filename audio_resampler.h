@@ -0,0 +1,79 @@
+#ifndef AUDIO_RESAMPLER_H
+#define AUDIO_RESAMPLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <speex/speex_resampler.h>
+
+//
+// PCM16 sample rate converter of one stream direction.
+//
+// Telephony against the 24 kHz of the Realtime API gives small exact ratios
+// (8k <-> 24k is 1:3, 16k <-> 24k is 2:3). For those, and any other ratio with
+// both terms up to 6, mono audio goes through a polyphase FIR: a Kaiser
+// windowed sinc split in one short filter per output phase, stored as Q14 and
+// run with integer multiply-add SIMD (AVX2, SSE2, NEON or scalar, picked once
+// at runtime). Anything else (arbitrary ratios, stereo) is handed to speex.
+//
+// Quality follows the speex scale, 0 (fastest) to 10 (best): it sets the
+// filter length and its Kaiser window. Quality 0 is flat to about 70% of the
+// lower rate's band and rejects aliases by 45 dB; from quality 5 the response
+// is flat past 85% of the band (3.4 kHz at 8 kHz) and aliases and images stay
+// at least 60 dB down, 70 to 90 dB over most of the stop band, the Q14
+// coefficients setting the floor.
+//
+// Not thread safe: one resampler belongs to one thread at a time, like the
+// speex state it replaces.
+//
+struct ResamplerOptions {
+    int quality = 5;       // 0 to 10, speex scale
+    bool polyphase = true; // false hands every ratio to speex
+};
+
+class AudioResampler {
+  public:
+    AudioResampler(uint32_t channels, uint32_t in_rate, uint32_t out_rate,
+                   const ResamplerOptions& options = ResamplerOptions());
+    ~AudioResampler();
+
+    AudioResampler(const AudioResampler&) = delete;
+    AudioResampler& operator=(const AudioResampler&) = delete;
+
+    // RESAMPLER_ERR_SUCCESS, or the speex error that prevented the fallback from starting.
+    int init_error() const {
+        return m_init_error;
+    }
+
+    // Same contract as speex_resampler_process_int(), interleaved when there are several
+    // channels: converts up to *in_len frames into at most *out_len frames and stores the
+    // counts actually consumed and produced. Returns a speex error code.
+    int process(const int16_t *in, uint32_t *in_len, int16_t *out, uint32_t *out_len);
+
+    // "polyphase/<simd backend>" or "speex", for logs and benchmarks.
+    const char *kernel() const;
+
+  private:
+    bool init_polyphase(uint32_t in_rate, uint32_t out_rate, int quality);
+
+    uint32_t m_channels;
+    int m_init_error = RESAMPLER_ERR_SUCCESS;
+    SpeexResamplerState *m_speex = nullptr;
+
+    // polyphase
+    uint32_t m_up = 0;   // L: output samples per ratio period
+    uint32_t m_down = 0; // M: input samples per ratio period
+    size_t m_taps = 0;   // per phase, a multiple of 8
+    std::vector<int16_t> m_coefs; // m_up phases of m_taps, reversed so a dot product runs forward in time
+    std::vector<int16_t> m_work;  // m_taps - 1 samples of history, then the input being converted
+    uint64_t m_position = 0;      // next output, in 1/L input samples from the first new input sample
+};
+
+// Name of the SIMD kernel the polyphase filters use: "avx2", "sse2", "neon" or "scalar".
+const char *resampler_simd_backend();
+
+// Forces a kernel by name (benchmarks and tests). Returns false if the running CPU
+// does not support it, leaving the current selection untouched.
+bool resampler_simd_set_backend(const char *name);
+
+#endif // AUDIO_RESAMPLER_H
@@ -0,0 +1,527 @@
+#include "base64_simd.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BASE64_SIMD_X86 1
+#include <immintrin.h>
+#define BASE64_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define BASE64_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define BASE64_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+const char kEncodeTable[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                            "abcdefghijklmnopqrstuvwxyz"
+                            "0123456789+/";
+
+const uint8_t kInvalid = 0xff;
+
+// Decode table matching pos_of_char() in base64.cpp: both the standard and the
+// url alphabet map to 62/63, everything else is invalid.
+struct DecodeTable {
+    uint8_t value[256];
+
+    DecodeTable() {
+        memset(value, kInvalid, sizeof(value));
+        for (uint8_t i = 0; i < 64; i++) {
+            value[static_cast<uint8_t>(kEncodeTable[i])] = i;
+        }
+        value['-'] = 62;
+        value['_'] = 63;
+    }
+};
+
+const DecodeTable kDecodeTable;
+
+inline bool is_padding(char c) {
+    return c == '=' || c == '.';
+}
+
+//
+// Scalar kernels. These are also used for the tails and for any block the
+// vector kernels refuse, so they define the reference behaviour.
+//
+
+size_t encode_tail(const unsigned char *src, size_t len, char *dst) {
+    char *out = dst;
+    size_t pos = 0;
+    for (; pos + 3 <= len; pos += 3) {
+        const uint32_t v = (static_cast<uint32_t>(src[pos]) << 16) | (static_cast<uint32_t>(src[pos + 1]) << 8) |
+                           static_cast<uint32_t>(src[pos + 2]);
+        out[0] = kEncodeTable[(v >> 18) & 0x3f];
+        out[1] = kEncodeTable[(v >> 12) & 0x3f];
+        out[2] = kEncodeTable[(v >> 6) & 0x3f];
+        out[3] = kEncodeTable[v & 0x3f];
+        out += 4;
+    }
+    if (len - pos == 1) {
+        out[0] = kEncodeTable[src[pos] >> 2];
+        out[1] = kEncodeTable[(src[pos] & 0x03) << 4];
+        out[2] = '=';
+        out[3] = '=';
+        out += 4;
+    } else if (len - pos == 2) {
+        out[0] = kEncodeTable[src[pos] >> 2];
+        out[1] = kEncodeTable[((src[pos] & 0x03) << 4) | (src[pos + 1] >> 4)];
+        out[2] = kEncodeTable[(src[pos + 1] & 0x0f) << 2];
+        out[3] = '=';
+        out += 4;
+    }
+    return out - dst;
+}
+
+// Decodes the 4-character chunk starting at pos the way decode() in base64.cpp
+// does, including its handling of short and padded chunks.
+bool decode_chunk_exact(const char *src, size_t len, size_t pos, unsigned char *&out) {
+    if (pos + 1 >= len) {
+        return false;
+    }
+    const uint8_t v0 = kDecodeTable.value[static_cast<uint8_t>(src[pos])];
+    const uint8_t v1 = kDecodeTable.value[static_cast<uint8_t>(src[pos + 1])];
+    if (v0 == kInvalid || v1 == kInvalid) {
+        return false;
+    }
+    *out++ = static_cast<unsigned char>((v0 << 2) + ((v1 & 0x30) >> 4));
+
+    if (pos + 2 < len && !is_padding(src[pos + 2])) {
+        const uint8_t v2 = kDecodeTable.value[static_cast<uint8_t>(src[pos + 2])];
+        if (v2 == kInvalid) {
+            return false;
+        }
+        *out++ = static_cast<unsigned char>(((v1 & 0x0f) << 4) + ((v2 & 0x3c) >> 2));
+
+        if (pos + 3 < len && !is_padding(src[pos + 3])) {
+            const uint8_t v3 = kDecodeTable.value[static_cast<uint8_t>(src[pos + 3])];
+            if (v3 == kInvalid) {
+                return false;
+            }
+            *out++ = static_cast<unsigned char>(((v2 & 0x03) << 6) + v3);
+        }
+    }
+    return true;
+}
+
+// Decodes src[pos, end) chunk by chunk; end is either a multiple of 4 past pos
+// or the end of the input.
+bool decode_tail(const char *src, size_t len, size_t pos, size_t end, unsigned char *&out) {
+    while (pos < end) {
+        if (pos + 4 <= len) {
+            const uint8_t v0 = kDecodeTable.value[static_cast<uint8_t>(src[pos])];
+            const uint8_t v1 = kDecodeTable.value[static_cast<uint8_t>(src[pos + 1])];
+            const uint8_t v2 = kDecodeTable.value[static_cast<uint8_t>(src[pos + 2])];
+            const uint8_t v3 = kDecodeTable.value[static_cast<uint8_t>(src[pos + 3])];
+            if (((v0 | v1 | v2 | v3) & 0xc0) == 0) {
+                const uint32_t v = (static_cast<uint32_t>(v0) << 18) | (static_cast<uint32_t>(v1) << 12) |
+                                   (static_cast<uint32_t>(v2) << 6) | v3;
+                out[0] = static_cast<unsigned char>(v >> 16);
+                out[1] = static_cast<unsigned char>(v >> 8);
+                out[2] = static_cast<unsigned char>(v);
+                out += 3;
+                pos += 4;
+                continue;
+            }
+        }
+        if (!decode_chunk_exact(src, len, pos, out)) {
+            return false;
+        }
+        pos += 4;
+    }
+    return true;
+}
+
+size_t encode_scalar(const unsigned char *src, size_t len, char *dst) {
+    return encode_tail(src, len, dst);
+}
+
+bool decode_scalar(const char *src, size_t len, unsigned char *dst, size_t *dst_len) {
+    unsigned char *out = dst;
+    if (!decode_tail(src, len, 0, len, out)) {
+        return false;
+    }
+    *dst_len = out - dst;
+    return true;
+}
+
+#if defined(BASE64_SIMD_X86)
+
+//
+// SSE4.1 / AVX2 kernels, after Wojciech Muła and Daniel Lemire,
+// "Faster Base64 Encoding and Decoding Using AVX2 Instructions" (2018).
+//
+
+BASE64_TARGET_SSE41 inline __m128i enc_reshuffle_sse(__m128i in) {
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+BASE64_TARGET_SSE41 inline __m128i enc_translate_sse(__m128i indices) {
+    const __m128i shift_lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+    result = _mm_shuffle_epi8(shift_lut, result);
+    return _mm_add_epi8(result, indices);
+}
+
+BASE64_TARGET_SSE41 size_t encode_sse41(const unsigned char *src, size_t len, char *dst) {
+    size_t pos = 0;
+    char *out = dst;
+    // Each step loads 16 bytes and consumes 12 of them.
+    for (; pos + 16 <= len; pos += 12) {
+        const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + pos));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), enc_translate_sse(enc_reshuffle_sse(in)));
+        out += 16;
+    }
+    out += encode_tail(src + pos, len - pos, out);
+    return out - dst;
+}
+
+// Maps the standard alphabet to 6-bit values. Returns false if the block holds
+// anything else, including padding and the url alphabet.
+BASE64_TARGET_SSE41 inline bool dec_translate_sse(__m128i in, __m128i& out) {
+    const __m128i shift_lut = _mm_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_lut = _mm_setr_epi8(static_cast<char>(0xa8), static_cast<char>(0xf8), static_cast<char>(0xf8),
+                                           static_cast<char>(0xf8), static_cast<char>(0xf8), static_cast<char>(0xf8),
+                                           static_cast<char>(0xf8), static_cast<char>(0xf8), static_cast<char>(0xf8),
+                                           static_cast<char>(0xf8), static_cast<char>(0xf0), 0x54, 0x50, 0x50, 0x50,
+                                           0x54);
+    const __m128i bitpos_lut =
+        _mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, static_cast<char>(0x80), 0, 0, 0, 0, 0, 0, 0, 0);
+
+    const __m128i higher_nibble = _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0f));
+    const __m128i lower_nibble = _mm_and_si128(in, _mm_set1_epi8(0x0f));
+    const __m128i sh = _mm_shuffle_epi8(shift_lut, higher_nibble);
+    const __m128i eq_2f = _mm_cmpeq_epi8(in, _mm_set1_epi8(0x2f));
+    const __m128i shift = _mm_blendv_epi8(sh, _mm_set1_epi8(16), eq_2f);
+    const __m128i m = _mm_shuffle_epi8(mask_lut, lower_nibble);
+    const __m128i bit = _mm_shuffle_epi8(bitpos_lut, higher_nibble);
+    const __m128i non_match = _mm_cmpeq_epi8(_mm_and_si128(m, bit), _mm_setzero_si128());
+    if (_mm_movemask_epi8(non_match)) {
+        return false;
+    }
+    out = _mm_add_epi8(in, shift);
+    return true;
+}
+
+BASE64_TARGET_SSE41 inline __m128i dec_pack_sse(__m128i values) {
+    const __m128i merge_ab_and_bc = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    const __m128i merged = _mm_madd_epi16(merge_ab_and_bc, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+BASE64_TARGET_SSE41 bool decode_sse41(const char *src, size_t len, unsigned char *dst, size_t *dst_len) {
+    size_t pos = 0;
+    unsigned char *out = dst;
+    // A block stores 16 bytes but only 12 are valid; keeping 16 characters
+    // of input in reserve guarantees the overrun stays inside dst.
+    while (pos + 32 <= len) {
+        const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + pos));
+        __m128i values;
+        if (dec_translate_sse(in, values)) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out), dec_pack_sse(values));
+            out += 12;
+        } else if (!decode_tail(src, len, pos, pos + 16, out)) {
+            return false;
+        }
+        pos += 16;
+    }
+    if (!decode_tail(src, len, pos, len, out)) {
+        return false;
+    }
+    *dst_len = out - dst;
+    return true;
+}
+
+BASE64_TARGET_AVX2 inline __m256i enc_reshuffle_avx2(__m256i in) {
+    in = _mm256_shuffle_epi8(in, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1, 10, 11, 9, 10, 7, 8,
+                                                 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+    const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+    const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    return _mm256_or_si256(t1, t3);
+}
+
+BASE64_TARGET_AVX2 inline __m256i enc_translate_avx2(__m256i indices) {
+    const __m256i shift_lut = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '+' - 62, '/' - 63, 'A', 0, 0, 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    result = _mm256_shuffle_epi8(shift_lut, result);
+    return _mm256_add_epi8(result, indices);
+}
+
+BASE64_TARGET_AVX2 size_t encode_avx2(const unsigned char *src, size_t len, char *dst) {
+    size_t pos = 0;
+    char *out = dst;
+    // Each 128-bit lane gets 12 input bytes: the high lane loads src + 12,
+    // so a step reads 28 bytes and consumes 24.
+    for (; pos + 28 <= len; pos += 24) {
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + pos));
+        const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + pos + 12));
+        const __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), enc_translate_avx2(enc_reshuffle_avx2(in)));
+        out += 32;
+    }
+    out += encode_sse41(src + pos, len - pos, out);
+    return out - dst;
+}
+
+BASE64_TARGET_AVX2 inline bool dec_translate_avx2(__m256i in, __m256i& out) {
+    const __m256i shift_lut = _mm256_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 19, 4,
+                                               -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const char a8 = static_cast<char>(0xa8);
+    const char f8 = static_cast<char>(0xf8);
+    const char f0 = static_cast<char>(0xf0);
+    const __m256i mask_lut = _mm256_setr_epi8(a8, f8, f8, f8, f8, f8, f8, f8, f8, f8, f0, 0x54, 0x50, 0x50, 0x50, 0x54,
+                                              a8, f8, f8, f8, f8, f8, f8, f8, f8, f8, f0, 0x54, 0x50, 0x50, 0x50, 0x54);
+    const char b7 = static_cast<char>(0x80);
+    const __m256i bitpos_lut = _mm256_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, b7, 0, 0, 0, 0, 0, 0, 0, 0,
+                                                0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, b7, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    const __m256i higher_nibble = _mm256_and_si256(_mm256_srli_epi32(in, 4), _mm256_set1_epi8(0x0f));
+    const __m256i lower_nibble = _mm256_and_si256(in, _mm256_set1_epi8(0x0f));
+    const __m256i sh = _mm256_shuffle_epi8(shift_lut, higher_nibble);
+    const __m256i eq_2f = _mm256_cmpeq_epi8(in, _mm256_set1_epi8(0x2f));
+    const __m256i shift = _mm256_blendv_epi8(sh, _mm256_set1_epi8(16), eq_2f);
+    const __m256i m = _mm256_shuffle_epi8(mask_lut, lower_nibble);
+    const __m256i bit = _mm256_shuffle_epi8(bitpos_lut, higher_nibble);
+    const __m256i non_match = _mm256_cmpeq_epi8(_mm256_and_si256(m, bit), _mm256_setzero_si256());
+    if (_mm256_movemask_epi8(non_match)) {
+        return false;
+    }
+    out = _mm256_add_epi8(in, shift);
+    return true;
+}
+
+BASE64_TARGET_AVX2 inline __m256i dec_pack_avx2(__m256i values) {
+    const __m256i merge_ab_and_bc = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    const __m256i merged = _mm256_madd_epi16(merge_ab_and_bc, _mm256_set1_epi32(0x00011000));
+    const __m256i packed = _mm256_shuffle_epi8(merged, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1,
+                                                                        -1, -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                                                                        -1, -1, -1, -1));
+    return _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+}
+
+BASE64_TARGET_AVX2 bool decode_avx2(const char *src, size_t len, unsigned char *dst, size_t *dst_len) {
+    size_t pos = 0;
+    unsigned char *out = dst;
+    // A block stores 32 bytes but only 24 are valid, see decode_sse41().
+    while (pos + 48 <= len) {
+        const __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + pos));
+        __m256i values;
+        if (dec_translate_avx2(in, values)) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), dec_pack_avx2(values));
+            out += 24;
+        } else if (!decode_tail(src, len, pos, pos + 32, out)) {
+            return false;
+        }
+        pos += 32;
+    }
+    size_t tail_len = 0;
+    if (!decode_sse41(src + pos, len - pos, out, &tail_len)) {
+        return false;
+    }
+    *dst_len = (out - dst) + tail_len;
+    return true;
+}
+
+#elif defined(BASE64_SIMD_NEON)
+
+inline uint8x16_t enc_translate_neon(uint8x16_t idx) {
+    uint8x16_t offset = vdupq_n_u8('A');
+    offset = vbslq_u8(vcgeq_u8(idx, vdupq_n_u8(26)), vdupq_n_u8('a' - 26), offset);
+    offset = vbslq_u8(vcgeq_u8(idx, vdupq_n_u8(52)), vdupq_n_u8(static_cast<uint8_t>('0' - 52)), offset);
+    offset = vbslq_u8(vceqq_u8(idx, vdupq_n_u8(62)), vdupq_n_u8(static_cast<uint8_t>('+' - 62)), offset);
+    offset = vbslq_u8(vceqq_u8(idx, vdupq_n_u8(63)), vdupq_n_u8(static_cast<uint8_t>('/' - 63)), offset);
+    return vaddq_u8(idx, offset);
+}
+
+size_t encode_neon(const unsigned char *src, size_t len, char *dst) {
+    size_t pos = 0;
+    char *out = dst;
+    const uint8x16_t low2 = vdupq_n_u8(0x03);
+    const uint8x16_t low4 = vdupq_n_u8(0x0f);
+    const uint8x16_t low6 = vdupq_n_u8(0x3f);
+    for (; pos + 48 <= len; pos += 48) {
+        const uint8x16x3_t in = vld3q_u8(src + pos);
+        uint8x16x4_t idx;
+        idx.val[0] = vshrq_n_u8(in.val[0], 2);
+        idx.val[1] = vorrq_u8(vshlq_n_u8(vandq_u8(in.val[0], low2), 4), vshrq_n_u8(in.val[1], 4));
+        idx.val[2] = vorrq_u8(vshlq_n_u8(vandq_u8(in.val[1], low4), 2), vshrq_n_u8(in.val[2], 6));
+        idx.val[3] = vandq_u8(in.val[2], low6);
+        for (int i = 0; i < 4; i++) {
+            idx.val[i] = enc_translate_neon(idx.val[i]);
+        }
+        vst4q_u8(reinterpret_cast<uint8_t *>(out), idx);
+        out += 64;
+    }
+    out += encode_tail(src + pos, len - pos, out);
+    return out - dst;
+}
+
+// Standard alphabet only; anything else sets bits in invalid.
+inline uint8x16_t dec_translate_neon(uint8x16_t c, uint8x16_t& invalid) {
+    const uint8x16_t upper = vsubq_u8(c, vdupq_n_u8('A'));
+    const uint8x16_t lower = vsubq_u8(c, vdupq_n_u8('a'));
+    const uint8x16_t digit = vsubq_u8(c, vdupq_n_u8('0'));
+    const uint8x16_t is_upper = vcltq_u8(upper, vdupq_n_u8(26));
+    const uint8x16_t is_lower = vcltq_u8(lower, vdupq_n_u8(26));
+    const uint8x16_t is_digit = vcltq_u8(digit, vdupq_n_u8(10));
+    const uint8x16_t is_plus = vceqq_u8(c, vdupq_n_u8('+'));
+    const uint8x16_t is_slash = vceqq_u8(c, vdupq_n_u8('/'));
+
+    uint8x16_t v = vandq_u8(is_upper, upper);
+    v = vbslq_u8(is_lower, vaddq_u8(lower, vdupq_n_u8(26)), v);
+    v = vbslq_u8(is_digit, vaddq_u8(digit, vdupq_n_u8(52)), v);
+    v = vbslq_u8(is_plus, vdupq_n_u8(62), v);
+    v = vbslq_u8(is_slash, vdupq_n_u8(63), v);
+
+    const uint8x16_t valid = vorrq_u8(vorrq_u8(vorrq_u8(is_upper, is_lower), vorrq_u8(is_digit, is_plus)), is_slash);
+    invalid = vorrq_u8(invalid, vmvnq_u8(valid));
+    return v;
+}
+
+bool decode_neon(const char *src, size_t len, unsigned char *dst, size_t *dst_len) {
+    size_t pos = 0;
+    unsigned char *out = dst;
+    for (; pos + 64 <= len; pos += 64) {
+        const uint8x16x4_t in = vld4q_u8(reinterpret_cast<const uint8_t *>(src + pos));
+        uint8x16_t invalid = vdupq_n_u8(0);
+        const uint8x16_t a = dec_translate_neon(in.val[0], invalid);
+        const uint8x16_t b = dec_translate_neon(in.val[1], invalid);
+        const uint8x16_t c = dec_translate_neon(in.val[2], invalid);
+        const uint8x16_t d = dec_translate_neon(in.val[3], invalid);
+        const uint8x8_t folded = vorr_u8(vget_low_u8(invalid), vget_high_u8(invalid));
+        if (vget_lane_u64(vreinterpret_u64_u8(folded), 0) != 0) {
+            if (!decode_tail(src, len, pos, pos + 64, out)) {
+                return false;
+            }
+            continue;
+        }
+        uint8x16x3_t packed;
+        packed.val[0] = vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b, 4));
+        packed.val[1] = vorrq_u8(vshlq_n_u8(b, 4), vshrq_n_u8(c, 2));
+        packed.val[2] = vorrq_u8(vshlq_n_u8(c, 6), d);
+        vst3q_u8(out, packed);
+        out += 48;
+    }
+    if (!decode_tail(src, len, pos, len, out)) {
+        return false;
+    }
+    *dst_len = out - dst;
+    return true;
+}
+
+#endif
+
+struct codec_t {
+    const char *name;
+    size_t (*encode)(const unsigned char *, size_t, char *);
+    bool (*decode)(const char *, size_t, unsigned char *, size_t *);
+};
+
+const codec_t kScalarCodec = {"scalar", encode_scalar, decode_scalar};
+#if defined(BASE64_SIMD_X86)
+const codec_t kSse41Codec = {"sse4.1", encode_sse41, decode_sse41};
+const codec_t kAvx2Codec = {"avx2", encode_avx2, decode_avx2};
+#elif defined(BASE64_SIMD_NEON)
+const codec_t kNeonCodec = {"neon", encode_neon, decode_neon};
+#endif
+
+bool codec_supported(const codec_t *codec) {
+#if defined(BASE64_SIMD_X86)
+    __builtin_cpu_init();
+    if (codec == &kAvx2Codec) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (codec == &kSse41Codec) {
+        return __builtin_cpu_supports("sse4.1");
+    }
+#endif
+    return codec != nullptr;
+}
+
+const codec_t *detect_codec() {
+#if defined(BASE64_SIMD_X86)
+    if (codec_supported(&kAvx2Codec)) {
+        return &kAvx2Codec;
+    }
+    if (codec_supported(&kSse41Codec)) {
+        return &kSse41Codec;
+    }
+#elif defined(BASE64_SIMD_NEON)
+    return &kNeonCodec;
+#endif
+    return &kScalarCodec;
+}
+
+std::atomic<const codec_t *> g_codec(nullptr);
+
+inline const codec_t *active_codec() {
+    const codec_t *codec = g_codec.load(std::memory_order_acquire);
+    if (!codec) {
+        codec = detect_codec();
+        g_codec.store(codec, std::memory_order_release);
+    }
+    return codec;
+}
+
+} // namespace
+
+size_t base64_encoded_size(size_t len) {
+    return (len + 2) / 3 * 4;
+}
+
+size_t base64_decoded_max_size(size_t len) {
+    return (len + 3) / 4 * 3;
+}
+
+size_t base64_encode_into(const unsigned char *src, size_t len, char *dst) {
+    return active_codec()->encode(src, len, dst);
+}
+
+bool base64_decode_into(const char *src, size_t len, unsigned char *dst, size_t *dst_len) {
+    *dst_len = 0;
+    if (len == 0) {
+        return true;
+    }
+    return active_codec()->decode(src, len, dst, dst_len);
+}
+
+const char *base64_simd_backend() {
+    return active_codec()->name;
+}
+
+bool base64_simd_set_backend(const char *name) {
+    const codec_t *candidates[] = {
+#if defined(BASE64_SIMD_X86)
+        &kAvx2Codec,
+        &kSse41Codec,
+#elif defined(BASE64_SIMD_NEON)
+        &kNeonCodec,
+#endif
+        &kScalarCodec,
+    };
+    for (const codec_t *codec : candidates) {
+        if (strcmp(codec->name, name) == 0 && codec_supported(codec)) {
+            g_codec.store(codec, std::memory_order_release);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,40 @@
+#ifndef BASE64_SIMD_H
+#define BASE64_SIMD_H
+
+#include <cstddef>
+
+//
+// Allocation-free base64 codec used on the audio hot paths.
+//
+// The encoder emits the standard alphabet with '=' padding, byte for byte what
+// base64_encode(bytes, len, false) returns. The decoder accepts exactly the
+// inputs base64_decode() accepts (standard and url alphabets, '=' or '.' padding,
+// unpadded tails) and produces the same bytes; where base64_decode() would throw,
+// base64_decode_into() returns false instead.
+//
+// The best kernel for the running CPU (AVX2, SSE4.1, NEON or scalar) is selected
+// once, on first use.
+//
+
+// Exact number of characters base64_encode_into() writes for len input bytes.
+size_t base64_encoded_size(size_t len);
+
+// Upper bound of the bytes base64_decode_into() writes for len input characters.
+size_t base64_decoded_max_size(size_t len);
+
+// Encodes len bytes into dst, which must hold base64_encoded_size(len) characters.
+// No terminating NUL is written. Returns the number of characters written.
+size_t base64_encode_into(const unsigned char *src, size_t len, char *dst);
+
+// Decodes len characters into dst, which must hold base64_decoded_max_size(len) bytes.
+// On success stores the decoded length in *dst_len and returns true.
+bool base64_decode_into(const char *src, size_t len, unsigned char *dst, size_t *dst_len);
+
+// Name of the kernel selected at runtime: "avx2", "sse4.1", "neon" or "scalar".
+const char *base64_simd_backend();
+
+// Forces a kernel by name (benchmarks only). Returns false if the running CPU
+// does not support it, leaving the current selection untouched.
+bool base64_simd_set_backend(const char *name);
+
+#endif // BASE64_SIMD_H
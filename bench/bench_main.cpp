@@ -0,0 +1,349 @@
+//
+// Microbenchmark of the FreeSWITCH independent core: every case processes one
+// 20 ms frame of PCM16 mono per iteration and reports nanoseconds per frame.
+//
+// usage: mod_openai_audio_stream_bench [iterations]
+//
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "audio_resampler.h"
+#include "base64.h"
+#include "base64_simd.h"
+#include "g711.h"
+#include "playback_pipeline.h"
+#include "realtime_protocol.h"
+#include "silence_gate.h"
+#include "stream_stats.h"
+
+namespace {
+
+const uint32_t SERVER_RATE = 24000; // OpenAI realtime PCM16
+const uint32_t FRAME_MS = 20;
+const int RUNS = 5;
+
+size_t frame_samples(uint32_t rate) {
+    return rate * FRAME_MS / 1000;
+}
+
+// keeps results alive so the work is not optimized away
+volatile size_t g_sink;
+
+std::vector<int16_t> make_tone(size_t samples, uint32_t rate) {
+    std::vector<int16_t> pcm(samples);
+    for (size_t i = 0; i < samples; i++) {
+        pcm[i] = static_cast<int16_t>(8000 * std::sin(2 * M_PI * 440 * i / rate));
+    }
+    return pcm;
+}
+
+// Runs fn(iterations) RUNS times and prints the best ns per frame.
+template <typename Fn> void report(const char *name, size_t iterations, Fn fn) {
+    fn(iterations / 10 + 1); // warm up caches, branch predictors and lazy initialization
+    double best = 0;
+    for (int run = 0; run < RUNS; run++) {
+        auto start = std::chrono::steady_clock::now();
+        fn(iterations);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        double ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+        if (run == 0 || ns < best) {
+            best = ns;
+        }
+    }
+    printf("  %-44s %10.1f ns/frame\n", name, best);
+}
+
+void bench_base64(size_t iterations) {
+    const size_t bytes = frame_samples(SERVER_RATE) * sizeof(int16_t);
+    std::vector<int16_t> pcm = make_tone(frame_samples(SERVER_RATE), SERVER_RATE);
+    const unsigned char *src = reinterpret_cast<const unsigned char *>(pcm.data());
+    std::vector<char> text(base64_encoded_size(bytes));
+    std::vector<unsigned char> decoded(base64_decoded_max_size(text.size()));
+    base64_encode_into(src, bytes, text.data());
+
+    printf("base64, %zu bytes per frame\n", bytes);
+    report("base64_encode (std::string)", iterations, [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            g_sink = base64_encode(src, bytes, false).size();
+        }
+    });
+    report("base64_decode (std::string)", iterations, [&](size_t n) {
+        std::string in(text.data(), text.size());
+        for (size_t i = 0; i < n; i++) {
+            g_sink = base64_decode(in).size();
+        }
+    });
+
+    const char *backends[] = {"scalar", "sse4.1", "avx2", "neon"};
+    const std::string selected = base64_simd_backend();
+    for (const char *backend : backends) {
+        if (!base64_simd_set_backend(backend)) {
+            continue;
+        }
+        std::string name = std::string("base64_encode_into [") + backend + "]";
+        report(name.c_str(), iterations, [&](size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                g_sink = base64_encode_into(src, bytes, text.data());
+            }
+        });
+        name = std::string("base64_decode_into [") + backend + "]";
+        report(name.c_str(), iterations, [&](size_t n) {
+            size_t len = 0;
+            for (size_t i = 0; i < n; i++) {
+                base64_decode_into(text.data(), text.size(), decoded.data(), &len);
+            }
+            g_sink = len;
+        });
+    }
+    base64_simd_set_backend(selected.c_str());
+}
+
+void bench_framing(size_t iterations) {
+    const size_t bytes = frame_samples(SERVER_RATE) * sizeof(int16_t);
+    std::vector<int16_t> pcm = make_tone(frame_samples(SERVER_RATE), SERVER_RATE);
+    std::vector<char> message(realtime_audio_append_size(bytes));
+
+    printf("uplink framing (%s)\n", base64_simd_backend());
+    report("realtime_write_audio_append", iterations, [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            g_sink = realtime_write_audio_append(reinterpret_cast<const uint8_t *>(pcm.data()), bytes,
+                                                 message.data());
+        }
+    });
+}
+
+// {"type":"response.output_audio.delta",...,"delta":"<one frame of base64 audio>"}
+std::string make_delta_message() {
+    const size_t bytes = frame_samples(SERVER_RATE) * sizeof(int16_t);
+    std::vector<int16_t> pcm = make_tone(frame_samples(SERVER_RATE), SERVER_RATE);
+    std::string message("{\"type\":\"response.output_audio.delta\",\"event_id\":\"event_bench\","
+                        "\"response_id\":\"resp_bench\",\"item_id\":\"item_bench\",\"output_index\":0,"
+                        "\"content_index\":0,\"delta\":\"");
+    message += base64_encode(reinterpret_cast<const unsigned char *>(pcm.data()), bytes, false);
+    message += "\"}";
+    return message;
+}
+
+void bench_delta(size_t iterations) {
+    const std::string message = make_delta_message();
+    std::vector<char> stripped(message.size() + 1);
+
+    printf("downlink delta messages, %zu bytes each\n", message.size());
+    report("realtime_scan_message", iterations, [&](size_t n) {
+        realtime_message_t msg;
+        for (size_t i = 0; i < n; i++) {
+            realtime_scan_message(message.data(), message.size(), &msg);
+        }
+        g_sink = msg.delta_len;
+    });
+    report("realtime_strip_audio", iterations, [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            g_sink = realtime_strip_audio(message.data(), message.size(), SERVER_RATE * 2, stripped.data());
+        }
+    });
+}
+
+// Delta in, frame out: scan, decode, resample into the playback queue, then read one
+// channel frame back the way write_frame does.
+void bench_playback(size_t iterations, uint32_t channel_rate) {
+    const std::string message = make_delta_message();
+    const size_t out_samples = frame_samples(channel_rate);
+    std::vector<int16_t> frame(out_samples);
+    std::vector<uint8_t> decoded(base64_decoded_max_size(message.size()));
+    StreamStats stats;
+    PlaybackPipeline pipeline(SERVER_RATE, channel_rate, 1000, &stats);
+
+    printf("playback %u Hz -> %u Hz\n", SERVER_RATE, channel_rate);
+    report("delta -> queue -> frame", iterations, [&](size_t n) {
+        realtime_message_t msg;
+        for (size_t i = 0; i < n; i++) {
+            realtime_scan_message(message.data(), message.size(), &msg);
+            bool ok = false;
+            size_t samples = 0;
+            if (!pipeline.push_base64_in_place(msg.delta, msg.delta_len, &ok, &samples)) {
+                size_t len = 0;
+                base64_decode_into(msg.delta, msg.delta_len, decoded.data(), &len);
+                pipeline.push_pcm(decoded.data(), len);
+            }
+            g_sink = pipeline.pop(frame.data(), out_samples);
+        }
+    });
+
+    std::vector<int16_t> pcm = make_tone(frame_samples(SERVER_RATE), SERVER_RATE);
+    report("pcm -> queue -> frame", iterations, [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            pipeline.push_pcm(reinterpret_cast<const uint8_t *>(pcm.data()), pcm.size() * sizeof(int16_t));
+            g_sink = pipeline.pop(frame.data(), out_samples);
+        }
+    });
+
+    if (stats.downlink_dropped_samples.load() > 0) {
+        printf("  warning: %llu samples dropped, the queue was not drained\n",
+               static_cast<unsigned long long>(stats.downlink_dropped_samples.load()));
+    }
+}
+
+// G.711 passthrough at 8 kHz: compressing one uplink frame, expanding one downlink frame on every
+// kernel, and a G.711 delta into the playback queue of an 8 kHz channel.
+void bench_g711(size_t iterations) {
+    const uint32_t rate = 8000;
+    const size_t samples = frame_samples(rate);
+    std::vector<int16_t> pcm = make_tone(samples, rate);
+    std::vector<uint8_t> encoded(samples);
+    std::vector<int16_t> decoded(samples);
+    const G711Law laws[] = {G711_ULAW, G711_ALAW};
+
+    printf("g711, %zu bytes per frame\n", samples);
+    for (G711Law law : laws) {
+        std::string name = std::string("g711_encode ") + g711_law_name(law);
+        report(name.c_str(), iterations, [&](size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                g711_encode(law, pcm.data(), samples, encoded.data());
+            }
+            g_sink = encoded[0];
+        });
+    }
+
+    const char *backends[] = {"scalar", "ssse3", "neon"};
+    const std::string selected = g711_simd_backend();
+    for (const char *backend : backends) {
+        if (!g711_simd_set_backend(backend)) {
+            continue;
+        }
+        for (G711Law law : laws) {
+            std::string name = std::string("g711_decode ") + g711_law_name(law) + " [" + backend + "]";
+            report(name.c_str(), iterations, [&](size_t n) {
+                for (size_t i = 0; i < n; i++) {
+                    g711_decode(law, encoded.data(), samples, decoded.data());
+                }
+                g_sink = decoded[0];
+            });
+        }
+    }
+    g711_simd_set_backend(selected.c_str());
+
+    g711_encode(G711_ULAW, pcm.data(), samples, encoded.data());
+    std::vector<char> text(base64_encoded_size(samples));
+    base64_encode_into(encoded.data(), samples, text.data());
+    std::vector<uint8_t> bytes(base64_decoded_max_size(text.size()));
+    StreamStats stats;
+    PlaybackPipeline pipeline(rate, rate, 1000, &stats);
+    report("g711 delta -> queue -> frame", iterations, [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            size_t len = 0;
+            base64_decode_into(text.data(), text.size(), bytes.data(), &len);
+            pipeline.push_g711(G711_ULAW, bytes.data(), len);
+            g_sink = pipeline.pop(decoded.data(), samples);
+        }
+    });
+}
+
+// One 20 ms frame through a resampler per iteration: speex, then the polyphase filter on
+// every SIMD kernel the CPU runs, at the fast, default and best qualities.
+void bench_resampler(size_t iterations, uint32_t in_rate, uint32_t out_rate) {
+    std::vector<int16_t> pcm = make_tone(frame_samples(in_rate), in_rate);
+    std::vector<int16_t> out(frame_samples(out_rate) + 16);
+
+    printf("resample %u Hz -> %u Hz\n", in_rate, out_rate);
+    auto run = [&](const std::string& name, const ResamplerOptions& options) {
+        AudioResampler resampler(1, in_rate, out_rate, options);
+        report(name.c_str(), iterations, [&](size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                uint32_t in_len = static_cast<uint32_t>(pcm.size());
+                uint32_t out_len = static_cast<uint32_t>(out.size());
+                resampler.process(pcm.data(), &in_len, out.data(), &out_len);
+                g_sink = out_len;
+            }
+        });
+    };
+
+    const int qualities[] = {3, 5, 8};
+    for (int quality : qualities) {
+        ResamplerOptions options;
+        options.quality = quality;
+        options.polyphase = false;
+        run("speex q" + std::to_string(quality), options);
+    }
+
+    const char *backends[] = {"scalar", "sse2", "avx2", "neon"};
+    const std::string selected = resampler_simd_backend();
+    for (const char *backend : backends) {
+        if (!resampler_simd_set_backend(backend)) {
+            continue;
+        }
+        for (int quality : qualities) {
+            ResamplerOptions options;
+            options.quality = quality;
+            run(std::string("polyphase [") + backend + "] q" + std::to_string(quality), options);
+        }
+    }
+    resampler_simd_set_backend(selected.c_str());
+}
+
+// Silence gate at the OpenAI rate: a voiced frame, decided on its first window, a quiet frame
+// just below the threshold, where every window also gets its zero crossings counted, and the
+// steady state of a silent uplink, held back and trimmed to the pre-roll.
+void bench_silence_gate(size_t iterations) {
+    const size_t samples = frame_samples(SERVER_RATE);
+    std::vector<int16_t> tone = make_tone(samples, SERVER_RATE);
+    std::vector<int16_t> quiet(samples);
+    for (size_t i = 0; i < samples; i++) {
+        quiet[i] = static_cast<int16_t>(100 * std::sin(2 * M_PI * 100 * i / SERVER_RATE)); // hum at -53 dBFS
+    }
+    SilenceGateConfig config;
+    config.threshold_dbfs = -50;
+    StreamStats stats;
+    SilenceGate gate(SERVER_RATE, 1, config, &stats);
+
+    printf("silence gate, %zu samples per frame\n", samples);
+    report("is_speech voiced", iterations, [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            g_sink = gate.is_speech(tone.data(), samples);
+        }
+    });
+    report("is_speech quiet", iterations, [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            g_sink = gate.is_speech(quiet.data(), samples);
+        }
+    });
+    report("admit quiet (held back)", iterations, [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            g_sink = gate.admit(quiet.data(), samples);
+        }
+    });
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t iterations = 100000;
+    if (argc > 1) {
+        iterations = strtoul(argv[1], nullptr, 10);
+        if (iterations == 0) {
+            fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+    printf("%zu iterations, best of %d runs, %u ms frames\n\n", iterations, RUNS, FRAME_MS);
+
+    bench_base64(iterations);
+    bench_framing(iterations);
+    bench_delta(iterations);
+    bench_playback(iterations, 24000);
+    bench_playback(iterations, 16000);
+    bench_playback(iterations, 8000);
+    bench_g711(iterations);
+    bench_silence_gate(iterations);
+    bench_resampler(iterations, 24000, 8000);
+    bench_resampler(iterations, 24000, 16000);
+    bench_resampler(iterations, 8000, 24000);
+    bench_resampler(iterations, 16000, 24000);
+    return 0;
+}
@@ -0,0 +1,218 @@
+#include "debug_audio_writer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+namespace {
+
+// at 24 kHz PCM16 this is close to three minutes of audio waiting for the disk
+const size_t MAX_QUEUED_BYTES = 8 * 1024 * 1024;
+const size_t MAX_SPARE_BUFFERS = 64;
+const size_t FILE_BUFFER_SIZE = 64 * 1024;
+const size_t WAV_HEADER_SIZE = 44;
+
+void put_le16(uint8_t *p, uint16_t v) {
+    p[0] = static_cast<uint8_t>(v);
+    p[1] = static_cast<uint8_t>(v >> 8);
+}
+
+void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = static_cast<uint8_t>(v);
+    p[1] = static_cast<uint8_t>(v >> 8);
+    p[2] = static_cast<uint8_t>(v >> 16);
+    p[3] = static_cast<uint8_t>(v >> 24);
+}
+
+void write_wav_header(FILE *file, uint32_t sample_rate, uint32_t data_size) {
+    const uint16_t channels = 1;
+    const uint16_t bits_per_sample = 16;
+    uint8_t header[WAV_HEADER_SIZE];
+
+    memcpy(header, "RIFF", 4);
+    put_le32(header + 4, 36 + data_size);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_le32(header + 16, 16); // fmt chunk size
+    put_le16(header + 20, 1);  // pcm
+    put_le16(header + 22, channels);
+    put_le32(header + 24, sample_rate);
+    put_le32(header + 28, sample_rate * channels * bits_per_sample / 8);
+    put_le16(header + 32, channels * bits_per_sample / 8);
+    put_le16(header + 34, bits_per_sample);
+    memcpy(header + 36, "data", 4);
+    put_le32(header + 40, data_size);
+
+    fwrite(header, 1, sizeof(header), file);
+}
+
+struct Capture {
+    FILE *file;
+    uint32_t sample_rate;
+    uint32_t data_size;
+};
+
+} // namespace
+
+DebugAudioWriter& DebugAudioWriter::instance() {
+    static DebugAudioWriter writer;
+    return writer;
+}
+
+DebugAudioWriter::~DebugAudioWriter() {
+    shutdown();
+}
+
+bool DebugAudioWriter::start_locked() {
+    if (m_thread.joinable()) {
+        return true;
+    }
+    m_stopping = false;
+    try {
+        m_thread = std::thread(&DebugAudioWriter::run, this);
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+void DebugAudioWriter::push_locked(Command&& command) {
+    m_queued_bytes += command.data.size();
+    m_queue.push_back(std::move(command));
+    m_wakeup.notify_one();
+}
+
+uint64_t DebugAudioWriter::open(const std::string& path, uint32_t sample_rate) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!start_locked()) {
+        return 0;
+    }
+    Command command{OPEN, m_next_capture++, sample_rate, path, {}};
+    uint64_t capture = command.capture;
+    push_locked(std::move(command));
+    return capture;
+}
+
+bool DebugAudioWriter::append(uint64_t capture, const uint8_t *data, size_t len) {
+    if (capture == 0 || len == 0) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_thread.joinable() || m_queued_bytes + len > MAX_QUEUED_BYTES) {
+        m_dropped_bytes.fetch_add(len, std::memory_order_relaxed);
+        return false;
+    }
+
+    Command command{APPEND, capture, 0, std::string(), {}};
+    if (!m_spare.empty()) {
+        command.data.swap(m_spare.back());
+        m_spare.pop_back();
+    }
+    command.data.assign(data, data + len);
+    push_locked(std::move(command));
+    return true;
+}
+
+void DebugAudioWriter::close(uint64_t capture) {
+    if (capture == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_thread.joinable()) {
+        push_locked(Command{CLOSE, capture, 0, std::string(), {}});
+    }
+}
+
+void DebugAudioWriter::remove(const std::string& path) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_thread.joinable()) {
+        push_locked(Command{REMOVE, 0, 0, path, {}});
+    } else {
+        ::remove(path.c_str());
+    }
+}
+
+void DebugAudioWriter::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_thread.joinable()) {
+            return;
+        }
+        m_stopping = true;
+        m_wakeup.notify_one();
+    }
+    m_thread.join();
+}
+
+void DebugAudioWriter::run() {
+    std::unordered_map<uint64_t, Capture> captures;
+    std::deque<Command> batch;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeup.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+            if (m_queue.empty()) {
+                break; // stopping and drained
+            }
+            batch.swap(m_queue);
+            m_queued_bytes = 0;
+        }
+
+        for (auto& command : batch) {
+            switch (command.type) {
+                case OPEN: {
+                    FILE *file = fopen(command.path.c_str(), "wb");
+                    if (file) {
+                        setvbuf(file, nullptr, _IOFBF, FILE_BUFFER_SIZE);
+                        write_wav_header(file, command.sample_rate, 0);
+                        captures[command.capture] = Capture{file, command.sample_rate, 0};
+                    }
+                    break;
+                }
+                case APPEND: {
+                    auto it = captures.find(command.capture);
+                    if (it != captures.end()) {
+                        fwrite(command.data.data(), 1, command.data.size(), it->second.file);
+                        it->second.data_size += static_cast<uint32_t>(command.data.size());
+                    }
+                    break;
+                }
+                case CLOSE: {
+                    auto it = captures.find(command.capture);
+                    if (it != captures.end()) {
+                        Capture& c = it->second;
+                        fseek(c.file, 0, SEEK_SET);
+                        write_wav_header(c.file, c.sample_rate, c.data_size);
+                        fclose(c.file);
+                        captures.erase(it);
+                    }
+                    break;
+                }
+                case REMOVE:
+                    ::remove(command.path.c_str());
+                    break;
+            }
+        }
+
+        // a capture still being written is readable up to the last batch
+        for (auto& entry : captures) {
+            fflush(entry.second.file);
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& command : batch) {
+            if (command.type == APPEND && m_spare.size() < MAX_SPARE_BUFFERS) {
+                command.data.clear();
+                m_spare.push_back(std::move(command.data));
+            }
+        }
+        batch.clear();
+    }
+
+    // captures left open by streamers that never closed them
+    for (auto& entry : captures) {
+        fseek(entry.second.file, 0, SEEK_SET);
+        write_wav_header(entry.second.file, entry.second.sample_rate, entry.second.data_size);
+        fclose(entry.second.file);
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef DEBUG_AUDIO_WRITER_H
+#define DEBUG_AUDIO_WRITER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+// Module wide background writer for the debug audio files.
+//
+// Streamers hand PCM over through a bounded queue and never touch the disk
+// themselves. Each capture is one streaming WAV file: the header is written
+// with empty sizes on open and patched when the capture is closed. The writer
+// thread drains the queue in batches, so consecutive appends end up in a few
+// large writes.
+//
+// All calls are thread safe. The thread is started on the first open() and
+// stopped, after draining the queue, by shutdown().
+//
+class DebugAudioWriter {
+  public:
+    static DebugAudioWriter& instance();
+
+    // Starts a capture of mono PCM16 at sample_rate into path.
+    // Returns its handle, 0 if the writer thread cannot be started.
+    uint64_t open(const std::string& path, uint32_t sample_rate);
+
+    // Queues len bytes for the capture. Returns false, dropping them, when the
+    // queue already holds too much data.
+    bool append(uint64_t capture, const uint8_t *data, size_t len);
+
+    // Finalizes the WAV header and closes the file.
+    void close(uint64_t capture);
+
+    // Deletes path once every command queued before has been processed.
+    void remove(const std::string& path);
+
+    // Drains the queue and joins the writer thread.
+    void shutdown();
+
+    // Bytes dropped because the queue was full.
+    uint64_t dropped_bytes() const {
+        return m_dropped_bytes.load(std::memory_order_relaxed);
+    }
+
+  private:
+    enum CommandType { OPEN, APPEND, CLOSE, REMOVE };
+
+    struct Command {
+        CommandType type;
+        uint64_t capture;
+        uint32_t sample_rate;
+        std::string path;
+        std::vector<uint8_t> data;
+    };
+
+    DebugAudioWriter() = default;
+    ~DebugAudioWriter();
+
+    bool start_locked();
+    void push_locked(Command&& command);
+    void run();
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::deque<Command> m_queue;
+    std::vector<std::vector<uint8_t>> m_spare; // recycled append buffers
+    size_t m_queued_bytes = 0;
+    uint64_t m_next_capture = 1;
+    bool m_stopping = false;
+    std::thread m_thread;
+    std::atomic<uint64_t> m_dropped_bytes{0};
+};
+
+#endif // DEBUG_AUDIO_WRITER_H
@@ -0,0 +1,63 @@
+#include "decode_queue.h"
+
+#include <utility>
+
+DecodeQueue::DecodeQueue(size_t capacity, StreamStats *stats) : m_capacity(capacity), m_stats(stats) {}
+
+bool DecodeQueue::push(DecodeJobKind kind, const void *data, size_t len, const char *text, size_t text_len) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_bytes + len + text_len > m_capacity) {
+        if (!m_overflowing) {
+            m_overflowing = true;
+            m_stats->add(m_stats->downlink_queue_overflows);
+        }
+        m_stats->add(m_stats->downlink_queue_dropped_bytes, len);
+        return false;
+    }
+    if (m_spare.empty()) {
+        m_jobs.emplace_back();
+    } else {
+        m_jobs.push_back(std::move(m_spare.back()));
+        m_spare.pop_back();
+    }
+    DecodeJob& job = m_jobs.back();
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    job.kind = kind;
+    job.data.assign(bytes, bytes + len);
+    job.text.assign(text, text + text_len);
+    m_bytes += len + text_len;
+    return true;
+}
+
+void DecodeQueue::barge_in() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    while (!m_jobs.empty()) {
+        m_stats->add(m_stats->downlink_discarded_bytes, m_jobs.front().data.size());
+        recycle(m_jobs.front());
+        m_jobs.pop_front();
+    }
+    m_bytes = 0;
+    m_overflowing = false;
+    m_epoch++;
+}
+
+bool DecodeQueue::pop(DecodeJob *job, uint32_t *epoch) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    *epoch = m_epoch;
+    if (m_jobs.empty()) {
+        m_overflowing = false;
+        return false;
+    }
+    DecodeJob& front = m_jobs.front();
+    m_bytes -= front.data.size() + front.text.size();
+    std::swap(*job, front);
+    recycle(front);
+    m_jobs.pop_front();
+    return true;
+}
+
+void DecodeQueue::recycle(DecodeJob& job) {
+    job.data.clear();
+    job.text.clear();
+    m_spare.push_back(std::move(job));
+}
@@ -0,0 +1,74 @@
+#ifndef DECODE_QUEUE_H
+#define DECODE_QUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "stream_stats.h"
+
+//
+// Downlink audio on its way from the websocket receive thread to the decode
+// worker of the stream. The receive thread only copies each delta in, so it
+// keeps draining the socket and handles the control messages behind a burst of
+// audio right away; the worker decodes, resamples and queues the audio for
+// playback in the order it arrived.
+//
+// Barge-in starts a new epoch: what is still queued is dropped undecoded, and
+// pop() hands the worker the epoch with each job, so it knows to clear the
+// playback queue before anything of the new epoch plays. The queue holds at
+// most capacity bytes; audio arriving beyond that is dropped, and counted, until
+// the worker empties the queue.
+//
+enum DecodeJobKind {
+    DECODE_BASE64,       // a response.output_audio.delta payload
+    DECODE_BINARY,       // a raw audio mode frame, PCM16 or an Opus packet
+    DECODE_END_RESPONSE, // response.output_audio.done, in order with the audio
+};
+
+struct DecodeJob {
+    DecodeJobKind kind = DECODE_BASE64;
+    std::vector<uint8_t> data; // the audio as received
+    std::vector<char> text;    // the message, when events need it along with the decoded audio
+};
+
+class DecodeQueue {
+  public:
+    DecodeQueue(size_t capacity, StreamStats *stats);
+
+    DecodeQueue(const DecodeQueue&) = delete;
+    DecodeQueue& operator=(const DecodeQueue&) = delete;
+
+    // Receive thread. Copies the job in; false if it does not fit.
+    bool push(DecodeJobKind kind, const void *data, size_t len, const char *text = nullptr, size_t text_len = 0);
+
+    // Receive thread. Drops everything queued and starts a new epoch.
+    void barge_in();
+
+    // True from the first drop until the queue is empty again, one backlog at a time.
+    bool overflowing() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_overflowing;
+    }
+
+    // Worker. Swaps the oldest job into *job, whose previous buffers are kept for later pushes;
+    // false when there is none. *epoch is set either way: the epoch the job belongs to, or the
+    // current one.
+    bool pop(DecodeJob *job, uint32_t *epoch);
+
+  private:
+    void recycle(DecodeJob& job);
+
+    const size_t m_capacity;
+    StreamStats *m_stats;
+    std::mutex m_mutex;
+    std::deque<DecodeJob> m_jobs;
+    std::vector<DecodeJob> m_spare; // popped jobs, reused for their buffers
+    size_t m_bytes = 0;
+    uint32_t m_epoch = 0;
+    bool m_overflowing = false;
+};
+
+#endif // DECODE_QUEUE_H
@@ -0,0 +1,184 @@
+#include "encoder_pool.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+
+struct EncoderPool::Stream {
+    Worker *worker;
+    std::function<void()> work;
+    std::atomic<bool> pending{false};
+};
+
+class EncoderPool::Worker {
+  public:
+    explicit Worker(int cpu) : m_cpu(cpu) {}
+
+    bool start() {
+        try {
+            m_thread = std::thread(&Worker::run, this);
+        } catch (const std::exception&) {
+            return false;
+        }
+        return true;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+            m_stopping = true;
+            m_wakeup.notify_one();
+        }
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+    }
+
+    // Only the first wake after a pass takes the mutex: the worker is either about to wait,
+    // or has not yet cleared the flag and will see the stream pending anyway.
+    void wake() {
+        if (!m_signalled.exchange(true, std::memory_order_acq_rel)) {
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+            m_wakeup.notify_one();
+        }
+    }
+
+    void attach(Stream *stream) {
+        std::lock_guard<std::mutex> lock(m_streams_mutex);
+        m_streams.push_back(stream);
+    }
+
+    // Waits for the pass in progress, which holds the mutex.
+    void detach(Stream *stream) {
+        std::lock_guard<std::mutex> lock(m_streams_mutex);
+        m_streams.erase(std::remove(m_streams.begin(), m_streams.end(), stream), m_streams.end());
+    }
+
+    std::atomic<size_t> load{0}; // streams assigned to this worker
+
+  private:
+    void run() {
+        if (m_cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(m_cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(m_wake_mutex);
+                m_wakeup.wait(lock, [this] { return m_stopping || m_signalled.load(std::memory_order_acquire); });
+                if (m_stopping) {
+                    return;
+                }
+            }
+            // cleared before the pass: a stream woken from now on signals again
+            m_signalled.store(false, std::memory_order_release);
+
+            std::lock_guard<std::mutex> lock(m_streams_mutex);
+            for (Stream *stream : m_streams) {
+                if (stream->pending.exchange(false, std::memory_order_acq_rel)) {
+                    stream->work();
+                }
+            }
+        }
+    }
+
+    const int m_cpu;
+    std::thread m_thread;
+    std::mutex m_wake_mutex;
+    std::condition_variable m_wakeup;
+    bool m_stopping = false;
+    std::atomic<bool> m_signalled{false};
+    std::mutex m_streams_mutex;
+    std::vector<Stream *> m_streams;
+};
+
+EncoderPool& EncoderPool::instance() {
+    static EncoderPool pool;
+    return pool;
+}
+
+EncoderPool::~EncoderPool() {
+    shutdown();
+}
+
+void EncoderPool::configure(size_t threads, const std::vector<int>& cpus) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_threads = threads;
+    m_cpus = cpus;
+}
+
+bool EncoderPool::enabled() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_threads > 0;
+}
+
+EncoderPool::Stream *EncoderPool::add(std::function<void()> work) {
+    Worker *best = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_shut_down || m_threads == 0) {
+            return nullptr;
+        }
+        if (m_workers.empty()) {
+            for (size_t i = 0; i < m_threads; i++) {
+                int cpu = m_cpus.empty() ? -1 : m_cpus[i % m_cpus.size()];
+                std::unique_ptr<Worker> worker(new Worker(cpu));
+                if (!worker->start()) {
+                    break;
+                }
+                m_workers.push_back(std::move(worker));
+            }
+            if (m_workers.empty()) {
+                return nullptr;
+            }
+        }
+        best = m_workers[0].get();
+        for (auto& worker : m_workers) {
+            if (worker->load.load(std::memory_order_relaxed) < best->load.load(std::memory_order_relaxed)) {
+                best = worker.get();
+            }
+        }
+        best->load.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Stream *stream = new Stream;
+    stream->worker = best;
+    stream->work = std::move(work);
+    best->attach(stream);
+    return stream;
+}
+
+void EncoderPool::wake(Stream *stream) {
+    if (!stream->pending.exchange(true, std::memory_order_acq_rel)) {
+        stream->worker->wake();
+    }
+}
+
+void EncoderPool::remove(Stream *stream) {
+    if (!stream) {
+        return;
+    }
+    stream->worker->detach(stream);
+    stream->worker->load.fetch_sub(1, std::memory_order_relaxed);
+    delete stream;
+}
+
+// The workers are stopped but not freed: streams that outlive the module shutdown still
+// point to them.
+void EncoderPool::shutdown() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_shut_down) {
+        return;
+    }
+    m_shut_down = true;
+    for (auto& worker : m_workers) {
+        worker->stop();
+    }
+}
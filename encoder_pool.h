@@ -0,0 +1,62 @@
+#ifndef ENCODER_POOL_H
+#define ENCODER_POOL_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//
+// Module wide threads doing the audio work of the streams in place of the
+// threads that receive the audio: the uplink (resampling, silence suppression,
+// encoding and sending) for the media threads, and the downlink decoding for
+// the websocket threads.
+//
+// Each direction of a stream registers its work once; it is assigned to the
+// least loaded worker and stays there. The receiving thread then only copies
+// the audio into a queue of the stream and calls wake(), which costs an atomic
+// exchange, and a notify when the worker is idle. Wakes that arrive while the
+// stream is already pending are merged, so a late worker catches up in one
+// pass over everything queued since. Workers are started on the first add()
+// and pinned to the configured cpus, if any.
+//
+class EncoderPool {
+  public:
+    class Worker;
+    struct Stream;
+
+    static EncoderPool& instance();
+
+    // Sets the number of workers, 0 to keep the work on the media threads, and the cpus
+    // worker i is pinned to (the i-th, wrapping around). Meant to be called at module load.
+    void configure(size_t threads, const std::vector<int>& cpus);
+
+    bool enabled();
+
+    // Registers the work of a stream, run on its worker after wake(). Null when the pool is
+    // disabled, shut down, or none of its threads could start; the caller does the work itself.
+    Stream *add(std::function<void()> work);
+
+    // Any thread, typically the media thread after capturing frames.
+    static void wake(Stream *stream);
+
+    // Waits for the work of the stream to finish if it is running, then frees the stream:
+    // its work never runs again.
+    void remove(Stream *stream);
+
+    // Joins the workers. Streams still registered are not run anymore.
+    void shutdown();
+
+  private:
+    EncoderPool() = default;
+    ~EncoderPool();
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    size_t m_threads = 0;
+    std::vector<int> m_cpus;
+    bool m_shut_down = false;
+};
+
+#endif // ENCODER_POOL_H
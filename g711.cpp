@@ -0,0 +1,296 @@
+#include "g711.h"
+
+#include <atomic>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define G711_SIMD_X86 1
+#include <immintrin.h>
+#define G711_TARGET_SSSE3 __attribute__((target("ssse3")))
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define G711_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+const int ULAW_BIAS = 0x84;
+const int ULAW_CLIP = 8159; // in 14-bit units
+
+// Reference coders (Sun Microsystems' public domain g711.c), used to build the tables.
+
+int segment(int value, const int *ends) {
+    int seg = 0;
+    while (seg < 8 && value > ends[seg]) {
+        seg++;
+    }
+    return seg;
+}
+
+uint8_t ulaw_from_linear14(int value) {
+    static const int ends[8] = {0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF};
+    int mask = 0xFF;
+    if (value < 0) {
+        value = -value;
+        mask = 0x7F;
+    }
+    if (value > ULAW_CLIP) {
+        value = ULAW_CLIP;
+    }
+    value += ULAW_BIAS >> 2;
+    const int seg = segment(value, ends);
+    if (seg >= 8) {
+        return static_cast<uint8_t>(0x7F ^ mask);
+    }
+    return static_cast<uint8_t>(((seg << 4) | ((value >> (seg + 1)) & 0x0F)) ^ mask);
+}
+
+uint8_t alaw_from_linear13(int value) {
+    static const int ends[8] = {0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF};
+    int mask = 0xD5;
+    if (value < 0) {
+        value = -value - 1;
+        mask = 0x55;
+    }
+    const int seg = segment(value, ends);
+    if (seg >= 8) {
+        return static_cast<uint8_t>(0x7F ^ mask);
+    }
+    const int mantissa = seg < 2 ? (value >> 1) & 0x0F : (value >> seg) & 0x0F;
+    return static_cast<uint8_t>(((seg << 4) | mantissa) ^ mask);
+}
+
+int16_t linear_from_ulaw(uint8_t code) {
+    const int u = ~code & 0xFF;
+    const int t = (((u & 0x0F) << 3) + ULAW_BIAS) << ((u & 0x70) >> 4);
+    return static_cast<int16_t>((u & 0x80) ? ULAW_BIAS - t : t - ULAW_BIAS);
+}
+
+int16_t linear_from_alaw(uint8_t code) {
+    const int a = code ^ 0x55;
+    const int seg = (a & 0x70) >> 4;
+    int t = (a & 0x0F) << 4;
+    t = seg ? (t + 0x108) << (seg - 1) : t + 8;
+    return static_cast<int16_t>((a & 0x80) ? t : -t);
+}
+
+// Encoders index by the top 14 (mu-law) or 13 (A-law) bits of the sample, decoders by the code.
+struct Tables {
+    uint8_t ulaw_encode[1 << 14];
+    uint8_t alaw_encode[1 << 13];
+    int16_t ulaw_decode[256];
+    int16_t alaw_decode[256];
+
+    Tables() {
+        for (int i = 0; i < (1 << 14); i++) {
+            ulaw_encode[i] = ulaw_from_linear14(i < (1 << 13) ? i : i - (1 << 14));
+        }
+        for (int i = 0; i < (1 << 13); i++) {
+            alaw_encode[i] = alaw_from_linear13(i < (1 << 12) ? i : i - (1 << 13));
+        }
+        for (int i = 0; i < 256; i++) {
+            ulaw_decode[i] = linear_from_ulaw(static_cast<uint8_t>(i));
+            alaw_decode[i] = linear_from_alaw(static_cast<uint8_t>(i));
+        }
+    }
+};
+
+const Tables kTables;
+
+//
+// Decode kernels. The scalar one also finishes the tails of the vector ones.
+//
+
+void decode_scalar(G711Law law, const uint8_t *src, size_t len, int16_t *dst) {
+    const int16_t *table = law == G711_ULAW ? kTables.ulaw_decode : kTables.alaw_decode;
+    for (size_t i = 0; i < len; i++) {
+        dst[i] = table[src[i]];
+    }
+}
+
+#if defined(G711_SIMD_X86)
+// mu-law: t = ((mantissa << 3) + 0x84) << segment, sample = +-(t - 0x84), negative when the sign bit is set
+G711_TARGET_SSSE3 void decode_ulaw_ssse3(const uint8_t *src, size_t len, int16_t *dst) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i shifts = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, static_cast<char>(0x80), 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i bias = _mm_set1_epi16(ULAW_BIAS);
+    size_t pos = 0;
+    for (; pos + 16 <= len; pos += 16) {
+        const __m128i u = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + pos)),
+                                        _mm_set1_epi8(static_cast<char>(0xFF)));
+        const __m128i seg = _mm_and_si128(_mm_srli_epi16(u, 4), _mm_set1_epi8(0x07));
+        const __m128i mult = _mm_shuffle_epi8(shifts, seg);
+        const __m128i mantissa = _mm_and_si128(u, _mm_set1_epi8(0x0F));
+        const __m128i negative = _mm_cmplt_epi8(u, zero);
+
+        __m128i m = _mm_unpacklo_epi8(mantissa, zero);
+        __m128i t = _mm_mullo_epi16(_mm_add_epi16(_mm_slli_epi16(m, 3), bias), _mm_unpacklo_epi8(mult, zero));
+        __m128i n = _mm_unpacklo_epi8(negative, negative);
+        t = _mm_sub_epi16(t, bias);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + pos), _mm_sub_epi16(_mm_xor_si128(t, n), n));
+
+        m = _mm_unpackhi_epi8(mantissa, zero);
+        t = _mm_mullo_epi16(_mm_add_epi16(_mm_slli_epi16(m, 3), bias), _mm_unpackhi_epi8(mult, zero));
+        n = _mm_unpackhi_epi8(negative, negative);
+        t = _mm_sub_epi16(t, bias);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + pos + 8), _mm_sub_epi16(_mm_xor_si128(t, n), n));
+    }
+    decode_scalar(G711_ULAW, src + pos, len - pos, dst + pos);
+}
+
+// A-law: t = (mantissa << 4) + 8 (+ 0x100 above segment 0) << (segment - 1), negative when the sign bit is clear
+G711_TARGET_SSSE3 void decode_alaw_ssse3(const uint8_t *src, size_t len, int16_t *dst) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i shifts = _mm_setr_epi8(1, 1, 2, 4, 8, 16, 32, 64, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i offsets = _mm_setr_epi8(0, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0); // high byte of 0x100
+    const __m128i eight = _mm_set1_epi16(8);
+    size_t pos = 0;
+    for (; pos + 16 <= len; pos += 16) {
+        const __m128i a = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + pos)),
+                                        _mm_set1_epi8(0x55));
+        const __m128i seg = _mm_and_si128(_mm_srli_epi16(a, 4), _mm_set1_epi8(0x07));
+        const __m128i mult = _mm_shuffle_epi8(shifts, seg);
+        const __m128i offset = _mm_shuffle_epi8(offsets, seg);
+        const __m128i mantissa = _mm_and_si128(a, _mm_set1_epi8(0x0F));
+        const __m128i negative = _mm_cmpeq_epi8(_mm_cmplt_epi8(a, zero), zero);
+
+        __m128i base = _mm_add_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(mantissa, zero), 4), eight);
+        __m128i t = _mm_mullo_epi16(_mm_add_epi16(base, _mm_unpacklo_epi8(zero, offset)),
+                                    _mm_unpacklo_epi8(mult, zero));
+        __m128i n = _mm_unpacklo_epi8(negative, negative);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + pos), _mm_sub_epi16(_mm_xor_si128(t, n), n));
+
+        base = _mm_add_epi16(_mm_slli_epi16(_mm_unpackhi_epi8(mantissa, zero), 4), eight);
+        t = _mm_mullo_epi16(_mm_add_epi16(base, _mm_unpackhi_epi8(zero, offset)), _mm_unpackhi_epi8(mult, zero));
+        n = _mm_unpackhi_epi8(negative, negative);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + pos + 8), _mm_sub_epi16(_mm_xor_si128(t, n), n));
+    }
+    decode_scalar(G711_ALAW, src + pos, len - pos, dst + pos);
+}
+
+void decode_ssse3(G711Law law, const uint8_t *src, size_t len, int16_t *dst) {
+    if (law == G711_ULAW) {
+        decode_ulaw_ssse3(src, len, dst);
+    } else {
+        decode_alaw_ssse3(src, len, dst);
+    }
+}
+#elif defined(G711_SIMD_NEON)
+void decode_neon(G711Law law, const uint8_t *src, size_t len, int16_t *dst) {
+    static const uint8_t kUlawShifts[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+    static const uint8_t kAlawShifts[8] = {1, 1, 2, 4, 8, 16, 32, 64};
+    static const uint8_t kAlawOffsets[8] = {0, 1, 1, 1, 1, 1, 1, 1};
+    const bool ulaw = law == G711_ULAW;
+    const uint8x8_t shifts = vld1_u8(ulaw ? kUlawShifts : kAlawShifts);
+    const uint8x8_t offsets = vld1_u8(kAlawOffsets);
+    size_t pos = 0;
+    for (; pos + 8 <= len; pos += 8) {
+        const uint8x8_t code = ulaw ? vmvn_u8(vld1_u8(src + pos)) : veor_u8(vld1_u8(src + pos), vdup_n_u8(0x55));
+        const uint8x8_t seg = vand_u8(vshr_n_u8(code, 4), vdup_n_u8(0x07));
+        const int16x8_t mult = vreinterpretq_s16_u16(vmovl_u8(vtbl1_u8(shifts, seg)));
+        const int16x8_t mantissa = vreinterpretq_s16_u16(vmovl_u8(vand_u8(code, vdup_n_u8(0x0F))));
+        const uint16x8_t sign = vmovl_u8(vtst_u8(code, vdup_n_u8(0x80)));
+        int16x8_t t;
+        uint16x8_t negative;
+        if (ulaw) {
+            t = vmulq_s16(vaddq_s16(vshlq_n_s16(mantissa, 3), vdupq_n_s16(ULAW_BIAS)), mult);
+            t = vsubq_s16(t, vdupq_n_s16(ULAW_BIAS));
+            negative = vtstq_u16(sign, sign);
+        } else {
+            const int16x8_t offset = vreinterpretq_s16_u16(vshll_n_u8(vtbl1_u8(offsets, seg), 8));
+            t = vmulq_s16(vaddq_s16(vaddq_s16(vshlq_n_s16(mantissa, 4), vdupq_n_s16(8)), offset), mult);
+            negative = vceqq_u16(sign, vdupq_n_u16(0));
+        }
+        vst1q_s16(dst + pos, vbslq_s16(negative, vnegq_s16(t), t));
+    }
+    decode_scalar(law, src + pos, len - pos, dst + pos);
+}
+#endif
+
+struct kernel_t {
+    const char *name;
+    void (*decode)(G711Law, const uint8_t *, size_t, int16_t *);
+};
+
+const kernel_t kScalarKernel = {"scalar", decode_scalar};
+#if defined(G711_SIMD_X86)
+const kernel_t kSsse3Kernel = {"ssse3", decode_ssse3};
+#elif defined(G711_SIMD_NEON)
+const kernel_t kNeonKernel = {"neon", decode_neon};
+#endif
+
+bool kernel_supported(const kernel_t *kernel) {
+#if defined(G711_SIMD_X86)
+    __builtin_cpu_init();
+    if (kernel == &kSsse3Kernel) {
+        return __builtin_cpu_supports("ssse3");
+    }
+#endif
+    return kernel != nullptr;
+}
+
+const kernel_t *detect_kernel() {
+#if defined(G711_SIMD_X86)
+    if (kernel_supported(&kSsse3Kernel)) {
+        return &kSsse3Kernel;
+    }
+#elif defined(G711_SIMD_NEON)
+    return &kNeonKernel;
+#endif
+    return &kScalarKernel;
+}
+
+std::atomic<const kernel_t *> g_kernel(nullptr);
+
+inline const kernel_t *active_kernel() {
+    const kernel_t *kernel = g_kernel.load(std::memory_order_acquire);
+    if (!kernel) {
+        kernel = detect_kernel();
+        g_kernel.store(kernel, std::memory_order_release);
+    }
+    return kernel;
+}
+
+} // namespace
+
+const char *g711_law_name(G711Law law) {
+    return law == G711_ULAW ? "g711_ulaw" : "g711_alaw";
+}
+
+void g711_encode(G711Law law, const int16_t *pcm, size_t samples, uint8_t *dst) {
+    if (law == G711_ULAW) {
+        for (size_t i = 0; i < samples; i++) {
+            dst[i] = kTables.ulaw_encode[(static_cast<uint16_t>(pcm[i]) >> 2)];
+        }
+    } else {
+        for (size_t i = 0; i < samples; i++) {
+            dst[i] = kTables.alaw_encode[(static_cast<uint16_t>(pcm[i]) >> 3)];
+        }
+    }
+}
+
+void g711_decode(G711Law law, const uint8_t *src, size_t len, int16_t *dst) {
+    active_kernel()->decode(law, src, len, dst);
+}
+
+const char *g711_simd_backend() {
+    return active_kernel()->name;
+}
+
+bool g711_simd_set_backend(const char *name) {
+    const kernel_t *candidates[] = {
+#if defined(G711_SIMD_X86)
+        &kSsse3Kernel,
+#elif defined(G711_SIMD_NEON)
+        &kNeonKernel,
+#endif
+        &kScalarKernel,
+    };
+    for (const kernel_t *kernel : candidates) {
+        if (strcmp(kernel->name, name) == 0 && kernel_supported(kernel)) {
+            g_kernel.store(kernel, std::memory_order_release);
+            return true;
+        }
+    }
+    return false;
+}
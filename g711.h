@@ -0,0 +1,36 @@
+#ifndef G711_H
+#define G711_H
+
+#include <cstddef>
+#include <cstdint>
+
+//
+// G.711 codec for streams that exchange g711_ulaw or g711_alaw with the server
+// instead of PCM16, at 8 kHz, one byte per sample.
+//
+// Both directions give the same results as the reference G.711 code (Sun's
+// g711.c, also used by FreeSWITCH): the encoder is one lookup per sample in a
+// table of the 14-bit (mu-law) or 13-bit (A-law) input; the decoder expands
+// 16 bytes at a time with two 8-entry shuffle tables, the segment giving the
+// shift and the bias, then finishes with a 256-entry table. The decode kernel
+// (SSSE3, NEON or scalar) is selected once, on first use.
+//
+enum G711Law { G711_ULAW, G711_ALAW };
+
+// Name of the law as the Realtime API spells its audio format: "g711_ulaw" or "g711_alaw".
+const char *g711_law_name(G711Law law);
+
+// Encodes samples PCM16 samples into as many bytes at dst.
+void g711_encode(G711Law law, const int16_t *pcm, size_t samples, uint8_t *dst);
+
+// Decodes len bytes into as many PCM16 samples at dst.
+void g711_decode(G711Law law, const uint8_t *src, size_t len, int16_t *dst);
+
+// Name of the decode kernel selected at runtime: "ssse3", "neon" or "scalar".
+const char *g711_simd_backend();
+
+// Forces a decode kernel by name (benchmarks and tests). Returns false if the running
+// CPU does not support it, leaving the current selection untouched.
+bool g711_simd_set_backend(const char *name);
+
+#endif // G711_H
@@ -114,6 +114,10 @@ static switch_status_t start_capture(switch_core_session_t *session, switch_medi
     switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "setting bug private data.\n");
     switch_channel_set_private(channel, MY_BUG_NAME, bug);
 
+    // only now: the first server messages may already be waiting and their handlers look for the bug
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "connecting.\n");
+    stream_session_connect(session);
+
     switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "exiting start_capture.\n");
     return SWITCH_STATUS_SUCCESS;
 }
@@ -190,7 +194,7 @@ static switch_status_t send_json(switch_core_session_t *session, char *json) {
     "         where <rate> = 8k|16k|24k or any multiple of 8000\n"                                                     \
     "         send_rate default: 24k, playback_rate default: 24k\n" api_name                                           \
     " <uuid> [stop | pause | resume]\n" api_name " <uuid> [mute | unmute] [user | openai | all]\n" api_name            \
-    " <uuid> send_json <base64json>\n"                                                                                 \
+    " <uuid> send_json <base64json>\n" api_name " <uuid> stats\n"                                                     \
     "--------------------------------------------------------------------------------\n"
 
 #define STREAM_API_SYNTAX STREAM_API_SYNTAX_BODY("uuid_openai_audio_stream")
@@ -210,7 +214,8 @@ typedef enum {
     STREAM_CMD_PAUSE,
     STREAM_CMD_RESUME,
     STREAM_CMD_MUTE,
-    STREAM_CMD_UNMUTE
+    STREAM_CMD_UNMUTE,
+    STREAM_CMD_STATS
 } stream_command_t;
 
 static stream_command_t stream_command_from_string(const char *name) {
@@ -238,6 +243,9 @@ static stream_command_t stream_command_from_string(const char *name) {
     if (!strcasecmp(name, "unmute")) {
         return STREAM_CMD_UNMUTE;
     }
+    if (!strcasecmp(name, "stats")) {
+        return STREAM_CMD_STATS;
+    }
     return STREAM_CMD_UNKNOWN;
 }
 
@@ -245,6 +253,7 @@ static switch_status_t stream_api_execute(switch_stream_handle_t *stream, switch
                                           const char *cmd, const stream_api_config_t *api_config) {
     char *mycmd = NULL, *argv[8] = {0};
     int argc = 0;
+    switch_bool_t replied = SWITCH_FALSE;
 
     switch_status_t status = SWITCH_STATUS_FALSE;
 
@@ -368,6 +377,10 @@ static switch_status_t stream_api_execute(switch_stream_handle_t *stream, switch
                 status = do_audio_mute(lsession, target, command == STREAM_CMD_MUTE ? 1 : 0);
                 break;
             }
+            case STREAM_CMD_STATS:
+                status = stream_session_stats(lsession, stream);
+                replied = status == SWITCH_STATUS_SUCCESS ? SWITCH_TRUE : SWITCH_FALSE;
+                break;
             case STREAM_CMD_UNKNOWN:
             default:
                 switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
@@ -382,7 +395,9 @@ static switch_status_t stream_api_execute(switch_stream_handle_t *stream, switch
                           argv[0]);
     }
 
-    if (status == SWITCH_STATUS_SUCCESS) {
+    if (replied) {
+        /* the command already wrote its own output */
+    } else if (status == SWITCH_STATUS_SUCCESS) {
         stream->write_function(stream, "+OK Success\n");
     } else {
         stream->write_function(stream, "-ERR Operation Failed\n");
@@ -404,6 +419,11 @@ SWITCH_STANDARD_API(raw_stream_function) {
     return stream_api_execute(stream, session, cmd, &RAW_STREAM_API_CONFIG);
 }
 
+SWITCH_STANDARD_API(stats_function) {
+    stream_module_stats(stream);
+    return SWITCH_STATUS_SUCCESS;
+}
+
 SWITCH_MODULE_LOAD_FUNCTION(mod_openai_audio_stream_load) {
     switch_api_interface_t *api_interface;
 
@@ -418,14 +438,18 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_openai_audio_stream_load) {
         switch_event_reserve_subclass(EVENT_ERROR) != SWITCH_STATUS_SUCCESS ||
         switch_event_reserve_subclass(EVENT_DISCONNECT) != SWITCH_STATUS_SUCCESS ||
         switch_event_reserve_subclass(EVENT_OPENAI_SPEECH_STARTED) != SWITCH_STATUS_SUCCESS ||
-        switch_event_reserve_subclass(EVENT_OPENAI_SPEECH_STOPPED) != SWITCH_STATUS_SUCCESS) {
+        switch_event_reserve_subclass(EVENT_OPENAI_SPEECH_STOPPED) != SWITCH_STATUS_SUCCESS ||
+        switch_event_reserve_subclass(EVENT_SEND_OVERFLOW) != SWITCH_STATUS_SUCCESS) {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
                           "Couldn't register an event subclass for mod_openai_audio_stream API.\n");
         return SWITCH_STATUS_TERM;
     }
+    stream_module_init();
     SWITCH_ADD_API(api_interface, "uuid_openai_audio_stream", "audio_stream API", stream_function, STREAM_API_SYNTAX);
     SWITCH_ADD_API(api_interface, "uuid_raw_audio_stream", "raw audio_stream API", raw_stream_function,
                    RAW_STREAM_API_SYNTAX);
+    SWITCH_ADD_API(api_interface, "openai_audio_stream_stats", "audio_stream statistics of all sessions",
+                   stats_function, "");
     switch_console_set_complete("add uuid_openai_audio_stream ::console::list_uuid start ws-uri");
     switch_console_set_complete("add uuid_openai_audio_stream ::console::list_uuid stop");
     switch_console_set_complete("add uuid_openai_audio_stream ::console::list_uuid pause");
@@ -433,6 +457,7 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_openai_audio_stream_load) {
     switch_console_set_complete("add uuid_openai_audio_stream ::console::list_uuid mute");
     switch_console_set_complete("add uuid_openai_audio_stream ::console::list_uuid unmute");
     switch_console_set_complete("add uuid_openai_audio_stream ::console::list_uuid send_json");
+    switch_console_set_complete("add uuid_openai_audio_stream ::console::list_uuid stats");
     switch_console_set_complete("add uuid_raw_audio_stream ::console::list_uuid start ws-uri");
     switch_console_set_complete("add uuid_raw_audio_stream ::console::list_uuid stop");
     switch_console_set_complete("add uuid_raw_audio_stream ::console::list_uuid pause");
@@ -440,6 +465,7 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_openai_audio_stream_load) {
     switch_console_set_complete("add uuid_raw_audio_stream ::console::list_uuid mute");
     switch_console_set_complete("add uuid_raw_audio_stream ::console::list_uuid unmute");
     switch_console_set_complete("add uuid_raw_audio_stream ::console::list_uuid send_json");
+    switch_console_set_complete("add uuid_raw_audio_stream ::console::list_uuid stats");
 
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "mod_openai_audio_stream API successfully loaded\n");
 
@@ -451,12 +477,14 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_openai_audio_stream_load) {
   Called when the system shuts down
   Macro expands to: switch_status_t mod_openai_audio_stream_shutdown() */
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_openai_audio_stream_shutdown) {
+    stream_module_shutdown();
     switch_event_free_subclass(EVENT_JSON);
     switch_event_free_subclass(EVENT_CONNECT);
     switch_event_free_subclass(EVENT_DISCONNECT);
     switch_event_free_subclass(EVENT_ERROR);
     switch_event_free_subclass(EVENT_OPENAI_SPEECH_STARTED);
     switch_event_free_subclass(EVENT_OPENAI_SPEECH_STOPPED);
+    switch_event_free_subclass(EVENT_SEND_OVERFLOW);
 
     return SWITCH_STATUS_SUCCESS;
 }
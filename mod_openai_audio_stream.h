@@ -3,7 +3,6 @@
 
 #include <switch.h>
 #include <limits.h>
-#include <speex/speex_resampler.h>
 
 #define MY_BUG_NAME "audio_stream"
 #define MAX_SESSION_ID (256)
@@ -16,13 +15,14 @@
 #define EVENT_PLAY "mod_openai_audio_stream::play"
 #define EVENT_OPENAI_SPEECH_STARTED "mod_openai_audio_stream::openai_speech_start"
 #define EVENT_OPENAI_SPEECH_STOPPED "mod_openai_audio_stream::openai_speech_stop"
+#define EVENT_SEND_OVERFLOW "mod_openai_audio_stream::send_overflow"
 
 typedef void (*responseHandler_t)(switch_core_session_t *session, const char *eventName, const char *json);
 
 struct private_data {
     switch_mutex_t *mutex;
     char sessionId[MAX_SESSION_ID];
-    SpeexResamplerState *resampler;
+    void *resampler; // AudioResampler of the uplink, NULL when the rates match
     responseHandler_t responseHandler;
     void *pAudioStreamer;
     char ws_uri[MAX_WS_URI];
@@ -35,7 +35,6 @@ struct private_data {
     int raw_audio_mode : 1;
     switch_buffer_t *sbuffer;
     int rtp_packets;
-    switch_buffer_t *playback_buffer;
     void *stream_buffers;
 };
 
@@ -1,60 +1,213 @@
 #include <string>
 #include <cstring>
 #include "mod_openai_audio_stream.h"
-#include <ixwebsocket/IXWebSocket.h>
-#include <sstream>
-#include <queue>
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <cinttypes>
 #include <memory>
 #include <mutex>
-#include <thread>
 #include <vector>
 
 #include <switch_json.h>
-#include <fstream>
 #include <switch_buffer.h>
 #include <unordered_map>
 #include <unordered_set>
+#include "audio_arena.h"
+#include "audio_resampler.h"
 #include "base64.h"
+#include "base64_simd.h"
+#include "debug_audio_writer.h"
+#include "decode_queue.h"
+#include "encoder_pool.h"
+#include "g711.h"
+#include "opus_codec.h"
+#include "playback_pipeline.h"
+#include "realtime_protocol.h"
+#include "send_queue.h"
+#include "silence_gate.h"
+#include "spsc_ring.h"
+#include "stream_stats.h"
+#include "teardown_queue.h"
+#include "tls_session_cache.h"
+#include "uplink_state.h"
+#include "ws_connection_pool.h"
+#include "ws_transport.h"
 
 #define FRAME_SIZE_8000 320 /* 1000x0.02 (20ms)= 160 x(16bit= 2 bytes) 320 frame size*/
-#define MAX_AUDIO_CHUNK_SAMPLES                                                                                        \
-    16384 /* max samples per queue entry (~32KB), keeps chunks within playback buffer capacity */
 
-// Persistent buffers for stream_frame to avoid per-frame heap allocations
+// Persistent buffers for the media side, carved from the session's own arena so the uplink scratch buffers
+// make no general purpose allocations; the send queue and the waiting texts have heap storage of their own.
+// They belong to the uplink owner, stream_frame or its encoder pool worker; other threads go through uplink.
 struct StreamBuffers {
-    std::vector<uint8_t> flush_buffer;
-    std::vector<spx_int16_t> resample_buffer;
-    std::vector<uint8_t> data_buf;
+    UplinkState uplink;
+    std::mutex texts_mutex;
+    std::vector<std::string> texts; // send_json messages waiting behind queued audio, guarded by texts_mutex
+    std::atomic<bool> send_backlog{false}; // send_queue holds audio, as of the last frame
+
+    AudioArena arena;
+    ArenaBuffer flush_buffer{arena, SWITCH_RECOMMENDED_BUFFER_SIZE};
+    ArenaBuffer resample_buffer{arena, SWITCH_RECOMMENDED_BUFFER_SIZE};
+    ArenaBuffer data_buf{arena, SWITCH_RECOMMENDED_BUFFER_SIZE};
+    // uplink audio compressed to G.711, when the stream sends it
+    ArenaBuffer g711_buffer{arena, SWITCH_RECOMMENDED_BUFFER_SIZE / sizeof(int16_t)};
+    // input_audio_buffer.append message, reused for every frame
+    ArenaBuffer json_frame{arena, realtime_audio_append_size(SWITCH_RECOMMENDED_BUFFER_SIZE)};
+    // the streamer's counters; kept here too because stream_frame may count a drop before it can lock
+    std::shared_ptr<StreamStats> stats;
+    // uplink silence suppression (STREAM_VAD), null when every frame is sent
+    std::unique_ptr<SilenceGate> silence_gate;
+    // uplink Opus stage of the raw audio mode, null otherwise
+    std::unique_ptr<OpusPacketEncoder> opus_encoder;
+    // uplink audio waiting for a backed up socket, null when STREAM_SEND_QUEUE_MS is 0
+    std::unique_ptr<SendQueue> send_queue;
+
+    // with an encoder pool: the media thread copies its frames into capture_ring, through
+    // capture_buf, and the pool's worker does the rest; all null otherwise
+    EncoderPool::Stream *encoder = nullptr;
+    std::unique_ptr<SpscRing<int16_t>> capture_ring;
+    std::unique_ptr<ArenaBuffer> capture_buf;
+    size_t capture_chunk = 0; // samples the worker reads at a time, 20 ms of all channels
+};
+
+// What a stream exchanges with the server instead of PCM16, see STREAM_AUDIO_FORMAT.
+struct WireFormat {
+    bool g711 = false; // G.711 at 8 kHz both ways
+    G711Law g711_law = G711_ULAW;
+    bool opus = false; // raw audio mode only: one Opus packet per binary message both ways
+    OpusOptions opus_options;
+};
+
+// Session handle cached for the lifetime of the media bug, so the websocket thread does not go through
+// switch_core_session_locate() (global hash lookup + read lock) for every message.
+//
+// attach() takes one session read lock up front. Readers pin the handle with acquire()/release();
+// invalidate() (stream cleanup, i.e. SWITCH_ABC_TYPE_CLOSE) stops new readers, and whoever drops the
+// last reference, invalidate() itself or the last reader, gives the read lock back. Nobody ever waits,
+// so a reader may safely end up closing the media bug itself.
+class SessionRef {
+  public:
+    ~SessionRef() {
+        invalidate();
+    }
+
+    void attach(switch_core_session_t *session) {
+        if (session && switch_core_session_read_lock(session) == SWITCH_STATUS_SUCCESS) {
+            m_session = session;
+            m_state.store(VALID, std::memory_order_release);
+        }
+    }
+
+    switch_core_session_t *acquire() {
+        if (m_state.fetch_add(READER, std::memory_order_acquire) & VALID) {
+            return m_session;
+        }
+        release();
+        return nullptr;
+    }
 
-    StreamBuffers() {
-        flush_buffer.reserve(SWITCH_RECOMMENDED_BUFFER_SIZE);
-        resample_buffer.reserve(SWITCH_RECOMMENDED_BUFFER_SIZE / sizeof(spx_int16_t));
-        data_buf.resize(SWITCH_RECOMMENDED_BUFFER_SIZE);
+    void release() {
+        if (m_state.fetch_sub(READER, std::memory_order_acq_rel) == READER) {
+            drop();
+        }
+    }
+
+    void invalidate() {
+        if (m_state.fetch_and(~VALID, std::memory_order_acq_rel) == VALID) {
+            drop();
+        }
+    }
+
+  private:
+    static const uint32_t VALID = 1;
+    static const uint32_t READER = 2;
+
+    void drop() {
+        if (m_session && !m_dropped.exchange(true)) {
+            switch_core_session_rwunlock(m_session);
+        }
     }
+
+    switch_core_session_t *m_session = nullptr;
+    std::atomic<uint32_t> m_state{0}; // VALID flag + READER per pinned reference
+    std::atomic<bool> m_dropped{false};
+};
+
+// Pins the cached session for one scope, converts to false once the media bug is gone.
+class SessionGuard {
+  public:
+    explicit SessionGuard(SessionRef& ref) : m_ref(ref), m_session(ref.acquire()) {}
+    ~SessionGuard() {
+        if (m_session) {
+            m_ref.release();
+        }
+    }
+
+    SessionGuard(const SessionGuard&) = delete;
+    SessionGuard& operator=(const SessionGuard&) = delete;
+
+    switch_core_session_t *get() const {
+        return m_session;
+    }
+    explicit operator bool() const {
+        return m_session != nullptr;
+    }
+
+  private:
+    SessionRef& m_ref;
+    switch_core_session_t *m_session;
+};
+
+// Buffers of the thread decoding the downlink: the websocket thread's, or the decode worker's.
+struct DecodeScratch {
+    ArenaBuffer& pcm;        // downlink PCM
+    ArenaBuffer& expanded;   // G.711 received, as PCM16 for the debug files
+    ArenaBuffer& event_json; // message with its debug file, for EVENT_PLAY
+};
+
+// Downlink decode stage of a stream, when the encoder pool runs: the queue the websocket thread fills,
+// and what the decode worker uses to empty it, in an arena of its own.
+struct DecodeState {
+    DecodeState(size_t capacity, StreamStats *stats) : queue(capacity, stats) {}
+
+    DecodeQueue queue;
+    AudioArena arena;
+    ArenaBuffer pcm{arena};
+    ArenaBuffer expanded{arena};
+    ArenaBuffer event_json{arena};
+    DecodeScratch scratch{pcm, expanded, event_json};
+    DecodeJob job;      // the one being decoded, its buffers reused
+    uint32_t epoch = 0; // of the last job
 };
 
 class AudioStreamer {
   public:
-    AudioStreamer(const char *uuid, const char *wsUri, responseHandler_t callback, int deflate, int heart_beat,
-                  bool suppressLog, const char *extra_headers, bool no_reconnect, const char *tls_cafile,
-                  const char *tls_keyfile, const char *tls_certfile, bool tls_disable_hostname_validation,
-                  uint32_t session_sampling, uint32_t playback_sampling, bool disable_audiofiles, bool raw_audio_mode)
+    AudioStreamer(switch_core_session_t *session, const char *uuid, const char *wsUri, responseHandler_t callback,
+                  int deflate, int heart_beat, bool suppressLog, const char *extra_headers, bool no_reconnect,
+                  const char *tls_cafile, const char *tls_keyfile, const char *tls_certfile,
+                  bool tls_disable_hostname_validation, uint32_t session_sampling, uint32_t playback_sampling,
+                  bool disable_audiofiles, bool raw_audio_mode, uint32_t playback_queue_ms, bool strip_audio,
+                  const PlayoutConfig& playout, const ResamplerOptions& resampler, const WireFormat& format)
         : m_sessionId(uuid), m_notify(callback), m_suppress_log(suppressLog), m_extra_headers(extra_headers),
-          m_playFile(0), m_disable_audiofiles(disable_audiofiles), m_raw_audio_mode(raw_audio_mode) {
-
-        in_sample_rate = playback_sampling;
+          m_playFile(0), m_stats(std::make_shared<StreamStats>()),
+          m_playback(playback_sampling, session_sampling, playback_queue_ms, m_stats.get(), playout, resampler),
+          m_disable_audiofiles(disable_audiofiles), m_raw_audio_mode(raw_audio_mode), m_strip_audio(strip_audio),
+          m_g711(format.g711), m_g711_law(format.g711_law) {
+
+        m_session_ref.attach(session);
+        StreamStatsRegistry::instance().add(m_stats.get());
+        if (format.opus) {
+            m_opus_decoder.reset(new OpusPacketDecoder(playback_sampling));
+        }
 
-        ix::WebSocketHttpHeaders headers;
-        ix::SocketTLSOptions tlsOptions;
+        WsTransportOptions options;
         if (m_extra_headers) {
             cJSON *headers_json = cJSON_Parse(m_extra_headers);
             if (headers_json) {
                 cJSON *iterator = headers_json->child;
                 while (iterator) {
                     if (iterator->type == cJSON_String && iterator->valuestring != nullptr) {
-                        headers[iterator->string] = iterator->valuestring;
+                        options.headers[iterator->string] = iterator->valuestring;
                     }
                     iterator = iterator->next;
                 }
@@ -62,125 +215,133 @@ class AudioStreamer {
             }
         }
 
-        webSocket.setUrl(wsUri);
+        if (m_opus_decoder) {
+            // tells the backend to expect, and to answer with, Opus packets
+            options.headers["X-Stream-Audio-Codec"] = "opus";
+        }
+
+        options.url = wsUri;
 
         // Setup eventual TLS options.
         // tls_cafile may hold the special values
         // NONE, which disables validation and SYSTEM which uses
         // the system CAs bundle
         if (tls_cafile) {
-            tlsOptions.caFile = tls_cafile;
+            options.tls_cafile = tls_cafile;
         }
 
         if (tls_keyfile) {
-            tlsOptions.keyFile = tls_keyfile;
+            options.tls_keyfile = tls_keyfile;
         }
 
         if (tls_certfile) {
-            tlsOptions.certFile = tls_certfile;
+            options.tls_certfile = tls_certfile;
         }
 
-        tlsOptions.disable_hostname_validation = tls_disable_hostname_validation;
-        webSocket.setTLSOptions(tlsOptions);
+        options.tls_disable_hostname_validation = tls_disable_hostname_validation;
 
         // Optional heart beat, sent every xx seconds when there is not any traffic
         // to make sure that load balancers do not kill an idle connection.
-        if (heart_beat)
-            webSocket.setPingInterval(heart_beat);
+        options.ping_interval_secs = heart_beat;
 
         // Per message deflate connection is enabled by default. You can tweak its parameters or disable it
-        if (deflate)
-            webSocket.disablePerMessageDeflate();
-
-        // Set extra headers if any
-        if (!headers.empty())
-            webSocket.setExtraHeaders(headers);
-
-        if (no_reconnect)
-            webSocket.disableAutomaticReconnection();
-
-        // Setup a callback to be fired when a message or an event (open, close, error) is received
-        webSocket.setOnMessageCallback([this](const ix::WebSocketMessagePtr& msg) {
-            if (msg->type == ix::WebSocketMessageType::Message) {
-                if (msg->binary) {
-                    if (m_raw_audio_mode) {
-                        if (!m_disable_audiofiles) {
-                            saveDebugAudioFile(msg->str, true);
-                        }
-                        auto converted = convertRawAudio(msg->str);
-                        if (!converted.empty()) {
-                            playback_clear_requested = false;
-                            m_response_audio_done = false;
-                            push_audio_queue(converted);
-                        }
+        options.per_message_deflate = !deflate;
+        options.auto_reconnect = !no_reconnect;
+
+        EncoderPool& pool = EncoderPool::instance();
+        if (pool.enabled()) {
+            // sized for the playback queue (a second at least) of base64 audio, with room for the
+            // messages that go along for the debug files
+            const size_t bytes_per_second = static_cast<size_t>(playback_sampling) * (m_g711 ? 1 : 2);
+            const size_t queue_ms = std::max<uint32_t>(playback_queue_ms, 1000);
+            m_decode.reset(new DecodeState(bytes_per_second * queue_ms / 1000 * 3, m_stats.get()));
+            m_decoder = pool.add([this] { decodeQueued(); });
+            if (!m_decoder) {
+                m_decode.reset();
+            }
+        }
+
+        // Setup a callback to be fired when a message or an event (open, close, error) is received.
+        // It runs on the socket thread, or on the shared event loop thread the stream is assigned to.
+        // With the connection pool enabled the socket may already be open, then connect() replays its
+        // open event and what the server sent so far.
+        m_transport = ws_connection_pool_acquire(options, [this](const WsEvent& event) {
+            if (event.type == WS_EVENT_BINARY) {
+                if (m_raw_audio_mode) {
+                    m_stats->add(m_stats->downlink_chunks);
+                    if (m_decoder) {
+                        queueDecode(DECODE_BINARY, event.data, event.len);
                     } else {
-                        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
-                                          "(%s) Received binary WebSocket frame (%zu bytes) but raw audio mode is not "
-                                          "enabled, ignoring\n",
-                                          m_sessionId.c_str(), msg->str.size());
+                        playBinary(reinterpret_cast<const uint8_t *>(event.data), event.len, m_scratch);
                     }
                 } else {
-                    eventCallback(MESSAGE, msg->str.c_str());
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                      "(%s) Received binary WebSocket frame (%zu bytes) but raw audio mode is not "
+                                      "enabled, ignoring\n",
+                                      m_sessionId.c_str(), event.len);
                 }
+            } else if (event.type == WS_EVENT_TEXT) {
+                eventCallback(MESSAGE, event.data, event.len);
 
-            } else if (msg->type == ix::WebSocketMessageType::Open) {
+            } else if (event.type == WS_EVENT_OPEN) {
+                m_stats->add(m_stats->connects);
+                if (m_opened_once) {
+                    m_stats->add(m_stats->reconnects);
+                }
+                m_opened_once = true;
                 cJSON *root;
                 root = cJSON_CreateObject();
                 cJSON_AddStringToObject(root, "status", "connected");
                 char *json_str = cJSON_PrintUnformatted(root);
 
-                eventCallback(CONNECT_SUCCESS, json_str);
+                eventCallback(CONNECT_SUCCESS, json_str, strlen(json_str));
 
                 cJSON_Delete(root);
                 switch_safe_free(json_str);
 
-            } else if (msg->type == ix::WebSocketMessageType::Error) {
-                // A message will be fired when there is an error with the connection. The message type will be
-                // ix::WebSocketMessageType::Error.
+            } else if (event.type == WS_EVENT_ERROR) {
+                m_stats->add(m_stats->connection_errors);
+                // A message will be fired when there is an error with the connection.
                 //  Multiple fields will be inuse on the event to describe the error.
                 cJSON *root, *message;
                 root = cJSON_CreateObject();
                 cJSON_AddStringToObject(root, "status", "error");
                 message = cJSON_CreateObject();
-                cJSON_AddNumberToObject(message, "retries", msg->errorInfo.retries);
-                cJSON_AddStringToObject(message, "error", msg->errorInfo.reason.c_str());
-                cJSON_AddNumberToObject(message, "wait_time", msg->errorInfo.wait_time);
-                cJSON_AddNumberToObject(message, "http_status", msg->errorInfo.http_status);
+                cJSON_AddNumberToObject(message, "retries", event.retries);
+                cJSON_AddStringToObject(message, "error", event.reason);
+                cJSON_AddNumberToObject(message, "wait_time", event.wait_time);
+                cJSON_AddNumberToObject(message, "http_status", event.http_status);
                 cJSON_AddItemToObject(root, "message", message);
 
                 char *json_str = cJSON_PrintUnformatted(root);
 
-                eventCallback(CONNECT_ERROR, json_str);
+                eventCallback(CONNECT_ERROR, json_str, strlen(json_str));
 
                 cJSON_Delete(root);
                 switch_safe_free(json_str);
-            } else if (msg->type == ix::WebSocketMessageType::Close) {
+            } else if (event.type == WS_EVENT_CLOSE) {
                 // The server can send an explicit code and reason for closing.
-                // This data can be accessed through the closeInfo object.
                 cJSON *root, *message;
                 root = cJSON_CreateObject();
                 cJSON_AddStringToObject(root, "status", "disconnected");
                 message = cJSON_CreateObject();
-                cJSON_AddNumberToObject(message, "code", msg->closeInfo.code);
-                cJSON_AddStringToObject(message, "reason", msg->closeInfo.reason.c_str());
+                cJSON_AddNumberToObject(message, "code", event.close_code);
+                cJSON_AddStringToObject(message, "reason", event.reason);
                 cJSON_AddItemToObject(root, "message", message);
                 char *json_str = cJSON_PrintUnformatted(root);
 
-                eventCallback(CONNECTION_DROPPED, json_str);
+                eventCallback(CONNECTION_DROPPED, json_str, strlen(json_str));
 
                 cJSON_Delete(root);
                 switch_safe_free(json_str);
             }
         });
+    }
 
-        out_sample_rate = session_sampling;
-        if (in_sample_rate != out_sample_rate) {
-            int err = 0;
-            m_resampler = speex_resampler_init(1, in_sample_rate, out_sample_rate, 5, &err);
-        }
-
-        // Now that our callback is setup, we can start our background thread and receive messages
-        webSocket.start();
+    // Connects in the background. Called once the media bug is attached: a pooled connection replays
+    // session.created right away, and the responses to it need the bug.
+    void connect() {
+        m_transport->start();
     }
 
     switch_media_bug_t *get_media_bug(switch_core_session_t *session) {
@@ -201,8 +362,9 @@ class AudioStreamer {
         }
     }
 
-    void eventCallback(notifyEvent_t event, const char *message) {
-        switch_core_session_t *psession = switch_core_session_locate(m_sessionId.c_str());
+    void eventCallback(notifyEvent_t event, const char *message, size_t length) {
+        SessionGuard guard(m_session_ref);
+        switch_core_session_t *psession = guard.get();
         if (psession) {
             switch (event) {
                 case CONNECT_SUCCESS:
@@ -219,311 +381,562 @@ class AudioStreamer {
                     media_bug_close(psession);
 
                     break;
-                case MESSAGE:
-                    std::string msg(message);
-                    if (processMessage(psession, msg) != SWITCH_TRUE) {
-                        m_notify(psession, EVENT_JSON, msg.c_str());
+                case MESSAGE: {
+                    // message is the websocket receive buffer, it is neither copied nor reparsed here;
+                    // processMessage() only fills m_event_json when it rewrites the message.
+                    // Events and logs get the text with the audio taken out when asked to.
+                    const char *text = message;
+                    size_t text_len = length;
+                    if (m_strip_audio && m_stripped_json.reserve(length + 1)) {
+                        const uint32_t bytes_per_second = m_playback.server_rate() * (m_g711 ? 1 : 2);
+                        size_t stripped = realtime_strip_audio(message, length, bytes_per_second,
+                                                               m_stripped_json.as<char>());
+                        if (stripped > 0) {
+                            text = m_stripped_json.as<char>();
+                            text_len = stripped;
+                        }
+                    }
+
+                    m_event_json.clear();
+                    if (processMessage(psession, message, length, text, text_len) != SWITCH_TRUE) {
+                        m_notify(psession, EVENT_JSON, m_event_json.empty() ? text : m_event_json.as<char>());
                     }
 
                     if (!m_suppress_log) {
                         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_DEBUG,
-                                          "Received message: %s\n", msg.c_str());
+                                          "Received message: %s\n",
+                                          m_event_json.empty() ? text : m_event_json.as<char>());
                     }
                     break;
+                }
             }
-            switch_core_session_rwunlock(psession);
         }
     }
 
-    std::vector<int16_t> convertRawAudio(const std::string& input_raw) {
-        if (input_raw.size() < 2) {
-            return {};
-        }
-        // PCM16 requires 2-byte aligned input; truncate any trailing odd byte
-        size_t usable_bytes = input_raw.size() & ~static_cast<size_t>(1);
-        size_t in_samples = usable_bytes / 2;
-
-        if (!m_resampler) {
-            std::vector<int16_t> buffer(in_samples);
-            std::memcpy(buffer.data(), input_raw.data(), usable_bytes);
-            return buffer;
-        }
-
-        double scaled = static_cast<double>(in_samples) * out_sample_rate / in_sample_rate;
-        size_t out_samples = static_cast<size_t>(scaled) + 1;
-
-        if (in_samples > UINT32_MAX || out_samples > UINT32_MAX) {
-            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Too many samples to resample: in=%zu, out=%zu\n",
-                              in_samples, out_samples);
-            return {};
+    // Puts audio received from the server (PCM16, or G.711 when the stream uses it) into the playback
+    // queue. Returns the number of samples queued.
+    size_t queueAudio(const uint8_t *audio, size_t len) {
+        PlaybackPipeline::PushResult result =
+            m_g711 ? m_playback.push_g711(m_g711_law, audio, len) : m_playback.push_pcm(audio, len);
+        if (result.error != RESAMPLER_ERR_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Resampling failed with error code: %d\n",
+                              result.error);
+        } else if (result.dropped > 0) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                              "(%s) playback queue full, dropping %zu of %zu samples\n", m_sessionId.c_str(),
+                              result.dropped, m_g711 ? len : len / sizeof(int16_t));
         }
+        return result.queued;
+    }
 
-        std::vector<int16_t> in_buffer(in_samples);
-        std::vector<int16_t> out_buffer(out_samples);
+    // Decodes a base64 delta straight into the playback queue when no debug file needs the
+    // PCM. Returns false if the caller has to go through the decode buffer instead; *ok and
+    // *samples are set when it returns true.
+    bool decodeIntoQueue(const char *audio, size_t audio_len, bool *ok, size_t *samples) {
+        return m_disable_audiofiles && !m_g711 && m_playback.push_base64_in_place(audio, audio_len, ok, samples);
+    }
 
-        std::memcpy(in_buffer.data(), input_raw.data(), usable_bytes);
+    const AudioArena& arena() const {
+        return m_arena;
+    }
 
-        spx_uint32_t in_len = static_cast<spx_uint32_t>(in_samples);
-        spx_uint32_t out_len = static_cast<spx_uint32_t>(out_samples);
+    // null without a decode worker
+    const AudioArena *decode_arena() const {
+        return m_decode ? &m_decode->arena : nullptr;
+    }
 
-        int err = speex_resampler_process_int(m_resampler, 0, in_buffer.data(), &in_len, out_buffer.data(), &out_len);
+    void logDownlinkCopies() {
+        uint64_t samples = m_stats->downlink_samples.load(std::memory_order_relaxed);
+        const uint32_t rate = m_playback.channel_rate();
+        if (samples == 0 || rate == 0) {
+            return;
+        }
+        double seconds = static_cast<double>(samples) / rate;
+        double per_second = m_stats->downlink_bytes_copied.load(std::memory_order_relaxed) / seconds;
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG,
+                          "(%s) downlink: %.1f s of audio, %.0f bytes copied per second of audio (%.1fx the PCM)\n",
+                          m_sessionId.c_str(), seconds, per_second, per_second / (rate * sizeof(int16_t)));
+    }
+
+    // Hands raw audio to the background writer. All audio of one response goes to the same WAV
+    // file, opened on the first chunk and finalized by endDebugCapture(). Returns the file path.
+    std::string saveDebugAudioFile(const uint8_t *rawAudio, size_t length, DecodeScratch& scratch,
+                                   bool notifyPlaybackEvent = false) {
+        if (m_g711 && scratch.expanded.resize(length * sizeof(int16_t))) {
+            // the files are PCM16 WAV whatever the stream exchanges
+            g711_decode(m_g711_law, rawAudio, length, scratch.expanded.as<int16_t>());
+            rawAudio = scratch.expanded.data();
+            length *= sizeof(int16_t);
+        }
+        std::string filePath;
+        {
+            std::lock_guard<std::mutex> lock(m_capture_mutex);
+            if (!m_capture) {
+                char path[256];
+                switch_snprintf(path, sizeof(path), "%s%s%s_%d.tmp.wav", SWITCH_GLOBAL_dirs.temp_dir,
+                                SWITCH_PATH_SEPARATOR, m_sessionId.c_str(), m_playFile++);
+                m_capture_path = path;
+                m_capture = DebugAudioWriter::instance().open(m_capture_path, m_playback.server_rate());
+                m_Files.insert(m_capture_path);
+            }
+            if (!DebugAudioWriter::instance().append(m_capture, rawAudio, length) && !m_capture_overflow) {
+                m_capture_overflow = true;
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                  "(%s) debug audio writer is behind, dropping audio from %s\n", m_sessionId.c_str(),
+                                  m_capture_path.c_str());
+            }
+            filePath = m_capture_path;
+        }
 
-        if (err != RESAMPLER_ERR_SUCCESS) {
-            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Resampling failed with error code: %d\n", err);
-            return {}; // empty on error
+        SessionGuard guard(m_session_ref);
+        switch_core_session_t *psession = guard.get();
+        if (notifyPlaybackEvent && psession) {
+            cJSON *payload = cJSON_CreateObject();
+            cJSON_AddStringToObject(payload, "file", filePath.c_str());
+            char *jsonString = cJSON_PrintUnformatted(payload);
+            m_notify(psession, EVENT_PLAY, jsonString);
+            cJSON_Delete(payload);
+            free(jsonString);
         }
 
-        out_buffer.resize(out_len); // resize to actual resampled size
-        return out_buffer;
+        return filePath;
     }
 
-    // create wav file from raw audio
-    // rawAudio passed as constant reference because it is never edited
-    std::string createWavFromRaw(const std::string& rawAudio) {
+    // Closes the current debug file, the writer patches its WAV header.
+    void endDebugCapture() {
+        std::lock_guard<std::mutex> lock(m_capture_mutex);
+        if (m_capture) {
+            DebugAudioWriter::instance().close(m_capture);
+            m_capture = 0;
+            m_capture_overflow = false;
+        }
+    }
 
-        const int numChannels = 1;    // mono
-        const int bitsPerSample = 16; // pcm16
-        int byteRate = in_sample_rate * numChannels * bitsPerSample / 8;
-        int blockAlign = numChannels * bitsPerSample / 8;
-        uint32_t dataSize = static_cast<uint32_t>(rawAudio.size());
-        uint32_t chunkSize = 36 + dataSize;
+    // Appends ,"file":"<path>" to the JSON object in message, the NUL terminated result goes to out.
+    // False, out left as it was, if message is not an object or out cannot grow.
+    bool appendFileToMessage(ArenaBuffer& out_json, const char *message, size_t length, const std::string& filePath) {
+        const char *close = message + length;
+        while (close > message && *(close - 1) != '}') {
+            close--;
+        }
+        if (close == message) {
+            return false;
+        }
+        static const char file_key[] = ",\"file\":\"";
+        size_t head = (close - 1) - message;
+        if (!out_json.resize(head + sizeof(file_key) - 1 + filePath.size() * 2 + 3)) {
+            return false;
+        }
+        char *out = out_json.as<char>();
+        memcpy(out, message, head);
+        out += head;
+        memcpy(out, file_key, sizeof(file_key) - 1);
+        out += sizeof(file_key) - 1;
+        for (char c : filePath) {
+            if (c == '"' || c == '\\') {
+                *out++ = '\\';
+            }
+            *out++ = c;
+        }
+        *out++ = '"';
+        *out++ = '}';
+        *out = '\0';
+        out_json.resize(out - out_json.as<char>());
+        return true;
+    }
 
-        std::ostringstream wavStream; // write in string like stream
+    switch_bool_t processAudioDelta(switch_core_session_t *session, const char *message, size_t length,
+                                    const char *audio, size_t audio_len) {
+        if (audio_len == 0) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                              "(%s) processMessage - response.output_audio.delta no audio data\n",
+                              m_sessionId.c_str());
+            return SWITCH_FALSE;
+        }
 
-        // creating wav header
-        // riff header
-        wavStream.write("RIFF", 4);                                     // chunk id
-        wavStream.write(reinterpret_cast<const char *>(&chunkSize), 4); // chunk Size
-        wavStream.write("WAVE", 4);
+        m_stats->add(m_stats->downlink_chunks);
+        if (m_decoder) {
+            // the message only goes along when the debug file events need it
+            const bool with_text = !m_disable_audiofiles;
+            return queueDecode(DECODE_BASE64, audio, audio_len, with_text ? message : nullptr, with_text ? length : 0)
+                       ? SWITCH_TRUE
+                       : SWITCH_FALSE;
+        }
+        return decodeDelta(message, length, audio, audio_len, m_scratch) ? SWITCH_TRUE : SWITCH_FALSE;
+    }
+
+    // Decodes a base64 delta into the playback queue. Returns true if it queued samples.
+    bool decodeDelta(const char *message, size_t length, const char *audio, size_t audio_len,
+                     DecodeScratch& scratch) {
+        m_response_audio_done.store(false, std::memory_order_release);
+        bool ok = false;
+        size_t samples = 0;
+        if (!decodeIntoQueue(audio, audio_len, &ok, &samples)) {
+            // decode into the reusable per-session buffer, the resampler (or debug file) reads it from there
+            size_t decoded = 0;
+            ok = scratch.pcm.reserve(base64_decoded_max_size(audio_len)) &&
+                 base64_decode_into(audio, audio_len, scratch.pcm.data(), &decoded);
+            if (ok) {
+                scratch.pcm.resize(decoded);
+                m_stats->add(m_stats->downlink_bytes_copied, decoded);
 
-        // this subchunk contains format infos
-        wavStream.write("fmt ", 4);
-        uint32_t subchunk1Size = 16;
-        wavStream.write(reinterpret_cast<const char *>(&subchunk1Size), 4);
-        uint16_t audioFormat = 1; // 1 is pcm
-        wavStream.write(reinterpret_cast<const char *>(&audioFormat), 2);
-        wavStream.write(reinterpret_cast<const char *>(&numChannels), 2);
-        wavStream.write(reinterpret_cast<const char *>(&in_sample_rate), 4);
-        wavStream.write(reinterpret_cast<const char *>(&byteRate), 4);
-        wavStream.write(reinterpret_cast<const char *>(&blockAlign), 2);
-        wavStream.write(reinterpret_cast<const char *>(&bitsPerSample), 2);
+                if (!m_disable_audiofiles) {
+                    std::string filePath = saveDebugAudioFile(scratch.pcm.data(), decoded, scratch);
+                    if (appendFileToMessage(scratch.event_json, message, length, filePath)) {
+                        SessionGuard guard(m_session_ref);
+                        if (guard) {
+                            m_notify(guard.get(), EVENT_PLAY, scratch.event_json.as<char>());
+                        }
+                    }
+                }
 
-        // data subchunk contains audio data
-        wavStream.write("data", 4);
-        wavStream.write(reinterpret_cast<const char *>(&dataSize), 4);
-        wavStream.write(rawAudio.data(), dataSize);
+                samples = m_g711 ? decoded : decoded / sizeof(int16_t);
+                queueAudio(scratch.pcm.data(), decoded);
+            }
+        }
 
-        return wavStream.str();
+        if (!ok) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                              "(%s) processMessage - base64 decode error: invalid data\n", m_sessionId.c_str());
+            return false;
+        }
+        return samples > 0;
     }
 
-    std::string saveDebugAudioFile(const std::string& rawAudio, bool notifyPlaybackEvent = false) {
-        char filePath[256];
-        std::string fileType = ".wav";
-        switch_snprintf(filePath, 256, "%s%s%s_%d.tmp%s", SWITCH_GLOBAL_dirs.temp_dir, SWITCH_PATH_SEPARATOR,
-                        m_sessionId.c_str(), m_playFile++, fileType.c_str());
+    // A raw audio mode frame: Opus packets are decoded first, the audio goes to the playback queue.
+    void playBinary(const uint8_t *audio, size_t len, DecodeScratch& scratch) {
+        if (m_opus_decoder) {
+            int samples = m_opus_decoder->decode(audio, len);
+            if (samples < 0) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                  "(%s) dropping Opus packet of %zu bytes: %s\n", m_sessionId.c_str(), len,
+                                  opus_error_string(samples));
+                return;
+            }
+            audio = reinterpret_cast<const uint8_t *>(m_opus_decoder->pcm());
+            len = samples * sizeof(int16_t);
+        }
+        if (!m_disable_audiofiles) {
+            saveDebugAudioFile(audio, len, scratch, true);
+        }
+        // frames come straight from the receive buffer (or the Opus decoder) into the playback ring
+        if (queueAudio(audio, len) > 0) {
+            m_response_audio_done.store(false, std::memory_order_release);
+        }
+    }
 
-        std::ofstream fstream(filePath, std::ofstream::binary);
-        std::string wavData = createWavFromRaw(rawAudio);
-        fstream.write(wavData.data(), wavData.size());
-        fstream.flush();
-        fstream.close();
-        m_Files.insert(filePath);
+    // The server sent the last audio of the response.
+    void endResponse() {
+        m_response_audio_done.store(true, std::memory_order_release);
+        m_playback.end_response();
+        if (!m_disable_audiofiles) {
+            endDebugCapture();
+        }
+    }
 
-        switch_core_session_t *psession = switch_core_session_locate(m_sessionId.c_str());
-        if (notifyPlaybackEvent && psession) {
-            cJSON *payload = cJSON_CreateObject();
-            cJSON_AddStringToObject(payload, "file", filePath);
-            char *jsonString = cJSON_PrintUnformatted(payload);
-            m_notify(psession, EVENT_PLAY, jsonString);
-            cJSON_Delete(payload);
-            free(jsonString);
+    // Barge-in: nothing the server sent so far is played anymore.
+    void interruptPlayback() {
+        clear_audio_queue();
+        if (!m_disable_audiofiles) {
+            endDebugCapture();
         }
-        if (psession) {
-            switch_core_session_rwunlock(psession);
+    }
+
+    // Receive thread: hands the audio to the decode worker. False if its queue is full; the drop is
+    // counted by the queue, and logged once per backlog.
+    bool queueDecode(DecodeJobKind kind, const void *data, size_t len, const char *text = nullptr,
+                     size_t text_len = 0) {
+        DecodeQueue& queue = m_decode->queue;
+        const bool overflowing = queue.overflowing();
+        if (!queue.push(kind, data, len, text, text_len)) {
+            if (!overflowing) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                  "(%s) decode worker behind, queue full, dropping audio until it catches up\n",
+                                  m_sessionId.c_str());
+            }
+            return false;
         }
+        EncoderPool::wake(m_decoder);
+        return true;
+    }
 
-        return filePath;
+    // Decode worker: plays what the receive thread queued, in order. A new epoch means a barge-in
+    // came in since the last job: what was queued for playback until now goes first.
+    void decodeQueued() {
+        DecodeScratch& scratch = m_decode->scratch;
+        DecodeJob& job = m_decode->job;
+        for (;;) {
+            uint32_t epoch = 0;
+            const bool popped = m_decode->queue.pop(&job, &epoch);
+            if (epoch != m_decode->epoch) {
+                m_decode->epoch = epoch;
+                interruptPlayback();
+            }
+            if (!popped) {
+                return;
+            }
+            switch (job.kind) {
+                case DECODE_BASE64:
+                    decodeDelta(job.text.data(), job.text.size(), reinterpret_cast<const char *>(job.data.data()),
+                                job.data.size(), scratch);
+                    break;
+                case DECODE_BINARY:
+                    playBinary(job.data.data(), job.data.size(), scratch);
+                    break;
+                case DECODE_END_RESPONSE:
+                    endResponse();
+                    break;
+            }
+        }
     }
 
-    switch_bool_t processMessage(switch_core_session_t *session, std::string& message) {
-        cJSON *json = cJSON_Parse(message.c_str());
+    // text/text_len is what events and logs show for message, see eventCallback()
+    switch_bool_t processMessage(switch_core_session_t *session, const char *message, size_t length,
+                                 const char *text, size_t text_len) {
+        realtime_message_t rt;
         switch_bool_t status = SWITCH_FALSE;
-        if (!json) {
+        if (!realtime_scan_message(message, length, &rt)) {
             return status;
         }
 
-        const char *jsType = cJSON_GetObjectCstr(json, "type");
         if (!m_suppress_log) {
-            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "processMessage type: %s\n",
-                              jsType ? jsType : "null");
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "processMessage type: %.*s\n",
+                              rt.type ? static_cast<int>(rt.type_len) : 4, rt.type ? rt.type : "null");
         }
 
-        if (jsType && strstr(jsType, "error")) {
-            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
-                              "(%s) processMessage - error: %s\n", m_sessionId.c_str(), message.c_str());
-
-        } else if (jsType && strcmp(jsType, "input_audio_buffer.speech_started") == 0) {
-            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
-                              "(%s) processMessage - user speech started, stopping openai audio playback\n",
-                              m_sessionId.c_str());
-            clear_audio_queue();
-            // also clear the private_t playback buffer used in write frame
-            playback_clear_requested = true;
+        switch (rt.event) {
+            case REALTIME_EVENT_ERROR:
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                                  "(%s) processMessage - error: %s\n", m_sessionId.c_str(), text);
+                break;
 
-        } else if (jsType && strcmp(jsType, "input_audio_buffer.speech_stopped") == 0) {
-            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
-                              "(%s) processMessage - user speech stopped\n", m_sessionId.c_str());
-            // Do not clear playback_clear_requested here; it should remain true until new audio is received.
-
-        } else if (jsType && strcmp(jsType, "response.output_audio.delta") == 0) {
-            const char *jsonAudio = cJSON_GetObjectCstr(json, "delta");
-            playback_clear_requested = false;
-            m_response_audio_done = false;
-
-            if (jsonAudio && strlen(jsonAudio) > 0) {
-                std::string rawAudio;
-                try {
-                    rawAudio = base64_decode(jsonAudio);
-                } catch (const std::exception& e) {
-                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
-                                      "(%s) processMessage - base64 decode error: %s\n", m_sessionId.c_str(), e.what());
-                    cJSON_Delete(json);
-                    return status;
+            case REALTIME_EVENT_SPEECH_STARTED:
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+                                  "(%s) processMessage - user speech started, stopping openai audio playback\n",
+                                  m_sessionId.c_str());
+                if (m_decoder) {
+                    // queued audio is dropped now, the worker clears the playback queue next
+                    m_decode->queue.barge_in();
+                    EncoderPool::wake(m_decoder);
+                } else {
+                    interruptPlayback();
                 }
+                break;
 
-                if (!m_disable_audiofiles) {
-                    std::string filePath = saveDebugAudioFile(rawAudio);
-                    cJSON *jsonFile = cJSON_CreateString(filePath.c_str());
-                    cJSON_AddItemToObject(json, "file", jsonFile);
-
-                    char *jsonString = cJSON_PrintUnformatted(json);
-                    m_notify(session, EVENT_PLAY, jsonString);
-                    message.assign(jsonString);
-                    free(jsonString);
+            case REALTIME_EVENT_SPEECH_STOPPED:
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+                                  "(%s) processMessage - user speech stopped\n", m_sessionId.c_str());
+                break;
+
+            case REALTIME_EVENT_AUDIO_DELTA:
+                if (!rt.delta_escaped) {
+                    status = processAudioDelta(session, text, text_len, rt.delta, rt.delta ? rt.delta_len : 0);
+                } else {
+                    // escaped base64 ("\/") is unusual enough to let cJSON unescape it
+                    cJSON *json = cJSON_Parse(message);
+                    const char *audio = json ? cJSON_GetObjectCstr(json, "delta") : nullptr;
+                    status = processAudioDelta(session, text, text_len, audio, audio ? strlen(audio) : 0);
+                    if (json) {
+                        cJSON_Delete(json);
+                    }
                 }
+                break;
 
-                auto resampled = convertRawAudio(rawAudio);
-                if (!resampled.empty()) {
-                    push_audio_queue(resampled);
-                    status = SWITCH_TRUE;
+            case REALTIME_EVENT_AUDIO_DONE:
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG,
+                                  "(%s) processMessage - audio done\n", m_sessionId.c_str());
+                if (m_decoder) {
+                    queueDecode(DECODE_END_RESPONSE, nullptr, 0); // after the audio still queued
+                } else {
+                    endResponse();
                 }
+                break;
 
-            } else {
-                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
-                                  "(%s) processMessage - response.output_audio.delta no audio data\n",
-                                  m_sessionId.c_str());
-            }
-        } else if (jsType && strcmp(jsType, "response.output_audio.done") == 0) {
-            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG,
-                              "(%s) processMessage - audio done\n", m_sessionId.c_str());
-            m_response_audio_done = true;
+            case REALTIME_EVENT_OTHER:
+                break;
         }
-        cJSON_Delete(json);
         return status;
     }
 
-    // managing queue, check if empty before popping or peeking
+    // playback ring: the websocket thread produces, the media thread (write_frame) consumes
 
-    void push_audio_queue(const std::vector<int16_t>& audio_data) {
-        std::lock_guard<std::mutex> lock(m_audio_queue_mutex);
-        const size_t total = audio_data.size();
-        if (total <= MAX_AUDIO_CHUNK_SAMPLES) {
-            m_audio_queue.push(audio_data);
-        } else {
-            size_t num_chunks = (total + MAX_AUDIO_CHUNK_SAMPLES - 1) / MAX_AUDIO_CHUNK_SAMPLES;
-            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG,
-                              "(%s) push_audio_queue: re-chunking %zu samples into %zu chunks (max %d samples each)\n",
-                              m_sessionId.c_str(), total, num_chunks, MAX_AUDIO_CHUNK_SAMPLES);
-            for (size_t offset = 0; offset < total; offset += MAX_AUDIO_CHUNK_SAMPLES) {
-                size_t end = std::min(offset + MAX_AUDIO_CHUNK_SAMPLES, total);
-                m_audio_queue.emplace(audio_data.begin() + offset, audio_data.begin() + end);
-            }
-        }
+    // the single copy on the media side: ring -> write replace frame, once the response can play
+    size_t playout_audio_queue(int16_t *out, size_t samples) {
+        return m_playback.playout(out, samples, m_response_audio_done.load(std::memory_order_acquire));
     }
 
-    bool pop_audio_queue(std::vector<int16_t>& out_audio) {
-        std::lock_guard<std::mutex> lock(m_audio_queue_mutex);
-        if (m_audio_queue.empty()) {
-            return false;
-        }
-        out_audio = m_audio_queue.front();
-        m_audio_queue.pop();
-        return true;
+    size_t skip_audio_queue(size_t samples) {
+        return m_playback.skip(samples);
     }
 
+    // producer side: drops everything queued so far, write_frame skips it on its next read
     void clear_audio_queue() {
-        std::lock_guard<std::mutex> lock(m_audio_queue_mutex);
-        while (!m_audio_queue.empty()) {
-            m_audio_queue.pop();
-        }
+        m_playback.clear();
+    }
+
+    // Called once the media bug is closing: later callbacks find no session and do nothing. The stats stay
+    // registered until the destructor, the decode worker and the closing socket may still count.
+    void detachSession() {
+        m_session_ref.invalidate();
+    }
+
+    const std::shared_ptr<StreamStats>& stats() const {
+        return m_stats;
+    }
+
+    // why the downlink Opus decoder could not start, nullptr if it did or is not used
+    const char *opus_decoder_error() const {
+        return m_opus_decoder ? m_opus_decoder->init_error() : nullptr;
+    }
+
+    // nullptr when the server and the channel run at the same rate
+    const char *playback_resampler_kernel() const {
+        return m_playback.resampler_kernel();
     }
 
     ~AudioStreamer() {
-        if (m_resampler) {
-            speex_resampler_destroy(m_resampler);
-            m_resampler = nullptr;
-        }
+        // the transport is done with the streamer, nothing wakes the decoder anymore
+        EncoderPool::instance().remove(m_decoder);
+        m_decoder = nullptr;
+        // folded once the last thread that counts is gone
+        StreamStatsRegistry::instance().remove(m_stats.get());
     }
 
-    void disconnect() {
+    // on_stopped runs once the transport will not call the streamer anymore, it may release it
+    void disconnect(std::function<void()> on_stopped) {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "disconnecting...\n");
-        webSocket.stop();
+        m_transport->stop(std::move(on_stopped));
     }
 
     bool isConnected() {
-        return (webSocket.getReadyState() == ix::ReadyState::Open);
+        return m_transport->is_open();
     }
 
-    void writeAudioDelta(uint8_t *buffer, size_t len) {
-        if (!this->isConnected())
+    void writeAudioDelta(const uint8_t *buffer, size_t len, StreamBuffers *bufs) {
+        if (!this->isConnected() || len == 0)
             return;
-        // Convert the buffer to PCM16 and then base64 encode it.
 
-        std::string base64Audio = base64_encode(buffer, len, false);
-        if (base64Audio.empty())
+        // Frame the base64 PCM16 straight into the session's reusable message buffer,
+        // the buffer only grows (within the arena) when a larger chunk than ever before is sent.
+        ArenaBuffer& frame = bufs->json_frame;
+        if (!frame.reserve(realtime_audio_append_size(len))) {
             return;
-
-        cJSON *root = cJSON_CreateObject();
-        cJSON_AddStringToObject(root, "type", "input_audio_buffer.append");
-        cJSON_AddStringToObject(root, "audio", base64Audio.c_str());
-
-        char *jsonStr = cJSON_PrintUnformatted(root);
-        webSocket.sendUtf8Text(ix::IXWebSocketSendData(jsonStr, strlen(jsonStr)));
-
-        cJSON_Delete(root);
-        switch_safe_free(jsonStr);
+        }
+        size_t frame_len = realtime_write_audio_append(buffer, len, frame.as<char>());
+        m_transport->send_text(frame.as<char>(), frame_len);
+        m_stats->add(m_stats->uplink_frames);
+        m_stats->add(m_stats->uplink_bytes, len);
     }
 
-    void writeBinary(uint8_t *buffer, size_t len) {
+    void writeBinary(const uint8_t *buffer, size_t len) {
         if (!this->isConnected())
             return;
-        webSocket.sendBinary(ix::IXWebSocketSendData(reinterpret_cast<const char *>(buffer), len));
+        m_transport->send_binary(buffer, len);
+        m_stats->add(m_stats->uplink_frames);
+        m_stats->add(m_stats->uplink_bytes, len);
     }
 
-    void sendAudio(uint8_t *buffer, size_t len) {
+    void writeAudio(const uint8_t *buffer, size_t len, StreamBuffers *bufs) {
         if (m_raw_audio_mode) {
             writeBinary(buffer, len);
         } else {
-            writeAudioDelta(buffer, len);
+            writeAudioDelta(buffer, len, bufs);
         }
     }
 
+    // len bytes of PCM16 at the stream rate, compressed to G.711 or Opus first when the stream uses it
+    void sendAudio(const uint8_t *buffer, size_t len, StreamBuffers *bufs) {
+        if (bufs->opus_encoder) {
+            // whole frames only, the encoder keeps the rest for the next call
+            size_t packets = bufs->opus_encoder->encode(reinterpret_cast<const int16_t *>(buffer),
+                                                        len / sizeof(int16_t));
+            for (size_t i = 0; i < packets; i++) {
+                size_t packet_len = 0;
+                const uint8_t *packet = bufs->opus_encoder->packet(i, &packet_len);
+                deliverAudio(packet, packet_len, bufs);
+            }
+            return;
+        }
+        if (m_g711) {
+            const size_t samples = len / sizeof(int16_t);
+            if (!bufs->g711_buffer.resize(samples)) {
+                return;
+            }
+            g711_encode(m_g711_law, reinterpret_cast<const int16_t *>(buffer), samples, bufs->g711_buffer.data());
+            buffer = bufs->g711_buffer.data();
+            len = samples;
+        }
+        deliverAudio(buffer, len, bufs);
+    }
+
+    // Hands audio in the wire format to the transport, or to the send queue while the socket is backed up.
+    void deliverAudio(const uint8_t *buffer, size_t len, StreamBuffers *bufs) {
+        SendQueue *queue = bufs->send_queue.get();
+        if (queue) {
+            drainSendQueue(bufs, false);
+            const size_t buffered = m_transport->buffered_amount();
+            if (queue->must_wait(buffered)) {
+                const bool overflowing = queue->overflowing();
+                if (queue->push(buffer, len) > 0 && !overflowing) {
+                    sendQueueOverflow(*queue, buffered);
+                }
+                return;
+            }
+        }
+        writeAudio(buffer, len, bufs);
+    }
+
+    // Moves waiting audio to the transport while it stays under the high water mark, or all of it
+    // with force, so that a message sent next does not overtake it.
+    void drainSendQueue(StreamBuffers *bufs, bool force) {
+        SendQueue *queue = bufs->send_queue.get();
+        if (!queue) {
+            return;
+        }
+        while (!queue->empty() && (force || m_transport->buffered_amount() < queue->config().high_water)) {
+            size_t len = 0;
+            const uint8_t *audio = queue->front(&len);
+            writeAudio(audio, len, bufs);
+            queue->pop();
+        }
+    }
+
+    // First drop of a backlog: logged, and signalled with an event under the event policy.
+    void sendQueueOverflow(const SendQueue& queue, size_t buffered) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                          "(%s) uplink backed up, %zu bytes unsent and %zu queued, dropping audio\n",
+                          m_sessionId.c_str(), buffered, queue.bytes());
+        if (queue.config().policy != SEND_OVERFLOW_EVENT) {
+            return;
+        }
+        SessionGuard guard(m_session_ref);
+        if (!guard) {
+            return;
+        }
+        cJSON *root = cJSON_CreateObject();
+        cJSON_AddNumberToObject(root, "buffered_bytes", buffered);
+        cJSON_AddNumberToObject(root, "queued_bytes", queue.bytes());
+        cJSON_AddNumberToObject(root, "capacity_bytes", queue.config().capacity);
+        char *json_str = cJSON_PrintUnformatted(root);
+        m_notify(guard.get(), EVENT_SEND_OVERFLOW, json_str);
+        cJSON_Delete(root);
+        switch_safe_free(json_str);
+    }
+
     void writeText(const char *text) { // Openai only accepts json not utf8 plain text
         if (!this->isConnected())
             return;
-        webSocket.sendUtf8Text(ix::IXWebSocketSendData(text, strlen(text)));
+        m_transport->send_text(text, strlen(text));
     }
 
+    // the writer deletes the files after finishing any write still queued for them
     void deleteFiles() {
-        if (m_playFile > 0) {
-            for (const auto& fileName : m_Files) {
-                remove(fileName.c_str());
-            }
+        endDebugCapture();
+        std::lock_guard<std::mutex> lock(m_capture_mutex);
+        for (const auto& fileName : m_Files) {
+            DebugAudioWriter::instance().remove(fileName);
         }
-    }
-
-    bool clear_requested() {
-        return playback_clear_requested;
+        m_Files.clear();
     }
 
     bool is_openai_speaking() {
@@ -531,19 +944,19 @@ class AudioStreamer {
     }
 
     bool is_response_audio_done() {
-        return m_response_audio_done;
+        return m_response_audio_done.load(std::memory_order_acquire);
     }
 
     void openai_speech_started() {
         m_openai_speaking = true;
-        switch_core_session_t *psession = switch_core_session_locate(m_sessionId.c_str());
+        SessionGuard guard(m_session_ref);
+        switch_core_session_t *psession = guard.get();
 
         if (psession) {
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "(%s) Openai started speaking\n",
                               m_sessionId.c_str());
             const char *payload = "{\"status\":\"started\"}";
             m_notify(psession, EVENT_OPENAI_SPEECH_STARTED, payload);
-            switch_core_session_rwunlock(psession);
         } else {
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
                               "(%s) Openai speech started - could not locate session\n", m_sessionId.c_str());
@@ -552,14 +965,14 @@ class AudioStreamer {
 
     void openai_speech_stopped() {
         m_openai_speaking = false;
-        switch_core_session_t *psession = switch_core_session_locate(m_sessionId.c_str());
+        SessionGuard guard(m_session_ref);
+        switch_core_session_t *psession = guard.get();
 
         if (psession) {
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "(%s) Openai stopped speaking\n",
                               m_sessionId.c_str());
             const char *payload = "{\"status\":\"stopped\"}";
             m_notify(psession, EVENT_OPENAI_SPEECH_STOPPED, payload);
-            switch_core_session_rwunlock(psession);
         } else {
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
                               "(%s) Openai speech stopped - could not locate session\n", m_sessionId.c_str());
@@ -568,36 +981,60 @@ class AudioStreamer {
 
   private:
     std::string m_sessionId;
+    SessionRef m_session_ref;
     responseHandler_t m_notify;
-    ix::WebSocket webSocket;
+    std::unique_ptr<WsTransport> m_transport;
     bool m_suppress_log;
     const char *m_extra_headers;
     int m_playFile;
     std::unordered_set<std::string> m_Files;
-
-    int in_sample_rate = 24000;  // playback sample rate (default: OpenAI 24kHz)
-    int out_sample_rate = 16000; // output default sample rate
-    SpeexResamplerState *m_resampler = nullptr;
-    std::queue<std::vector<int16_t>> m_audio_queue;
-    std::mutex m_audio_queue_mutex;
-    bool playback_clear_requested = false;
+    std::mutex m_capture_mutex; // debug capture state, shared by the websocket thread and cleanup
+    uint64_t m_capture = 0;     // DebugAudioWriter handle of the response being captured
+    std::string m_capture_path;
+    bool m_capture_overflow = false;
+
+    std::shared_ptr<StreamStats> m_stats; // shared with StreamBuffers, registered while the stream is attached
+    PlaybackPipeline m_playback;          // server rate in, channel rate out
+    AudioArena m_arena;                   // websocket thread only, like the buffers below
+    ArenaBuffer m_decode_buffer{m_arena}; // downlink PCM
+    bool m_opened_once = false;          // websocket thread only
+    ArenaBuffer m_event_json{m_arena};    // rewritten message for events
+    ArenaBuffer m_stripped_json{m_arena}; // message without its audio payloads, see m_strip_audio
+    ArenaBuffer m_expanded_audio{m_arena}; // G.711 received, as PCM16 for the debug files
+    DecodeScratch m_scratch{m_decode_buffer, m_expanded_audio, m_event_json};
     bool m_disable_audiofiles = false; // disable saving audio files if true
     bool m_openai_speaking = false;
-    bool m_response_audio_done = false;
+    std::atomic<bool> m_response_audio_done{false};
     bool m_raw_audio_mode = false;
+    bool m_strip_audio = false; // events and logs carry audio sizes instead of base64 payloads
+    bool m_g711 = false;        // audio goes both ways as G.711 at 8 kHz instead of PCM16
+    G711Law m_g711_law = G711_ULAW;
+    std::unique_ptr<OpusPacketDecoder> m_opus_decoder; // decoding thread, raw audio mode with Opus only
+    // downlink decode stage, both null when the websocket thread decodes the audio itself
+    std::unique_ptr<DecodeState> m_decode;
+    EncoderPool::Stream *m_decoder = nullptr;
 };
 
 namespace {
 
+// Audio unsent in the transport past which the uplink waits in the send queue, where it can still be
+// dropped or merged, rather than in the socket's buffer.
+const uint32_t SEND_HIGH_WATER_MS = 100;
+
+// Audio the media thread can capture ahead of its encoder pool worker.
+const size_t CAPTURE_RING_MS = 500;
+
 switch_status_t stream_data_init(private_t *tech_pvt, switch_core_session_t *session, char *wsUri, uint32_t sampling,
                                  int desiredSampling, int playback_sampling, int channels,
                                  responseHandler_t responseHandler, int deflate, int heart_beat, bool suppressLog,
                                  int rtp_packets, const char *extra_headers, bool no_reconnect, const char *tls_cafile,
                                  const char *tls_keyfile, const char *tls_certfile,
                                  bool tls_disable_hostname_validation, bool disable_audiofiles,
-                                 switch_bool_t start_muted, bool raw_audio_mode) {
-    int err; // speex
-
+                                 switch_bool_t start_muted, bool raw_audio_mode, uint32_t playback_queue_ms,
+                                 bool strip_audio, const PlayoutConfig& playout, const ResamplerOptions& uplink,
+                                 const ResamplerOptions& downlink, const WireFormat& format, bool vad,
+                                 const SilenceGateConfig& vad_config, uint32_t send_queue_ms,
+                                 SendOverflowPolicy send_overflow) {
     switch_memory_pool_t *pool = switch_core_session_get_pool(session);
 
     memset(tech_pvt, 0, sizeof(private_t));
@@ -616,21 +1053,58 @@ switch_status_t stream_data_init(private_t *tech_pvt, switch_core_session_t *ses
     tech_pvt->raw_audio_mode = raw_audio_mode ? 1 : 0;
 
     const size_t buflen = (FRAME_SIZE_8000 * desiredSampling / 8000 * channels * rtp_packets);
-    const size_t playback_buflen = 128000; // 128KB may need to be decreased
-
-    if (switch_buffer_create(pool, &tech_pvt->playback_buffer, playback_buflen) != SWITCH_STATUS_SUCCESS) {
-        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
-                          "%s: Error creating playback buffer.\n", tech_pvt->sessionId);
-        return SWITCH_STATUS_FALSE;
-    }
 
     auto *as =
-        new AudioStreamer(tech_pvt->sessionId, wsUri, responseHandler, deflate, heart_beat, suppressLog, extra_headers,
-                          no_reconnect, tls_cafile, tls_keyfile, tls_certfile, tls_disable_hostname_validation,
-                          sampling, playback_sampling, disable_audiofiles, raw_audio_mode);
+        new AudioStreamer(session, tech_pvt->sessionId, wsUri, responseHandler, deflate, heart_beat, suppressLog,
+                          extra_headers, no_reconnect, tls_cafile, tls_keyfile, tls_certfile,
+                          tls_disable_hostname_validation, sampling, playback_sampling, disable_audiofiles,
+                          raw_audio_mode, playback_queue_ms, strip_audio, playout, downlink, format);
 
     tech_pvt->pAudioStreamer = static_cast<void *>(as);
-    tech_pvt->stream_buffers = static_cast<void *>(new StreamBuffers());
+    auto *bufs = new StreamBuffers();
+    bufs->stats = as->stats();
+    tech_pvt->stream_buffers = static_cast<void *>(bufs);
+
+    if (format.opus) {
+        bufs->opus_encoder.reset(new OpusPacketEncoder(desiredSampling, channels, format.opus_options));
+        const char *error = bufs->opus_encoder->init_error();
+        if (!error) {
+            error = as->opus_decoder_error();
+        }
+        if (error) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                              "(%s) Error initializing Opus: %s.\n", tech_pvt->sessionId, error);
+            return SWITCH_STATUS_FALSE;
+        }
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG,
+                          "(%s) Opus at %d bit/s, %u ms frames, sent at %d Hz, played from %d Hz\n",
+                          tech_pvt->sessionId, format.opus_options.bitrate, format.opus_options.frame_ms,
+                          desiredSampling, playback_sampling);
+    }
+
+    if (vad) {
+        bufs->silence_gate.reset(new SilenceGate(desiredSampling, channels, vad_config, bufs->stats.get()));
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG,
+                          "(%s) silence suppression below %d dBFS, %u ms hangover, %u ms pre-roll, %u ms keep-alive\n",
+                          tech_pvt->sessionId, vad_config.threshold_dbfs, vad_config.hangover_ms,
+                          vad_config.preroll_ms, vad_config.keepalive_ms);
+    }
+
+    if (send_queue_ms > 0) {
+        // sized in the wire format: Opus at its nominal bitrate, base64 and JSON framing left out
+        const size_t sample_bytes = format.g711 ? 1 : sizeof(int16_t);
+        const size_t bytes_per_second = format.opus ? format.opus_options.bitrate / 8
+                                                    : static_cast<size_t>(desiredSampling) * channels * sample_bytes;
+        SendQueueConfig queue;
+        queue.capacity = bytes_per_second * send_queue_ms / 1000;
+        queue.high_water = bytes_per_second * SEND_HIGH_WATER_MS / 1000;
+        if (!raw_audio_mode) {
+            queue.high_water = realtime_audio_append_size(queue.high_water);
+        }
+        queue.frame_bytes = format.opus ? 0 : channels * sample_bytes;
+        queue.policy = send_overflow;
+        bufs->send_queue.reset(new SendQueue(queue, bufs->stats.get()));
+    }
 
     switch_mutex_init(&tech_pvt->mutex, SWITCH_MUTEX_NESTED, pool);
 
@@ -641,54 +1115,362 @@ switch_status_t stream_data_init(private_t *tech_pvt, switch_core_session_t *ses
     }
 
     if (static_cast<uint32_t>(desiredSampling) != sampling) {
-        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%s) resampling from %u to %u\n",
-                          tech_pvt->sessionId, sampling, desiredSampling);
-        tech_pvt->resampler = speex_resampler_init(channels, sampling, desiredSampling, SWITCH_RESAMPLE_QUALITY, &err);
-        if (0 != err) {
+        auto *resampler = new AudioResampler(channels, sampling, desiredSampling, uplink);
+        tech_pvt->resampler = static_cast<void *>(resampler);
+        if (resampler->init_error() != RESAMPLER_ERR_SUCCESS) {
             switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
-                              "Error initializing resampler: %s.\n", speex_resampler_strerror(err));
+                              "Error initializing resampler: %s.\n", speex_resampler_strerror(resampler->init_error()));
             return SWITCH_STATUS_FALSE;
         }
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG,
+                          "(%s) resampling from %u to %u, %s kernel at quality %d\n", tech_pvt->sessionId,
+                          sampling, desiredSampling, resampler->kernel(), uplink.quality);
     } else {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG,
                           "(%s) no resampling needed for this call\n", tech_pvt->sessionId);
     }
 
-    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%s) stream_data_init\n",
-                      tech_pvt->sessionId);
-
-    return SWITCH_STATUS_SUCCESS;
+    if (const char *kernel = as->playback_resampler_kernel()) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG,
+                          "(%s) playback resampling from %d to %u, %s kernel at quality %d\n", tech_pvt->sessionId,
+                          playback_sampling, sampling, kernel, downlink.quality);
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%s) stream_data_init\n",
+                      tech_pvt->sessionId);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+#ifndef NDEBUG
+// Debug builds verify that the scratch buffers never had to leave their session arena for the heap. The
+// queues are not covered, see audio_arena.h.
+void check_arena(const char *sessionId, const char *side, const AudioArena& arena) {
+    if (arena.heap_allocations() > 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                          "(%s) %s buffers made %llu heap allocations outside the session arena\n", sessionId, side,
+                          static_cast<unsigned long long>(arena.heap_allocations()));
+    }
+}
+#endif
+
+void destroy_tech_pvt(private_t *tech_pvt) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "%s destroy_tech_pvt\n", tech_pvt->sessionId);
+    auto *bufs = static_cast<StreamBuffers *>(tech_pvt->stream_buffers);
+    if (bufs && bufs->encoder) {
+        // the media bug is gone, nothing wakes the stream anymore; waits for a pass in progress
+        EncoderPool::instance().remove(bufs->encoder);
+        bufs->encoder = nullptr;
+    }
+    if (tech_pvt->resampler) {
+        delete static_cast<AudioResampler *>(tech_pvt->resampler);
+        tech_pvt->resampler = nullptr;
+    }
+    if (tech_pvt->mutex) {
+        switch_mutex_destroy(tech_pvt->mutex);
+        tech_pvt->mutex = nullptr;
+    }
+    if (tech_pvt->pAudioStreamer) {
+        auto *as = static_cast<AudioStreamer *>(tech_pvt->pAudioStreamer);
+        delete as;
+        tech_pvt->pAudioStreamer = nullptr;
+    }
+    if (tech_pvt->stream_buffers) {
+        auto *sb = static_cast<StreamBuffers *>(tech_pvt->stream_buffers);
+#ifndef NDEBUG
+        check_arena(tech_pvt->sessionId, "media", sb->arena);
+#endif
+        delete sb;
+        tech_pvt->stream_buffers = nullptr;
+    }
+}
+
+// Uplink owner, for a MUTE_SILENCE post: the batch in progress is dropped, a second of silence sent instead.
+void send_mute_silence(private_t *tech_pvt, StreamBuffers *bufs) {
+    if (tech_pvt->sbuffer) {
+        switch_buffer_zero(tech_pvt->sbuffer);
+    }
+
+    AudioStreamer *streamer = static_cast<AudioStreamer *>(tech_pvt->pAudioStreamer);
+    if (streamer && streamer->isConnected()) {
+        size_t channels = tech_pvt->channels > 0 ? static_cast<size_t>(tech_pvt->channels) : 1;
+        size_t sample_rate = tech_pvt->sampling > 0
+                                 ? static_cast<size_t>(tech_pvt->sampling)
+                                 : 24000; // 24 KHz is currently the only supported rate by openai
+        size_t bytes = channels * sample_rate * sizeof(int16_t);
+        // the flush buffer is free here: sbuffer was just zeroed
+        ArenaBuffer& silence = bufs->flush_buffer;
+        if (silence.resize(bytes)) {
+            memset(silence.data(), 0, bytes);
+            streamer->sendAudio(silence.data(), bytes, bufs);
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG,
+                              "(%s) Sent %zu bytes of silence after muting user audio\n", tech_pvt->sessionId, bytes);
+        }
+    }
+}
+
+// Uplink owner, or cleanup once it closed the uplink: send_json messages after the audio queued before them.
+void send_waiting_texts(AudioStreamer *streamer, StreamBuffers *bufs) {
+    std::unique_lock<std::mutex> lock(bufs->texts_mutex, std::try_to_lock);
+    if (!lock) {
+        bufs->uplink.post(UplinkState::SEND_TEXT); // a message is being added right now, next frame
+        return;
+    }
+    if (streamer) {
+        streamer->drainSendQueue(bufs, true);
+        for (const std::string& text : bufs->texts) {
+            streamer->writeText(text.c_str());
+        }
+    }
+    bufs->texts.clear();
+    bufs->send_backlog.store(false, std::memory_order_release);
+}
+
+void finish(private_t *tech_pvt) {
+    std::shared_ptr<AudioStreamer> aStreamer;
+    aStreamer.reset(static_cast<AudioStreamer *>(tech_pvt->pAudioStreamer));
+    tech_pvt->pAudioStreamer = nullptr;
+
+    // the transport closes in the background and drops the last reference once it is done with the streamer
+    aStreamer->disconnect([aStreamer] {});
+}
+
+// The uplink of a stream: the frames read_frame() returns are resampled, gated, encoded and sent. Runs on the
+// media thread with the frames of the media bug, or on an encoder pool worker with those it captured.
+template <typename ReadFrame> void stream_uplink(private_t *tech_pvt, StreamBuffers *bufs, ReadFrame read_frame) {
+    // the uplink is ours until we leave, with whatever the control paths posted; only cleanup keeps us out
+    uint32_t work = 0;
+    if (!bufs->uplink.enter(&work))
+        return;
+    struct Leave {
+        UplinkState& uplink;
+        ~Leave() {
+            uplink.leave();
+        }
+    } leave{bufs->uplink};
+
+    auto *pAudioStreamer = static_cast<AudioStreamer *>(tech_pvt->pAudioStreamer);
+    if (work & UplinkState::MUTE_SILENCE) {
+        send_mute_silence(tech_pvt, bufs);
+    }
+    if (work & UplinkState::SEND_TEXT) {
+        send_waiting_texts(pAudioStreamer, bufs);
+    }
+
+    if (tech_pvt->audio_paused || tech_pvt->user_audio_muted) {
+        if (bufs->capture_ring) {
+            // captured before the pause or mute, stale by the time it ends
+            bufs->capture_ring->skip(bufs->capture_ring->read_available());
+        }
+        return;
+    }
+
+    switch_frame_t frame{};
+    frame.data = bufs->data_buf.data();
+    frame.buflen = SWITCH_RECOMMENDED_BUFFER_SIZE;
+
+    if (!pAudioStreamer || !pAudioStreamer->isConnected()) {
+        // nothing can go out: take the frames anyway, so they are counted now rather than sent stale later
+        while (read_frame(frame)) {
+            if (frame.datalen > 0) {
+                bufs->stats->add(bufs->stats->uplink_dropped_frames);
+                bufs->stats->add(bufs->stats->uplink_dropped_bytes, frame.datalen);
+            }
+        }
+        return;
+    }
+
+    // audio held back by a congested socket goes first, as soon as it drained
+    pAudioStreamer->drainSendQueue(bufs, false);
+
+    // captured audio goes through the silence gate, when there is one, on its way out
+    auto send_captured = [&](const uint8_t *data, size_t len) {
+        if (bufs->silence_gate) {
+            if (!bufs->silence_gate->admit(reinterpret_cast<const int16_t *>(data), len / sizeof(int16_t))) {
+                return;
+            }
+            size_t preroll_samples = 0;
+            const int16_t *preroll = bufs->silence_gate->preroll(&preroll_samples);
+            if (preroll_samples > 0) {
+                pAudioStreamer->sendAudio(reinterpret_cast<const uint8_t *>(preroll),
+                                          preroll_samples * sizeof(int16_t), bufs);
+            }
+        }
+        pAudioStreamer->sendAudio(data, len, bufs);
+    };
+
+    auto flush_sbuffer = [&]() {
+        switch_size_t inuse = switch_buffer_inuse(tech_pvt->sbuffer);
+        if (inuse > 0 && bufs->flush_buffer.resize(inuse)) {
+            switch_buffer_read(tech_pvt->sbuffer, bufs->flush_buffer.data(), inuse);
+            switch_buffer_zero(tech_pvt->sbuffer);
+            send_captured(bufs->flush_buffer.data(), inuse);
+        }
+    };
+
+    while (read_frame(frame)) {
+        // Validate frame data before processing
+        if (frame.datalen == 0 || frame.samples == 0) {
+            continue;
+        }
+
+        if (!tech_pvt->resampler) {
+            if (tech_pvt->rtp_packets == 1) {
+                send_captured(static_cast<const uint8_t *>(frame.data), frame.datalen);
+            } else {
+                size_t write_len = frame.datalen;
+                const uint8_t *write_data = static_cast<const uint8_t *>(frame.data);
+                switch_size_t free_space = switch_buffer_freespace(tech_pvt->sbuffer);
+                if (write_len > free_space) {
+                    flush_sbuffer();
+                    free_space = switch_buffer_freespace(tech_pvt->sbuffer);
+                }
+                // Only write if buffer has enough space
+                if (write_len <= free_space) {
+                    switch_buffer_write(tech_pvt->sbuffer, write_data, write_len);
+                    if (switch_buffer_freespace(tech_pvt->sbuffer) == 0) {
+                        flush_sbuffer();
+                    }
+                } else {
+                    bufs->stats->add(bufs->stats->uplink_dropped_frames);
+                    bufs->stats->add(bufs->stats->uplink_dropped_bytes, write_len);
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                      "%s: Dropping %zu bytes of audio data, buffer capacity exceeded\n",
+                                      tech_pvt->sessionId, write_len);
+                }
+            }
+            continue;
+        }
+
+        size_t available = switch_buffer_freespace(tech_pvt->sbuffer);
+        uint32_t in_len = frame.samples;
+        uint32_t out_len = available / (tech_pvt->channels * sizeof(int16_t));
+        if (out_len == 0) {
+            flush_sbuffer();
+            available = switch_buffer_freespace(tech_pvt->sbuffer);
+            out_len = available / (tech_pvt->channels * sizeof(int16_t));
+            // Skip processing if buffer still has no space after flushing
+            if (out_len == 0) {
+                bufs->stats->add(bufs->stats->uplink_dropped_frames);
+                bufs->stats->add(bufs->stats->uplink_dropped_bytes, frame.datalen);
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                  "%s: Buffer full, cannot process resampled frame\n", tech_pvt->sessionId);
+                continue;
+            }
+        }
+
+        if (!bufs->resample_buffer.resize(out_len * tech_pvt->channels * sizeof(int16_t))) {
+            continue;
+        }
+
+        static_cast<AudioResampler *>(tech_pvt->resampler)
+            ->process(static_cast<const int16_t *>(frame.data), &in_len, bufs->resample_buffer.as<int16_t>(), &out_len);
+
+        size_t bytes_written = out_len * tech_pvt->channels * sizeof(int16_t);
+        if (bytes_written > 0) {
+            // For 20ms packets, send immediately without buffering
+            if (tech_pvt->rtp_packets == 1) {
+                send_captured(bufs->resample_buffer.data(), bytes_written);
+            } else {
+                // Check if buffer has enough space before writing
+                switch_size_t free_space = switch_buffer_freespace(tech_pvt->sbuffer);
+                if (bytes_written > free_space) {
+                    flush_sbuffer();
+                    free_space = switch_buffer_freespace(tech_pvt->sbuffer);
+                }
+                if (bytes_written <= free_space) {
+                    switch_buffer_write(tech_pvt->sbuffer, bufs->resample_buffer.data(), bytes_written);
+                    if (switch_buffer_freespace(tech_pvt->sbuffer) == 0) {
+                        flush_sbuffer();
+                    }
+                } else {
+                    bufs->stats->add(bufs->stats->uplink_dropped_frames);
+                    bufs->stats->add(bufs->stats->uplink_dropped_bytes, bytes_written);
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                      "%s: Dropping %zu bytes of resampled audio data, buffer capacity exceeded\n",
+                                      tech_pvt->sessionId, bytes_written);
+                }
+            }
+        }
+    }
+
+    bufs->send_backlog.store(bufs->send_queue && !bufs->send_queue->empty(), std::memory_order_release);
 }
 
-void destroy_tech_pvt(private_t *tech_pvt) {
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "%s destroy_tech_pvt\n", tech_pvt->sessionId);
-    if (tech_pvt->resampler) {
-        speex_resampler_destroy(tech_pvt->resampler);
-        tech_pvt->resampler = nullptr;
-    }
-    if (tech_pvt->mutex) {
-        switch_mutex_destroy(tech_pvt->mutex);
-        tech_pvt->mutex = nullptr;
+// Media thread, with an encoder pool: the frames are only copied out, whole, for the worker to stream.
+void capture_frames(switch_media_bug_t *bug, private_t *tech_pvt, StreamBuffers *bufs) {
+    if (!tech_pvt->audio_paused && !tech_pvt->user_audio_muted) {
+        switch_frame_t frame{};
+        frame.data = bufs->capture_buf->data();
+        frame.buflen = SWITCH_RECOMMENDED_BUFFER_SIZE;
+        while (switch_core_media_bug_read(bug, &frame, SWITCH_TRUE) == SWITCH_STATUS_SUCCESS) {
+            const size_t samples = frame.datalen / sizeof(int16_t);
+            if (samples == 0) {
+                continue;
+            }
+            if (bufs->capture_ring->write_available() < samples) {
+                // the worker fell a whole ring behind
+                bufs->stats->add(bufs->stats->uplink_dropped_frames);
+                bufs->stats->add(bufs->stats->uplink_dropped_bytes, frame.datalen);
+                continue;
+            }
+            bufs->capture_ring->write(static_cast<const int16_t *>(frame.data), samples);
+        }
     }
-    if (tech_pvt->pAudioStreamer) {
-        auto *as = static_cast<AudioStreamer *>(tech_pvt->pAudioStreamer);
-        delete as;
-        tech_pvt->pAudioStreamer = nullptr;
+    // also while paused or muted, for the work the control paths posted
+    EncoderPool::wake(bufs->encoder);
+}
+
+// Encoder pool worker: streams what the media thread captured, 20 ms at a time.
+void encode_captured(private_t *tech_pvt, StreamBuffers *bufs) {
+    SpscRing<int16_t>& ring = *bufs->capture_ring;
+    const size_t chunk = bufs->capture_chunk;
+    const size_t channels = tech_pvt->channels > 0 ? static_cast<size_t>(tech_pvt->channels) : 1;
+    stream_uplink(tech_pvt, bufs, [&](switch_frame_t& frame) {
+        if (ring.read_available() < chunk) {
+            return false; // the rest of a frame that was not 20 ms long, with the next one
+        }
+        frame.datalen = ring.read(static_cast<int16_t *>(frame.data), chunk) * sizeof(int16_t);
+        frame.samples = frame.datalen / (channels * sizeof(int16_t));
+        return true;
+    });
+}
+
+// Hands the uplink of a new stream to the encoder pool, if there is one; sampling is the rate of the call.
+void start_encoder(private_t *tech_pvt, uint32_t sampling, int channels) {
+    EncoderPool& pool = EncoderPool::instance();
+    if (!pool.enabled()) {
+        return;
     }
-    if (tech_pvt->stream_buffers) {
-        auto *sb = static_cast<StreamBuffers *>(tech_pvt->stream_buffers);
-        delete sb;
-        tech_pvt->stream_buffers = nullptr;
+    auto *bufs = static_cast<StreamBuffers *>(tech_pvt->stream_buffers);
+    const size_t frame_samples = static_cast<size_t>(sampling) / 50 * static_cast<size_t>(channels);
+    if (frame_samples == 0 || frame_samples * sizeof(int16_t) > SWITCH_RECOMMENDED_BUFFER_SIZE) {
+        return;
+    }
+    bufs->capture_ring.reset(new SpscRing<int16_t>(frame_samples * CAPTURE_RING_MS / 20));
+    bufs->capture_buf.reset(new ArenaBuffer(bufs->arena, SWITCH_RECOMMENDED_BUFFER_SIZE));
+    bufs->capture_chunk = frame_samples;
+    bufs->encoder = pool.add([tech_pvt, bufs] { encode_captured(tech_pvt, bufs); });
+    if (!bufs->encoder) {
+        // no worker could start: the media thread streams as usual
+        bufs->capture_ring.reset();
+        bufs->capture_buf.reset();
     }
 }
 
-void finish(private_t *tech_pvt) {
-    std::shared_ptr<AudioStreamer> aStreamer;
-    aStreamer.reset(static_cast<AudioStreamer *>(tech_pvt->pAudioStreamer));
-    tech_pvt->pAudioStreamer = nullptr;
-
-    std::thread t([aStreamer] { aStreamer->disconnect(); });
-    t.detach();
+// "2,3" -> {2, 3}
+std::vector<int> parse_cpu_list(const char *list) {
+    std::vector<int> cpus;
+    for (const char *p = list; p && *p;) {
+        char *end;
+        long cpu = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        cpus.push_back(static_cast<int>(cpu));
+        p = *end == ',' ? end + 1 : end;
+    }
+    return cpus;
 }
 
 } // namespace
@@ -835,7 +1617,17 @@ switch_status_t stream_session_send_json(switch_core_session_t *session, const c
 
     switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG,
                       "stream_session_send_json: sending JSON: %s\n", json_unformatted);
-    pAudioStreamer->writeText(json_unformatted);
+    auto *bufs = static_cast<StreamBuffers *>(tech_pvt->stream_buffers);
+    if (bufs && bufs->send_backlog.load(std::memory_order_acquire)) {
+        // audio waiting in the send queue was captured first: the media thread sends the message after it
+        {
+            std::lock_guard<std::mutex> lock(bufs->texts_mutex);
+            bufs->texts.emplace_back(json_unformatted);
+        }
+        bufs->uplink.post(UplinkState::SEND_TEXT);
+    } else {
+        pAudioStreamer->writeText(json_unformatted);
+    }
     status = SWITCH_STATUS_SUCCESS;
 
     if (json_unformatted)
@@ -891,32 +1683,14 @@ switch_status_t stream_session_set_user_mute(switch_core_session_t *session, int
                       tech_pvt->user_audio_muted ? "muted" : "unmuted");
 
     if (tech_pvt->user_audio_muted) {
-        if (tech_pvt->mutex) {
-            switch_mutex_lock(tech_pvt->mutex);
-        }
-
-        if (tech_pvt->sbuffer) {
-            switch_buffer_zero(tech_pvt->sbuffer);
-        }
-
         AudioStreamer *streamer = static_cast<AudioStreamer *>(tech_pvt->pAudioStreamer);
-        if (streamer && streamer->isConnected()) {
-            size_t channels = tech_pvt->channels > 0 ? static_cast<size_t>(tech_pvt->channels) : 1;
-            size_t sample_rate = tech_pvt->sampling > 0
-                                     ? static_cast<size_t>(tech_pvt->sampling)
-                                     : 24000; // 24 KHz is currently the only supported rate by openai
-            size_t bytes = channels * sample_rate * sizeof(int16_t);
-            std::vector<uint8_t> silence(bytes, 0);
-            streamer->sendAudio(silence.data(), silence.size());
-            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG,
-                              "Sent %zu bytes of silence after muting user audio\n", silence.size());
+        auto *bufs = static_cast<StreamBuffers *>(tech_pvt->stream_buffers);
+        if (streamer && streamer->isConnected() && bufs) {
+            // the uplink buffers belong to the media thread, it sends the silence on its next frame
+            bufs->uplink.post(UplinkState::MUTE_SILENCE);
         } else {
             status = SWITCH_STATUS_FALSE;
         }
-
-        if (tech_pvt->mutex) {
-            switch_mutex_unlock(tech_pvt->mutex);
-        }
     }
 
     return status;
@@ -967,6 +1741,17 @@ switch_status_t stream_session_init(switch_core_session_t *session, responseHand
     bool tls_disable_hostname_validation = false;
     bool disable_audiofiles = false;
     bool raw_audio_mode = force_raw_audio_mode ? true : false;
+    uint32_t playback_queue_ms = 30000;
+    bool strip_audio = false;
+    PlayoutConfig playout;
+    ResamplerOptions uplink_resampler;
+    ResamplerOptions downlink_resampler;
+    uplink_resampler.quality = SWITCH_RESAMPLE_QUALITY;
+    WireFormat format;
+    bool vad = false;
+    SilenceGateConfig vad_config;
+    uint32_t send_queue_ms = 1000;
+    SendOverflowPolicy send_overflow = SEND_OVERFLOW_DROP;
 
     switch_channel_t *channel = switch_core_session_get_channel(session);
 
@@ -995,6 +1780,10 @@ switch_status_t stream_session_init(switch_core_session_t *session, responseHand
         disable_audiofiles = true;
     }
 
+    if (switch_channel_var_true(channel, "STREAM_EVENT_STRIP_AUDIO")) {
+        strip_audio = true;
+    }
+
     if (switch_channel_var_true(channel, "STREAM_RAW_AUDIO")) {
         raw_audio_mode = true;
         if (force_raw_audio_mode) {
@@ -1023,6 +1812,192 @@ switch_status_t stream_session_init(switch_core_session_t *session, responseHand
         }
     }
 
+    const char *playbackQueue = switch_channel_get_variable(channel, "STREAM_PLAYBACK_QUEUE_MS");
+    if (playbackQueue) {
+        int value = atoi(playbackQueue);
+        if (value >= 1000) {
+            playback_queue_ms = static_cast<uint32_t>(value);
+        } else {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+                              "%s: Invalid playback queue of %s ms, must be at least 1000. Using default %u ms.\n",
+                              switch_channel_get_name(channel), playbackQueue, playback_queue_ms);
+        }
+    }
+
+    const char *prebuffer = switch_channel_get_variable(channel, "STREAM_PLAYOUT_PREBUFFER_MS");
+    if (prebuffer) {
+        int value = atoi(prebuffer);
+        if (value >= 0) {
+            playout.prebuffer_ms = static_cast<uint32_t>(value);
+        }
+    }
+
+    const char *playoutMax = switch_channel_get_variable(channel, "STREAM_PLAYOUT_MAX_MS");
+    if (playoutMax) {
+        int value = atoi(playoutMax);
+        if (value >= 0) {
+            playout.max_ms = static_cast<uint32_t>(value);
+        }
+    }
+
+    const char *resampleQuality = switch_channel_get_variable(channel, "STREAM_RESAMPLE_QUALITY");
+    if (resampleQuality) {
+        char *endptr;
+        long value = strtol(resampleQuality, &endptr, 10);
+        if (*endptr == '\0' && value >= 0 && value <= 10) {
+            uplink_resampler.quality = downlink_resampler.quality = static_cast<int>(value);
+        } else {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+                              "%s: Invalid resample quality %s, must be 0 to 10. Using defaults.\n",
+                              switch_channel_get_name(channel), resampleQuality);
+        }
+    }
+
+    const char *resamplerKind = switch_channel_get_variable(channel, "STREAM_RESAMPLER");
+    if (resamplerKind && !strcasecmp(resamplerKind, "speex")) {
+        uplink_resampler.polyphase = downlink_resampler.polyphase = false;
+    }
+
+    // G.711 both ways at 8 kHz: "g711" follows the call's codec, PCMU and PCMA calls then skip resampling.
+    // Opus is for the raw audio mode, OpenAI does not take it.
+    const char *audioFormat = switch_channel_get_variable(channel, "STREAM_AUDIO_FORMAT");
+    if (audioFormat && strcasecmp(audioFormat, "pcm16") != 0) {
+        switch_codec_t *read_codec = switch_core_session_get_read_codec(session);
+        const char *codec = read_codec && read_codec->implementation ? read_codec->implementation->iananame : "";
+        if (!strcasecmp(audioFormat, "g711")) {
+            format.g711 = !strcasecmp(codec, "PCMU") || !strcasecmp(codec, "PCMA");
+            format.g711_law = !strcasecmp(codec, "PCMA") ? G711_ALAW : G711_ULAW;
+        } else if (!strcasecmp(audioFormat, "g711_ulaw") || !strcasecmp(audioFormat, "g711_alaw")) {
+            format.g711 = true;
+            format.g711_law = !strcasecmp(audioFormat, "g711_alaw") ? G711_ALAW : G711_ULAW;
+        } else if (!strcasecmp(audioFormat, "opus")) {
+            format.opus = true;
+        } else {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+                              "%s: Invalid audio format %s, must be pcm16, g711, g711_ulaw, g711_alaw or opus. "
+                              "Using pcm16.\n",
+                              switch_channel_get_name(channel), audioFormat);
+        }
+        if (format.g711 && channels != 1) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+                              "%s: G.711 streams are mono only. Using pcm16.\n", switch_channel_get_name(channel));
+            format.g711 = false;
+        }
+        if (format.g711) {
+            sampling = playback_sampling = 8000;
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+                              "%s: Streaming %s at 8000 Hz (call codec %s), set it as input_audio_format and "
+                              "output_audio_format of the session.\n",
+                              switch_channel_get_name(channel), g711_law_name(format.g711_law), codec);
+        } else if (!strcasecmp(audioFormat, "g711")) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+                              "%s: Call codec %s is not G.711, streaming pcm16.\n", switch_channel_get_name(channel),
+                              codec);
+        }
+
+        if (format.opus) {
+            const char *reason = nullptr;
+            if (!raw_audio_mode) {
+                reason = "it needs the raw audio mode";
+            } else if (!opus_available()) {
+                reason = "the module was built without libopus";
+            } else if (!opus_rate_supported(sampling) || !opus_rate_supported(playback_sampling)) {
+                reason = "the sample rates must be 8k, 16k, 24k or 48k";
+            }
+            if (reason) {
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+                                  "%s: Cannot stream Opus, %s. Using pcm16.\n", switch_channel_get_name(channel),
+                                  reason);
+                format.opus = false;
+            }
+        }
+        if (format.opus) {
+            const char *bitrate = switch_channel_get_variable(channel, "STREAM_OPUS_BITRATE");
+            if (bitrate) {
+                int value = atoi(bitrate);
+                if (value >= 6000 && value <= 510000) {
+                    format.opus_options.bitrate = value;
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+                                      "%s: Invalid Opus bitrate %s, must be 6000 to 510000. Using default %d.\n",
+                                      switch_channel_get_name(channel), bitrate, format.opus_options.bitrate);
+                }
+            }
+            const char *frameMs = switch_channel_get_variable(channel, "STREAM_OPUS_FRAME_MS");
+            if (frameMs) {
+                int value = atoi(frameMs);
+                if (value == 10 || value == 20 || value == 40 || value == 60) {
+                    format.opus_options.frame_ms = static_cast<uint32_t>(value);
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+                                      "%s: Invalid Opus frame of %s ms, must be 10, 20, 40 or 60. Using default %u.\n",
+                                      switch_channel_get_name(channel), frameMs, format.opus_options.frame_ms);
+                }
+            }
+        }
+    }
+
+    // Silence suppression: frames past the hangover after speech stay home, but for a keep-alive now and then
+    if (switch_channel_var_true(channel, "STREAM_VAD")) {
+        vad = true;
+        const char *threshold = switch_channel_get_variable(channel, "STREAM_VAD_THRESHOLD_DB");
+        if (threshold) {
+            char *endptr;
+            long value = strtol(threshold, &endptr, 10);
+            if (*endptr == '\0' && value >= -90 && value <= 0) {
+                vad_config.threshold_dbfs = static_cast<int>(value);
+            } else {
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+                                  "%s: Invalid VAD threshold of %s dB, must be -90 to 0. Using default %d.\n",
+                                  switch_channel_get_name(channel), threshold, vad_config.threshold_dbfs);
+            }
+        }
+        const char *hangover = switch_channel_get_variable(channel, "STREAM_VAD_HANGOVER_MS");
+        if (hangover) {
+            int value = atoi(hangover);
+            if (value >= 0) {
+                vad_config.hangover_ms = static_cast<uint32_t>(value);
+            }
+        }
+        const char *preroll = switch_channel_get_variable(channel, "STREAM_VAD_PREROLL_MS");
+        if (preroll) {
+            int value = atoi(preroll);
+            if (value >= 0 && value <= 1000) {
+                vad_config.preroll_ms = static_cast<uint32_t>(value);
+            } else {
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+                                  "%s: Invalid VAD pre-roll of %s ms, must be 0 to 1000. Using default %u ms.\n",
+                                  switch_channel_get_name(channel), preroll, vad_config.preroll_ms);
+            }
+        }
+        const char *keepalive = switch_channel_get_variable(channel, "STREAM_VAD_KEEPALIVE_MS");
+        if (keepalive) {
+            int value = atoi(keepalive);
+            if (value >= 0) {
+                vad_config.keepalive_ms = static_cast<uint32_t>(value);
+            }
+        }
+    }
+
+    const char *sendQueue = switch_channel_get_variable(channel, "STREAM_SEND_QUEUE_MS");
+    if (sendQueue) {
+        int value = atoi(sendQueue);
+        if (value == 0 || value >= 100) {
+            send_queue_ms = static_cast<uint32_t>(value);
+        } else {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+                              "%s: Invalid send queue of %s ms, must be 0 or at least 100. Using default %u ms.\n",
+                              switch_channel_get_name(channel), sendQueue, send_queue_ms);
+        }
+    }
+
+    const char *sendOverflow = switch_channel_get_variable(channel, "STREAM_SEND_OVERFLOW");
+    if (sendOverflow && !send_overflow_policy_parse(sendOverflow, &send_overflow)) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+                          "%s: Invalid send overflow policy %s, must be drop, merge or event. Using drop.\n",
+                          switch_channel_get_name(channel), sendOverflow);
+    }
+
     if ((buffer_size = switch_channel_get_variable(channel, "STREAM_BUFFER_SIZE"))) {
         int bSize = atoi(buffer_size);
         if (bSize % 20 != 0) {
@@ -1055,134 +2030,52 @@ switch_status_t stream_session_init(switch_core_session_t *session, responseHand
                                                   playback_sampling, channels, responseHandler, deflate, heart_beat,
                                                   suppressLog, rtp_packets, extra_headers, no_reconnect, tls_cafile,
                                                   tls_keyfile, tls_certfile, tls_disable_hostname_validation,
-                                                  disable_audiofiles, start_muted, raw_audio_mode)) {
+                                                  disable_audiofiles, start_muted, raw_audio_mode, playback_queue_ms,
+                                                  strip_audio, playout, uplink_resampler, downlink_resampler,
+                                                  format, vad, vad_config, send_queue_ms, send_overflow)) {
         destroy_tech_pvt(tech_pvt);
         return SWITCH_STATUS_FALSE;
     }
+    start_encoder(tech_pvt, samples_per_second, channels);
 
     *ppUserData = tech_pvt;
 
     return SWITCH_STATUS_SUCCESS;
 }
 
-switch_bool_t stream_frame(switch_media_bug_t *bug) {
-    auto *tech_pvt = static_cast<private_t *>(switch_core_media_bug_get_user_data(bug));
-    if (!tech_pvt || tech_pvt->audio_paused || tech_pvt->user_audio_muted)
-        return SWITCH_TRUE;
-
-    if (switch_mutex_trylock(tech_pvt->mutex) != SWITCH_STATUS_SUCCESS) {
-        return SWITCH_TRUE;
+switch_status_t stream_session_connect(switch_core_session_t *session) {
+    switch_channel_t *channel = switch_core_session_get_channel(session);
+    auto *bug = static_cast<switch_media_bug_t *>(switch_channel_get_private(channel, MY_BUG_NAME));
+    if (!bug) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                          "stream_session_connect failed because no bug\n");
+        return SWITCH_STATUS_FALSE;
     }
+    auto *tech_pvt = static_cast<private_t *>(switch_core_media_bug_get_user_data(bug));
+    if (!tech_pvt || !tech_pvt->pAudioStreamer)
+        return SWITCH_STATUS_FALSE;
 
-    auto *pAudioStreamer = static_cast<AudioStreamer *>(tech_pvt->pAudioStreamer);
+    static_cast<AudioStreamer *>(tech_pvt->pAudioStreamer)->connect();
+    return SWITCH_STATUS_SUCCESS;
+}
 
-    if (!pAudioStreamer || !pAudioStreamer->isConnected()) {
-        switch_mutex_unlock(tech_pvt->mutex);
+switch_bool_t stream_frame(switch_media_bug_t *bug) {
+    auto *tech_pvt = static_cast<private_t *>(switch_core_media_bug_get_user_data(bug));
+    if (!tech_pvt)
         return SWITCH_TRUE;
-    }
 
     // Get persistent buffers (allocated once per session, reused across all frames)
     auto *bufs = static_cast<StreamBuffers *>(tech_pvt->stream_buffers);
+    if (!bufs)
+        return SWITCH_TRUE;
 
-    auto flush_sbuffer = [&]() {
-        switch_size_t inuse = switch_buffer_inuse(tech_pvt->sbuffer);
-        if (inuse > 0) {
-            bufs->flush_buffer.resize(inuse);
-            switch_buffer_read(tech_pvt->sbuffer, bufs->flush_buffer.data(), inuse);
-            switch_buffer_zero(tech_pvt->sbuffer);
-            pAudioStreamer->sendAudio(bufs->flush_buffer.data(), inuse);
-        }
-    };
-
-    switch_frame_t frame{};
-    frame.data = bufs->data_buf.data();
-    frame.buflen = SWITCH_RECOMMENDED_BUFFER_SIZE;
-
-    while (switch_core_media_bug_read(bug, &frame, SWITCH_TRUE) == SWITCH_STATUS_SUCCESS) {
-        // Validate frame data before processing
-        if (frame.datalen == 0 || frame.samples == 0) {
-            continue;
-        }
-
-        if (!tech_pvt->resampler) {
-            if (tech_pvt->rtp_packets == 1) {
-                pAudioStreamer->sendAudio(static_cast<uint8_t *>(frame.data), frame.datalen);
-            } else {
-                size_t write_len = frame.datalen;
-                const uint8_t *write_data = static_cast<const uint8_t *>(frame.data);
-                switch_size_t free_space = switch_buffer_freespace(tech_pvt->sbuffer);
-                if (write_len > free_space) {
-                    flush_sbuffer();
-                    free_space = switch_buffer_freespace(tech_pvt->sbuffer);
-                }
-                // Only write if buffer has enough space
-                if (write_len <= free_space) {
-                    switch_buffer_write(tech_pvt->sbuffer, write_data, write_len);
-                    if (switch_buffer_freespace(tech_pvt->sbuffer) == 0) {
-                        flush_sbuffer();
-                    }
-                } else {
-                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
-                                      "%s: Dropping %zu bytes of audio data, buffer capacity exceeded\n",
-                                      tech_pvt->sessionId, write_len);
-                }
-            }
-            continue;
-        }
-
-        size_t available = switch_buffer_freespace(tech_pvt->sbuffer);
-        spx_uint32_t in_len = frame.samples;
-        spx_uint32_t out_len = available / (tech_pvt->channels * sizeof(spx_int16_t));
-        if (out_len == 0) {
-            flush_sbuffer();
-            available = switch_buffer_freespace(tech_pvt->sbuffer);
-            out_len = available / (tech_pvt->channels * sizeof(spx_int16_t));
-            // Skip processing if buffer still has no space after flushing
-            if (out_len == 0) {
-                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
-                                  "%s: Buffer full, cannot process resampled frame\n", tech_pvt->sessionId);
-                continue;
-            }
-        }
-
-        bufs->resample_buffer.resize(out_len * tech_pvt->channels);
-
-        if (tech_pvt->channels == 1) {
-            speex_resampler_process_int(tech_pvt->resampler, 0, static_cast<const spx_int16_t *>(frame.data), &in_len,
-                                        bufs->resample_buffer.data(), &out_len);
-        } else {
-            speex_resampler_process_interleaved_int(tech_pvt->resampler, static_cast<const spx_int16_t *>(frame.data),
-                                                    &in_len, bufs->resample_buffer.data(), &out_len);
-        }
-
-        size_t bytes_written = out_len * tech_pvt->channels * sizeof(spx_int16_t);
-        if (bytes_written > 0) {
-            // For 20ms packets, send immediately without buffering
-            if (tech_pvt->rtp_packets == 1) {
-                pAudioStreamer->sendAudio(reinterpret_cast<uint8_t *>(bufs->resample_buffer.data()), bytes_written);
-            } else {
-                // Check if buffer has enough space before writing
-                switch_size_t free_space = switch_buffer_freespace(tech_pvt->sbuffer);
-                if (bytes_written > free_space) {
-                    flush_sbuffer();
-                    free_space = switch_buffer_freespace(tech_pvt->sbuffer);
-                }
-                if (bytes_written <= free_space) {
-                    switch_buffer_write(tech_pvt->sbuffer,
-                                        reinterpret_cast<const uint8_t *>(bufs->resample_buffer.data()), bytes_written);
-                    if (switch_buffer_freespace(tech_pvt->sbuffer) == 0) {
-                        flush_sbuffer();
-                    }
-                } else {
-                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
-                                      "%s: Dropping %zu bytes of resampled audio data, buffer capacity exceeded\n",
-                                      tech_pvt->sessionId, bytes_written);
-                }
-            }
-        }
+    if (bufs->encoder) {
+        capture_frames(bug, tech_pvt, bufs);
+    } else {
+        stream_uplink(tech_pvt, bufs, [bug](switch_frame_t& frame) {
+            return switch_core_media_bug_read(bug, &frame, SWITCH_TRUE) == SWITCH_STATUS_SUCCESS;
+        });
     }
-
-    switch_mutex_unlock(tech_pvt->mutex);
     return SWITCH_TRUE;
 }
 
@@ -1215,51 +2108,137 @@ switch_bool_t write_frame(switch_core_session_t *session, switch_media_bug_t *bu
         bytes_needed = frame->buflen;
     }
 
-    uint32_t inuse = switch_buffer_inuse(tech_pvt->playback_buffer);
-
-    // push a chunk in the audio buffer used treated as cache
-    if (as->clear_requested()) {
-        switch_buffer_zero(tech_pvt->playback_buffer);
-        inuse = 0;
-    }
-    bool chunk_enqueued = false;
-    if (inuse < bytes_needed * 2) {
-        std::vector<int16_t> chunk;
-        if (as->pop_audio_queue(chunk)) {
-            switch_buffer_write(tech_pvt->playback_buffer, chunk.data(), chunk.size() * sizeof(int16_t));
-            chunk_enqueued = true;
-        }
-    }
-    if (!chunk_enqueued && inuse == 0) {
+    // read straight from the lock-free playback queue into the frame
+    size_t samples_needed = bytes_needed / sizeof(int16_t);
+    size_t samples = tech_pvt->openai_audio_muted
+                         ? as->skip_audio_queue(samples_needed)
+                         : as->playout_audio_queue(static_cast<int16_t *>(frame->data), samples_needed);
+    if (samples == 0) {
         // Openai just finished speaking for interruption or end of response
         if (as->is_openai_speaking() && as->is_response_audio_done()) {
             as->openai_speech_stopped();
         }
         return SWITCH_TRUE;
     }
-
-    if (inuse > bytes_needed) {
-        inuse = bytes_needed;
+    if (tech_pvt->openai_audio_muted) {
+        return SWITCH_TRUE;
     }
 
-    if (tech_pvt->openai_audio_muted) {
-        switch_buffer_toss(tech_pvt->playback_buffer, inuse);
-    } else {
-        switch_byte_t *data = static_cast<switch_byte_t *>(frame->data);
+    if (!as->is_openai_speaking()) {
+        as->openai_speech_started();
+    }
 
-        switch_buffer_read(tech_pvt->playback_buffer, data, inuse);
+    // a frame the queue could not fill is completed with silence, the channel always gets full frames
+    frame->datalen = samples_needed * sizeof(int16_t);
+    frame->samples = frame->datalen / bytes_per_sample;
 
-        if (!as->is_openai_speaking()) {
-            as->openai_speech_started();
-        }
+    switch_core_media_bug_set_write_replace_frame(bug, frame);
 
-        frame->datalen = inuse;
-        frame->samples = frame->datalen / bytes_per_sample;
+    return SWITCH_TRUE;
+}
 
-        switch_core_media_bug_set_write_replace_frame(bug, frame);
+switch_status_t stream_session_stats(switch_core_session_t *session, switch_stream_handle_t *stream) {
+    switch_channel_t *channel = switch_core_session_get_channel(session);
+    auto *bug = static_cast<switch_media_bug_t *>(switch_channel_get_private(channel, MY_BUG_NAME));
+    if (!bug) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                          "stream_session_stats failed because no bug\n");
+        return SWITCH_STATUS_FALSE;
+    }
+    auto *tech_pvt = static_cast<private_t *>(switch_core_media_bug_get_user_data(bug));
+    auto *bufs = tech_pvt ? static_cast<StreamBuffers *>(tech_pvt->stream_buffers) : nullptr;
+    if (!bufs || !bufs->stats) {
+        return SWITCH_STATUS_FALSE;
     }
 
-    return SWITCH_TRUE;
+    // counters are read lock-free, the media path is never held up by a stats request
+    stream->write_function(stream, "%s\n", bufs->stats->to_json().c_str());
+    return SWITCH_STATUS_SUCCESS;
+}
+
+void stream_module_stats(switch_stream_handle_t *stream) {
+    std::string json = StreamStatsRegistry::instance().to_json();
+    json.pop_back();
+
+    auto append = [&json](const char *name, uint64_t value) {
+        char field[96];
+        json.append(field, snprintf(field, sizeof(field), ",\"%s\":%" PRIu64, name, value));
+    };
+
+    // streams being closed are not registered anymore, their teardown is reported on its own
+    const TeardownQueue& teardowns = TeardownQueue::instance();
+    append("teardowns_pending", teardowns.pending());
+    append("teardowns_peak_pending", teardowns.peak_pending());
+    append("teardowns_completed", teardowns.completed());
+    append("teardown_waits", teardowns.waits());
+    append("teardown_handoffs", teardowns.handoffs());
+
+    const WsConnectionPoolStats pool = ws_connection_pool_stats();
+    append("pool_hits", pool.hits);
+    append("pool_misses", pool.misses);
+    append("pool_idle", pool.idle);
+
+    const TlsSessionStats tls = tls_session_stats();
+    append("tls_handshakes", tls.handshakes);
+    append("tls_resumed", tls.resumed);
+    append("tls_resumed_pct", tls.handshakes ? tls.resumed * 100 / tls.handshakes : 0);
+
+    json.push_back('}');
+    stream->write_function(stream, "%s\n", json.c_str());
+}
+
+// Module wide settings come from global variables (vars.xml), read once at load.
+void stream_module_init(void) {
+    const char *teardown_threads = switch_core_get_variable("openai_audio_stream_teardown_threads");
+    const char *teardown_queue = switch_core_get_variable("openai_audio_stream_teardown_queue");
+    TeardownQueue::instance().configure(teardown_threads ? atoi(teardown_threads) : 0,
+                                        teardown_queue ? atoi(teardown_queue) : 0);
+
+    const char *pool_min_idle = switch_core_get_variable("openai_audio_stream_pool_min_idle");
+    const char *pool_max_age = switch_core_get_variable("openai_audio_stream_pool_max_age");
+    int min_idle = pool_min_idle ? atoi(pool_min_idle) : 0;
+    if (min_idle > 0) {
+        int max_age = pool_max_age ? atoi(pool_max_age) : 0;
+        if (max_age <= 0) {
+            max_age = 120;
+        }
+        ws_connection_pool_configure(min_idle, max_age);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE,
+                          "keeping %d websocket connections ready per endpoint, for at most %d seconds each\n",
+                          min_idle, max_age);
+    }
+
+    const char *encoder_threads = switch_core_get_variable("openai_audio_stream_encoder_threads");
+    int encoders = encoder_threads ? atoi(encoder_threads) : 0;
+    if (encoders > 0) {
+        const char *encoder_cpus = switch_core_get_variable("openai_audio_stream_encoder_cpus");
+        const std::vector<int> cpus = parse_cpu_list(encoder_cpus);
+        EncoderPool::instance().configure(encoders, cpus);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "uplink audio is encoded by %d threads%s%s\n",
+                          encoders, cpus.empty() ? "" : ", pinned to cpus ", cpus.empty() ? "" : encoder_cpus);
+    }
+
+    const char *io_threads = switch_core_get_variable("openai_audio_stream_io_threads");
+    int threads = io_threads ? atoi(io_threads) : 0;
+    if (threads <= 0) {
+        return; // one websocket thread per stream
+    }
+
+    const char *io_cpus = switch_core_get_variable("openai_audio_stream_io_cpus");
+    const std::vector<int> cpus = parse_cpu_list(io_cpus);
+    ws_event_loop_configure(threads, cpus);
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE,
+                      "websocket connections share %d event loop threads%s%s\n", threads,
+                      cpus.empty() ? "" : ", pinned to cpus ", cpus.empty() ? "" : io_cpus);
+}
+
+void stream_module_shutdown(void) {
+    // streams still closing release their streamer, and with it their debug files, before the writer stops
+    ws_connection_pool_shutdown();
+    EncoderPool::instance().shutdown();
+    TeardownQueue::instance().shutdown();
+    ws_event_loop_shutdown();
+    DebugAudioWriter::instance().shutdown();
 }
 
 switch_status_t stream_session_cleanup(switch_core_session_t *session, char *text, int channelIsClosing) {
@@ -1272,6 +2251,17 @@ switch_status_t stream_session_cleanup(switch_core_session_t *session, char *tex
         strncpy(sessionId, tech_pvt->sessionId, MAX_SESSION_ID - 1);
         sessionId[MAX_SESSION_ID - 1] = '\0';
 
+        auto *audioStreamer = static_cast<AudioStreamer *>(tech_pvt->pAudioStreamer);
+        if (audioStreamer) {
+            audioStreamer->detachSession();
+        }
+
+        // waits for a frame being streamed, the uplink owner stays out from here on
+        auto *bufs = static_cast<StreamBuffers *>(tech_pvt->stream_buffers);
+        if (bufs) {
+            bufs->uplink.close();
+        }
+
         switch_mutex_lock(tech_pvt->mutex);
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%s) stream_session_cleanup\n",
                           sessionId);
@@ -1281,9 +2271,18 @@ switch_status_t stream_session_cleanup(switch_core_session_t *session, char *tex
             switch_core_media_bug_remove(session, &bug);
         }
 
-        auto *audioStreamer = static_cast<AudioStreamer *>(tech_pvt->pAudioStreamer);
         if (audioStreamer) {
+            audioStreamer->logDownlinkCopies();
+#ifndef NDEBUG
+            check_arena(sessionId, "websocket", audioStreamer->arena());
+            if (const AudioArena *decode_arena = audioStreamer->decode_arena()) {
+                check_arena(sessionId, "decode", *decode_arena);
+            }
+#endif
             audioStreamer->deleteFiles();
+            if (bufs) {
+                send_waiting_texts(audioStreamer, bufs);
+            }
             if (text && *text) {
                 stream_session_send_json(session, text);
             }
@@ -12,8 +12,13 @@ switch_status_t stream_session_init(switch_core_session_t *session, responseHand
                                     uint32_t samples_per_second, char *wsUri, int sampling, int playback_sampling,
                                     int channels, switch_bool_t start_muted, switch_bool_t force_raw_audio_mode,
                                     void **ppUserData);
+switch_status_t stream_session_connect(switch_core_session_t *session);
 switch_bool_t stream_frame(switch_media_bug_t *bug);
 switch_bool_t write_frame(switch_core_session_t *session, switch_media_bug_t *bug);
 switch_status_t stream_session_cleanup(switch_core_session_t *session, char *text, int channelIsClosing);
+switch_status_t stream_session_stats(switch_core_session_t *session, switch_stream_handle_t *stream);
+void stream_module_init(void);
+void stream_module_stats(switch_stream_handle_t *stream);
+void stream_module_shutdown(void);
 
 #endif // OPENAI_AUDIO_STREAMER_GLUE_H
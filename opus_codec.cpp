@@ -0,0 +1,211 @@
+#include "opus_codec.h"
+
+#ifdef HAVE_OPUS
+#include <opus.h>
+#endif
+
+namespace {
+
+const uint32_t MAX_PACKET_MS = 120; // longest duration an Opus packet can carry
+const size_t MAX_FRAME_BYTES = 1275;
+
+#ifndef HAVE_OPUS
+const char kNoOpus[] = "built without Opus support";
+#endif
+
+} // namespace
+
+bool opus_available() {
+#ifdef HAVE_OPUS
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool opus_rate_supported(uint32_t rate) {
+    return rate == 8000 || rate == 12000 || rate == 16000 || rate == 24000 || rate == 48000;
+}
+
+#ifdef HAVE_OPUS
+
+OpusPacketEncoder::OpusPacketEncoder(uint32_t rate, uint32_t channels, const OpusOptions& options)
+    : m_channels(channels) {
+    if (!opus_rate_supported(rate) || channels < 1 || channels > 2) {
+        m_init_error = "unsupported sample rate or channel count";
+        return;
+    }
+    const uint32_t frame_ms = options.frame_ms;
+    if (frame_ms != 10 && frame_ms != 20 && frame_ms != 40 && frame_ms != 60) {
+        m_init_error = "unsupported frame duration";
+        return;
+    }
+
+    int err = OPUS_OK;
+    OpusEncoder *encoder = opus_encoder_create(static_cast<opus_int32>(rate), static_cast<int>(channels),
+                                               OPUS_APPLICATION_VOIP, &err);
+    if (err != OPUS_OK) {
+        m_init_error = opus_strerror(err);
+        return;
+    }
+    m_encoder = encoder;
+    if (opus_encoder_ctl(encoder, OPUS_SET_BITRATE(static_cast<opus_int32>(options.bitrate))) != OPUS_OK) {
+        m_init_error = "unsupported bitrate";
+        return;
+    }
+    m_repacketizer = opus_repacketizer_create();
+    if (!m_repacketizer) {
+        m_init_error = opus_strerror(OPUS_ALLOC_FAIL);
+        return;
+    }
+
+    m_frame_samples = static_cast<size_t>(rate) * frame_ms / 1000 * channels;
+    m_frames_per_packet = MAX_PACKET_MS / frame_ms;
+    m_pending.reserve(m_frame_samples);
+}
+
+OpusPacketEncoder::~OpusPacketEncoder() {
+    if (m_repacketizer) {
+        opus_repacketizer_destroy(static_cast<OpusRepacketizer *>(m_repacketizer));
+    }
+    if (m_encoder) {
+        opus_encoder_destroy(static_cast<OpusEncoder *>(m_encoder));
+    }
+}
+
+size_t OpusPacketEncoder::encode(const int16_t *pcm, size_t samples) {
+    m_packets.clear();
+    m_out.clear();
+    if (m_init_error) {
+        return 0;
+    }
+
+    const size_t frames = (m_pending.size() + samples) / m_frame_samples;
+    // the repacketizer keeps pointers into the frames until the packet is out, so reserve them all up front
+    m_frames.resize(frames * MAX_FRAME_BYTES);
+    OpusEncoder *encoder = static_cast<OpusEncoder *>(m_encoder);
+    OpusRepacketizer *repacketizer = static_cast<OpusRepacketizer *>(m_repacketizer);
+    opus_repacketizer_init(repacketizer);
+    m_packet_frames = 0;
+
+    for (size_t i = 0; i < frames; i++) {
+        // a frame starts with what the last call left, otherwise it is read in place
+        const int16_t *frame = pcm;
+        if (!m_pending.empty()) {
+            const size_t missing = m_frame_samples - m_pending.size();
+            m_pending.insert(m_pending.end(), pcm, pcm + missing);
+            pcm += missing;
+            samples -= missing;
+            frame = m_pending.data();
+        } else {
+            pcm += m_frame_samples;
+            samples -= m_frame_samples;
+        }
+
+        unsigned char *data = &m_frames[i * MAX_FRAME_BYTES];
+        const opus_int32 len = opus_encode(encoder, frame, static_cast<int>(m_frame_samples / m_channels), data,
+                                           static_cast<opus_int32>(MAX_FRAME_BYTES));
+        m_pending.clear();
+        if (len < 0) {
+            m_errors++;
+            continue;
+        }
+
+        if (m_packet_frames == m_frames_per_packet) {
+            flush_packet();
+        }
+        if (opus_repacketizer_cat(repacketizer, data, len) != OPUS_OK) {
+            // the encoder switched mode or bandwidth, frames of a packet must all share one
+            flush_packet();
+            if (opus_repacketizer_cat(repacketizer, data, len) != OPUS_OK) {
+                m_errors++;
+                continue;
+            }
+        }
+        m_packet_frames++;
+    }
+    flush_packet();
+
+    m_pending.insert(m_pending.end(), pcm, pcm + samples);
+    return m_packets.size();
+}
+
+void OpusPacketEncoder::flush_packet() {
+    OpusRepacketizer *repacketizer = static_cast<OpusRepacketizer *>(m_repacketizer);
+    if (m_packet_frames > 0) {
+        const size_t offset = m_out.size();
+        const size_t max_len = m_packet_frames * (MAX_FRAME_BYTES + 2) + 2;
+        m_out.resize(offset + max_len);
+        const opus_int32 len =
+            opus_repacketizer_out(repacketizer, &m_out[offset], static_cast<opus_int32>(max_len));
+        if (len > 0) {
+            m_out.resize(offset + len);
+            m_packets.push_back(std::make_pair(offset, static_cast<size_t>(len)));
+        } else {
+            m_out.resize(offset);
+            m_errors++;
+        }
+    }
+    opus_repacketizer_init(repacketizer);
+    m_packet_frames = 0;
+}
+
+OpusPacketDecoder::OpusPacketDecoder(uint32_t rate) {
+    if (!opus_rate_supported(rate)) {
+        m_init_error = "unsupported sample rate";
+        return;
+    }
+    int err = OPUS_OK;
+    OpusDecoder *decoder = opus_decoder_create(static_cast<opus_int32>(rate), 1, &err);
+    if (err != OPUS_OK) {
+        m_init_error = opus_strerror(err);
+        return;
+    }
+    m_decoder = decoder;
+    m_pcm.resize(static_cast<size_t>(rate) * MAX_PACKET_MS / 1000);
+}
+
+OpusPacketDecoder::~OpusPacketDecoder() {
+    if (m_decoder) {
+        opus_decoder_destroy(static_cast<OpusDecoder *>(m_decoder));
+    }
+}
+
+int OpusPacketDecoder::decode(const uint8_t *packet, size_t len) {
+    if (m_init_error) {
+        return OPUS_INVALID_STATE;
+    }
+    return opus_decode(static_cast<OpusDecoder *>(m_decoder), packet, static_cast<opus_int32>(len), m_pcm.data(),
+                       static_cast<int>(m_pcm.size()), 0);
+}
+
+const char *opus_error_string(int error) {
+    return opus_strerror(error);
+}
+
+#else // HAVE_OPUS
+
+OpusPacketEncoder::OpusPacketEncoder(uint32_t, uint32_t channels, const OpusOptions&)
+    : m_init_error(kNoOpus), m_channels(channels) {}
+
+OpusPacketEncoder::~OpusPacketEncoder() {}
+
+size_t OpusPacketEncoder::encode(const int16_t *, size_t) {
+    return 0;
+}
+
+void OpusPacketEncoder::flush_packet() {}
+
+OpusPacketDecoder::OpusPacketDecoder(uint32_t) : m_init_error(kNoOpus) {}
+
+OpusPacketDecoder::~OpusPacketDecoder() {}
+
+int OpusPacketDecoder::decode(const uint8_t *, size_t) {
+    return -1;
+}
+
+const char *opus_error_string(int) {
+    return kNoOpus;
+}
+
+#endif // HAVE_OPUS
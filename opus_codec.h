@@ -0,0 +1,107 @@
+#ifndef OPUS_CODEC_H
+#define OPUS_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+//
+// Opus stage of the raw audio mode: PCM16 in, one Opus packet per binary
+// websocket message out, and back.
+//
+// The encoder cuts its input in frames of a fixed duration, keeping the
+// remainder for the next call, so it accepts whatever the uplink batches
+// (20 ms frames or STREAM_BUFFER_SIZE worth of them). All the frames one call
+// completes are merged into a single packet, up to the 120 ms a packet can
+// hold, so batching still gives one message per batch.
+//
+// Built against libopus when HAVE_OPUS is defined. Without it both sides
+// report an init error and opus_available() returns false.
+//
+struct OpusOptions {
+    int bitrate = 32000;     // bits per second, 6000 to 510000
+    uint32_t frame_ms = 20;  // 10, 20, 40 or 60
+};
+
+// True if the module was built with libopus.
+bool opus_available();
+
+// True if Opus can run at this sample rate (8, 12, 16, 24 or 48 kHz).
+bool opus_rate_supported(uint32_t rate);
+
+class OpusPacketEncoder {
+  public:
+    OpusPacketEncoder(uint32_t rate, uint32_t channels, const OpusOptions& options);
+    ~OpusPacketEncoder();
+
+    OpusPacketEncoder(const OpusPacketEncoder&) = delete;
+    OpusPacketEncoder& operator=(const OpusPacketEncoder&) = delete;
+
+    // Why the encoder could not start, nullptr when it is ready.
+    const char *init_error() const {
+        return m_init_error;
+    }
+
+    // Takes samples interleaved PCM16 samples (all channels counted) and encodes every
+    // frame they complete. Returns the number of packets ready, read with packet(); they
+    // stay valid until the next call.
+    size_t encode(const int16_t *pcm, size_t samples);
+
+    const uint8_t *packet(size_t index, size_t *len) const {
+        *len = m_packets[index].second;
+        return m_out.data() + m_packets[index].first;
+    }
+
+    // Encoder errors since the start, the frames concerned are dropped.
+    uint64_t errors() const {
+        return m_errors;
+    }
+
+  private:
+    void flush_packet();
+
+    const char *m_init_error = nullptr;
+    void *m_encoder = nullptr;      // OpusEncoder
+    void *m_repacketizer = nullptr; // OpusRepacketizer
+    uint32_t m_channels;
+    size_t m_frame_samples = 0; // per frame, all channels
+    uint32_t m_frames_per_packet = 1;
+    uint32_t m_packet_frames = 0; // frames merged in the packet being built
+    std::vector<int16_t> m_pending; // start of the next frame
+    std::vector<uint8_t> m_frames;  // encoded frames of the current call, read by the repacketizer
+    std::vector<uint8_t> m_out;
+    std::vector<std::pair<size_t, size_t>> m_packets; // offset and length in m_out
+    uint64_t m_errors = 0;
+};
+
+class OpusPacketDecoder {
+  public:
+    // Mono output at rate.
+    explicit OpusPacketDecoder(uint32_t rate);
+    ~OpusPacketDecoder();
+
+    OpusPacketDecoder(const OpusPacketDecoder&) = delete;
+    OpusPacketDecoder& operator=(const OpusPacketDecoder&) = delete;
+
+    const char *init_error() const {
+        return m_init_error;
+    }
+
+    // Decodes one packet into pcm(). Returns the samples decoded, or a negative
+    // Opus error code, see opus_error_string().
+    int decode(const uint8_t *packet, size_t len);
+
+    const int16_t *pcm() const {
+        return m_pcm.data();
+    }
+
+  private:
+    const char *m_init_error = nullptr;
+    void *m_decoder = nullptr; // OpusDecoder
+    std::vector<int16_t> m_pcm;
+};
+
+const char *opus_error_string(int error);
+
+#endif // OPUS_CODEC_H
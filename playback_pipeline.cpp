@@ -0,0 +1,240 @@
+#include "playback_pipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "base64_simd.h"
+
+namespace {
+
+// the jitter estimate moves a quarter of the way down to the last response's value
+const uint32_t JITTER_DECAY_SHIFT = 2;
+
+// G.711 is expanded this many samples at a time ahead of the resampler, 60 ms at 8 kHz
+const size_t G711_BLOCK_SAMPLES = 480;
+
+int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+uint32_t ms_to_samples(uint32_t ms, uint32_t rate) {
+    return static_cast<uint32_t>(static_cast<uint64_t>(ms) * rate / 1000);
+}
+
+} // namespace
+
+PlaybackPipeline::PlaybackPipeline(uint32_t server_rate, uint32_t channel_rate, uint32_t queue_ms, StreamStats *stats,
+                                   const PlayoutConfig& playout, const ResamplerOptions& resampler)
+    : m_server_rate(server_rate), m_channel_rate(channel_rate),
+      m_ring(static_cast<size_t>(channel_rate) * queue_ms / 1000), m_stats(stats),
+      m_prebuffer(std::min<uint32_t>(ms_to_samples(playout.prebuffer_ms, channel_rate), m_ring.capacity() / 2)),
+      m_max_target(std::min<uint32_t>(std::max(ms_to_samples(playout.max_ms, channel_rate), m_prebuffer),
+                                      m_ring.capacity() / 2)) {
+    if (server_rate != channel_rate) {
+        m_resampler.reset(new AudioResampler(1, server_rate, channel_rate, resampler));
+    }
+    m_stats->sample_rate.store(channel_rate, std::memory_order_relaxed);
+    m_stats->playback_capacity_samples.store(static_cast<uint32_t>(m_ring.capacity()), std::memory_order_relaxed);
+    publish_target();
+}
+
+PlaybackPipeline::~PlaybackPipeline() = default;
+
+// Copy accounting: every pass that moves PCM from one buffer to another adds the bytes it
+// moved, samples counts the audio queued for playback (at the channel rate).
+void PlaybackPipeline::account(size_t copied_samples, size_t queued_samples) {
+    if (queued_samples > 0) {
+        arrived(queued_samples);
+    }
+    m_stats->add(m_stats->downlink_bytes_copied, copied_samples * sizeof(int16_t));
+    m_stats->add(m_stats->downlink_samples, queued_samples);
+    m_stats->playback_queue_samples.store(static_cast<uint32_t>(m_ring.size_approx()), std::memory_order_relaxed);
+}
+
+PlaybackPipeline::PushResult PlaybackPipeline::push_pcm(const uint8_t *pcm, size_t len) {
+    // PCM16 requires 2-byte aligned input; truncate any trailing odd byte
+    return push_samples(reinterpret_cast<const int16_t *>(pcm), len / sizeof(int16_t));
+}
+
+PlaybackPipeline::PushResult PlaybackPipeline::push_g711(G711Law law, const uint8_t *data, size_t len) {
+    PushResult result = {0, 0, RESAMPLER_ERR_SUCCESS};
+    if (m_resampler) {
+        // a block at a time on the stack, the resampler carries its state from one block to the next
+        int16_t block[G711_BLOCK_SAMPLES];
+        for (size_t done = 0; done < len;) {
+            const size_t n = std::min(len - done, G711_BLOCK_SAMPLES);
+            g711_decode(law, data + done, n, block);
+            done += n;
+            if (!resample(block, n, &result)) {
+                result.dropped += len - done; // the queue is full, or the resampler failed
+                break;
+            }
+        }
+        m_stats->add(m_stats->downlink_bytes_copied, len * sizeof(int16_t));
+        m_stats->add(m_stats->downlink_dropped_samples, result.dropped);
+        account(result.queued, result.queued);
+        return result;
+    }
+
+    // expanded straight into the ring's free space, wrapping into the second region if needed
+    int16_t *region[2];
+    size_t region_len[2];
+    m_ring.write_regions(&region[0], &region_len[0], &region[1], &region_len[1]);
+    for (int i = 0; i < 2 && result.queued < len; i++) {
+        const size_t n = std::min(region_len[i], len - result.queued);
+        g711_decode(law, data + result.queued, n, region[i]);
+        result.queued += n;
+    }
+    m_ring.commit(result.queued);
+    result.dropped = len - result.queued;
+
+    m_stats->add(m_stats->downlink_dropped_samples, result.dropped);
+    account(result.queued, result.queued);
+    return result;
+}
+
+PlaybackPipeline::PushResult PlaybackPipeline::push_samples(const int16_t *in, size_t in_samples) {
+    PushResult result = {0, 0, RESAMPLER_ERR_SUCCESS};
+    if (in_samples == 0) {
+        return result;
+    }
+
+    if (!m_resampler) {
+        result.queued = m_ring.write(in, in_samples);
+        result.dropped = in_samples - result.queued;
+    } else {
+        resample(in, in_samples, &result);
+    }
+
+    m_stats->add(m_stats->downlink_dropped_samples, result.dropped);
+    account(result.queued, result.queued);
+    return result;
+}
+
+// The resampler fills the ring's free space directly, wrapping into the second region if needed. Adds
+// to *result what was queued and the input that did not fit; false if some did not, or on error.
+bool PlaybackPipeline::resample(const int16_t *in, size_t in_samples, PushResult *result) {
+    int16_t *region[2];
+    size_t region_len[2];
+    m_ring.write_regions(&region[0], &region_len[0], &region[1], &region_len[1]);
+
+    size_t consumed = 0;
+    size_t queued = 0;
+    for (int i = 0; i < 2 && consumed < in_samples && region_len[i] > 0; i++) {
+        uint32_t in_len = static_cast<uint32_t>(std::min<size_t>(in_samples - consumed, UINT32_MAX));
+        uint32_t out_len = static_cast<uint32_t>(std::min<size_t>(region_len[i], UINT32_MAX));
+        result->error = m_resampler->process(in + consumed, &in_len, region[i], &out_len);
+        if (result->error != RESAMPLER_ERR_SUCCESS) {
+            break;
+        }
+        consumed += in_len;
+        queued += out_len;
+    }
+    m_ring.commit(queued);
+    result->queued += queued;
+    result->dropped += in_samples - consumed;
+    return consumed == in_samples;
+}
+
+bool PlaybackPipeline::push_base64_in_place(const char *b64, size_t len, bool *ok, size_t *samples) {
+    if (m_resampler) {
+        return false;
+    }
+    int16_t *first, *second;
+    size_t first_len, second_len;
+    m_ring.write_regions(&first, &first_len, &second, &second_len);
+    if (first_len * sizeof(int16_t) < base64_decoded_max_size(len)) {
+        return false;
+    }
+
+    size_t decoded = 0;
+    *ok = base64_decode_into(b64, len, reinterpret_cast<unsigned char *>(first), &decoded);
+    *samples = *ok ? decoded / sizeof(int16_t) : 0;
+    m_ring.commit(*samples);
+    account(*samples, *samples);
+    return true;
+}
+
+size_t PlaybackPipeline::pop(int16_t *out, size_t count) {
+    size_t read = m_ring.read(out, count);
+    m_stats->add(m_stats->downlink_bytes_copied, read * sizeof(int16_t));
+    m_stats->playback_queue_samples.store(static_cast<uint32_t>(m_ring.read_available()), std::memory_order_relaxed);
+    return read;
+}
+
+// Lateness of a delta: how long after its first sample would have been due, had the response
+// been played in real time from the arrival of its first delta. Playing that much later avoids
+// every gap the response had.
+void PlaybackPipeline::arrived(size_t samples) {
+    const int64_t now = now_us();
+    if (!m_in_response) {
+        m_in_response = true;
+        m_response_start_us = now;
+        m_response_samples = 0;
+        m_response_jitter = 0;
+    }
+
+    const int64_t due_us = m_response_start_us + static_cast<int64_t>(m_response_samples * 1000000 / m_channel_rate);
+    if (now > due_us) {
+        uint64_t late = static_cast<uint64_t>(now - due_us) * m_channel_rate / 1000000;
+        uint32_t late_samples = static_cast<uint32_t>(std::min<uint64_t>(late, UINT32_MAX));
+        m_response_jitter = std::max(m_response_jitter, late_samples);
+        if (late_samples > m_jitter) {
+            m_jitter = late_samples; // raised at once, the next underrun may be a frame away
+            publish_target();
+        }
+    }
+    m_response_samples += samples;
+}
+
+void PlaybackPipeline::end_response() {
+    if (!m_in_response) {
+        return;
+    }
+    m_in_response = false;
+    if (m_jitter > m_response_jitter) {
+        m_jitter -= (m_jitter - m_response_jitter + (1u << JITTER_DECAY_SHIFT) - 1) >> JITTER_DECAY_SHIFT;
+        publish_target();
+    }
+}
+
+void PlaybackPipeline::publish_target() {
+    uint32_t target = std::min(std::max(m_prebuffer, m_jitter), m_max_target);
+    m_target.store(target, std::memory_order_relaxed);
+    m_stats->playout_target_samples.store(target, std::memory_order_relaxed);
+}
+
+void PlaybackPipeline::clear() {
+    m_ring.discard_all();
+    m_clears.fetch_add(1, std::memory_order_release);
+    end_response();
+}
+
+size_t PlaybackPipeline::playout(int16_t *out, size_t count, bool response_done) {
+    const uint32_t clears = m_clears.load(std::memory_order_acquire);
+    if (clears != m_seen_clears) {
+        m_seen_clears = clears; // barge-in, whatever was playing is gone
+        m_playing = false;
+    }
+
+    if (!m_playing) {
+        const size_t available = m_ring.read_available();
+        if (available == 0 || (available < m_target.load(std::memory_order_relaxed) && !response_done)) {
+            return 0;
+        }
+        m_playing = true;
+    }
+
+    size_t samples = pop(out, count);
+    if (samples < count) {
+        memset(out + samples, 0, (count - samples) * sizeof(int16_t));
+        m_playing = false;
+        if (!response_done) {
+            m_stats->add(m_stats->playback_underruns); // the server is late, wait for the target again
+        }
+    }
+    return samples;
+}
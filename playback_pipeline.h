@@ -0,0 +1,145 @@
+#ifndef PLAYBACK_PIPELINE_H
+#define PLAYBACK_PIPELINE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "audio_resampler.h"
+#include "g711.h"
+#include "spsc_ring.h"
+#include "stream_stats.h"
+
+//
+// Downlink half of a stream: PCM16 (or G.711) mono from the server goes in at
+// the server rate, samples at the channel rate come out for the write replace
+// frame.
+//
+// Samples are stored once, in a lock-free ring sized in milliseconds of channel
+// audio: the resampler writes straight into the ring's free space and the
+// consumer reads straight into the frame.
+//
+// Playout: a response starts playing once the queue holds the playout target,
+// the larger of the configured prebuffer and the arrival jitter observed so
+// far. Jitter is how late each delta arrives compared to a real time stream
+// that started with the first delta of its response; the highest value raises
+// the target at once and the target decays back at the end of each response.
+// When the queue runs dry mid-response the frame is completed with silence and
+// the response waits for the target again, instead of playing short frames.
+//
+// Producer methods belong to the thread decoding the downlink (the websocket
+// thread, or the stream's decode worker), consumer methods to the media
+// thread. Counters go to the given StreamStats, which must outlive the
+// pipeline.
+//
+struct PlayoutConfig {
+    uint32_t prebuffer_ms = 0; // minimum audio queued before a response starts playing
+    uint32_t max_ms = 200;     // cap of the adaptive target, prebuffer_ms or less keeps the target fixed
+};
+
+class PlaybackPipeline {
+  public:
+    struct PushResult {
+        size_t queued;  // samples added to the queue
+        size_t dropped; // input samples that did not fit
+        int error;      // speex error code, RESAMPLER_ERR_SUCCESS if none
+    };
+
+    PlaybackPipeline(uint32_t server_rate, uint32_t channel_rate, uint32_t queue_ms, StreamStats *stats,
+                     const PlayoutConfig& playout = PlayoutConfig(),
+                     const ResamplerOptions& resampler = ResamplerOptions());
+    ~PlaybackPipeline();
+
+    PlaybackPipeline(const PlaybackPipeline&) = delete;
+    PlaybackPipeline& operator=(const PlaybackPipeline&) = delete;
+
+    uint32_t server_rate() const {
+        return m_server_rate;
+    }
+    uint32_t channel_rate() const {
+        return m_channel_rate;
+    }
+    bool resampling() const {
+        return m_resampler != nullptr;
+    }
+    // resampler kernel name, nullptr without resampling
+    const char *resampler_kernel() const {
+        return m_resampler ? m_resampler->kernel() : nullptr;
+    }
+    size_t capacity() const {
+        return m_ring.capacity();
+    }
+
+    // Producer: queues len bytes of PCM16, resampling if needed. A trailing odd byte is ignored.
+    PushResult push_pcm(const uint8_t *pcm, size_t len);
+
+    // Producer: queues len bytes of G.711, expanded straight into the queue when there is no resampling,
+    // else a block at a time on the stack ahead of the resampler.
+    PushResult push_g711(G711Law law, const uint8_t *data, size_t len);
+
+    // Producer: decodes base64 PCM16 straight into the queue. Only possible without resampling
+    // and with enough contiguous free space; returns false, touching nothing, otherwise.
+    // When it returns true, *ok tells whether the text was valid base64 and *samples how many
+    // samples were queued.
+    bool push_base64_in_place(const char *b64, size_t len, bool *ok, size_t *samples);
+
+    // Producer: drops everything queued so far (barge-in); the consumer skips it on its next call.
+    void clear();
+
+    // Producer: the server sent the last audio of the response.
+    void end_response();
+
+    // Consumer: fills out with count samples once the response can play, completing with silence
+    // what the queue cannot fill. Returns the samples taken from the queue, 0 when there is
+    // nothing to play yet (out untouched).
+    size_t playout(int16_t *out, size_t count, bool response_done);
+
+    // Consumer: samples queued before a response starts playing.
+    uint32_t playout_target() const {
+        return m_target.load(std::memory_order_relaxed);
+    }
+
+    // Consumer: copies up to count samples into out, returns how many were copied.
+    size_t pop(int16_t *out, size_t count);
+
+    // Consumer: drops up to count samples, returns how many were dropped.
+    size_t skip(size_t count) {
+        return m_ring.skip(count);
+    }
+
+    // Consumer: samples ready to be played.
+    size_t available() {
+        return m_ring.read_available();
+    }
+
+  private:
+    PushResult push_samples(const int16_t *in, size_t in_samples);
+    bool resample(const int16_t *in, size_t in_samples, PushResult *result);
+    void account(size_t copied_samples, size_t queued_samples);
+    void arrived(size_t samples);
+    void publish_target();
+
+    const uint32_t m_server_rate;
+    const uint32_t m_channel_rate;
+    std::unique_ptr<AudioResampler> m_resampler;
+    SpscRing<int16_t> m_ring;
+    StreamStats *m_stats;
+
+    // playout, the target and the clear count are the only state shared by both sides
+    const uint32_t m_prebuffer;  // samples
+    const uint32_t m_max_target; // samples
+    std::atomic<uint32_t> m_target{0};
+    std::atomic<uint32_t> m_clears{0};
+    // producer
+    bool m_in_response = false;
+    int64_t m_response_start_us = 0;
+    uint64_t m_response_samples = 0;
+    uint32_t m_response_jitter = 0; // samples, highest lateness of the current response
+    uint32_t m_jitter = 0;          // samples, running estimate
+    // consumer
+    bool m_playing = false;
+    uint32_t m_seen_clears = 0;
+};
+
+#endif // PLAYBACK_PIPELINE_H
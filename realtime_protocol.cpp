@@ -0,0 +1,363 @@
+#include "realtime_protocol.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+#include "base64_simd.h"
+
+namespace {
+
+const char kAudioAppendPrefix[] = "{\"type\":\"input_audio_buffer.append\",\"audio\":\"";
+const char kAudioAppendSuffix[] = "\"}";
+
+const size_t kAudioAppendPrefixLen = sizeof(kAudioAppendPrefix) - 1;
+const size_t kAudioAppendSuffixLen = sizeof(kAudioAppendSuffix) - 1;
+
+const size_t kMaxNesting = 256;
+
+// below this a payload costs less than the metadata replacing it
+const size_t kMinStrippedValue = 128;
+
+struct EventName {
+    const char *name;
+    size_t len;
+    realtime_event_t event;
+};
+
+#define EVENT_NAME(str, event) {str, sizeof(str) - 1, event}
+
+const EventName kEventNames[] = {
+    EVENT_NAME("response.output_audio.delta", REALTIME_EVENT_AUDIO_DELTA),
+    EVENT_NAME("response.output_audio.done", REALTIME_EVENT_AUDIO_DONE),
+    EVENT_NAME("input_audio_buffer.speech_started", REALTIME_EVENT_SPEECH_STARTED),
+    EVENT_NAME("input_audio_buffer.speech_stopped", REALTIME_EVENT_SPEECH_STOPPED),
+};
+
+#undef EVENT_NAME
+
+inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+const char *skip_space(const char *p, const char *end) {
+    while (p < end && is_space(*p)) {
+        p++;
+    }
+    return p;
+}
+
+// p points at the opening quote. Returns the position after the closing quote,
+// or nullptr if the string is not terminated.
+const char *scan_string(const char *p, const char *end, bool *escaped) {
+    *escaped = false;
+    p++;
+    while (p < end) {
+        // memchr-style search for the next quote or backslash keeps long base64
+        // payloads on the fast path
+        const char *q = static_cast<const char *>(memchr(p, '"', end - p));
+        if (!q) {
+            return nullptr;
+        }
+        const char *b = static_cast<const char *>(memchr(p, '\\', q - p));
+        if (!b) {
+            return q + 1;
+        }
+        *escaped = true;
+        p = b + 2;
+    }
+    return nullptr;
+}
+
+// Skips any JSON value. p points at its first character.
+const char *skip_value(const char *p, const char *end) {
+    char stack[kMaxNesting];
+    size_t depth = 0;
+    bool escaped;
+
+    do {
+        p = skip_space(p, end);
+        if (p >= end) {
+            return nullptr;
+        }
+        switch (*p) {
+            case '"':
+                p = scan_string(p, end, &escaped);
+                if (!p) {
+                    return nullptr;
+                }
+                break;
+            case '{':
+            case '[':
+                if (depth == kMaxNesting) {
+                    return nullptr;
+                }
+                stack[depth++] = *p == '{' ? '}' : ']';
+                p = skip_space(p + 1, end);
+                if (p < end && *p == stack[depth - 1]) {
+                    depth--;
+                    p++;
+                    break;
+                }
+                if (stack[depth - 1] == '}') {
+                    // key of the first member
+                    if (p >= end || *p != '"' || !(p = scan_string(p, end, &escaped))) {
+                        return nullptr;
+                    }
+                    p = skip_space(p, end);
+                    if (p >= end || *p != ':') {
+                        return nullptr;
+                    }
+                    p++;
+                }
+                continue;
+            default: {
+                const char *start = p;
+                while (p < end && (isalnum(static_cast<unsigned char>(*p)) || *p == '-' || *p == '+' || *p == '.')) {
+                    p++;
+                }
+                if (p == start) {
+                    return nullptr;
+                }
+                break;
+            }
+        }
+
+        // after a value: separators and closing brackets of the enclosing containers
+        for (;;) {
+            p = skip_space(p, end);
+            if (depth == 0) {
+                return p;
+            }
+            if (p >= end) {
+                return nullptr;
+            }
+            if (*p == stack[depth - 1]) {
+                depth--;
+                p++;
+                continue;
+            }
+            if (*p != ',') {
+                return nullptr;
+            }
+            p = skip_space(p + 1, end);
+            if (stack[depth - 1] == '}') {
+                if (p >= end || *p != '"' || !(p = scan_string(p, end, &escaped))) {
+                    return nullptr;
+                }
+                p = skip_space(p, end);
+                if (p >= end || *p != ':') {
+                    return nullptr;
+                }
+                p++;
+            }
+            break;
+        }
+    } while (depth > 0);
+
+    return p;
+}
+
+inline bool key_equals(const char *key, size_t key_len, const char *name, size_t name_len) {
+    return key_len == name_len && memcmp(key, name, name_len) == 0;
+}
+
+realtime_event_t classify(const char *type, size_t len) {
+    for (const EventName& e : kEventNames) {
+        if (key_equals(type, len, e.name, e.len)) {
+            return e.event;
+        }
+    }
+    static const char kError[] = "error";
+    const size_t error_len = sizeof(kError) - 1;
+    for (size_t i = 0; i + error_len <= len; i++) {
+        if (memcmp(type + i, kError, error_len) == 0) {
+            return REALTIME_EVENT_ERROR;
+        }
+    }
+    return REALTIME_EVENT_OTHER;
+}
+
+} // namespace
+
+size_t realtime_audio_append_size(size_t len) {
+    return kAudioAppendPrefixLen + base64_encoded_size(len) + kAudioAppendSuffixLen;
+}
+
+size_t realtime_write_audio_append(const uint8_t *audio, size_t len, char *dst) {
+    char *out = dst;
+    memcpy(out, kAudioAppendPrefix, kAudioAppendPrefixLen);
+    out += kAudioAppendPrefixLen;
+    out += base64_encode_into(audio, len, out);
+    memcpy(out, kAudioAppendSuffix, kAudioAppendSuffixLen);
+    out += kAudioAppendSuffixLen;
+    return out - dst;
+}
+
+bool realtime_scan_message(const char *json, size_t len, realtime_message_t *msg) {
+    const char *p = json;
+    const char *end = json + len;
+    bool escaped;
+    bool seen_type = false;
+    bool seen_delta = false;
+
+    memset(msg, 0, sizeof(*msg));
+
+    p = skip_space(p, end);
+    if (p >= end || *p != '{') {
+        return false;
+    }
+    p = skip_space(p + 1, end);
+    if (p < end && *p == '}') {
+        return true;
+    }
+
+    for (;;) {
+        if (p >= end || *p != '"') {
+            return false;
+        }
+        const char *key = p + 1;
+        p = scan_string(p, end, &escaped);
+        if (!p) {
+            return false;
+        }
+        const size_t key_len = (p - 1) - key;
+        p = skip_space(p, end);
+        if (p >= end || *p != ':') {
+            return false;
+        }
+        p = skip_space(p + 1, end);
+        if (p >= end) {
+            return false;
+        }
+
+        // like cJSON lookups, only the first occurrence of a key counts
+        const bool is_type = !seen_type && key_equals(key, key_len, "type", 4);
+        const bool is_delta = !seen_delta && key_equals(key, key_len, "delta", 5);
+        seen_type = seen_type || is_type;
+        seen_delta = seen_delta || is_delta;
+        if ((is_type || is_delta) && *p == '"') {
+            const char *value = p + 1;
+            p = scan_string(p, end, &escaped);
+            if (!p) {
+                return false;
+            }
+            if (is_type) {
+                msg->type = value;
+                msg->type_len = (p - 1) - value;
+            } else {
+                msg->delta = value;
+                msg->delta_len = (p - 1) - value;
+                msg->delta_escaped = escaped;
+            }
+        } else {
+            p = skip_value(p, end);
+            if (!p) {
+                return false;
+            }
+        }
+
+        p = skip_space(p, end);
+        if (p >= end) {
+            return false;
+        }
+        if (*p == '}') {
+            break;
+        }
+        if (*p != ',') {
+            return false;
+        }
+        p = skip_space(p + 1, end);
+    }
+
+    // anything after the closing brace is ignored, as cJSON_Parse() does
+    msg->event = msg->type ? classify(msg->type, msg->type_len) : REALTIME_EVENT_OTHER;
+    return true;
+}
+
+namespace {
+
+// Bytes carried by a base64 string of len characters, escaped ones counted once.
+size_t base64_payload_bytes(const char *value, size_t len) {
+    size_t chars = len;
+    for (const char *b = value; (b = static_cast<const char *>(memchr(b, '\\', value + len - b))); b += 2) {
+        chars--;
+    }
+    while (chars > 0 && (value[len - 1] == '=' || value[len - 1] == '.')) {
+        chars--;
+        len--;
+    }
+    return chars / 4 * 3 + (chars % 4 ? chars % 4 - 1 : 0);
+}
+
+inline bool ends_with(const char *s, size_t len, const char *suffix, size_t suffix_len) {
+    return len >= suffix_len && memcmp(s + len - suffix_len, suffix, suffix_len) == 0;
+}
+
+} // namespace
+
+size_t realtime_strip_audio(const char *json, size_t len, uint32_t bytes_per_second, char *dst) {
+    realtime_message_t msg;
+    if (!realtime_scan_message(json, len, &msg)) {
+        return 0;
+    }
+    static const char kAudioDelta[] = "audio.delta";
+    const bool strip_delta = msg.type && ends_with(msg.type, msg.type_len, kAudioDelta, sizeof(kAudioDelta) - 1);
+
+    const char *p = json;
+    const char *end = json + len;
+    const char *copied = json; // input up to here is already in dst
+    char *out = dst;
+    const char *key = nullptr;
+    size_t key_len = 0;
+    size_t stripped = 0;
+    bool escaped;
+
+    while (p < end) {
+        const char *q = static_cast<const char *>(memchr(p, '"', end - p));
+        if (!q) {
+            break;
+        }
+        const char *after = scan_string(q, end, &escaped);
+        if (!after) {
+            return 0;
+        }
+        const char *next = skip_space(after, end);
+        if (next < end && *next == ':') {
+            // a key: remember it if its value follows right away
+            key = q + 1;
+            key_len = (after - 1) - key;
+            p = skip_space(next + 1, end);
+            if (p >= end || *p != '"') {
+                key = nullptr;
+            }
+            continue;
+        }
+
+        const char *value = q + 1;
+        const size_t value_len = (after - 1) - value;
+        const bool audio_key =
+            key && (key_equals(key, key_len, "audio", 5) || (strip_delta && key_equals(key, key_len, "delta", 5)));
+        const bool strip = audio_key && value_len >= kMinStrippedValue;
+        if (strip) {
+            const size_t bytes = base64_payload_bytes(value, value_len);
+            const unsigned long long ms = bytes_per_second ? bytes * 1000ULL / bytes_per_second : 0;
+            memcpy(out, copied, q - copied);
+            out += q - copied;
+            out += sprintf(out, "\"\",\"%.*s_bytes\":%zu,\"%.*s_ms\":%llu", static_cast<int>(key_len), key, bytes,
+                           static_cast<int>(key_len), key, ms);
+            copied = after;
+            stripped++;
+        }
+        key = nullptr;
+        p = after;
+    }
+
+    if (stripped == 0) {
+        return 0;
+    }
+    memcpy(out, copied, end - copied);
+    out += end - copied;
+    *out = '\0';
+    return out - dst;
+}
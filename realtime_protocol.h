@@ -0,0 +1,59 @@
+#ifndef REALTIME_PROTOCOL_H
+#define REALTIME_PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+//
+// Wire-format helpers for the OpenAI Realtime protocol. These work on plain
+// buffers and do not depend on FreeSWITCH.
+//
+
+// Exact size of the input_audio_buffer.append message carrying len audio bytes.
+size_t realtime_audio_append_size(size_t len);
+
+// Writes {"type":"input_audio_buffer.append","audio":"<base64>"} into dst, which
+// must hold realtime_audio_append_size(len) bytes. No terminating NUL is written.
+// Returns the number of bytes written.
+size_t realtime_write_audio_append(const uint8_t *audio, size_t len, char *dst);
+
+// Server events the module acts upon, everything else is REALTIME_EVENT_OTHER.
+enum realtime_event_t {
+    REALTIME_EVENT_OTHER,
+    REALTIME_EVENT_ERROR, // any type containing "error"
+    REALTIME_EVENT_SPEECH_STARTED,
+    REALTIME_EVENT_SPEECH_STOPPED,
+    REALTIME_EVENT_AUDIO_DELTA,
+    REALTIME_EVENT_AUDIO_DONE
+};
+
+// Result of realtime_scan_message(). Spans point into the scanned buffer and
+// are not NUL terminated.
+struct realtime_message_t {
+    realtime_event_t event;
+    const char *type; // value of the top-level "type" string, nullptr if absent
+    size_t type_len;
+    const char *delta; // raw contents of the top-level "delta" string, nullptr if absent
+    size_t delta_len;
+    bool delta_escaped; // delta holds backslash escapes and cannot be used verbatim
+};
+
+// Single pass over a server message that classifies it by its "type" and locates
+// the "delta" string without building a DOM. Returns false if the text is not a
+// well-formed JSON object.
+bool realtime_scan_message(const char *json, size_t len, realtime_message_t *msg);
+
+// Copies a server message into dst with the base64 audio taken out, for event
+// consumers that do not need it. Every "audio" string value and, in audio delta
+// messages (type ending in "audio.delta"), every "delta" string value becomes ""
+// followed by two members giving the payload size, e.g.
+//   "delta":"","delta_bytes":4800,"delta_ms":100
+// with the duration computed from the audio's bytes_per_second (twice the sample
+// rate for PCM16 mono, the sample rate for G.711). Values shorter than
+// 128 characters are left alone, so the result is never longer than the input;
+// dst must hold len + 1 bytes and is NUL terminated.
+// Returns the length written, 0 if the text is not a well-formed JSON object or
+// contains nothing to strip (dst is then unspecified).
+size_t realtime_strip_audio(const char *json, size_t len, uint32_t bytes_per_second, char *dst);
+
+#endif // REALTIME_PROTOCOL_H
@@ -0,0 +1,100 @@
+#include "send_queue.h"
+
+#include <strings.h>
+
+bool send_overflow_policy_parse(const char *name, SendOverflowPolicy *policy) {
+    if (!strcasecmp(name, "drop")) {
+        *policy = SEND_OVERFLOW_DROP;
+    } else if (!strcasecmp(name, "merge")) {
+        *policy = SEND_OVERFLOW_MERGE;
+    } else if (!strcasecmp(name, "event")) {
+        *policy = SEND_OVERFLOW_EVENT;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+SendQueue::SendQueue(const SendQueueConfig& config, StreamStats *stats) : m_config(config), m_stats(stats) {}
+
+size_t SendQueue::push(const uint8_t *data, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    size_t dropped = 0;
+    if (m_bytes + len > m_config.capacity) {
+        if (m_config.policy == SEND_OVERFLOW_EVENT || len > m_config.capacity) {
+            overflow(len);
+            if (m_messages.empty()) {
+                m_overflowing = false; // nothing left to drain: the next drop is another backlog
+            }
+            return len;
+        }
+        dropped = make_room(len);
+    }
+
+    const bool merge = m_config.policy == SEND_OVERFLOW_MERGE && m_config.frame_bytes > 0;
+    if (merge && !m_messages.empty()) {
+        m_messages.back().insert(m_messages.back().end(), data, data + len);
+    } else {
+        if (m_spare.empty()) {
+            m_messages.emplace_back();
+        } else {
+            m_messages.push_back(std::move(m_spare.back()));
+            m_spare.pop_back();
+        }
+        m_messages.back().assign(data, data + len);
+    }
+    m_bytes += len;
+    m_stats->add(m_stats->uplink_queued_frames);
+    return dropped;
+}
+
+void SendQueue::pop() {
+    discard_front();
+    if (m_messages.empty()) {
+        m_overflowing = false;
+    }
+}
+
+void SendQueue::discard_front() {
+    std::vector<uint8_t>& message = m_messages.front();
+    m_bytes -= message.size();
+    message.clear();
+    m_spare.push_back(std::move(message));
+    m_messages.pop_front();
+}
+
+// Drops the oldest audio until len more bytes fit. Under the merge policy whole samples are
+// cut from the start of the merged message, otherwise whole messages go.
+size_t SendQueue::make_room(size_t len) {
+    size_t needed = m_bytes + len - m_config.capacity;
+    size_t dropped = 0;
+    while (needed > 0 && !m_messages.empty()) {
+        std::vector<uint8_t>& oldest = m_messages.front();
+        const size_t frame = m_config.frame_bytes;
+        if (m_config.policy == SEND_OVERFLOW_MERGE && frame > 0) {
+            const size_t cut = (needed + frame - 1) / frame * frame;
+            if (cut < oldest.size()) {
+                oldest.erase(oldest.begin(), oldest.begin() + cut);
+                m_bytes -= cut;
+                dropped += cut;
+                break;
+            }
+        }
+        const size_t size = oldest.size();
+        dropped += size;
+        needed -= size < needed ? size : needed;
+        discard_front();
+    }
+    overflow(dropped);
+    return dropped;
+}
+
+void SendQueue::overflow(size_t dropped) {
+    if (!m_overflowing) {
+        m_overflowing = true;
+        m_stats->add(m_stats->uplink_queue_overflows);
+    }
+    m_stats->add(m_stats->uplink_queue_dropped_bytes, dropped);
+}
@@ -0,0 +1,93 @@
+#ifndef SEND_QUEUE_H
+#define SEND_QUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "stream_stats.h"
+
+//
+// Bounded queue of uplink audio in front of the websocket. While the transport
+// has less than high_water bytes unsent, audio goes straight through; past it,
+// audio waits here instead of piling up in the transport, and is handed over
+// again once the socket drains. The queue never holds more than capacity bytes,
+// so the uplink delay and the memory of a session stay bounded however long
+// the link stalls. What happens to audio beyond that is the overflow policy.
+//
+// Messages are the audio payloads (PCM16, G.711 or Opus packets), not framed
+// yet. Media thread only, like the other uplink buffers.
+//
+enum SendOverflowPolicy {
+    SEND_OVERFLOW_DROP,  // the oldest audio makes room for the new one
+    SEND_OVERFLOW_MERGE, // waiting audio is merged into one message, its oldest samples make room
+    SEND_OVERFLOW_EVENT, // new audio is dropped while the queue is full; the stream signals it
+};
+
+// "drop", "merge" or "event"; false for anything else.
+bool send_overflow_policy_parse(const char *name, SendOverflowPolicy *policy);
+
+struct SendQueueConfig {
+    size_t capacity = 0;    // audio bytes waiting at most
+    size_t high_water = 0;  // bytes unsent in the transport from which audio waits here
+    size_t frame_bytes = 2; // bytes per sample of all channels, 0 when messages cannot be merged (Opus)
+    SendOverflowPolicy policy = SEND_OVERFLOW_DROP;
+};
+
+class SendQueue {
+  public:
+    SendQueue(const SendQueueConfig& config, StreamStats *stats);
+
+    SendQueue(const SendQueue&) = delete;
+    SendQueue& operator=(const SendQueue&) = delete;
+
+    const SendQueueConfig& config() const {
+        return m_config;
+    }
+
+    // True if audio must go through the queue, rather than straight to a transport with
+    // buffered bytes unsent: something is waiting already, or the transport is past the mark.
+    bool must_wait(size_t buffered) const {
+        return !m_messages.empty() || buffered >= m_config.high_water;
+    }
+
+    // Queues one message, applying the overflow policy. Returns the bytes dropped to keep
+    // the queue within its capacity, the new message's or older ones.
+    size_t push(const uint8_t *data, size_t len);
+
+    bool empty() const {
+        return m_messages.empty();
+    }
+
+    size_t bytes() const {
+        return m_bytes;
+    }
+
+    // True from the first drop until the queue is empty again, one backlog at a time.
+    bool overflowing() const {
+        return m_overflowing;
+    }
+
+    // Oldest message, valid until pop().
+    const uint8_t *front(size_t *len) const {
+        *len = m_messages.front().size();
+        return m_messages.front().data();
+    }
+
+    void pop();
+
+  private:
+    size_t make_room(size_t len);
+    void discard_front();
+    void overflow(size_t dropped);
+
+    const SendQueueConfig m_config;
+    StreamStats *m_stats;
+    std::deque<std::vector<uint8_t>> m_messages;
+    std::vector<std::vector<uint8_t>> m_spare; // popped messages, reused for their capacity
+    size_t m_bytes = 0;
+    bool m_overflowing = false;
+};
+
+#endif // SEND_QUEUE_H
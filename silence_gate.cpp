@@ -0,0 +1,175 @@
+#include "silence_gate.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+const double FULL_SCALE_SQUARE = 32768.0 * 32768.0;
+const double UNVOICED_MARGIN = 0.25; // 6 dB below the threshold
+const double UNVOICED_CROSSINGS = 0.25; // sign changes per sample of fricatives, voiced speech stays well below
+
+// Baseline SIMD only (SSE2 on x86-64, NEON on ARM): the windows are short and both loops are
+// bound by the loads, wider vectors would not pay for a runtime dispatch.
+
+uint64_t sum_squares(const int16_t *x, size_t n) {
+    uint64_t sum = 0;
+    size_t k = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    for (; k + 8 <= n; k += 8) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + k));
+        // each pair sums to at most 2^31, which only fits unsigned: widen before adding up
+        const __m128i sq = _mm_madd_epi16(v, v);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), acc);
+    sum = lanes[0] + lanes[1];
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    uint64x2_t acc = vdupq_n_u64(0);
+    for (; k + 8 <= n; k += 8) {
+        const int16x8_t v = vld1q_s16(x + k);
+        acc = vpadalq_u32(acc, vreinterpretq_u32_s32(vmull_s16(vget_low_s16(v), vget_low_s16(v))));
+        acc = vpadalq_u32(acc, vreinterpretq_u32_s32(vmull_s16(vget_high_s16(v), vget_high_s16(v))));
+    }
+    sum = vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+#endif
+    for (; k < n; k++) {
+        sum += static_cast<uint64_t>(static_cast<int32_t>(x[k]) * x[k]);
+    }
+    return sum;
+}
+
+// Sign changes between consecutive samples of the same channel, stride apart. n is at most
+// a window, so the 16-bit vector counters cannot overflow.
+size_t zero_crossings(const int16_t *x, size_t n, size_t stride) {
+    if (n <= stride) {
+        return 0;
+    }
+    const size_t pairs = n - stride;
+    size_t count = 0;
+    size_t k = 0;
+#if defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (; k + 8 <= pairs; k += 8) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + k));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + k + stride));
+        acc = _mm_sub_epi16(acc, _mm_srai_epi16(_mm_xor_si128(a, b), 15)); // -1 where the signs differ
+    }
+    acc = _mm_madd_epi16(acc, _mm_set1_epi16(1));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    count = static_cast<size_t>(_mm_cvtsi128_si32(acc));
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    int16x8_t acc = vdupq_n_s16(0);
+    for (; k + 8 <= pairs; k += 8) {
+        const int16x8_t a = vld1q_s16(x + k);
+        const int16x8_t b = vld1q_s16(x + k + stride);
+        acc = vsubq_s16(acc, vshrq_n_s16(veorq_s16(a, b), 15));
+    }
+    const int64x2_t wide = vpaddlq_s32(vpaddlq_s16(acc));
+    count = static_cast<size_t>(vgetq_lane_s64(wide, 0) + vgetq_lane_s64(wide, 1));
+#endif
+    for (; k < pairs; k++) {
+        count += (x[k] ^ x[k + stride]) < 0;
+    }
+    return count;
+}
+
+uint64_t ms_to_samples(uint32_t ms, uint32_t rate) {
+    return static_cast<uint64_t>(ms) * rate / 1000;
+}
+
+} // namespace
+
+SilenceGate::SilenceGate(uint32_t rate, uint32_t channels, const SilenceGateConfig& config, StreamStats *stats)
+    : m_channels(std::max<uint32_t>(channels, 1)),
+      m_window(std::max<size_t>(static_cast<size_t>(rate / 100) * m_channels, m_channels + 1)),
+      m_threshold(FULL_SCALE_SQUARE * std::pow(10.0, config.threshold_dbfs / 10.0)),
+      m_hangover(ms_to_samples(config.hangover_ms, rate)), m_keepalive(ms_to_samples(config.keepalive_ms, rate)),
+      m_preroll_max(static_cast<size_t>(ms_to_samples(config.preroll_ms, rate)) * m_channels), m_stats(stats),
+      m_since_speech(m_hangover + 1) {
+    m_held.reserve(m_preroll_max * 2);
+    m_preroll.reserve(m_preroll_max * 2);
+}
+
+SilenceGate::~SilenceGate() {
+    discard_held();
+}
+
+bool SilenceGate::is_speech(const int16_t *pcm, size_t samples) const {
+    for (size_t pos = 0; pos < samples; pos += m_window) {
+        const size_t n = std::min(m_window, samples - pos);
+        const double energy = static_cast<double>(sum_squares(pcm + pos, n)) / n;
+        if (energy >= m_threshold) {
+            return true;
+        }
+        if (energy >= m_threshold * UNVOICED_MARGIN && n > m_channels) {
+            const double rate = static_cast<double>(zero_crossings(pcm + pos, n, m_channels)) / (n - m_channels);
+            if (rate >= UNVOICED_CROSSINGS) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool SilenceGate::admit(const int16_t *pcm, size_t samples) {
+    const uint64_t duration = samples / m_channels;
+    m_preroll.clear();
+
+    if (is_speech(pcm, samples)) {
+        m_since_speech = 0;
+        m_since_sent = 0;
+        m_preroll.swap(m_held); // the onset, in the order it was captured
+        return true;
+    }
+
+    m_since_speech += duration;
+    if (m_since_speech <= m_hangover) {
+        m_since_sent = 0;
+        return true;
+    }
+
+    m_since_sent += duration;
+    if (m_keepalive > 0 && m_since_sent >= m_keepalive) {
+        // what was held before this chunk can no longer lead the next speech
+        discard_held();
+        m_since_sent = 0;
+        return true;
+    }
+
+    m_stats->add(m_stats->uplink_suppressed_frames);
+    hold(pcm, samples);
+    return false;
+}
+
+// Keeps the last m_preroll_max samples held back; what falls out of them is never sent.
+void SilenceGate::hold(const int16_t *pcm, size_t samples) {
+    if (samples >= m_preroll_max) {
+        m_stats->add(m_stats->uplink_suppressed_bytes, (m_held.size() + samples - m_preroll_max) * sizeof(int16_t));
+        m_held.assign(pcm + (samples - m_preroll_max), pcm + samples);
+        return;
+    }
+    m_held.insert(m_held.end(), pcm, pcm + samples);
+    if (m_held.size() > m_preroll_max) {
+        const size_t excess = m_held.size() - m_preroll_max;
+        m_stats->add(m_stats->uplink_suppressed_bytes, excess * sizeof(int16_t));
+        m_held.erase(m_held.begin(), m_held.begin() + excess);
+    }
+}
+
+void SilenceGate::discard_held() {
+    m_stats->add(m_stats->uplink_suppressed_bytes, m_held.size() * sizeof(int16_t));
+    m_held.clear();
+}
@@ -0,0 +1,76 @@
+#ifndef SILENCE_GATE_H
+#define SILENCE_GATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "stream_stats.h"
+
+//
+// Uplink silence suppression: decides, chunk by chunk, whether caller audio is
+// worth sending.
+//
+// Every 10 ms window is classified on its mean energy and zero crossing rate:
+// it is speech when its energy reaches the threshold, or comes within 6 dB of
+// it with the high crossing rate of unvoiced consonants (s, f, sh), which
+// carry little energy. A chunk with any speech window is sent; so is anything
+// within the hangover after the last speech, so word endings and short pauses
+// go through untouched.
+//
+// Past the hangover chunks are held back. The last pre-roll worth of them is
+// kept and sent right before the chunk where speech resumes, so the server
+// hears the onset the detector needed a window to notice. While held back, a
+// chunk is still let through every keep-alive interval, so the server keeps
+// receiving audio and its own turn detection keeps its clock.
+//
+// Media thread only. Held back chunks and the bytes that were never sent go to
+// the given StreamStats, which must outlive the gate.
+//
+struct SilenceGateConfig {
+    int threshold_dbfs = -45;    // mean energy of speech, relative to a full scale square wave
+    uint32_t hangover_ms = 400;  // audio still sent after the last speech
+    uint32_t preroll_ms = 200;   // audio held back last, sent before speech resumes
+    uint32_t keepalive_ms = 2000; // one chunk let through this often while silent, 0 never
+};
+
+class SilenceGate {
+  public:
+    SilenceGate(uint32_t rate, uint32_t channels, const SilenceGateConfig& config, StreamStats *stats);
+    ~SilenceGate();
+
+    SilenceGate(const SilenceGate&) = delete;
+    SilenceGate& operator=(const SilenceGate&) = delete;
+
+    // Takes samples interleaved PCM16 samples (all channels counted). Returns true if they
+    // must be sent, preceded by the preroll() audio when there is any.
+    bool admit(const int16_t *pcm, size_t samples);
+
+    // Audio to send before the chunk admit() just let through, valid until the next admit().
+    const int16_t *preroll(size_t *samples) const {
+        *samples = m_preroll.size();
+        return m_preroll.data();
+    }
+
+    // True if the chunk holds speech, exposed for benchmarks.
+    bool is_speech(const int16_t *pcm, size_t samples) const;
+
+  private:
+    void hold(const int16_t *pcm, size_t samples);
+    void discard_held();
+
+    const uint32_t m_channels;
+    const size_t m_window;       // samples of a 10 ms window, all channels
+    const double m_threshold;    // mean square of speech
+    const uint64_t m_hangover;   // in samples per channel, like the counters below
+    const uint64_t m_keepalive;
+    const size_t m_preroll_max;  // samples, all channels
+    StreamStats *m_stats;
+
+    uint64_t m_since_speech;
+    uint64_t m_since_sent = 0;
+    std::vector<int16_t> m_held; // the latest held back audio, at most m_preroll_max samples
+    std::vector<int16_t> m_preroll;
+};
+
+#endif // SILENCE_GATE_H
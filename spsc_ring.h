@@ -0,0 +1,154 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+//
+// Lock-free single-producer/single-consumer ring of trivially copyable items
+// with a capacity fixed at construction (rounded up to a power of two).
+//
+// Producer side: write(), write_regions()/commit(), write_available(), discard_all().
+// Consumer side: read(), skip(), read_available().
+// Each side must be driven by at most one thread at a time; neither side ever
+// blocks or allocates.
+//
+template <typename T> class SpscRing {
+  public:
+    explicit SpscRing(size_t capacity) : m_capacity(round_up(capacity)), m_mask(m_capacity - 1) {
+        m_items.reset(new T[m_capacity]);
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    size_t capacity() const {
+        return m_capacity;
+    }
+
+    // Producer: free slots. Items the consumer has not yet skipped after a
+    // discard_all() still count as used.
+    size_t write_available() const {
+        return m_capacity - static_cast<size_t>(m_head.load(std::memory_order_relaxed) -
+                                                m_tail.load(std::memory_order_acquire));
+    }
+
+    // Producer: appends up to count items, returns how many fit.
+    size_t write(const T *data, size_t count) {
+        const uint64_t head = m_head.load(std::memory_order_relaxed);
+        const size_t free_slots = m_capacity - static_cast<size_t>(head - m_tail.load(std::memory_order_acquire));
+        if (count > free_slots) {
+            count = free_slots;
+        }
+        const size_t offset = static_cast<size_t>(head) & m_mask;
+        const size_t first = count < m_capacity - offset ? count : m_capacity - offset;
+        memcpy(&m_items[offset], data, first * sizeof(T));
+        memcpy(&m_items[0], data + first, (count - first) * sizeof(T));
+        m_head.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    // Producer: exposes the free slots as at most two contiguous spans so items
+    // can be produced in place; nothing is visible to the consumer until
+    // commit(). Returns the total number of free slots.
+    size_t write_regions(T **first, size_t *first_len, T **second, size_t *second_len) {
+        const uint64_t head = m_head.load(std::memory_order_relaxed);
+        const size_t free_slots = m_capacity - static_cast<size_t>(head - m_tail.load(std::memory_order_acquire));
+        const size_t offset = static_cast<size_t>(head) & m_mask;
+        *first = &m_items[offset];
+        *first_len = free_slots < m_capacity - offset ? free_slots : m_capacity - offset;
+        *second = &m_items[0];
+        *second_len = free_slots - *first_len;
+        return free_slots;
+    }
+
+    // Producer: publishes count items filled in through write_regions().
+    void commit(size_t count) {
+        m_head.store(m_head.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    // Producer: drops everything written so far. The consumer skips it on its
+    // next access; items written after this call are kept.
+    void discard_all() {
+        m_discard.store(m_head.load(std::memory_order_relaxed), std::memory_order_release);
+    }
+
+    // Consumer: items ready to be read.
+    size_t read_available() {
+        const uint64_t tail = consumer_tail();
+        return static_cast<size_t>(m_head.load(std::memory_order_acquire) - tail);
+    }
+
+    // Consumer: copies up to count items into out, returns how many were read.
+    size_t read(T *out, size_t count) {
+        const uint64_t tail = consumer_tail();
+        const size_t used = static_cast<size_t>(m_head.load(std::memory_order_acquire) - tail);
+        if (count > used) {
+            count = used;
+        }
+        const size_t offset = static_cast<size_t>(tail) & m_mask;
+        const size_t first = count < m_capacity - offset ? count : m_capacity - offset;
+        memcpy(out, &m_items[offset], first * sizeof(T));
+        memcpy(out + first, &m_items[0], (count - first) * sizeof(T));
+        m_tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer: drops up to count items, returns how many were dropped.
+    size_t skip(size_t count) {
+        const uint64_t tail = consumer_tail();
+        const size_t used = static_cast<size_t>(m_head.load(std::memory_order_acquire) - tail);
+        if (count > used) {
+            count = used;
+        }
+        m_tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    // Either side: number of queued items at some recent point, for monitoring only.
+    size_t size_approx() const {
+        const uint64_t head = m_head.load(std::memory_order_acquire);
+        uint64_t tail = m_tail.load(std::memory_order_acquire);
+        const uint64_t discard = m_discard.load(std::memory_order_acquire);
+        if (discard > tail) {
+            tail = discard;
+        }
+        return head > tail ? static_cast<size_t>(head - tail) : 0;
+    }
+
+  private:
+    static size_t round_up(size_t n) {
+        size_t capacity = 1;
+        while (capacity < n) {
+            capacity <<= 1;
+        }
+        return capacity;
+    }
+
+    // Applies a pending discard_all() before the consumer touches the ring.
+    uint64_t consumer_tail() {
+        uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        const uint64_t discard = m_discard.load(std::memory_order_acquire);
+        if (discard > tail) {
+            tail = discard;
+            m_tail.store(tail, std::memory_order_release);
+        }
+        return tail;
+    }
+
+    const size_t m_capacity;
+    const size_t m_mask;
+    std::unique_ptr<T[]> m_items;
+
+    // 64-bit positions never wrap in practice. The padding keeps producer and
+    // consumer indexes on separate cache lines without needing aligned new.
+    std::atomic<uint64_t> m_head{0};
+    std::atomic<uint64_t> m_discard{0};
+    char m_padding[64];
+    std::atomic<uint64_t> m_tail{0};
+};
+
+#endif // SPSC_RING_H
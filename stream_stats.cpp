@@ -0,0 +1,84 @@
+#include "stream_stats.h"
+
+#include <cinttypes>
+#include <cstdio>
+
+namespace {
+
+void append_field(std::string& json, const char *name, uint64_t value) {
+    char field[96];
+    int len = snprintf(field, sizeof(field), "%s\"%s\":%" PRIu64, json.size() > 1 ? "," : "", name, value);
+    json.append(field, len);
+}
+
+uint64_t samples_to_ms(uint64_t samples, uint32_t rate) {
+    return rate ? samples * 1000 / rate : 0;
+}
+
+} // namespace
+
+std::string StreamStats::to_json() const {
+    std::string json("{");
+#define STREAM_STATS_APPEND(name) append_field(json, #name, name.load(std::memory_order_relaxed));
+    STREAM_STATS_COUNTERS(STREAM_STATS_APPEND)
+#undef STREAM_STATS_APPEND
+    const uint32_t rate = sample_rate.load(std::memory_order_relaxed);
+    append_field(json, "playback_queue_ms",
+                 samples_to_ms(playback_queue_samples.load(std::memory_order_relaxed), rate));
+    append_field(json, "playback_capacity_ms",
+                 samples_to_ms(playback_capacity_samples.load(std::memory_order_relaxed), rate));
+    append_field(json, "playout_target_ms",
+                 samples_to_ms(playout_target_samples.load(std::memory_order_relaxed), rate));
+    json.push_back('}');
+    return json;
+}
+
+StreamStatsRegistry& StreamStatsRegistry::instance() {
+    static StreamStatsRegistry registry;
+    return registry;
+}
+
+void StreamStatsRegistry::add(StreamStats *stats) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_live.insert(stats).second) {
+        m_sessions_total++;
+    }
+}
+
+void StreamStatsRegistry::remove(StreamStats *stats) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_live.erase(stats) == 0) {
+        return;
+    }
+#define STREAM_STATS_FOLD(name) m_total_##name += stats->name.load(std::memory_order_relaxed);
+    STREAM_STATS_COUNTERS(STREAM_STATS_FOLD)
+#undef STREAM_STATS_FOLD
+}
+
+std::string StreamStatsRegistry::to_json() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::string json("{");
+    append_field(json, "sessions", m_live.size());
+    append_field(json, "sessions_total", m_sessions_total);
+
+#define STREAM_STATS_SUM(name)                                                                                         \
+    {                                                                                                                  \
+        uint64_t sum = m_total_##name;                                                                                 \
+        for (const StreamStats *s : m_live) {                                                                          \
+            sum += s->name.load(std::memory_order_relaxed);                                                            \
+        }                                                                                                              \
+        append_field(json, #name, sum);                                                                                \
+    }
+    STREAM_STATS_COUNTERS(STREAM_STATS_SUM)
+#undef STREAM_STATS_SUM
+
+    uint64_t queue_ms = 0;
+    for (const StreamStats *s : m_live) {
+        queue_ms += samples_to_ms(s->playback_queue_samples.load(std::memory_order_relaxed),
+                                  s->sample_rate.load(std::memory_order_relaxed));
+    }
+    append_field(json, "playback_queue_ms", queue_ms);
+    json.push_back('}');
+    return json;
+}
@@ -0,0 +1,89 @@
+#ifndef STREAM_STATS_H
+#define STREAM_STATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+//
+// Runtime counters of one stream. Every field is a relaxed atomic written by
+// the thread that owns the event: the media thread or the encoder pool worker
+// for the uplink, the websocket thread or the decode worker for the downlink,
+// the media thread for playback. A counter may have more than one writer, an
+// add stays cheap either way. Readers take a consistent enough snapshot by
+// loading each field once.
+//
+
+// name of the counter, as shown in the JSON output
+#define STREAM_STATS_COUNTERS(X)                                                                                       \
+    X(uplink_frames)              /* audio messages sent to the server */                                              \
+    X(uplink_bytes)               /* audio bytes in them, PCM16 or G.711 */                                            \
+    X(uplink_dropped_frames)      /* frames lost on the uplink: not connected, buffer full, encoder behind */          \
+    X(uplink_dropped_bytes)       /* PCM bytes in them, when known */                                                  \
+    X(uplink_suppressed_frames)   /* chunks held back by the silence gate */                                           \
+    X(uplink_suppressed_bytes)    /* PCM bytes in them never sent, pre-roll excluded */                                \
+    X(uplink_queued_frames)       /* audio messages that waited in the send queue for the socket */                    \
+    X(uplink_queue_dropped_bytes) /* audio bytes the full send queue dropped, wire format */                           \
+    X(uplink_queue_overflows)     /* backlogs that filled the send queue */                                            \
+    X(downlink_chunks)            /* audio deltas or raw audio frames received */                                      \
+    X(downlink_samples)           /* samples queued for playback, at the channel rate */                               \
+    X(downlink_dropped_samples)   /* samples lost because the playback queue was full */                               \
+    X(downlink_discarded_bytes)   /* audio received but never decoded, dropped on barge-in */                          \
+    X(downlink_queue_dropped_bytes) /* audio dropped on arrival because the decode queue was full */                   \
+    X(downlink_queue_overflows)   /* backlogs that filled the decode queue */                                          \
+    X(downlink_bytes_copied)      /* PCM bytes moved between buffers on the way to the channel */                      \
+    X(playback_underruns)         /* times the queue ran dry in the middle of a response */                            \
+    X(connects)                   /* websocket connections opened, the first one included */                           \
+    X(reconnects)                 /* connections opened after the first one */                                         \
+    X(connection_errors)          /* websocket errors reported */
+
+struct StreamStats {
+#define STREAM_STATS_FIELD(name) std::atomic<uint64_t> name{0};
+    STREAM_STATS_COUNTERS(STREAM_STATS_FIELD)
+#undef STREAM_STATS_FIELD
+
+    // gauges, stored rather than accumulated
+    std::atomic<uint32_t> sample_rate{0};
+    std::atomic<uint32_t> playback_queue_samples{0};
+    std::atomic<uint32_t> playback_capacity_samples{0};
+    std::atomic<uint32_t> playout_target_samples{0};
+
+    void add(std::atomic<uint64_t>& counter, uint64_t value = 1) {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    // {"uplink_frames":..., ..., "playback_queue_ms":..., "playback_capacity_ms":..., "playout_target_ms":...}
+    std::string to_json() const;
+};
+
+//
+// Module wide view over the live streams. Registration happens on stream setup
+// and teardown only; collecting never touches the media path. Counters of
+// streams that went away are folded into running totals.
+//
+class StreamStatsRegistry {
+  public:
+    static StreamStatsRegistry& instance();
+
+    void add(StreamStats *stats);
+
+    // Folds the counters into the totals and forgets the stream.
+    void remove(StreamStats *stats);
+
+    // {"sessions":<live>,"sessions_total":<ever registered>, <counters summed over all streams>,
+    //  <gauges summed over the live ones>}
+    std::string to_json();
+
+  private:
+    std::mutex m_mutex;
+    std::unordered_set<StreamStats *> m_live;
+#define STREAM_STATS_TOTAL(name) uint64_t m_total_##name = 0;
+    STREAM_STATS_COUNTERS(STREAM_STATS_TOTAL)
+#undef STREAM_STATS_TOTAL
+    uint64_t m_sessions_total = 0;
+};
+
+#endif // STREAM_STATS_H
@@ -0,0 +1,139 @@
+#include "teardown_queue.h"
+
+TeardownQueue& TeardownQueue::instance() {
+    static TeardownQueue queue;
+    return queue;
+}
+
+TeardownQueue::~TeardownQueue() {
+    shutdown();
+}
+
+void TeardownQueue::configure(size_t workers, size_t capacity) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (workers > 0) {
+        m_num_workers = workers;
+    }
+    if (capacity > 0) {
+        m_capacity = capacity;
+    }
+    if (m_workers.empty()) {
+        m_stopping = false;
+    }
+}
+
+bool TeardownQueue::start_locked() {
+    if (!m_workers.empty()) {
+        return true;
+    }
+    try {
+        for (size_t i = 0; i < m_num_workers; i++) {
+            m_workers.emplace_back(&TeardownQueue::run, this);
+        }
+    } catch (const std::exception&) {
+        // keep whatever started, the queue still drains, only slower
+    }
+    return !m_workers.empty();
+}
+
+void TeardownQueue::post(std::function<void()> task, bool may_wait) {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (!m_stopping && start_locked()) {
+            if (m_queue.size() >= m_capacity && may_wait) {
+                m_waits.fetch_add(1, std::memory_order_relaxed);
+                m_room.wait(lock, [this] { return m_stopping || m_queue.size() < m_capacity; });
+            }
+            if (!m_stopping && m_queue.size() < m_capacity) {
+                enqueue_locked(std::move(task));
+                return;
+            }
+        }
+    }
+    if (!may_wait) {
+        if (hand_off(task)) {
+            return;
+        }
+        // no thread to be had: past the capacity rather than on the caller, while workers are left
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_stopping && !m_workers.empty()) {
+            enqueue_locked(std::move(task));
+            return;
+        }
+    }
+    task();
+    m_completed.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TeardownQueue::enqueue_locked(std::function<void()> task) {
+    m_queue.push_back(std::move(task));
+    uint64_t pending = m_pending.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (pending > m_peak_pending.load(std::memory_order_relaxed)) {
+        m_peak_pending.store(pending, std::memory_order_relaxed);
+    }
+    m_wakeup.notify_one();
+}
+
+// Runs the task on a detached thread, which shutdown() waits for. False if the thread cannot be started.
+bool TeardownQueue::hand_off(std::function<void()>& task) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_detached++;
+    }
+    m_pending.fetch_add(1, std::memory_order_relaxed);
+    try {
+        std::thread([this](std::function<void()> detached_task) {
+            detached_task();
+            m_pending.fetch_sub(1, std::memory_order_relaxed);
+            m_completed.fetch_add(1, std::memory_order_relaxed);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_detached == 0) {
+                m_idle.notify_all();
+            }
+        }, task).detach();
+    } catch (const std::exception&) {
+        m_pending.fetch_sub(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_detached == 0) {
+            m_idle.notify_all();
+        }
+        return false;
+    }
+    m_handoffs.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void TeardownQueue::shutdown() {
+    std::vector<std::thread> workers;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        m_wakeup.notify_all();
+        m_room.notify_all();
+        workers.swap(m_workers);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this] { return m_detached == 0; });
+}
+
+void TeardownQueue::run() {
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeup.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+            if (m_queue.empty()) {
+                break; // stopping and drained
+            }
+            task = std::move(m_queue.front());
+            m_queue.pop_front();
+            m_room.notify_one();
+        }
+        task();
+        m_pending.fetch_sub(1, std::memory_order_relaxed);
+        m_completed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
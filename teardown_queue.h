@@ -0,0 +1,88 @@
+#ifndef TEARDOWN_QUEUE_H
+#define TEARDOWN_QUEUE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// Module wide queue for the slow part of closing a stream (stopping its
+// websocket, which may wait for the close handshake and join the socket
+// thread), served by a fixed set of workers.
+//
+// A burst of hang ups costs queue entries instead of one thread each. When the
+// queue is full, post() waits for room, so callers are slowed down rather than
+// the module running out of threads. Socket threads must not wait, nor run a
+// task that joins them: theirs go to a detached thread of their own when the
+// queue is full or shut down. The workers are started on the first post() and
+// shutdown() returns only after every task queued or handed off so far has run.
+//
+class TeardownQueue {
+  public:
+    static TeardownQueue& instance();
+
+    // Sets the number of workers and the queue size. Meant to be called at
+    // module load, before the first post().
+    void configure(size_t workers, size_t capacity);
+
+    // Queues the task, waiting while the queue is full. Once the queue is shut
+    // down, or if no worker can be started, the task runs on the caller. With
+    // may_wait false (socket threads) it never waits nor runs inline: a full or
+    // shut down queue hands the task to a detached thread.
+    void post(std::function<void()> task, bool may_wait = true);
+
+    // Stops accepting tasks, runs the queued ones and joins the workers.
+    void shutdown();
+
+    // tasks queued or running
+    uint64_t pending() const {
+        return m_pending.load(std::memory_order_relaxed);
+    }
+    uint64_t peak_pending() const {
+        return m_peak_pending.load(std::memory_order_relaxed);
+    }
+    uint64_t completed() const {
+        return m_completed.load(std::memory_order_relaxed);
+    }
+    // post() calls that had to wait for room in the queue
+    uint64_t waits() const {
+        return m_waits.load(std::memory_order_relaxed);
+    }
+    // tasks of callers that could not wait, run on a thread of their own
+    uint64_t handoffs() const {
+        return m_handoffs.load(std::memory_order_relaxed);
+    }
+
+  private:
+    TeardownQueue() = default;
+    ~TeardownQueue();
+
+    bool start_locked();
+    void enqueue_locked(std::function<void()> task);
+    bool hand_off(std::function<void()>& task);
+    void run();
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup; // workers: a task was queued or stopping
+    std::condition_variable m_room;   // posters: a task was taken
+    std::condition_variable m_idle;   // shutdown: a handed off task finished
+    std::deque<std::function<void()>> m_queue;
+    std::vector<std::thread> m_workers;
+    size_t m_num_workers = 4;
+    size_t m_capacity = 1024;
+    bool m_stopping = false;
+    size_t m_detached = 0; // handed off tasks still running
+    std::atomic<uint64_t> m_pending{0};
+    std::atomic<uint64_t> m_peak_pending{0};
+    std::atomic<uint64_t> m_completed{0};
+    std::atomic<uint64_t> m_waits{0};
+    std::atomic<uint64_t> m_handoffs{0};
+};
+
+#endif // TEARDOWN_QUEUE_H
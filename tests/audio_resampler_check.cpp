@@ -0,0 +1,249 @@
+//
+// Check of the PCM16 resampler. For each telephony ratio, quality level and
+// polyphase kernel the running CPU supports:
+//  - feeding the input in pieces, or with a small output buffer, gives the
+//    same samples as one call over the whole buffer;
+//  - tones in the passband come out at their level;
+//  - tones past the lower rate's Nyquist frequency (aliases when downsampling)
+//    and the images of upsampling stay down by the filter's attenuation.
+// Ratios the polyphase filter does not handle, stereo, and polyphase disabled
+// must go to speex.
+//
+// usage: audio_resampler_check (exits non zero on the first failure)
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "audio_resampler.h"
+
+namespace {
+
+const char *const BACKENDS[] = {"scalar", "sse2", "avx2", "neon"};
+
+struct Ratio {
+    uint32_t in;
+    uint32_t out;
+};
+
+const Ratio RATIOS[] = {{8000, 24000}, {16000, 24000}, {24000, 8000}, {24000, 16000}, {48000, 16000}};
+
+const double AMPLITUDE = 16000;
+const double PASSBAND_TOLERANCE_DB = 0.1;
+const double FLOOR_DB = 60; // set by the Q14 coefficients, whatever the quality
+
+// stop band attenuation the quality asks for, as in audio_resampler.cpp, capped by the floor
+double attenuation_db(int quality) {
+    return std::min(45.0 + 5 * quality, FLOOR_DB);
+}
+
+// fraction of the lower rate's band the response is flat to
+double flat_to(int quality) {
+    return quality < 5 ? 0.70 : 0.85;
+}
+
+ResamplerOptions resampler_options(int quality, bool polyphase = true) {
+    ResamplerOptions options;
+    options.quality = quality;
+    options.polyphase = polyphase;
+    return options;
+}
+
+uint64_t g_rng = 0x2545f4914f6cdd1dull;
+
+uint32_t next_random() {
+    g_rng ^= g_rng << 13;
+    g_rng ^= g_rng >> 7;
+    g_rng ^= g_rng << 17;
+    return static_cast<uint32_t>(g_rng >> 32);
+}
+
+std::vector<int16_t> tone(double frequency, uint32_t rate, size_t samples) {
+    std::vector<int16_t> pcm(samples);
+    for (size_t i = 0; i < samples; i++) {
+        pcm[i] = static_cast<int16_t>(lround(AMPLITUDE * sin(2 * M_PI * frequency * i / rate)));
+    }
+    return pcm;
+}
+
+std::vector<int16_t> resample_whole(const Ratio& ratio, int quality, const std::vector<int16_t>& in) {
+    AudioResampler resampler(1, ratio.in, ratio.out, resampler_options(quality));
+    std::vector<int16_t> out(in.size() * ratio.out / ratio.in + 64);
+    uint32_t in_len = static_cast<uint32_t>(in.size());
+    uint32_t out_len = static_cast<uint32_t>(out.size());
+    resampler.process(in.data(), &in_len, out.data(), &out_len);
+    out.resize(out_len);
+    return out;
+}
+
+// Random input pieces, and when limit_output a random output room too, as the playback ring gives it.
+std::vector<int16_t> resample_chunked(const Ratio& ratio, int quality, const std::vector<int16_t>& in,
+                                      bool limit_output) {
+    AudioResampler resampler(1, ratio.in, ratio.out, resampler_options(quality));
+    std::vector<int16_t> out(in.size() * ratio.out / ratio.in + 64);
+    size_t consumed = 0;
+    size_t produced = 0;
+    while (consumed < in.size()) {
+        uint32_t in_len = static_cast<uint32_t>(std::min<size_t>(1 + next_random() % 700, in.size() - consumed));
+        uint32_t out_len = static_cast<uint32_t>(out.size() - produced);
+        if (limit_output) {
+            out_len = std::min<uint32_t>(out_len, 1 + next_random() % 300);
+        }
+        if (resampler.process(&in[consumed], &in_len, &out[produced], &out_len) != RESAMPLER_ERR_SUCCESS) {
+            return std::vector<int16_t>();
+        }
+        consumed += in_len;
+        produced += out_len;
+    }
+    out.resize(produced);
+    return out;
+}
+
+// Level in dB relative to AMPLITUDE of the output at frequency, and of everything else. The start and the
+// end, where the filter runs into the zeros around the input, are left out.
+void measure(const std::vector<int16_t>& out, uint32_t rate, double frequency, double *tone_db, double *rest_db) {
+    const size_t begin = out.size() / 4;
+    const size_t end = out.size() - out.size() / 8;
+    double s = 0, c = 0;
+    for (size_t i = begin; i < end; i++) {
+        s += out[i] * sin(2 * M_PI * frequency * i / rate);
+        c += out[i] * cos(2 * M_PI * frequency * i / rate);
+    }
+    s *= 2.0 / (end - begin);
+    c *= 2.0 / (end - begin);
+    double rest = 0;
+    for (size_t i = begin; i < end; i++) {
+        const double d = out[i] - s * sin(2 * M_PI * frequency * i / rate) - c * cos(2 * M_PI * frequency * i / rate);
+        rest += d * d;
+    }
+    *tone_db = 20 * log10(sqrt(s * s + c * c) / AMPLITUDE + 1e-12);
+    *rest_db = 20 * log10(sqrt(2 * rest / (end - begin)) / AMPLITUDE + 1e-12);
+}
+
+bool check_chunking(const char *backend, const Ratio& ratio, int quality) {
+    std::vector<int16_t> in(ratio.in / 2);
+    for (size_t i = 0; i < in.size(); i++) {
+        in[i] = static_cast<int16_t>(next_random());
+    }
+    const std::vector<int16_t> whole = resample_whole(ratio, quality, in);
+    for (bool limit_output : {false, true}) {
+        if (resample_chunked(ratio, quality, in, limit_output) != whole) {
+            printf("FAIL %s %u -> %u quality %d: %s output differs from the whole buffer's\n", backend, ratio.in,
+                   ratio.out, quality, limit_output ? "output limited" : "chunked");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool check_response(const char *backend, const Ratio& ratio, int quality) {
+    const double nyquist = std::min(ratio.in, ratio.out) / 2.0;
+    double tone_db, rest_db;
+
+    for (double fraction : {0.1, 0.5, flat_to(quality)}) {
+        const double frequency = fraction * nyquist;
+        measure(resample_whole(ratio, quality, tone(frequency, ratio.in, ratio.in)), ratio.out, frequency, &tone_db,
+                &rest_db);
+        if (fabs(tone_db) > PASSBAND_TOLERANCE_DB) {
+            printf("FAIL %s %u -> %u quality %d: %.0f Hz comes out at %.2f dB\n", backend, ratio.in, ratio.out,
+                   quality, frequency, tone_db);
+            return false;
+        }
+        // what is not the tone: aliases, images of upsampling, rounding
+        if (fraction <= 0.7 && rest_db > -attenuation_db(quality)) {
+            printf("FAIL %s %u -> %u quality %d: %.0f Hz leaves %.1f dB of aliases or images\n", backend, ratio.in,
+                   ratio.out, quality, frequency, rest_db);
+            return false;
+        }
+    }
+
+    if (ratio.in > ratio.out) {
+        for (double fraction : {1.15, 1.3, 1.5}) {
+            const double frequency = fraction * nyquist;
+            measure(resample_whole(ratio, quality, tone(frequency, ratio.in, ratio.in)), ratio.out, 0, &tone_db,
+                    &rest_db);
+            if (rest_db > -attenuation_db(quality)) {
+                printf("FAIL %s %u -> %u quality %d: %.0f Hz aliases at %.1f dB\n", backend, ratio.in, ratio.out,
+                       quality, frequency, rest_db);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool check_backend(const char *backend) {
+    for (const Ratio& ratio : RATIOS) {
+        for (int quality = 0; quality <= 10; quality++) {
+            AudioResampler resampler(1, ratio.in, ratio.out, resampler_options(quality));
+            if (strncmp(resampler.kernel(), "polyphase/", 10) != 0) {
+                printf("FAIL %u -> %u went to %s\n", ratio.in, ratio.out, resampler.kernel());
+                return false;
+            }
+            if (!check_chunking(backend, ratio, quality) || !check_response(backend, ratio, quality)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool check_speex_fallback() {
+    struct Fallback {
+        uint32_t channels;
+        uint32_t in;
+        uint32_t out;
+        bool polyphase;
+    };
+    const Fallback fallbacks[] = {
+        {1, 44100, 8000, true},  // 441:80
+        {1, 56000, 8000, true},  // 7:1, a term past 6
+        {2, 8000, 24000, true},  // stereo
+        {1, 8000, 24000, false}, // disabled
+    };
+    for (const Fallback& f : fallbacks) {
+        AudioResampler resampler(f.channels, f.in, f.out, resampler_options(5, f.polyphase));
+        if (strcmp(resampler.kernel(), "speex") != 0 || resampler.init_error() != RESAMPLER_ERR_SUCCESS) {
+            printf("FAIL %u channels %u -> %u%s: %s, error %d instead of speex\n", f.channels, f.in, f.out,
+                   f.polyphase ? "" : " without polyphase", resampler.kernel(), resampler.init_error());
+            return false;
+        }
+        // a second of audio goes through
+        std::vector<int16_t> in(f.in * f.channels);
+        std::vector<int16_t> out((f.out + 64) * f.channels);
+        uint32_t in_len = f.in;
+        uint32_t out_len = f.out + 64;
+        if (resampler.process(in.data(), &in_len, out.data(), &out_len) != RESAMPLER_ERR_SUCCESS || in_len != f.in ||
+            out_len + 64 < f.out || out_len > f.out + 1) {
+            printf("FAIL speex %u -> %u: %u of %u frames in, %u out\n", f.in, f.out, in_len, f.in, out_len);
+            return false;
+        }
+    }
+    printf("ok   speex fallback\n");
+    return true;
+}
+
+} // namespace
+
+int main() {
+    int checked = 0;
+    for (const char *backend : BACKENDS) {
+        if (!resampler_simd_set_backend(backend)) {
+            printf("skip %s: not supported by this cpu\n", backend);
+            continue;
+        }
+        if (!check_backend(backend)) {
+            return 1;
+        }
+        printf("ok   %s\n", backend);
+        checked++;
+    }
+    if (!check_speex_fallback()) {
+        return 1;
+    }
+    return checked > 0 ? 0 : 1;
+}
@@ -0,0 +1,169 @@
+//
+// Equivalence check of the SIMD base64 codec against base64.cpp, on every
+// kernel the running CPU supports: encoding, decoding of the standard and url
+// alphabets, unpadded tails, truncated and corrupted input. base64_decode_into()
+// must return the bytes base64_decode() returns, and false where it throws.
+//
+// usage: base64_simd_check (exits non zero on the first mismatch)
+//
+
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "base64.h"
+#include "base64_simd.h"
+
+namespace {
+
+const char *const BACKENDS[] = {"scalar", "sse4.1", "avx2", "neon"};
+const size_t MAX_LEN = 600;                   // every remainder of the 12, 24 and 48 byte vector blocks
+const size_t LARGE_LENS[] = {4096, 9600, 9601, 9602, 65535};
+const char CORRUPT_CHARS[] = {'!', '*', ' ', '\n', '=', '.', '-', '_', '\0', '\x80', '\xff'};
+
+uint64_t g_rng = 0x9e3779b97f4a7c15ull;
+
+uint32_t next_random() {
+    g_rng ^= g_rng << 13;
+    g_rng ^= g_rng >> 7;
+    g_rng ^= g_rng << 17;
+    return static_cast<uint32_t>(g_rng >> 32);
+}
+
+std::string random_bytes(size_t len) {
+    std::string bytes(len, '\0');
+    for (size_t i = 0; i < len; i++) {
+        bytes[i] = static_cast<char>(next_random());
+    }
+    return bytes;
+}
+
+std::string printable(const std::string& s) {
+    std::string out;
+    for (size_t i = 0; i < s.size() && i < 80; i++) {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        if (c >= 0x20 && c < 0x7f) {
+            out.push_back(static_cast<char>(c));
+        } else {
+            char hex[8];
+            snprintf(hex, sizeof(hex), "\\x%02x", c);
+            out += hex;
+        }
+    }
+    return s.size() > 80 ? out + "..." : out;
+}
+
+bool check_encode(const char *backend, const std::string& bytes) {
+    const unsigned char *src = reinterpret_cast<const unsigned char *>(bytes.data());
+    const std::string expected = base64_encode(src, bytes.size(), false);
+    std::vector<char> out(base64_encoded_size(bytes.size()) + 1);
+    const size_t written = base64_encode_into(src, bytes.size(), out.data());
+    if (written != expected.size() || std::string(out.data(), written) != expected) {
+        printf("FAIL %s encode of %zu bytes\n", backend, bytes.size());
+        return false;
+    }
+    return true;
+}
+
+// what base64_decode() does with text: the bytes, or false if it throws
+bool reference_decode(const std::string& text, std::string *bytes) {
+    try {
+        *bytes = base64_decode(text);
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+bool check_decode(const char *backend, const char *what, const std::string& text) {
+    std::string expected;
+    const bool expected_ok = reference_decode(text, &expected);
+    std::vector<unsigned char> out(base64_decoded_max_size(text.size()) + 1);
+    size_t len = 0;
+    const bool ok = base64_decode_into(text.data(), text.size(), out.data(), &len);
+    if (ok != expected_ok) {
+        printf("FAIL %s decode of %s \"%s\": %s, base64_decode() %s\n", backend, what, printable(text).c_str(),
+               ok ? "accepted" : "rejected", expected_ok ? "accepts" : "throws");
+        return false;
+    }
+    if (ok && (len > base64_decoded_max_size(text.size()) ||
+               std::string(reinterpret_cast<const char *>(out.data()), len) != expected)) {
+        printf("FAIL %s decode of %s \"%s\": %zu bytes differ from base64_decode()\n", backend, what,
+               printable(text).c_str(), len);
+        return false;
+    }
+    return true;
+}
+
+std::string strip_padding(std::string text) {
+    while (!text.empty() && (text.back() == '=' || text.back() == '.')) {
+        text.pop_back();
+    }
+    return text;
+}
+
+bool check_length(const char *backend, size_t len) {
+    const std::string bytes = random_bytes(len);
+    if (!check_encode(backend, bytes)) {
+        return false;
+    }
+    const std::string standard = base64_encode(bytes, false);
+    const std::string url = base64_encode(bytes, true);
+    if (!check_decode(backend, "standard", standard) || !check_decode(backend, "url", url) ||
+        !check_decode(backend, "unpadded", strip_padding(standard)) ||
+        !check_decode(backend, "unpadded url", strip_padding(url))) {
+        return false;
+    }
+
+    // truncations: every cut of short inputs, the tail of longer ones
+    for (size_t cut = standard.size() > 64 ? standard.size() - 8 : 0; cut < standard.size(); cut++) {
+        if (!check_decode(backend, "truncated", standard.substr(0, cut))) {
+            return false;
+        }
+    }
+
+    // corruptions, at random places and in the last block where the vector kernels hand over
+    for (int round = 0; round < 8 && !standard.empty(); round++) {
+        std::string corrupted = standard;
+        const size_t pos = round < 2 ? corrupted.size() - 1 - round : next_random() % corrupted.size();
+        corrupted[pos] = CORRUPT_CHARS[next_random() % sizeof(CORRUPT_CHARS)];
+        if (!check_decode(backend, "corrupted", corrupted)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool check_backend(const char *backend) {
+    for (size_t len = 0; len < MAX_LEN; len++) {
+        if (!check_length(backend, len)) {
+            return false;
+        }
+    }
+    for (size_t len : LARGE_LENS) {
+        if (!check_length(backend, len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main() {
+    int checked = 0;
+    for (const char *backend : BACKENDS) {
+        if (!base64_simd_set_backend(backend)) {
+            printf("skip %s: not supported by this cpu\n", backend);
+            continue;
+        }
+        if (!check_backend(backend)) {
+            return 1;
+        }
+        printf("ok   %s\n", backend);
+        checked++;
+    }
+    return checked > 0 ? 0 : 1;
+}
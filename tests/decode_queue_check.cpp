@@ -0,0 +1,156 @@
+//
+// Check of the decode queue between the websocket thread and the decode worker:
+// jobs come out in order with their epoch, a barge-in drops what is queued and
+// bumps the epoch, and a full queue drops audio and counts it, with
+// overflowing() set once per backlog, which is what the streamer logs on.
+//
+// usage: decode_queue_check (exits non zero on the first failure)
+//
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "decode_queue.h"
+#include "stream_stats.h"
+
+namespace {
+
+bool expect(bool condition, const char *what) {
+    if (!condition) {
+        printf("FAIL %s\n", what);
+    }
+    return condition;
+}
+
+bool push_text(DecodeQueue& queue, const std::string& audio, const char *text = nullptr) {
+    return queue.push(DECODE_BASE64, audio.data(), audio.size(), text, text ? strlen(text) : 0);
+}
+
+std::string popped_audio(const DecodeJob& job) {
+    return std::string(job.data.begin(), job.data.end());
+}
+
+bool check_order() {
+    StreamStats stats;
+    DecodeQueue queue(1024, &stats);
+    DecodeJob job;
+    uint32_t epoch = 99;
+    if (!expect(!queue.pop(&job, &epoch) && epoch == 0, "empty queue pops nothing, epoch 0")) {
+        return false;
+    }
+    const bool pushed = push_text(queue, "AAAA", "{\"type\":\"response.output_audio.delta\"}") &&
+                        queue.push(DECODE_BINARY, "\x01\x02", 2) && queue.push(DECODE_END_RESPONSE, nullptr, 0);
+    if (!expect(pushed, "pushes within capacity succeed")) {
+        return false;
+    }
+    bool ok = expect(queue.pop(&job, &epoch) && job.kind == DECODE_BASE64 && popped_audio(job) == "AAAA" &&
+                         std::string(job.text.begin(), job.text.end()) == "{\"type\":\"response.output_audio.delta\"}",
+                     "first job is the delta with its message");
+    ok = ok && expect(queue.pop(&job, &epoch) && job.kind == DECODE_BINARY && popped_audio(job) == "\x01\x02" &&
+                          job.text.empty(),
+                      "second job is the binary frame, without text");
+    ok = ok && expect(queue.pop(&job, &epoch) && job.kind == DECODE_END_RESPONSE && job.data.empty(),
+                      "third job is the end of the response");
+    ok = ok && expect(!queue.pop(&job, &epoch), "queue is empty again");
+    if (ok) {
+        printf("ok   order\n");
+    }
+    return ok;
+}
+
+bool check_barge_in() {
+    StreamStats stats;
+    DecodeQueue queue(1024, &stats);
+    DecodeJob job;
+    uint32_t epoch = 0;
+    push_text(queue, "old1");
+    push_text(queue, "old22");
+    push_text(queue, "old333");
+    bool ok = expect(queue.pop(&job, &epoch) && epoch == 0 && popped_audio(job) == "old1", "first delta in epoch 0");
+
+    queue.barge_in();
+    ok = ok && expect(!queue.pop(&job, &epoch), "older deltas are dropped on barge-in");
+    ok = ok && expect(epoch == 1, "barge-in bumps the epoch");
+    ok = ok && expect(stats.downlink_discarded_bytes.load() == 11, "dropped deltas count as discarded bytes");
+
+    push_text(queue, "new");
+    ok = ok && expect(queue.pop(&job, &epoch) && epoch == 1 && popped_audio(job) == "new",
+                      "audio pushed after the barge-in pops with the new epoch");
+
+    queue.barge_in();
+    queue.barge_in();
+    ok = ok && expect(!queue.pop(&job, &epoch) && epoch == 3, "every barge-in bumps the epoch");
+    ok = ok && expect(stats.downlink_discarded_bytes.load() == 11, "barge-in on an empty queue discards nothing");
+    if (ok) {
+        printf("ok   barge-in\n");
+    }
+    return ok;
+}
+
+bool check_overflow() {
+    StreamStats stats;
+    DecodeQueue queue(10, &stats); // the bytes of the audio and the text together
+    DecodeJob job;
+    uint32_t epoch = 0;
+    const std::string four(4, 'A');
+
+    bool ok = expect(push_text(queue, four) && push_text(queue, four), "8 of 10 bytes fit");
+    ok = ok && expect(!queue.overflowing(), "not overflowing below capacity");
+    ok = ok && expect(!push_text(queue, four), "a push past capacity fails");
+    ok = ok && expect(queue.overflowing(), "the first drop starts a backlog");
+    ok = ok && expect(!push_text(queue, "AA", "x"), "the text counts against capacity too");
+    ok = ok && expect(push_text(queue, "AA"), "a push that still fits is queued");
+    ok = ok && expect(queue.overflowing(), "still overflowing until the worker empties the queue");
+    ok = ok && expect(stats.downlink_queue_overflows.load() == 1, "one overflow per backlog");
+    ok = ok && expect(stats.downlink_queue_dropped_bytes.load() == 6, "dropped audio bytes are counted");
+
+    while (queue.pop(&job, &epoch)) {
+    }
+    ok = ok && expect(!queue.overflowing(), "an empty queue ends the backlog");
+    ok = ok && expect(push_text(queue, four) && push_text(queue, four) && !push_text(queue, four),
+                      "a second backlog fills the queue again");
+    ok = ok && expect(queue.overflowing() && stats.downlink_queue_overflows.load() == 2,
+                      "the second backlog is counted once");
+    ok = ok && expect(stats.downlink_queue_dropped_bytes.load() == 10, "its dropped bytes add up");
+
+    queue.barge_in();
+    ok = ok && expect(!queue.overflowing(), "barge-in ends the backlog");
+    ok = ok && expect(push_text(queue, four) && push_text(queue, four), "the space is free again after barge-in");
+    if (ok) {
+        printf("ok   overflow\n");
+    }
+    return ok;
+}
+
+// popped jobs hand their buffers back, so a steady stream of deltas stops allocating
+bool check_reuse() {
+    StreamStats stats;
+    DecodeQueue queue(1 << 16, &stats);
+    DecodeJob job;
+    uint32_t epoch = 0;
+    const std::string delta(4000, 'A');
+    std::vector<const uint8_t *> seen;
+    bool ok = true;
+    for (int i = 0; i < 8 && ok; i++) {
+        ok = expect(push_text(queue, delta) && queue.pop(&job, &epoch) && popped_audio(job) == delta,
+                    "delta survives the round trip");
+        seen.push_back(job.data.data());
+    }
+    ok = ok && expect(seen[6] == seen[4] && seen[7] == seen[5], "buffers alternate between the job and the queue");
+    if (ok) {
+        printf("ok   buffer reuse\n");
+    }
+    return ok;
+}
+
+} // namespace
+
+int main() {
+    if (!check_order() || !check_barge_in() || !check_overflow() || !check_reuse()) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,181 @@
+//
+// Check of the G.711 codec against the reference code (Sun's g711.c, as
+// FreeSWITCH ships it): all 256 codes of both laws decoded by every kernel the
+// running CPU supports, at every offset of the vector blocks, and every PCM16
+// value encoded.
+//
+// usage: g711_check (exits non zero on the first mismatch)
+//
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "g711.h"
+
+namespace {
+
+const char *const BACKENDS[] = {"scalar", "ssse3", "neon"};
+const G711Law LAWS[] = {G711_ULAW, G711_ALAW};
+
+// Sun Microsystems' reference implementation, unchanged but for the formatting
+const int SIGN_BIT = 0x80;
+const int QUANT_MASK = 0xf;
+const int SEG_SHIFT = 4;
+const int SEG_MASK = 0x70;
+const int BIAS = 0x84;
+const int CLIP = 8159;
+
+const short seg_aend[8] = {0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF};
+const short seg_uend[8] = {0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF};
+
+int search(int val, const short *table, int size) {
+    for (int i = 0; i < size; i++) {
+        if (val <= table[i]) {
+            return i;
+        }
+    }
+    return size;
+}
+
+unsigned char linear2alaw(int pcm_val) {
+    int mask;
+    pcm_val = pcm_val >> 3;
+    if (pcm_val >= 0) {
+        mask = 0xD5;
+    } else {
+        mask = 0x55;
+        pcm_val = -pcm_val - 1;
+    }
+    int seg = search(pcm_val, seg_aend, 8);
+    if (seg >= 8) {
+        return static_cast<unsigned char>(0x7F ^ mask);
+    }
+    unsigned char aval = static_cast<unsigned char>(seg << SEG_SHIFT);
+    if (seg < 2) {
+        aval |= (pcm_val >> 1) & QUANT_MASK;
+    } else {
+        aval |= (pcm_val >> seg) & QUANT_MASK;
+    }
+    return static_cast<unsigned char>(aval ^ mask);
+}
+
+int alaw2linear(unsigned char a_val) {
+    a_val ^= 0x55;
+    int t = (a_val & QUANT_MASK) << 4;
+    int seg = (static_cast<unsigned>(a_val) & SEG_MASK) >> SEG_SHIFT;
+    switch (seg) {
+        case 0:
+            t += 8;
+            break;
+        case 1:
+            t += 0x108;
+            break;
+        default:
+            t += 0x108;
+            t <<= seg - 1;
+    }
+    return (a_val & SIGN_BIT) ? t : -t;
+}
+
+unsigned char linear2ulaw(int pcm_val) {
+    int mask;
+    pcm_val = pcm_val >> 2;
+    if (pcm_val < 0) {
+        pcm_val = -pcm_val;
+        mask = 0x7F;
+    } else {
+        mask = 0xFF;
+    }
+    if (pcm_val > CLIP) {
+        pcm_val = CLIP;
+    }
+    pcm_val += (BIAS >> 2);
+    int seg = search(pcm_val, seg_uend, 8);
+    if (seg >= 8) {
+        return static_cast<unsigned char>(0x7F ^ mask);
+    }
+    unsigned char uval = static_cast<unsigned char>((seg << 4) | ((pcm_val >> (seg + 1)) & 0xF));
+    return static_cast<unsigned char>(uval ^ mask);
+}
+
+int ulaw2linear(unsigned char u_val) {
+    u_val = ~u_val;
+    int t = ((u_val & QUANT_MASK) << 3) + BIAS;
+    t <<= (static_cast<unsigned>(u_val) & SEG_MASK) >> SEG_SHIFT;
+    return (u_val & SIGN_BIT) ? (BIAS - t) : (t - BIAS);
+}
+
+int reference_decode(G711Law law, uint8_t code) {
+    return law == G711_ULAW ? ulaw2linear(code) : alaw2linear(code);
+}
+
+// Every code, starting at each offset of a 16 byte block, so that each code goes
+// through every lane of the vector kernels and through the scalar tail.
+bool check_decode(const char *backend, G711Law law) {
+    for (size_t offset = 0; offset < 16; offset++) {
+        std::vector<uint8_t> codes(offset + 256 + 16);
+        for (size_t i = 0; i < codes.size(); i++) {
+            codes[i] = static_cast<uint8_t>(i - offset);
+        }
+        for (size_t len : {offset + 256, offset + 256 + 15}) {
+            std::vector<int16_t> pcm(len + 1, 0x5a5a);
+            g711_decode(law, codes.data(), len, pcm.data());
+            for (size_t i = 0; i < len; i++) {
+                if (pcm[i] != reference_decode(law, codes[i])) {
+                    printf("FAIL %s %s decode of 0x%02x at %zu: %d, reference %d\n", backend, g711_law_name(law),
+                           codes[i], i, pcm[i], reference_decode(law, codes[i]));
+                    return false;
+                }
+            }
+            if (pcm[len] != 0x5a5a) {
+                printf("FAIL %s %s decode of %zu bytes writes past the end\n", backend, g711_law_name(law), len);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool check_encode(G711Law law) {
+    std::vector<int16_t> pcm(65536);
+    for (size_t i = 0; i < pcm.size(); i++) {
+        pcm[i] = static_cast<int16_t>(static_cast<int>(i) - 32768);
+    }
+    std::vector<uint8_t> codes(pcm.size());
+    g711_encode(law, pcm.data(), pcm.size(), codes.data());
+    for (size_t i = 0; i < pcm.size(); i++) {
+        const uint8_t expected = law == G711_ULAW ? linear2ulaw(pcm[i]) : linear2alaw(pcm[i]);
+        if (codes[i] != expected) {
+            printf("FAIL %s encode of %d: 0x%02x, reference 0x%02x\n", g711_law_name(law), pcm[i], codes[i], expected);
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main() {
+    int checked = 0;
+    for (const char *backend : BACKENDS) {
+        if (!g711_simd_set_backend(backend)) {
+            printf("skip %s: not supported by this cpu\n", backend);
+            continue;
+        }
+        for (G711Law law : LAWS) {
+            if (!check_decode(backend, law)) {
+                return 1;
+            }
+        }
+        printf("ok   %s decode\n", backend);
+        checked++;
+    }
+    for (G711Law law : LAWS) {
+        if (!check_encode(law)) {
+            return 1;
+        }
+    }
+    printf("ok   encode\n");
+    return checked > 0 ? 0 : 1;
+}
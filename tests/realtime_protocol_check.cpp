@@ -0,0 +1,235 @@
+//
+// Check of the Realtime message scanner and of the audio stripping of event
+// payloads: top-level "type" and "delta" found past nested ones, escapes inside
+// strings, truncated and malformed input rejected, and the metadata around a
+// stripped payload left as it was.
+//
+// usage: realtime_protocol_check (exits non zero on the first failure)
+//
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "base64.h"
+#include "realtime_protocol.h"
+
+namespace {
+
+bool expect(bool condition, const char *what, const std::string& json) {
+    if (!condition) {
+        printf("FAIL %s: %s\n", what, json.substr(0, 200).c_str());
+    }
+    return condition;
+}
+
+bool scan(const std::string& json, realtime_message_t *msg) {
+    return realtime_scan_message(json.data(), json.size(), msg);
+}
+
+std::string span(const char *p, size_t len) {
+    return p ? std::string(p, len) : std::string("(null)");
+}
+
+// base64 of len bytes of audio
+std::string audio(size_t len) {
+    std::string bytes(len, '\0');
+    for (size_t i = 0; i < len; i++) {
+        bytes[i] = static_cast<char>(i * 31 + 7);
+    }
+    return base64_encode(bytes, false);
+}
+
+// 0 stands for nothing to strip
+std::string strip(const std::string& json, uint32_t bytes_per_second) {
+    std::vector<char> dst(json.size() + 1);
+    const size_t len = realtime_strip_audio(json.data(), json.size(), bytes_per_second, dst.data());
+    if (len == 0) {
+        return "0";
+    }
+    if (len > json.size() || dst[len] != '\0') {
+        return "longer than the input, or not terminated";
+    }
+    return std::string(dst.data(), len);
+}
+
+struct ScanCase {
+    const char *what;
+    const char *json;
+    realtime_event_t event;
+    const char *type;  // expected type span, nullptr if absent
+    const char *delta; // expected delta span, nullptr if absent
+    bool delta_escaped;
+};
+
+const ScanCase SCAN_CASES[] = {
+    {"audio delta", "{\"type\":\"response.output_audio.delta\",\"response_id\":\"r\",\"delta\":\"QUJD\"}",
+     REALTIME_EVENT_AUDIO_DELTA, "response.output_audio.delta", "QUJD", false},
+    {"delta before type", " \n{ \"delta\" : \"QUJD\" , \"type\" : \"response.output_audio.delta\" } ",
+     REALTIME_EVENT_AUDIO_DELTA, "response.output_audio.delta", "QUJD", false},
+    {"nested type and delta", "{\"item\":{\"type\":\"error\",\"delta\":\"x\",\"more\":[{\"type\":\"y\"}]},"
+                              "\"type\":\"response.output_audio.delta\",\"delta\":\"QUJD\"}",
+     REALTIME_EVENT_AUDIO_DELTA, "response.output_audio.delta", "QUJD", false},
+    {"nested in arrays", "{\"content\":[[{\"delta\":\"a\"}],{\"type\":\"input_audio_buffer.speech_started\"}],"
+                         "\"type\":\"session.updated\"}",
+     REALTIME_EVENT_OTHER, "session.updated", nullptr, false},
+    {"first occurrence counts", "{\"type\":\"response.output_audio.done\",\"type\":\"error\",\"delta\":\"A\","
+                                "\"delta\":\"B\"}",
+     REALTIME_EVENT_AUDIO_DONE, "response.output_audio.done", "A", false},
+    {"type not a string", "{\"type\":5,\"x\":{\"type\":\"error\"},\"type\":\"error\"}", REALTIME_EVENT_OTHER, nullptr,
+     nullptr, false},
+    {"escaped slash in delta", "{\"type\":\"response.output_audio.delta\",\"delta\":\"QU\\/JD\"}",
+     REALTIME_EVENT_AUDIO_DELTA, "response.output_audio.delta", "QU\\/JD", true},
+    {"escaped quotes and backslashes", "{\"text\":\"say \\\"type\\\":\\\"error\\\" \\\\\",\"type\":\"x\\\\\","
+                                       "\"delta\":\"a\\\"b\"}",
+     REALTIME_EVENT_OTHER, "x\\\\", "a\\\"b", true},
+    {"speech started", "{\"type\":\"input_audio_buffer.speech_started\",\"audio_start_ms\":1000}",
+     REALTIME_EVENT_SPEECH_STARTED, "input_audio_buffer.speech_started", nullptr, false},
+    {"speech stopped", "{\"type\":\"input_audio_buffer.speech_stopped\"}", REALTIME_EVENT_SPEECH_STOPPED,
+     "input_audio_buffer.speech_stopped", nullptr, false},
+    {"error", "{\"type\":\"error\",\"error\":{\"type\":\"invalid_request_error\",\"message\":\"m\"}}",
+     REALTIME_EVENT_ERROR, "error", nullptr, false},
+    {"any type with error", "{\"type\":\"transcription.error_event\"}", REALTIME_EVENT_ERROR,
+     "transcription.error_event", nullptr, false},
+    {"other values", "{\"a\":null,\"b\":true,\"c\":-1.5e+3,\"d\":[],\"e\":{},\"type\":\"session.created\"}",
+     REALTIME_EVENT_OTHER, "session.created", nullptr, false},
+    {"empty object", "{}", REALTIME_EVENT_OTHER, nullptr, nullptr, false},
+    {"trailing bytes ignored", "{\"type\":\"response.output_audio.done\"} junk", REALTIME_EVENT_AUDIO_DONE,
+     "response.output_audio.done", nullptr, false},
+};
+
+const char *const MALFORMED[] = {
+    "",
+    "   ",
+    "[]",
+    "\"type\"",
+    "{\"type\":\"x\",}",
+    "{\"type\" \"x\"}",
+    "{\"type\":}",
+    "{type:\"x\"}",
+    "{\"a\":[1,2}",
+    "{\"a\":{\"b\":1]}",
+    "{\"a\":{\"b\"}}",
+    "{\"a\":\"unterminated\\\"}",
+    "{\"a\":1 \"b\":2}",
+};
+
+bool check_scan() {
+    realtime_message_t msg;
+    for (const ScanCase& c : SCAN_CASES) {
+        const bool ok = scan(c.json, &msg) && msg.event == c.event &&
+                        span(msg.type, msg.type_len) == (c.type ? c.type : "(null)") &&
+                        span(msg.delta, msg.delta_len) == (c.delta ? c.delta : "(null)") &&
+                        msg.delta_escaped == c.delta_escaped;
+        if (!expect(ok, c.what, c.json)) {
+            return false;
+        }
+    }
+    printf("ok   scan\n");
+    return true;
+}
+
+bool check_malformed() {
+    realtime_message_t msg;
+    for (const char *json : MALFORMED) {
+        if (!expect(!scan(json, &msg), "malformed message accepted", json)) {
+            return false;
+        }
+    }
+
+    // every truncation of valid messages, the last byte of the closing brace included
+    const std::string messages[] = {
+        SCAN_CASES[2].json,
+        SCAN_CASES[7].json,
+        "{\"type\":\"response.output_audio.delta\",\"delta\":\"" + audio(300) + "\"}",
+    };
+    for (const std::string& json : messages) {
+        for (size_t cut = 0; cut < json.size(); cut++) {
+            const std::string truncated = json.substr(0, cut);
+            if (!expect(!scan(truncated, &msg), "truncated message accepted", truncated)) {
+                return false;
+            }
+            if (!expect(strip(truncated, 48000) == "0", "truncated message stripped", truncated)) {
+                return false;
+            }
+        }
+    }
+
+    std::string deep(300, '[');
+    deep = "{\"a\":" + deep + std::string(300, ']') + "}";
+    if (!expect(!scan(deep, &msg), "nesting beyond the limit accepted", deep)) {
+        return false;
+    }
+    printf("ok   malformed and truncated\n");
+    return true;
+}
+
+struct StripCase {
+    const char *what;
+    std::string json;
+    uint32_t bytes_per_second;
+    std::string expected; // "0" when there is nothing to strip
+};
+
+bool check_strip() {
+    const std::string delta = audio(4800);
+    const std::string meta = "\"event_id\":\"event_1\",\"response_id\":\"resp_1\",\"item_id\":\"item_1\","
+                             "\"output_index\":0,\"content_index\":0";
+    std::string escaped = std::string(125, 'A') + "\\/AA"; // 128 characters once unescaped, 96 bytes
+
+    const StripCase cases[] = {
+        {"audio delta, metadata kept", "{\"type\":\"response.output_audio.delta\"," + meta + ",\"delta\":\"" + delta +
+                                           "\"}",
+         24000, "{\"type\":\"response.output_audio.delta\"," + meta + ",\"delta\":\"\",\"delta_bytes\":4800,"
+                "\"delta_ms\":200}"},
+        {"G.711 rate and spaces", "{ \"delta\" : \"" + delta + "\" , \"type\" : \"response.output_audio.delta\" }",
+         8000,
+         "{ \"delta\" : \"\",\"delta_bytes\":4800,\"delta_ms\":600 , \"type\" : \"response.output_audio.delta\" }"},
+        {"unknown rate", "{\"type\":\"response.output_audio.delta\",\"delta\":\"" + delta + "\"}", 0,
+         "{\"type\":\"response.output_audio.delta\",\"delta\":\"\",\"delta_bytes\":4800,\"delta_ms\":0}"},
+        {"padding", "{\"type\":\"response.output_audio.delta\",\"delta\":\"" + audio(4801) + "\"}", 24000,
+         "{\"type\":\"response.output_audio.delta\",\"delta\":\"\",\"delta_bytes\":4801,\"delta_ms\":200}"},
+        {"escapes counted once", "{\"type\":\"response.output_audio.delta\",\"delta\":\"" + escaped + "\"}", 48000,
+         "{\"type\":\"response.output_audio.delta\",\"delta\":\"\",\"delta_bytes\":96,\"delta_ms\":2}"},
+        {"short delta left alone", "{\"type\":\"response.output_audio.delta\",\"delta\":\"" + audio(90) + "\"}",
+         24000, "0"},
+        {"text delta left alone", "{\"type\":\"response.output_audio_transcript.delta\",\"delta\":\"" + delta + "\"}",
+         24000, "0"},
+        {"nested audio", "{\"type\":\"conversation.item.created\",\"item\":{\"content\":[{\"type\":\"input_audio\","
+                         "\"audio\":\"" + delta + "\",\"transcript\":null}]}}",
+         24000, "{\"type\":\"conversation.item.created\",\"item\":{\"content\":[{\"type\":\"input_audio\","
+                "\"audio\":\"\",\"audio_bytes\":4800,\"audio_ms\":200,\"transcript\":null}]}}"},
+        {"audio as a value, not a key", "{\"type\":\"response.output_audio.delta\",\"modalities\":[\"audio\"],"
+                                        "\"delta\":\"" + delta + "\"}",
+         24000, "{\"type\":\"response.output_audio.delta\",\"modalities\":[\"audio\"],\"delta\":\"\","
+                "\"delta_bytes\":4800,\"delta_ms\":200}"},
+        {"quoted keys inside text", "{\"type\":\"response.output_audio.delta\",\"text\":\"\\\"audio\\\":\\\"" +
+                                        delta + "\\\"\",\"delta\":\"" + delta + "\"}",
+         24000, "{\"type\":\"response.output_audio.delta\",\"text\":\"\\\"audio\\\":\\\"" + delta +
+                "\\\"\",\"delta\":\"\",\"delta_bytes\":4800,\"delta_ms\":200}"},
+        {"malformed", "{\"type\":\"response.output_audio.delta\",\"delta\":\"" + delta + "\",}", 24000, "0"},
+    };
+    for (const StripCase& c : cases) {
+        const std::string stripped = strip(c.json, c.bytes_per_second);
+        if (!expect(stripped == c.expected, c.what, stripped)) {
+            return false;
+        }
+        realtime_message_t msg;
+        if (c.expected != "0" && !expect(scan(stripped, &msg), "stripped message no longer scans", stripped)) {
+            return false;
+        }
+    }
+    printf("ok   strip\n");
+    return true;
+}
+
+} // namespace
+
+int main() {
+    if (!check_scan() || !check_malformed() || !check_strip()) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,174 @@
+//
+// Check of the uplink send queue: the drop, merge and event overflow policies,
+// the capacity they keep, the backlog transitions the streamer raises its
+// overflow event on, and the counters. Control messages never enter the queue,
+// send_json drains it first; under the event policy the audio already queued
+// is never dropped either, only the new audio is.
+//
+// usage: send_queue_check (exits non zero on the first failure)
+//
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "send_queue.h"
+#include "stream_stats.h"
+
+namespace {
+
+bool expect(bool condition, const char *what) {
+    if (!condition) {
+        printf("FAIL %s\n", what);
+    }
+    return condition;
+}
+
+SendQueueConfig config(SendOverflowPolicy policy, size_t capacity, size_t frame_bytes = 2) {
+    SendQueueConfig config;
+    config.capacity = capacity;
+    config.high_water = 100;
+    config.frame_bytes = frame_bytes;
+    config.policy = policy;
+    return config;
+}
+
+size_t push(SendQueue& queue, const std::string& audio) {
+    return queue.push(reinterpret_cast<const uint8_t *>(audio.data()), audio.size());
+}
+
+// Everything waiting, oldest first, as the streamer drains it before a control message.
+std::vector<std::string> drain(SendQueue& queue) {
+    std::vector<std::string> messages;
+    while (!queue.empty()) {
+        size_t len = 0;
+        const uint8_t *data = queue.front(&len);
+        messages.push_back(std::string(reinterpret_cast<const char *>(data), len));
+        queue.pop();
+    }
+    return messages;
+}
+
+bool check_must_wait() {
+    StreamStats stats;
+    SendQueue queue(config(SEND_OVERFLOW_DROP, 10), &stats);
+    bool ok = expect(!queue.must_wait(99), "audio goes straight through below the high water mark");
+    ok = ok && expect(queue.must_wait(100), "and waits from it on");
+    push(queue, "ab");
+    ok = ok && expect(queue.must_wait(0), "audio waits behind audio already queued, whatever the transport");
+    drain(queue);
+    ok = ok && expect(!queue.must_wait(0) && queue.bytes() == 0, "until the queue drained");
+    if (ok) {
+        printf("ok   high water mark\n");
+    }
+    return ok;
+}
+
+bool check_drop() {
+    StreamStats stats;
+    SendQueue queue(config(SEND_OVERFLOW_DROP, 10), &stats);
+    bool ok = expect(push(queue, "aaaa") == 0 && push(queue, "bbbb") == 0, "8 of 10 bytes fit");
+    ok = ok && expect(!queue.overflowing(), "no backlog below capacity");
+    ok = ok && expect(push(queue, "cccc") == 4, "the oldest message makes room");
+    ok = ok && expect(queue.overflowing() && queue.bytes() == 8, "a backlog starts, the capacity holds");
+    ok = ok && expect(push(queue, "dddddd") == 4 && queue.bytes() == 10, "as many old messages go as needed");
+    ok = ok && expect(push(queue, std::string(11, 'e')) == 11, "a message larger than the queue is dropped itself");
+    ok = ok && expect(drain(queue) == std::vector<std::string>({"cccc", "dddddd"}), "the newest audio is kept");
+    ok = ok && expect(!queue.overflowing(), "draining ends the backlog");
+    ok = ok && expect(stats.uplink_queue_overflows.load() == 1 && stats.uplink_queue_dropped_bytes.load() == 19 &&
+                          stats.uplink_queued_frames.load() == 4,
+                      "one overflow, the dropped bytes and the queued messages are counted");
+    if (ok) {
+        printf("ok   drop policy\n");
+    }
+    return ok;
+}
+
+bool check_merge() {
+    StreamStats stats;
+    SendQueue queue(config(SEND_OVERFLOW_MERGE, 10), &stats);
+    bool ok = expect(push(queue, "aabb") == 0 && push(queue, "ccdd") == 0, "8 of 10 bytes fit");
+    ok = ok && expect(push(queue, "eeff") == 2, "whole samples are cut from the oldest audio, no more");
+    ok = ok && expect(queue.bytes() == 10, "the capacity holds");
+    ok = ok && expect(push(queue, "ggg") == 4, "an odd shortfall cuts a whole sample more");
+    ok = ok && expect(drain(queue) == std::vector<std::string>({"ddeeffggg"}), "waiting audio is one message");
+    ok = ok && expect(stats.uplink_queue_overflows.load() == 1 && stats.uplink_queue_dropped_bytes.load() == 6,
+                      "one overflow and the cut bytes are counted");
+
+    SendQueue packets(config(SEND_OVERFLOW_MERGE, 10, 0), &stats);
+    push(packets, "aaaa");
+    push(packets, "bbbb");
+    ok = ok && expect(push(packets, "cccc") == 4, "packets that cannot be merged are dropped whole");
+    ok = ok && expect(drain(packets) == std::vector<std::string>({"bbbb", "cccc"}), "and stay separate messages");
+    if (ok) {
+        printf("ok   merge policy\n");
+    }
+    return ok;
+}
+
+bool check_event() {
+    StreamStats stats;
+    SendQueue queue(config(SEND_OVERFLOW_EVENT, 10), &stats);
+    push(queue, "aaaa");
+    push(queue, "bbbb");
+
+    // the streamer raises its event on the first drop of a backlog, when overflowing() was still false
+    int events = 0;
+    for (int backlog = 0; backlog < 3; backlog++) {
+        for (int i = 0; i < 5; i++) {
+            const bool was_overflowing = queue.overflowing();
+            if (push(queue, "cccc") > 0 && !was_overflowing) {
+                events++;
+            }
+        }
+        if (!expect(queue.bytes() == 8 && drain(queue) == std::vector<std::string>({"aaaa", "bbbb"}),
+                    "queued audio is never dropped, the new audio is")) {
+            return false;
+        }
+        push(queue, "aaaa");
+        push(queue, "bbbb");
+    }
+    bool ok = expect(events == 3, "every backlog raises the event once");
+    ok = ok && expect(stats.uplink_queue_overflows.load() == 3 && stats.uplink_queue_dropped_bytes.load() == 60,
+                      "each backlog is counted once, every dropped byte is");
+
+    ok = ok && expect(push(queue, "cc") == 0 && !queue.overflowing(), "audio that still fits is queued");
+
+    // nothing ever drains an empty queue: a message larger than all of it must not leave a backlog behind
+    SendQueue empty(config(SEND_OVERFLOW_EVENT, 10), &stats);
+    events = 0;
+    for (int i = 0; i < 2; i++) {
+        const bool was_overflowing = empty.overflowing();
+        if (push(empty, std::string(11, 'a')) > 0 && !was_overflowing) {
+            events++;
+        }
+    }
+    ok = ok && expect(events == 2 && !empty.overflowing(), "a drop from an empty queue is never swallowed");
+    if (ok) {
+        printf("ok   event policy\n");
+    }
+    return ok;
+}
+
+bool check_parse() {
+    SendOverflowPolicy policy = SEND_OVERFLOW_DROP;
+    bool ok = expect(send_overflow_policy_parse("Merge", &policy) && policy == SEND_OVERFLOW_MERGE, "merge parses");
+    ok = ok && expect(send_overflow_policy_parse("event", &policy) && policy == SEND_OVERFLOW_EVENT, "event parses");
+    ok = ok && expect(send_overflow_policy_parse("DROP", &policy) && policy == SEND_OVERFLOW_DROP, "drop parses");
+    ok = ok && expect(!send_overflow_policy_parse("oldest", &policy) && policy == SEND_OVERFLOW_DROP,
+                      "anything else is refused");
+    if (ok) {
+        printf("ok   policy names\n");
+    }
+    return ok;
+}
+
+} // namespace
+
+int main() {
+    if (!check_must_wait() || !check_drop() || !check_merge() || !check_event() || !check_parse()) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,197 @@
+//
+// Check of the uplink silence gate on 20 ms chunks at 8 kHz: the hangover after
+// speech, the pre-roll replayed in capture order when speech resumes, the
+// keep-alive chunks let through while silent, the unvoiced consonant rule, and
+// the held back frames and bytes counted in the stats.
+//
+// usage: silence_gate_check (exits non zero on the first failure)
+//
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "silence_gate.h"
+#include "stream_stats.h"
+
+namespace {
+
+const uint32_t RATE = 8000;
+const size_t CHUNK = 160; // 20 ms
+const uint64_t CHUNK_BYTES = CHUNK * sizeof(int16_t);
+
+// the default configuration, in chunks
+const int HANGOVER_CHUNKS = 20;
+const int PREROLL_CHUNKS = 10;
+const int KEEPALIVE_CHUNKS = 100;
+
+bool expect(bool condition, const char *what) {
+    if (!condition) {
+        printf("FAIL %s\n", what);
+    }
+    return condition;
+}
+
+// 1 kHz at about -12 dBFS
+std::vector<int16_t> speech() {
+    std::vector<int16_t> pcm(CHUNK);
+    for (size_t i = 0; i < CHUNK; i++) {
+        pcm[i] = static_cast<int16_t>(lround(8000 * sin(2 * M_PI * 1000 * i / RATE)));
+    }
+    return pcm;
+}
+
+// A constant far below the threshold, so the pre-roll can be told apart chunk by chunk.
+std::vector<int16_t> silence(int16_t level) {
+    return std::vector<int16_t>(CHUNK, level);
+}
+
+// A square wave 4 dB below the -45 dBFS threshold, changing sign every period samples.
+std::vector<int16_t> square(size_t period) {
+    std::vector<int16_t> pcm(CHUNK);
+    for (size_t i = 0; i < CHUNK; i++) {
+        pcm[i] = (i / period) % 2 ? -116 : 116;
+    }
+    return pcm;
+}
+
+bool admit(SilenceGate& gate, const std::vector<int16_t>& pcm) {
+    return gate.admit(pcm.data(), pcm.size());
+}
+
+size_t preroll_samples(const SilenceGate& gate) {
+    size_t samples;
+    gate.preroll(&samples);
+    return samples;
+}
+
+// Speech, then the silent chunks of the hangover; returns false if the gate did not behave.
+bool speak_then_hang_over(SilenceGate& gate) {
+    if (!expect(admit(gate, speech()), "speech is sent")) {
+        return false;
+    }
+    for (int i = 1; i <= HANGOVER_CHUNKS; i++) {
+        if (!expect(admit(gate, silence(0)), "silence within the hangover is sent")) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool check_hangover() {
+    StreamStats stats;
+    SilenceGate gate(RATE, 1, SilenceGateConfig(), &stats);
+    bool ok = expect(!admit(gate, silence(0)), "silence before any speech is held back");
+    ok = ok && speak_then_hang_over(gate);
+    ok = ok && expect(!admit(gate, silence(0)), "silence past the hangover is held back");
+    ok = ok && speak_then_hang_over(gate); // speech restarts the hangover
+    ok = ok && expect(!admit(gate, silence(0)), "and it runs out again");
+    ok = ok && expect(stats.uplink_suppressed_frames.load() == 3, "held back chunks are counted");
+    if (ok) {
+        printf("ok   hangover\n");
+    }
+    return ok;
+}
+
+bool check_preroll() {
+    StreamStats stats;
+    SilenceGate gate(RATE, 1, SilenceGateConfig(), &stats);
+    bool ok = speak_then_hang_over(gate);
+    ok = ok && expect(preroll_samples(gate) == 0, "nothing to replay while speech goes on");
+    for (int i = 1; i <= 15 && ok; i++) {
+        ok = expect(!admit(gate, silence(static_cast<int16_t>(i))), "silence is held back");
+    }
+    ok = ok && expect(admit(gate, speech()), "speech resumes");
+    size_t samples;
+    const int16_t *preroll = gate.preroll(&samples);
+    ok = ok && expect(samples == PREROLL_CHUNKS * CHUNK, "the pre-roll is the last 200 ms held back");
+    for (size_t i = 0; i < samples && ok; i++) {
+        ok = expect(preroll[i] == static_cast<int16_t>(6 + i / CHUNK), "the pre-roll keeps the capture order");
+    }
+    ok = ok && expect(stats.uplink_suppressed_frames.load() == 15, "every held back chunk is counted");
+    ok = ok && expect(stats.uplink_suppressed_bytes.load() == 5 * CHUNK_BYTES,
+                      "only the bytes that fell out of the pre-roll count as never sent");
+
+    ok = ok && expect(admit(gate, speech()) && preroll_samples(gate) == 0, "the pre-roll is replayed once");
+    if (ok) {
+        printf("ok   pre-roll\n");
+    }
+    return ok;
+}
+
+bool check_keepalive() {
+    StreamStats stats;
+    const int chunks = 250;
+    std::vector<int> sent;
+    {
+        SilenceGate gate(RATE, 1, SilenceGateConfig(), &stats);
+        if (!speak_then_hang_over(gate)) {
+            return false;
+        }
+        for (int i = 1; i <= chunks; i++) {
+            if (admit(gate, silence(0))) {
+                sent.push_back(i);
+                if (!expect(preroll_samples(gate) == 0, "a keep-alive chunk comes without pre-roll")) {
+                    return false;
+                }
+            }
+        }
+        if (!expect(stats.uplink_suppressed_bytes.load() == (chunks - 2 - PREROLL_CHUNKS) * CHUNK_BYTES,
+                    "bytes count once they can no longer be sent")) {
+            return false;
+        }
+    }
+    bool ok = expect(sent == std::vector<int>({KEEPALIVE_CHUNKS, 2 * KEEPALIVE_CHUNKS}),
+                     "one chunk is let through every keep-alive interval");
+    ok = ok && expect(stats.uplink_suppressed_frames.load() == chunks - 2, "keep-alive chunks are not counted");
+    ok = ok && expect(stats.uplink_suppressed_bytes.load() == (chunks - 2) * CHUNK_BYTES,
+                      "the pre-roll still held counts when the gate goes");
+
+    SilenceGate resumed(RATE, 1, SilenceGateConfig(), &stats);
+    ok = ok && speak_then_hang_over(resumed);
+    for (int i = 1; i <= KEEPALIVE_CHUNKS && ok; i++) {
+        ok = expect(admit(resumed, silence(0)) == (i == KEEPALIVE_CHUNKS), "the keep-alive chunk is let through");
+    }
+    ok = ok && expect(admit(resumed, speech()) && preroll_samples(resumed) == 0,
+                      "audio held before a keep-alive chunk is not replayed after it");
+
+    SilenceGateConfig config;
+    config.keepalive_ms = 0;
+    SilenceGate gate(RATE, 1, config, &stats);
+    ok = ok && speak_then_hang_over(gate);
+    for (int i = 1; i <= chunks && ok; i++) {
+        ok = expect(!admit(gate, silence(0)), "a keep-alive of 0 lets nothing through");
+    }
+    if (ok) {
+        printf("ok   keep-alive\n");
+    }
+    return ok;
+}
+
+bool check_unvoiced() {
+    StreamStats stats;
+    SilenceGate gate(RATE, 1, SilenceGateConfig(), &stats);
+    const std::vector<int16_t> hiss = square(1);
+    const std::vector<int16_t> hum = square(40);
+    bool ok = expect(gate.is_speech(hiss.data(), hiss.size()), "a quiet signal crossing zero often is speech");
+    ok = ok && expect(!gate.is_speech(hum.data(), hum.size()), "the same energy crossing zero rarely is not");
+
+    SilenceGateConfig config;
+    config.threshold_dbfs = -60;
+    SilenceGate sensitive(RATE, 1, config, &stats);
+    ok = ok && expect(sensitive.is_speech(hum.data(), hum.size()), "the threshold is configurable");
+    if (ok) {
+        printf("ok   unvoiced consonants\n");
+    }
+    return ok;
+}
+
+} // namespace
+
+int main() {
+    if (!check_hangover() || !check_preroll() || !check_keepalive() || !check_unvoiced()) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,237 @@
+//
+// Check of the single-producer/single-consumer ring: write(), write_regions()
+// and commit() wrapping around the end of the storage, a producer and a
+// consumer thread passing a numbered stream, and discard_all() racing with
+// reads the consumer has already started.
+//
+// usage: spsc_ring_check (exits non zero on the first failure)
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "spsc_ring.h"
+
+namespace {
+
+const uint64_t THREADED_ITEMS = 2000000;
+
+bool expect(bool condition, const char *what) {
+    if (!condition) {
+        printf("FAIL %s\n", what);
+    }
+    return condition;
+}
+
+// xorshift, one per thread
+struct Random {
+    uint64_t state;
+
+    uint32_t next(uint32_t bound) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return static_cast<uint32_t>((state >> 32) % bound);
+    }
+};
+
+// Fills up to count items in place with the numbers from *next on, returns how many were committed.
+size_t produce_in_place(SpscRing<uint64_t>& ring, size_t count, uint64_t tag, uint64_t *next) {
+    uint64_t *first, *second;
+    size_t first_len, second_len;
+    const size_t free_slots = ring.write_regions(&first, &first_len, &second, &second_len);
+    count = std::min(count, free_slots);
+    for (size_t i = 0; i < count; i++) {
+        (i < first_len ? first[i] : second[i - first_len]) = tag | (*next)++;
+    }
+    ring.commit(count);
+    return count;
+}
+
+bool check_wrap_around() {
+    SpscRing<uint64_t> ring(5);
+    if (!expect(ring.capacity() == 8 && ring.write_available() == 8, "capacity rounds up to a power of two")) {
+        return false;
+    }
+    Random random = {0x9e3779b97f4a7c15ull};
+    uint64_t written = 0;
+    uint64_t read = 0;
+    uint64_t *storage = nullptr;
+    for (int round = 0; round < 10000; round++) {
+        uint64_t *first, *second;
+        size_t first_len, second_len;
+        const size_t free_slots = ring.write_regions(&first, &first_len, &second, &second_len);
+        if (!storage) {
+            storage = second;
+        }
+        const bool regions_ok = free_slots == ring.write_available() && first_len + second_len == free_slots &&
+                                second == storage && first >= storage && first + first_len <= storage + 8 &&
+                                (second_len == 0 || first + first_len == storage + 8);
+        if (!expect(regions_ok, "write_regions spans the free slots, the second one from the start")) {
+            return false;
+        }
+
+        const size_t count = random.next(9);
+        if (round % 2) {
+            uint64_t items[8];
+            for (size_t i = 0; i < count; i++) {
+                items[i] = written + i;
+            }
+            const size_t accepted = ring.write(items, count);
+            if (!expect(accepted == std::min(count, free_slots), "write takes what fits")) {
+                return false;
+            }
+            written += accepted;
+        } else {
+            produce_in_place(ring, count, 0, &written);
+        }
+
+        if (!expect(ring.read_available() == written - read && ring.size_approx() == written - read,
+                    "read_available counts the committed items")) {
+            return false;
+        }
+        uint64_t out[8];
+        const size_t got = ring.read(out, random.next(9));
+        for (size_t i = 0; i < got; i++) {
+            if (!expect(out[i] == read++, "items come out in order across the wrap")) {
+                return false;
+            }
+        }
+    }
+    if (!expect(written > 10000, "the stream went around the ring many times")) {
+        return false;
+    }
+    printf("ok   wrap-around\n");
+    return true;
+}
+
+bool check_discard() {
+    SpscRing<uint64_t> ring(8);
+    uint64_t next = 0;
+    uint64_t out[8];
+    produce_in_place(ring, 6, 0, &next);
+    bool ok = expect(ring.read(out, 2) == 2 && out[0] == 0 && out[1] == 1, "reads before the discard");
+
+    ring.discard_all();
+    ok = ok && expect(ring.write_available() == 4, "discarded items hold their slots until the consumer runs");
+    ok = ok && expect(ring.size_approx() == 0, "discarded items are not counted as queued");
+    produce_in_place(ring, 3, 0, &next);
+    ok = ok && expect(ring.read_available() == 3, "the consumer skips the discarded items");
+    ok = ok && expect(ring.write_available() == 5, "and frees their slots");
+    ok = ok && expect(ring.read(out, 8) == 3 && out[0] == 6 && out[2] == 8,
+                      "items written after the discard are kept");
+
+    produce_in_place(ring, 4, 0, &next);
+    ring.discard_all();
+    ok = ok && expect(ring.skip(8) == 0 && ring.read_available() == 0, "skip after a discard finds nothing");
+    ring.discard_all();
+    ok = ok && expect(ring.read(out, 8) == 0 && ring.write_available() == 8,
+                      "discarding an empty ring is harmless");
+    if (ok) {
+        printf("ok   discard\n");
+    }
+    return ok;
+}
+
+// The producer numbers items per generation and starts a new generation after each discard_all(). Whatever
+// the timing, the consumer sees every generation it reaches from item 0 on and without gaps, in order.
+bool run_threads(bool discard) {
+    SpscRing<uint64_t> ring(256);
+    std::atomic<bool> done{false};
+    std::thread producer([&] {
+        Random random = {0x2545f4914f6cdd1dull};
+        uint64_t generation = 0;
+        uint64_t next = 0;
+        uint64_t total = 0;
+        while (total < THREADED_ITEMS) {
+            if (discard && random.next(64) == 0) {
+                ring.discard_all();
+                generation++;
+                next = 0;
+            }
+            const size_t count = std::min<uint64_t>(1 + random.next(100), THREADED_ITEMS - total);
+            size_t written;
+            if (random.next(2)) {
+                std::vector<uint64_t> items(count);
+                for (size_t i = 0; i < count; i++) {
+                    items[i] = generation << 32 | (next + i);
+                }
+                written = ring.write(items.data(), count);
+                next += written;
+            } else {
+                written = produce_in_place(ring, count, generation << 32, &next);
+            }
+            total += written;
+            if (!written) {
+                std::this_thread::yield();
+            }
+        }
+        done.store(true, std::memory_order_release);
+    });
+
+    Random random = {0x853c49e6748fea9bull};
+    uint64_t generation = 0;
+    uint64_t expected = 0;
+    uint64_t received = 0;
+    bool ok = true;
+    std::vector<uint64_t> out(128);
+    for (;;) {
+        const bool finished = done.load(std::memory_order_acquire);
+        size_t got;
+        if (!discard && random.next(8) == 0) {
+            // skipped items are not seen, the numbering goes on; with discards a skip could straddle generations
+            got = ring.skip(1 + random.next(4));
+            expected += got;
+            received += got;
+            continue;
+        }
+        got = ring.read(out.data(), 1 + random.next(128));
+        for (size_t i = 0; i < got && ok; i++) {
+            const uint64_t item_generation = out[i] >> 32;
+            const uint64_t item = out[i] & 0xffffffff;
+            if (item_generation == generation && item == expected) {
+                expected++;
+            } else if (discard && item_generation > generation && item == 0) {
+                generation = item_generation;
+                expected = 1;
+            } else {
+                ok = expect(false, discard ? "generation seen from its start, without gaps"
+                                           : "items come out in order between threads");
+            }
+        }
+        received += got;
+        if (!ok || (finished && ring.read_available() == 0)) {
+            break;
+        }
+        if (!got) {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    return ok && expect(discard || received == THREADED_ITEMS, "every item arrives");
+}
+
+bool check_threads() {
+    if (!run_threads(false)) {
+        return false;
+    }
+    printf("ok   producer and consumer threads\n");
+    if (!run_threads(true)) {
+        return false;
+    }
+    printf("ok   discard_all during reads\n");
+    return true;
+}
+
+} // namespace
+
+int main() {
+    if (!check_wrap_around() || !check_discard() || !check_threads()) {
+        return 1;
+    }
+    return 0;
+}
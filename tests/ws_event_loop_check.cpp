@@ -0,0 +1,392 @@
+//
+// Loopback check of the event loop websocket client against a minimal server
+// run by the test itself on 127.0.0.1: upgrade request and handshake, masked
+// frames of every length encoding, fragmented messages with a ping in between,
+// heart beats, the close handshake from either side and reconnection. Frames
+// sent while the connection drops must never reach the next connection ahead
+// of its upgrade request.
+//
+// usage: ws_event_loop_check (exits non zero on the first failure)
+//
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/sha.h>
+
+#include "base64.h"
+#include "ws_event_loop.h"
+
+namespace {
+
+const int TIMEOUT_MS = 3000;
+const int RECONNECT_ROUNDS = 20;
+
+bool expect(bool condition, const char *what) {
+    if (!condition) {
+        printf("FAIL %s\n", what);
+    }
+    return condition;
+}
+
+// events of the client, handed from the loop thread to the test
+class Events {
+  public:
+    void push(const WsEvent& event) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Received received;
+        received.type = event.type;
+        if (event.type == WS_EVENT_TEXT || event.type == WS_EVENT_BINARY) {
+            received.data.assign(event.data, event.len);
+        }
+        received.close_code = event.type == WS_EVENT_CLOSE ? event.close_code : 0;
+        m_events.push_back(received);
+        m_changed.notify_all();
+    }
+
+    // waits for the next event of the given type, skipping the others
+    bool wait(WsEventType type, std::string *data = nullptr, uint16_t *close_code = nullptr) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(TIMEOUT_MS);
+        for (;;) {
+            while (!m_events.empty()) {
+                Received received = m_events.front();
+                m_events.pop_front();
+                if (received.type == type) {
+                    if (data) {
+                        *data = received.data;
+                    }
+                    if (close_code) {
+                        *close_code = received.close_code;
+                    }
+                    return true;
+                }
+            }
+            if (m_changed.wait_until(lock, deadline) == std::cv_status::timeout && m_events.empty()) {
+                return false;
+            }
+        }
+    }
+
+  private:
+    struct Received {
+        WsEventType type;
+        std::string data;
+        uint16_t close_code;
+    };
+
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::deque<Received> m_events;
+};
+
+bool wait_readable(int fd) {
+    pollfd pfd = {fd, POLLIN, 0};
+    return poll(&pfd, 1, TIMEOUT_MS) == 1;
+}
+
+bool read_exact(int fd, void *buf, size_t len) {
+    char *p = static_cast<char *>(buf);
+    while (len > 0) {
+        if (!wait_readable(fd)) {
+            return false;
+        }
+        ssize_t n = recv(fd, p, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool write_all(int fd, const std::string& data) {
+    return send(fd, data.data(), data.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(data.size());
+}
+
+int listen_loopback(uint16_t *port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(fd, 4) != 0 ||
+        getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &addr_len) != 0) {
+        return -1;
+    }
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+int accept_client(int listen_fd) {
+    return wait_readable(listen_fd) ? accept(listen_fd, nullptr, nullptr) : -1;
+}
+
+// Reads the upgrade request, byte by byte so that nothing after it is consumed, and accepts it.
+bool upgrade(int fd, std::string *request) {
+    request->clear();
+    char c;
+    while (request->size() < 4 || request->compare(request->size() - 4, 4, "\r\n\r\n") != 0) {
+        if (request->size() > 16384 || !read_exact(fd, &c, 1)) {
+            return false;
+        }
+        request->push_back(c);
+    }
+    const char KEY[] = "Sec-WebSocket-Key: ";
+    size_t key = request->find(KEY);
+    if (key == std::string::npos) {
+        return false;
+    }
+    key += sizeof(KEY) - 1;
+    std::string accept_input = request->substr(key, request->find("\r\n", key) - key);
+    accept_input += "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    SHA1(reinterpret_cast<const unsigned char *>(accept_input.data()), accept_input.size(), digest);
+    return write_all(fd, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                         "Sec-WebSocket-Accept: " +
+                             base64_encode(digest, sizeof(digest), false) + "\r\n\r\n");
+}
+
+struct Frame {
+    bool fin;
+    int opcode;
+    std::string payload;
+};
+
+// A client frame, which must be masked.
+bool read_frame(int fd, Frame *frame) {
+    uint8_t header[2];
+    if (!read_exact(fd, header, 2) || !(header[1] & 0x80)) {
+        return false;
+    }
+    frame->fin = header[0] & 0x80;
+    frame->opcode = header[0] & 0x0f;
+    uint64_t len = header[1] & 0x7f;
+    if (len >= 126) {
+        uint8_t ext[8];
+        const size_t ext_len = len == 126 ? 2 : 8;
+        if (!read_exact(fd, ext, ext_len)) {
+            return false;
+        }
+        len = 0;
+        for (size_t i = 0; i < ext_len; i++) {
+            len = len << 8 | ext[i];
+        }
+    }
+    uint8_t mask[4];
+    frame->payload.assign(len, '\0');
+    if (!read_exact(fd, mask, 4) || (len > 0 && !read_exact(fd, &frame->payload[0], len))) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        frame->payload[i] ^= mask[i & 3];
+    }
+    return true;
+}
+
+// A server frame, unmasked.
+bool write_frame(int fd, int opcode, bool fin, const std::string& payload) {
+    std::string frame;
+    frame.push_back(static_cast<char>((fin ? 0x80 : 0) | opcode));
+    if (payload.size() < 126) {
+        frame.push_back(static_cast<char>(payload.size()));
+    } else {
+        frame.push_back(126);
+        frame.push_back(static_cast<char>(payload.size() >> 8));
+        frame.push_back(static_cast<char>(payload.size()));
+    }
+    return write_all(fd, frame + payload);
+}
+
+bool expect_frame(int fd, int opcode, const std::string& payload, const char *what) {
+    Frame frame;
+    return expect(read_frame(fd, &frame) && frame.fin && frame.opcode == opcode && frame.payload == payload, what);
+}
+
+std::string pattern(size_t len) {
+    std::string data(len, '\0');
+    for (size_t i = 0; i < len; i++) {
+        data[i] = static_cast<char>(i * 7 + (i >> 8));
+    }
+    return data;
+}
+
+bool check_connect(int listen_fd, WsTransport& transport, Events& events, int *fd) {
+    std::string request;
+    transport.start();
+    *fd = accept_client(listen_fd);
+    bool ok = expect(*fd >= 0 && upgrade(*fd, &request), "upgrade handshake");
+    ok = ok && expect(request.compare(0, 31, "GET /realtime?model=x HTTP/1.1\r") == 0, "request line");
+    ok = ok && expect(request.find("\r\nAuthorization: Bearer test\r\n") != std::string::npos, "extra headers");
+    ok = ok && expect(events.wait(WS_EVENT_OPEN) && transport.is_open(), "open event");
+    if (ok) {
+        printf("ok   connect\n");
+    }
+    return ok;
+}
+
+bool check_frames(int fd, WsTransport& transport, Events& events) {
+    bool ok = true;
+    for (size_t len : {size_t(0), size_t(5), size_t(125), size_t(126), size_t(65535), size_t(65536), size_t(200000)}) {
+        const std::string data = pattern(len);
+        ok = ok && expect(transport.send_binary(data.data(), data.size()), "send_binary while open");
+        ok = ok && expect_frame(fd, 0x2, data, "binary frame of every length encoding");
+    }
+    ok = ok && expect(transport.send_text("hello", 5), "send_text while open");
+    ok = ok && expect_frame(fd, 0x1, "hello", "text frame");
+
+    std::string text;
+    ok = ok && expect(write_frame(fd, 0x1, true, "{\"type\":\"x\"}") && events.wait(WS_EVENT_TEXT, &text) &&
+                          text == "{\"type\":\"x\"}",
+                      "text message from the server");
+    const std::string large = pattern(40000);
+    ok = ok && expect(write_frame(fd, 0x2, true, large) && events.wait(WS_EVENT_BINARY, &text) && text == large,
+                      "binary message from the server");
+    if (ok) {
+        printf("ok   frames\n");
+    }
+    return ok;
+}
+
+bool check_fragments_and_ping(int fd, Events& events) {
+    std::string text;
+    bool ok = expect(write_frame(fd, 0x1, false, "frag-") && write_frame(fd, 0x9, true, "p1") &&
+                         write_frame(fd, 0x0, false, "ment-") && write_frame(fd, 0x0, true, "ed"),
+                     "fragments written");
+    ok = ok && expect_frame(fd, 0xa, "p1", "pong to a ping between fragments");
+    ok = ok && expect(events.wait(WS_EVENT_TEXT, &text) && text == "frag-ment-ed", "fragments reassembled");
+
+    // idle for the heart beat interval
+    ok = ok && expect_frame(fd, 0x9, "", "heart beat ping when idle");
+    if (ok) {
+        printf("ok   fragments and ping\n");
+    }
+    return ok;
+}
+
+bool check_server_close(int listen_fd, WsTransport& transport, Events& events, int *fd) {
+    uint16_t code = 0;
+    std::string request;
+    bool ok = expect(write_frame(*fd, 0x8, true, std::string("\x03\xe9going away", 12)), "close written");
+    ok = ok && expect_frame(*fd, 0x8, "\x03\xe9", "close reply echoes the code");
+    ok = ok && expect(events.wait(WS_EVENT_CLOSE, nullptr, &code) && code == 1001, "close event with the code");
+    ok = ok && expect(!transport.send_text("late", 4), "send_text fails once closed");
+    close(*fd);
+
+    *fd = accept_client(listen_fd);
+    ok = ok && expect(*fd >= 0 && upgrade(*fd, &request) && request.compare(0, 4, "GET ") == 0,
+                      "reconnect starts with the upgrade request");
+    ok = ok && expect(events.wait(WS_EVENT_OPEN), "open event after reconnecting");
+    ok = ok && expect(transport.send_text("again", 5), "send_text after reconnecting");
+    ok = ok && expect_frame(*fd, 0x1, "again", "frames flow on the new connection");
+    if (ok) {
+        printf("ok   close and reconnect\n");
+    }
+    return ok;
+}
+
+// The connection drops under a sender: its frames are cut off with the socket, never queued for the next one.
+bool check_drops_under_load(int listen_fd, WsTransport& transport, Events& events, int *fd) {
+    std::atomic<bool> running{true};
+    std::thread sender([&] {
+        const std::string data = pattern(3200);
+        while (running.load()) {
+            transport.send_binary(data.data(), data.size());
+            std::this_thread::yield();
+        }
+    });
+    bool ok = true;
+    std::string request;
+    for (int round = 0; round < RECONNECT_ROUNDS && ok; round++) {
+        Frame frame;
+        ok = expect(read_frame(*fd, &frame) && frame.opcode == 0x2, "frames from the sender");
+        shutdown(*fd, SHUT_RDWR);
+        close(*fd);
+        ok = ok && expect(events.wait(WS_EVENT_CLOSE), "drop reported");
+        *fd = accept_client(listen_fd);
+        ok = ok && expect(*fd >= 0 && upgrade(*fd, &request), "reconnect under load");
+        ok = ok && expect(request.compare(0, 4, "GET ") == 0, "no stale frame ahead of the upgrade request");
+        ok = ok && expect(events.wait(WS_EVENT_OPEN), "open event under load");
+    }
+    running = false;
+    sender.join();
+    if (ok) {
+        printf("ok   drops under load\n");
+    }
+    return ok;
+}
+
+bool check_stop(int fd, std::unique_ptr<WsTransport> transport) {
+    std::mutex mutex;
+    std::condition_variable stopped_cv;
+    bool stopped = false;
+    transport->stop([&] {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+        stopped_cv.notify_all();
+    });
+    Frame frame;
+    // audio still in flight may come first
+    while (read_frame(fd, &frame) && frame.opcode != 0x8) {
+    }
+    bool ok = expect(frame.opcode == 0x8 && frame.payload == "\x03\xe8", "stop sends a normal closure");
+    ok = ok && expect(write_frame(fd, 0x8, true, "\x03\xe8"), "close reply written");
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        ok = ok && expect(stopped_cv.wait_for(lock, std::chrono::milliseconds(TIMEOUT_MS), [&] { return stopped; }),
+                          "on_stopped runs");
+    }
+    close(fd);
+    if (ok) {
+        printf("ok   stop\n");
+    }
+    return ok;
+}
+
+} // namespace
+
+int main() {
+    uint16_t port = 0;
+    int listen_fd = listen_loopback(&port);
+    if (listen_fd < 0) {
+        printf("FAIL cannot listen on 127.0.0.1\n");
+        return 1;
+    }
+    ws_event_loop_configure(1, {});
+
+    WsTransportOptions options;
+    options.url = "ws://127.0.0.1:" + std::to_string(port) + "/realtime?model=x";
+    options.headers["Authorization"] = "Bearer test";
+    options.per_message_deflate = false;
+    options.ping_interval_secs = 1;
+    Events events;
+    std::unique_ptr<WsTransport> transport =
+        ws_event_loop_transport_create(options, [&events](const WsEvent& event) { events.push(event); });
+    if (!expect(transport != nullptr, "transport on the event loop")) {
+        return 1;
+    }
+
+    int fd = -1;
+    bool ok = check_connect(listen_fd, *transport, events, &fd) && check_frames(fd, *transport, events) &&
+              check_fragments_and_ping(fd, events) && check_server_close(listen_fd, *transport, events, &fd) &&
+              check_drops_under_load(listen_fd, *transport, events, &fd) && check_stop(fd, std::move(transport));
+    ws_event_loop_shutdown();
+    close(listen_fd);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+#include "tls_session_cache.h"
+
+#include <atomic>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+struct Peer {
+    SSL_SESSION *session = nullptr; // last session the server issued, offered to the next connection
+};
+
+struct Context {
+    std::string cafile;
+    std::string certfile;
+    std::string keyfile;
+    SSL_CTX *ctx;
+    std::unordered_map<std::string, Peer> peers; // by host:port, nodes never move
+};
+
+bool session_usable(SSL_SESSION *session) {
+    return SSL_SESSION_is_resumable(session) &&
+           SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) > time(nullptr);
+}
+
+class Cache {
+  public:
+    static Cache& instance() {
+        static Cache cache;
+        return cache;
+    }
+
+    SSL_CTX *context(const std::string& cafile, const std::string& certfile, const std::string& keyfile,
+                     std::string *error) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& context : m_contexts) {
+            if (context->cafile == cafile && context->certfile == certfile && context->keyfile == keyfile) {
+                return context->ctx;
+            }
+        }
+
+        if (m_peer_index < 0) {
+            m_peer_index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+        }
+        SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+        if (!ctx || m_peer_index < 0) {
+            *error = "cannot create TLS context";
+            SSL_CTX_free(ctx);
+            return nullptr;
+        }
+        SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+        SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+        if (cafile == "NONE") {
+            SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);
+        } else {
+            int ok = cafile == "SYSTEM" || cafile.empty() ? SSL_CTX_set_default_verify_paths(ctx)
+                                                          : SSL_CTX_load_verify_locations(ctx, cafile.c_str(), nullptr);
+            if (ok != 1) {
+                *error = "cannot load CA file " + cafile;
+                SSL_CTX_free(ctx);
+                return nullptr;
+            }
+            SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+        }
+        if (!certfile.empty() && SSL_CTX_use_certificate_chain_file(ctx, certfile.c_str()) != 1) {
+            *error = "cannot load certificate " + certfile;
+            SSL_CTX_free(ctx);
+            return nullptr;
+        }
+        if (!keyfile.empty() && SSL_CTX_use_PrivateKey_file(ctx, keyfile.c_str(), SSL_FILETYPE_PEM) != 1) {
+            *error = "cannot load key " + keyfile;
+            SSL_CTX_free(ctx);
+            return nullptr;
+        }
+
+        // sessions are kept per peer here, OpenSSL's own cache is keyed for servers
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, &Cache::onNewSession);
+
+        m_contexts.emplace_back(new Context{cafile, certfile, keyfile, ctx, {}});
+        return ctx;
+    }
+
+    void attach(SSL_CTX *ctx, SSL *ssl, const std::string& peer) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& context : m_contexts) {
+            if (context->ctx != ctx) {
+                continue;
+            }
+            Peer& cached = context->peers[peer];
+            if (cached.session && !session_usable(cached.session)) {
+                SSL_SESSION_free(cached.session);
+                cached.session = nullptr;
+            }
+            if (cached.session) {
+                SSL_set_session(ssl, cached.session);
+            }
+            SSL_set_ex_data(ssl, m_peer_index, &cached);
+            return;
+        }
+    }
+
+    void handshakeDone(SSL *ssl) {
+        m_handshakes.fetch_add(1, std::memory_order_relaxed);
+        if (SSL_session_reused(ssl)) {
+            m_resumed.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    TlsSessionStats stats() const {
+        return TlsSessionStats{m_handshakes.load(std::memory_order_relaxed), m_resumed.load(std::memory_order_relaxed)};
+    }
+
+  private:
+    Cache() = default;
+
+    // Called by OpenSSL with every session the server issues (TLS 1.3 sends tickets after the
+    // handshake, possibly several); the latest one replaces the cached session of the peer.
+    static int onNewSession(SSL *ssl, SSL_SESSION *session) {
+        Cache& cache = instance();
+        std::lock_guard<std::mutex> lock(cache.m_mutex);
+        Peer *peer = static_cast<Peer *>(SSL_get_ex_data(ssl, cache.m_peer_index));
+        if (!peer) {
+            return 0;
+        }
+        if (peer->session) {
+            SSL_SESSION_free(peer->session);
+        }
+        peer->session = session;
+        return 1; // the reference is ours
+    }
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<Context>> m_contexts;
+    int m_peer_index = -1;
+    std::atomic<uint64_t> m_handshakes{0};
+    std::atomic<uint64_t> m_resumed{0};
+};
+
+} // namespace
+
+SSL_CTX *tls_client_context(const std::string& cafile, const std::string& certfile, const std::string& keyfile,
+                            std::string *error) {
+    return Cache::instance().context(cafile, certfile, keyfile, error);
+}
+
+void tls_session_attach(SSL_CTX *ctx, SSL *ssl, const std::string& peer) {
+    Cache::instance().attach(ctx, ssl, peer);
+}
+
+void tls_session_handshake_done(SSL *ssl) {
+    Cache::instance().handshakeDone(ssl);
+}
+
+TlsSessionStats tls_session_stats() {
+    return Cache::instance().stats();
+}
@@ -0,0 +1,43 @@
+#ifndef TLS_SESSION_CACHE_H
+#define TLS_SESSION_CACHE_H
+
+#include <cstdint>
+#include <string>
+
+#include <openssl/ssl.h>
+
+//
+// Client TLS state shared by every connection of the module.
+//
+// One SSL_CTX per set of TLS files: CA certificates and the client
+// certificate and key are loaded once, not on every connection. Each context
+// keeps the last session (TLS 1.2 session id or TLS 1.3 ticket) the server
+// gave for every host:port, and offers it on the next handshake to the same
+// peer, which then skips the certificate exchange and the key agreement of a
+// full handshake.
+//
+// All functions are thread safe. Contexts and sessions live as long as the
+// process.
+//
+
+// Returns the context for the TLS files, nullptr with a reason in error if
+// they cannot be loaded. cafile may be "SYSTEM" or "NONE" like the
+// STREAM_TLS_CA_FILE channel variable.
+SSL_CTX *tls_client_context(const std::string& cafile, const std::string& certfile, const std::string& keyfile,
+                            std::string *error);
+
+// Offers the cached session of peer (host:port) on ssl, created from ctx, and
+// remembers the one the server issues. Call before the handshake starts.
+void tls_session_attach(SSL_CTX *ctx, SSL *ssl, const std::string& peer);
+
+// Accounts a completed handshake as full or resumed.
+void tls_session_handshake_done(SSL *ssl);
+
+struct TlsSessionStats {
+    uint64_t handshakes; // completed client handshakes
+    uint64_t resumed;    // of which resumed a cached session
+};
+
+TlsSessionStats tls_session_stats();
+
+#endif // TLS_SESSION_CACHE_H
@@ -0,0 +1,419 @@
+//
+// Multi-session load generator for the streaming path, meant to run against
+// tools/mock_realtime_server to find the per-node call ceiling.
+//
+// Each simulated call is what an AudioStreamer does for a live channel, minus
+// FreeSWITCH: an ix::WebSocket client configured the same way, the uplink
+// framing (input_audio_buffer.append or raw PCM16 frames) and the downlink
+// path of the core library (message scan, base64 decode, PlaybackPipeline).
+// A few media threads play the role of the FreeSWITCH media clock: every 20 ms
+// they send one frame and read one frame back for each call.
+//
+// Reported for the measurement window, after all calls are up:
+//   CPU per call        process CPU time / wall time / calls
+//   memory per call     resident set growth since before the first call / calls
+//   threads             threads of the process
+//   delivered latency   mock server send -> audio queued for playback, percentiles
+//
+// usage: load_generator [--url ws://127.0.0.1:8080] [--calls 100] [--duration 30]
+//                       [--ramp-ms 10] [--server-rate 24000] [--channel-rate 16000]
+//                       [--media-threads 4] [--raw] [--deflate]
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <ixwebsocket/IXNetSystem.h>
+#include <ixwebsocket/IXWebSocket.h>
+
+#include "base64_simd.h"
+#include "playback_pipeline.h"
+#include "realtime_protocol.h"
+#include "stream_stats.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const uint32_t FRAME_MS = 20;
+const uint32_t PLAYBACK_QUEUE_MS = 30000; // module default
+
+struct Options {
+    std::string url = "ws://127.0.0.1:8080";
+    size_t calls = 100;
+    uint32_t duration_s = 30;
+    uint32_t ramp_ms = 10;
+    uint32_t server_rate = 24000;
+    uint32_t channel_rate = 16000;
+    size_t media_threads = 4;
+    bool raw = false;
+    bool deflate = false;
+};
+
+uint64_t monotonic_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// "name":<number> anywhere in the text, 0 if absent
+uint64_t find_number(const char *text, size_t len, const char *name) {
+    const char *end = text + len;
+    const size_t name_len = strlen(name);
+    for (const char *p = text; p + name_len + 3 < end; p++) {
+        p = static_cast<const char *>(memchr(p, '"', end - p));
+        if (!p || p + name_len + 3 >= end) {
+            break;
+        }
+        if (!memcmp(p + 1, name, name_len) && p[name_len + 1] == '"' && p[name_len + 2] == ':') {
+            return strtoull(p + name_len + 3, nullptr, 10);
+        }
+    }
+    return 0;
+}
+
+long resident_bytes() {
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+int thread_count() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 8, "Threads:") == 0) {
+            return atoi(line.c_str() + 8);
+        }
+    }
+    return 0;
+}
+
+double cpu_seconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+class SimCall {
+  public:
+    SimCall(const Options& options, const std::vector<int16_t>& uplink)
+        : m_options(options), m_uplink(uplink), m_playback(options.server_rate, options.channel_rate,
+                                                           PLAYBACK_QUEUE_MS, &m_stats),
+          m_frame(options.channel_rate * FRAME_MS / 1000) {
+        m_message.resize(realtime_audio_append_size(uplink.size() * sizeof(int16_t)));
+        m_latencies.reserve(options.duration_s * 1000 / 20);
+    }
+
+    void start() {
+        std::string url = m_options.url;
+        url += url.find('?') == std::string::npos ? "?stamp=1" : "&stamp=1";
+        m_ws.setUrl(url);
+        if (!m_options.deflate) {
+            m_ws.disablePerMessageDeflate();
+        }
+        m_ws.setOnMessageCallback([this](const ix::WebSocketMessagePtr& msg) { onMessage(msg); });
+        m_ws.start();
+    }
+
+    void stop() {
+        m_ws.stop();
+    }
+
+    bool connected() const {
+        return m_connected.load(std::memory_order_relaxed);
+    }
+
+    // Media clock tick: one uplink frame out, one playback frame in.
+    void tick() {
+        if (!connected()) {
+            return;
+        }
+        const size_t bytes = m_uplink.size() * sizeof(int16_t);
+        const uint8_t *pcm = reinterpret_cast<const uint8_t *>(m_uplink.data());
+        if (m_options.raw) {
+            m_ws.sendBinary(ix::IXWebSocketSendData(reinterpret_cast<const char *>(pcm), bytes));
+        } else {
+            size_t len = realtime_write_audio_append(pcm, bytes, &m_message[0]);
+            m_ws.sendUtf8Text(ix::IXWebSocketSendData(m_message.data(), len));
+        }
+        m_stats.add(m_stats.uplink_frames);
+        m_stats.add(m_stats.uplink_bytes, bytes);
+
+        // same playout as write_frame, which counts the underruns
+        m_playback.playout(m_frame.data(), m_frame.size(), m_response_done.load(std::memory_order_relaxed));
+    }
+
+    // Only valid once the call is stopped.
+    const std::vector<uint32_t>& latencies() const {
+        return m_latencies;
+    }
+    const StreamStats& stats() const {
+        return m_stats;
+    }
+
+    void setRecording(bool recording) {
+        m_recording.store(recording, std::memory_order_relaxed);
+    }
+
+  private:
+    void onMessage(const ix::WebSocketMessagePtr& msg) {
+        if (msg->type == ix::WebSocketMessageType::Open) {
+            m_stats.add(m_stats.connects);
+            m_connected = true;
+        } else if (msg->type == ix::WebSocketMessageType::Close) {
+            m_connected = false;
+        } else if (msg->type == ix::WebSocketMessageType::Error) {
+            m_stats.add(m_stats.connection_errors);
+        } else if (msg->type == ix::WebSocketMessageType::Message) {
+            if (msg->binary) {
+                m_stats.add(m_stats.downlink_chunks);
+                m_response_done = false;
+                m_playback.push_pcm(reinterpret_cast<const uint8_t *>(msg->str.data()), msg->str.size());
+                record(m_raw_sent_us);
+                m_raw_sent_us = 0;
+            } else {
+                onText(msg->str.data(), msg->str.size());
+            }
+        }
+    }
+
+    void onText(const char *text, size_t len) {
+        realtime_message_t msg;
+        if (!realtime_scan_message(text, len, &msg)) {
+            return;
+        }
+        if (msg.event == REALTIME_EVENT_SPEECH_STARTED) {
+            m_playback.clear();
+        } else if (msg.event == REALTIME_EVENT_AUDIO_DONE) {
+            m_response_done = true;
+            m_playback.end_response();
+        } else if (msg.event == REALTIME_EVENT_AUDIO_DELTA && msg.delta) {
+            m_stats.add(m_stats.downlink_chunks);
+            m_response_done = false;
+            bool ok = false;
+            size_t samples = 0;
+            if (!m_playback.push_base64_in_place(msg.delta, msg.delta_len, &ok, &samples)) {
+                m_decoded.resize(base64_decoded_max_size(msg.delta_len));
+                size_t decoded = 0;
+                if (base64_decode_into(msg.delta, msg.delta_len, m_decoded.data(), &decoded)) {
+                    m_playback.push_pcm(m_decoded.data(), decoded);
+                }
+            }
+            record(find_number(text, len, "mock_sent_us"));
+        } else if (msg.type && msg.type_len == 15 && !memcmp(msg.type, "mock.audio_sent", 15)) {
+            m_raw_sent_us = find_number(text, len, "sent_us");
+        }
+    }
+
+    void record(uint64_t sent_us) {
+        if (sent_us == 0 || !m_recording.load(std::memory_order_relaxed)) {
+            return;
+        }
+        uint64_t now = monotonic_us();
+        m_latencies.push_back(now > sent_us ? static_cast<uint32_t>(std::min<uint64_t>(now - sent_us, UINT32_MAX))
+                                            : 0);
+    }
+
+    const Options& m_options;
+    const std::vector<int16_t>& m_uplink;
+    StreamStats m_stats;
+    PlaybackPipeline m_playback;
+    ix::WebSocket m_ws;
+    std::atomic<bool> m_connected{false};
+    std::atomic<bool> m_recording{false};
+    std::atomic<bool> m_response_done{false};
+    std::string m_message;           // media threads only
+    std::vector<int16_t> m_frame;    // media threads only
+    std::vector<uint8_t> m_decoded;  // websocket thread only, like the fields below
+    std::vector<uint32_t> m_latencies;
+    uint64_t m_raw_sent_us = 0;
+};
+
+bool parse_args(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (!strcmp(arg, "--raw")) {
+            options->raw = true;
+            continue;
+        }
+        if (!strcmp(arg, "--deflate")) {
+            options->deflate = true;
+            continue;
+        }
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value) {
+            return false;
+        }
+        if (!strcmp(arg, "--url")) {
+            options->url = value;
+        } else if (!strcmp(arg, "--calls")) {
+            options->calls = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--duration")) {
+            options->duration_s = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--ramp-ms")) {
+            options->ramp_ms = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--server-rate")) {
+            options->server_rate = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--channel-rate")) {
+            options->channel_rate = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--media-threads")) {
+            options->media_threads = strtoul(value, nullptr, 10);
+        } else {
+            return false;
+        }
+        i++;
+    }
+    return options->calls > 0 && options->duration_s > 0 && options->media_threads > 0 && options->server_rate > 0 &&
+           options->channel_rate > 0;
+}
+
+uint32_t percentile(const std::vector<uint32_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(std::ceil(p / 100 * sorted.size()));
+    return sorted[std::min(sorted.size() - 1, index > 0 ? index - 1 : 0)];
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!parse_args(argc, argv, &options)) {
+        fprintf(stderr,
+                "usage: %s [--url ws://127.0.0.1:8080] [--calls 100] [--duration 30] [--ramp-ms 10]\n"
+                "          [--server-rate 24000] [--channel-rate 16000] [--media-threads 4] [--raw] [--deflate]\n",
+                argv[0]);
+        return 1;
+    }
+
+    ix::initNetSystem();
+
+    // caller audio, one 20 ms frame at the server rate sent over and over
+    std::vector<int16_t> uplink(options.server_rate * FRAME_MS / 1000);
+    for (size_t i = 0; i < uplink.size(); i++) {
+        uplink[i] = static_cast<int16_t>(4000 * std::sin(2 * M_PI * 200 * i / options.server_rate));
+    }
+
+    const long rss_before = resident_bytes();
+    const int threads_before = thread_count();
+
+    std::vector<std::unique_ptr<SimCall>> calls;
+    calls.reserve(options.calls);
+    std::atomic<bool> running{true};
+
+    // media clock: calls are sharded across the threads, each ticks its share every 20 ms
+    std::vector<std::thread> media;
+    std::atomic<size_t> started{0};
+    for (size_t t = 0; t < options.media_threads; t++) {
+        media.emplace_back([&, t] {
+            Clock::time_point next = Clock::now();
+            while (running.load(std::memory_order_relaxed)) {
+                const size_t count = started.load(std::memory_order_acquire);
+                for (size_t i = t; i < count; i += options.media_threads) {
+                    calls[i]->tick();
+                }
+                next += std::chrono::milliseconds(FRAME_MS);
+                std::this_thread::sleep_until(next);
+            }
+        });
+    }
+
+    fprintf(stderr, "starting %zu calls to %s (%s)\n", options.calls, options.url.c_str(),
+            options.raw ? "raw" : "json");
+    for (size_t i = 0; i < options.calls; i++) {
+        calls.emplace_back(new SimCall(options, uplink));
+        calls.back()->start();
+        started.store(i + 1, std::memory_order_release);
+        if (options.ramp_ms) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(options.ramp_ms));
+        }
+    }
+
+    // give the stragglers a few seconds to connect
+    Clock::time_point deadline = Clock::now() + std::chrono::seconds(5);
+    size_t connected = 0;
+    while (Clock::now() < deadline) {
+        connected = std::count_if(calls.begin(), calls.end(), [](const std::unique_ptr<SimCall>& c) {
+            return c->connected();
+        });
+        if (connected == calls.size()) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    fprintf(stderr, "%zu of %zu calls connected, measuring for %u s\n", connected, calls.size(), options.duration_s);
+
+    for (auto& call : calls) {
+        call->setRecording(true);
+    }
+    const double cpu_start = cpu_seconds();
+    const Clock::time_point wall_start = Clock::now();
+    long rss_peak = 0;
+    int threads_peak = 0;
+    for (uint32_t s = 0; s < options.duration_s; s++) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        rss_peak = std::max(rss_peak, resident_bytes());
+        threads_peak = std::max(threads_peak, thread_count());
+    }
+    const double wall = std::chrono::duration<double>(Clock::now() - wall_start).count();
+    const double cpu = cpu_seconds() - cpu_start;
+    for (auto& call : calls) {
+        call->setRecording(false);
+    }
+
+    running = false;
+    for (auto& thread : media) {
+        thread.join();
+    }
+    for (auto& call : calls) {
+        call->stop();
+    }
+
+    std::vector<uint32_t> latencies;
+    uint64_t dropped = 0, underruns = 0, errors = 0, chunks = 0;
+    for (auto& call : calls) {
+        latencies.insert(latencies.end(), call->latencies().begin(), call->latencies().end());
+        dropped += call->stats().downlink_dropped_samples.load();
+        underruns += call->stats().playback_underruns.load();
+        errors += call->stats().connection_errors.load();
+        chunks += call->stats().downlink_chunks.load();
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    const double n = static_cast<double>(calls.size());
+    printf("calls:              %zu (%zu connected)\n", calls.size(), connected);
+    printf("cpu per call:       %.3f %% of a core (%.2f ms per call second)\n", cpu / wall / n * 100,
+           cpu / wall / n * 1000);
+    printf("memory per call:    %.1f KiB (rss %.1f MiB, %.1f MiB before the calls)\n",
+           (rss_peak - rss_before) / n / 1024, rss_peak / 1048576.0, rss_before / 1048576.0);
+    printf("threads:            %d (%d before the calls, %.2f per call)\n", threads_peak, threads_before,
+           (threads_peak - threads_before) / n);
+    printf("audio chunks:       %llu received, %llu samples dropped, %llu underruns, %llu connection errors\n",
+           static_cast<unsigned long long>(chunks), static_cast<unsigned long long>(dropped),
+           static_cast<unsigned long long>(underruns), static_cast<unsigned long long>(errors));
+    printf("delivered latency:  p50 %u us, p90 %u us, p99 %u us, p99.9 %u us, max %u us (%zu samples)\n",
+           percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99),
+           percentile(latencies, 99.9), latencies.empty() ? 0 : latencies.back(), latencies.size());
+
+    ix::uninitNetSystem();
+    return 0;
+}
@@ -0,0 +1,392 @@
+//
+// Local stand-in for the OpenAI Realtime endpoint, for load and latency tests
+// that must not burn API credits.
+//
+// Every connection is treated as one call. The server counts the caller audio
+// it receives (input_audio_buffer.append messages, or binary PCM16 frames for
+// uuid_raw_audio_stream) and, each time a turn worth of audio has arrived,
+// answers with
+//
+//   input_audio_buffer.speech_started
+//   input_audio_buffer.speech_stopped
+//   response.output_audio.delta  x (response_ms / delta_ms)
+//   response.output_audio.done
+//
+// A turn completing while a response is still being sent interrupts it, like a
+// caller barging in. Connections that send binary audio get binary audio back,
+// the control events stay JSON. Deltas are paced at --speed times real time,
+// 0 sends each response in one burst.
+//
+// Clients connecting with "stamp=1" in the query string get the send time of
+// every audio chunk (CLOCK_MONOTONIC, microseconds): as "mock_sent_us" in the
+// delta, or in a {"type":"mock.audio_sent"} text frame before each binary one.
+// The load generator uses it to measure delivery latency.
+//
+// usage: mock_realtime_server [--host 127.0.0.1] [--port 8080] [--rate 24000]
+//                             [--turn-ms 3000] [--response-ms 2000] [--delta-ms 100]
+//                             [--speed 1.0] [--max-connections 4096]
+//
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ixwebsocket/IXNetSystem.h>
+#include <ixwebsocket/IXWebSocketServer.h>
+
+#include "base64_simd.h"
+#include "realtime_protocol.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    uint32_t rate = 24000;
+    uint32_t turn_ms = 3000;
+    uint32_t response_ms = 2000;
+    uint32_t delta_ms = 100;
+    double speed = 1.0;
+    size_t max_connections = 4096;
+};
+
+uint64_t monotonic_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// One call. The websocket pointer is only valid while the connection is open;
+// the scheduler thread checks it under the mutex before every send.
+struct Call {
+    std::mutex mutex;
+    ix::WebSocket *ws = nullptr;
+    bool raw = false;
+    bool stamp = false;
+    uint64_t received_bytes = 0; // caller audio in the current turn
+    uint32_t turns = 0;
+    uint32_t generation = 0; // bumped on every response, stale scheduler entries compare against it
+    uint32_t remaining_chunks = 0;
+};
+
+struct Job {
+    Clock::time_point due;
+    std::shared_ptr<Call> call;
+    uint32_t generation;
+
+    bool operator<(const Job& other) const {
+        return due > other.due; // earliest first in std::priority_queue
+    }
+};
+
+class MockServer {
+  public:
+    explicit MockServer(const Options& options)
+        : m_options(options), m_server(options.port, options.host, 512, options.max_connections) {
+        const uint32_t samples = options.rate * options.delta_ms / 1000;
+        std::vector<int16_t> tone(samples);
+        for (uint32_t i = 0; i < samples; i++) {
+            tone[i] = static_cast<int16_t>(6000 * std::sin(2 * M_PI * 300 * i / options.rate));
+        }
+        m_chunk.assign(reinterpret_cast<const char *>(tone.data()), samples * sizeof(int16_t));
+        m_chunk_base64.resize(base64_encoded_size(m_chunk.size()));
+        base64_encode_into(reinterpret_cast<const unsigned char *>(m_chunk.data()), m_chunk.size(),
+                           &m_chunk_base64[0]);
+        m_turn_bytes = static_cast<uint64_t>(options.rate) * options.turn_ms / 1000 * sizeof(int16_t);
+        m_chunks_per_response = (options.response_ms + options.delta_ms - 1) / options.delta_ms;
+        m_interval = Clock::duration::zero();
+        if (options.speed > 0) {
+            std::chrono::duration<double, std::milli> interval(options.delta_ms / options.speed);
+            m_interval = std::chrono::duration_cast<Clock::duration>(interval);
+        }
+    }
+
+    bool start() {
+        m_server.disablePerMessageDeflate();
+        m_server.setOnClientMessageCallback(
+            [this](std::shared_ptr<ix::ConnectionState> state, ix::WebSocket& ws, const ix::WebSocketMessagePtr& msg) {
+                onMessage(state, ws, msg);
+            });
+        auto result = m_server.listen();
+        if (!result.first) {
+            fprintf(stderr, "listen on %s:%d failed: %s\n", m_options.host.c_str(), m_options.port,
+                    result.second.c_str());
+            return false;
+        }
+        m_server.start();
+        m_scheduler = std::thread(&MockServer::runScheduler, this);
+        return true;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+            m_wakeup.notify_one();
+        }
+        if (m_scheduler.joinable()) {
+            m_scheduler.join();
+        }
+        m_server.stop();
+    }
+
+    void printStats() {
+        fprintf(stderr, "connections: %u open, %u total; caller audio: %.1f s; responses: %u, interrupted: %u\n",
+                m_open.load(), m_connections.load(),
+                m_audio_in_bytes.load() / (2.0 * m_options.rate), m_responses.load(), m_interrupted.load());
+    }
+
+  private:
+    void onMessage(const std::shared_ptr<ix::ConnectionState>& state, ix::WebSocket& ws,
+                   const ix::WebSocketMessagePtr& msg) {
+        std::shared_ptr<Call> call = findCall(state->getId());
+        if (msg->type == ix::WebSocketMessageType::Open) {
+            call = std::make_shared<Call>();
+            call->ws = &ws;
+            call->stamp = msg->openInfo.uri.find("stamp=1") != std::string::npos;
+            {
+                std::lock_guard<std::mutex> lock(m_calls_mutex);
+                m_calls[state->getId()] = call;
+            }
+            m_connections++;
+            m_open++;
+            ws.sendText("{\"type\":\"session.created\",\"session\":{\"id\":\"sess_mock\",\"model\":\"mock\"}}");
+        } else if (msg->type == ix::WebSocketMessageType::Close) {
+            if (call) {
+                std::lock_guard<std::mutex> lock(call->mutex);
+                call->ws = nullptr;
+                call->generation++;
+            }
+            std::lock_guard<std::mutex> lock(m_calls_mutex);
+            m_calls.erase(state->getId());
+            m_open--;
+        } else if (msg->type == ix::WebSocketMessageType::Message && call) {
+            size_t audio_bytes = 0;
+            if (msg->binary) {
+                audio_bytes = msg->str.size();
+            } else if (msg->str.find("\"input_audio_buffer.append\"") != std::string::npos) {
+                // no need to decode, the base64 length tells the size
+                size_t overhead = realtime_audio_append_size(0);
+                audio_bytes = msg->str.size() > overhead ? (msg->str.size() - overhead) / 4 * 3 : 0;
+            }
+            if (audio_bytes > 0) {
+                m_audio_in_bytes += audio_bytes;
+                onAudio(call, msg->binary, audio_bytes);
+            }
+        }
+    }
+
+    std::shared_ptr<Call> findCall(const std::string& id) {
+        std::lock_guard<std::mutex> lock(m_calls_mutex);
+        auto it = m_calls.find(id);
+        return it == m_calls.end() ? nullptr : it->second;
+    }
+
+    void onAudio(const std::shared_ptr<Call>& call, bool binary, size_t bytes) {
+        uint32_t generation;
+        {
+            std::lock_guard<std::mutex> lock(call->mutex);
+            call->raw = binary;
+            call->received_bytes += bytes;
+            if (call->received_bytes < m_turn_bytes || !call->ws) {
+                return;
+            }
+            call->received_bytes = 0;
+            call->turns++;
+            if (call->remaining_chunks > 0) {
+                m_interrupted++;
+            }
+            call->ws->sendText("{\"type\":\"input_audio_buffer.speech_started\",\"item_id\":\"item_mock\"}");
+            call->ws->sendText("{\"type\":\"input_audio_buffer.speech_stopped\",\"item_id\":\"item_mock\"}");
+            call->remaining_chunks = m_chunks_per_response;
+            generation = ++call->generation;
+        }
+        m_responses++;
+        schedule(Job{Clock::now(), call, generation});
+    }
+
+    void schedule(Job&& job) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push(std::move(job));
+        m_wakeup.notify_one();
+    }
+
+    void runScheduler() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_stopping) {
+            if (m_jobs.empty()) {
+                m_wakeup.wait(lock);
+                continue;
+            }
+            if (m_jobs.top().due > Clock::now()) {
+                m_wakeup.wait_until(lock, m_jobs.top().due);
+                continue;
+            }
+            Job job = m_jobs.top();
+            m_jobs.pop();
+            lock.unlock();
+            bool more = sendChunk(job);
+            lock.lock();
+            if (more) {
+                job.due += m_interval;
+                m_jobs.push(std::move(job));
+            }
+        }
+    }
+
+    // Sends the next chunk of the response, or the done event after the last one.
+    // Returns true if the response goes on.
+    bool sendChunk(const Job& job) {
+        Call& call = *job.call;
+        std::lock_guard<std::mutex> lock(call.mutex);
+        if (call.generation != job.generation || !call.ws) {
+            return false; // interrupted or hung up
+        }
+        char meta[160];
+        if (call.remaining_chunks == 0) {
+            snprintf(meta, sizeof(meta), "{\"type\":\"response.output_audio.done\",\"response_id\":\"resp_%u\"}",
+                     call.turns);
+            call.ws->sendText(meta);
+            return false;
+        }
+        call.remaining_chunks--;
+
+        const uint64_t now_us = monotonic_us();
+        if (call.raw) {
+            if (call.stamp) {
+                snprintf(meta, sizeof(meta), "{\"type\":\"mock.audio_sent\",\"sent_us\":%llu,\"bytes\":%zu}",
+                         static_cast<unsigned long long>(now_us), m_chunk.size());
+                call.ws->sendText(meta);
+            }
+            call.ws->sendBinary(m_chunk);
+            return true;
+        }
+
+        std::string delta;
+        delta.reserve(m_chunk_base64.size() + 256);
+        snprintf(meta, sizeof(meta),
+                 "{\"type\":\"response.output_audio.delta\",\"response_id\":\"resp_%u\",\"item_id\":\"item_%u\","
+                 "\"output_index\":0,\"content_index\":0,",
+                 call.turns, call.turns);
+        delta += meta;
+        if (call.stamp) {
+            snprintf(meta, sizeof(meta), "\"mock_sent_us\":%llu,", static_cast<unsigned long long>(now_us));
+            delta += meta;
+        }
+        delta += "\"delta\":\"";
+        delta += m_chunk_base64;
+        delta += "\"}";
+        call.ws->sendText(delta);
+        return true;
+    }
+
+    Options m_options;
+    ix::WebSocketServer m_server;
+    std::string m_chunk;        // delta_ms of PCM16 tone at the server rate
+    std::string m_chunk_base64; // the same, for JSON deltas
+    uint64_t m_turn_bytes;
+    uint32_t m_chunks_per_response;
+    Clock::duration m_interval;
+
+    std::mutex m_calls_mutex;
+    std::map<std::string, std::shared_ptr<Call>> m_calls;
+
+    std::mutex m_mutex; // scheduler queue
+    std::condition_variable m_wakeup;
+    std::priority_queue<Job> m_jobs;
+    bool m_stopping = false;
+    std::thread m_scheduler;
+
+    std::atomic<uint32_t> m_connections{0};
+    std::atomic<uint32_t> m_open{0};
+    std::atomic<uint64_t> m_audio_in_bytes{0};
+    std::atomic<uint32_t> m_responses{0};
+    std::atomic<uint32_t> m_interrupted{0};
+};
+
+volatile std::sig_atomic_t g_stop = 0;
+
+void on_signal(int) {
+    g_stop = 1;
+}
+
+bool parse_args(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value) {
+            return false;
+        }
+        if (!strcmp(arg, "--host")) {
+            options->host = value;
+        } else if (!strcmp(arg, "--port")) {
+            options->port = atoi(value);
+        } else if (!strcmp(arg, "--rate")) {
+            options->rate = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--turn-ms")) {
+            options->turn_ms = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--response-ms")) {
+            options->response_ms = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--delta-ms")) {
+            options->delta_ms = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--speed")) {
+            options->speed = atof(value);
+        } else if (!strcmp(arg, "--max-connections")) {
+            options->max_connections = strtoul(value, nullptr, 10);
+        } else {
+            return false;
+        }
+        i++;
+    }
+    return options->rate > 0 && options->delta_ms > 0 && options->turn_ms > 0 && options->speed >= 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!parse_args(argc, argv, &options)) {
+        fprintf(stderr,
+                "usage: %s [--host 127.0.0.1] [--port 8080] [--rate 24000] [--turn-ms 3000] [--response-ms 2000]\n"
+                "          [--delta-ms 100] [--speed 1.0] [--max-connections 4096]\n",
+                argv[0]);
+        return 1;
+    }
+
+    ix::initNetSystem();
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    MockServer server(options);
+    if (!server.start()) {
+        return 1;
+    }
+    fprintf(stderr, "mock realtime server on ws://%s:%d, %u Hz, turn %u ms, response %u ms in %u ms deltas, %.1fx\n",
+            options.host.c_str(), options.port, options.rate, options.turn_ms, options.response_ms, options.delta_ms,
+            options.speed);
+
+    int ticks = 0;
+    while (!g_stop) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        if (++ticks % 50 == 0) {
+            server.printStats();
+        }
+    }
+    server.stop();
+    server.printStats();
+    ix::uninitNetSystem();
+    return 0;
+}
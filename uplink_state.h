@@ -0,0 +1,60 @@
+#ifndef UPLINK_STATE_H
+#define UPLINK_STATE_H
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+//
+// Hand-off between the media thread, which owns the uplink of a stream, and the
+// control paths (mute, send_json, cleanup), in a single state word.
+//
+// Control paths never wait for the media thread: they post work bits, which the
+// media thread takes, with ownership, when it enters on its next frame. Only
+// closing waits, for a frame in progress to finish; the media thread stays out
+// afterwards. Entering cannot fail for any other reason, so the media thread
+// never has to give up on a frame because someone else holds the stream.
+//
+class UplinkState {
+  public:
+    static const uint32_t MUTE_SILENCE = 1u << 2; // the user was muted: drop the batch, send a second of silence
+    static const uint32_t SEND_TEXT = 1u << 3;    // messages wait behind queued audio
+
+    // Media thread. Takes the uplink and the work posted since the last frame; false once closed.
+    bool enter(uint32_t *work) {
+        uint32_t state = m_state.load(std::memory_order_relaxed);
+        do {
+            if (state & CLOSED) {
+                return false;
+            }
+        } while (!m_state.compare_exchange_weak(state, BUSY, std::memory_order_acquire, std::memory_order_relaxed));
+        *work = state;
+        return true;
+    }
+
+    void leave() {
+        m_state.fetch_and(~BUSY, std::memory_order_release);
+    }
+
+    // Any thread.
+    void post(uint32_t work) {
+        m_state.fetch_or(work, std::memory_order_release);
+    }
+
+    // Waits for the frame in progress, if any, and keeps the media thread out from now on;
+    // the caller then owns the uplink. Must not be called from the media thread while it is in.
+    void close() {
+        m_state.fetch_or(CLOSED, std::memory_order_acq_rel);
+        while (m_state.load(std::memory_order_acquire) & BUSY) {
+            std::this_thread::yield();
+        }
+    }
+
+  private:
+    static const uint32_t BUSY = 1u << 0;
+    static const uint32_t CLOSED = 1u << 1;
+
+    std::atomic<uint32_t> m_state{0};
+};
+
+#endif // UPLINK_STATE_H
@@ -0,0 +1,404 @@
+#include "ws_connection_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const std::chrono::seconds MAINTENANCE_INTERVAL(1);
+const std::chrono::seconds PROFILE_IDLE_TIMEOUT(600); // profiles no stream used for this long are closed
+const int MAX_RETRY_WAIT_SECS = 60;                   // backoff of a profile whose connections keep failing
+const size_t MAX_BACKLOG_BYTES = 256 * 1024;          // received by an idle connection, session.created is ~2 KB
+
+//
+// Sits between a pooled connection and its stream. Until a stream claims the
+// connection, events are kept here; claim() and adopt() hand them over in
+// order, then events go straight to the stream handler. The handler never runs
+// under the lock: events arriving during the replay are queued behind it, and
+// the replay ends only once nothing is left, so callbacks stay serialized.
+//
+class Link {
+  public:
+    void onEvent(const WsEvent& event) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_direct) {
+                keepLocked(event);
+                return;
+            }
+        }
+        m_handler(event); // set before m_direct, never changed after
+    }
+
+    // Reserves an open connection for a stream.
+    bool claim() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_open || m_dead || m_claimed) {
+            return false;
+        }
+        m_claimed = true;
+        return true;
+    }
+
+    // Replays the open event and the backlog to the stream, which gets the following events directly.
+    void adopt(WsEventHandler handler) {
+        WsEvent open = {};
+        open.type = WS_EVENT_OPEN;
+        handler(open);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_backlog.empty()) {
+            std::vector<StoredEvent> backlog;
+            backlog.swap(m_backlog);
+            m_backlog_bytes = 0;
+            lock.unlock();
+            for (const auto& stored : backlog) {
+                handler(stored.event());
+            }
+            lock.lock();
+        }
+        m_backlog.shrink_to_fit();
+        m_handler = std::move(handler);
+        m_direct = true;
+    }
+
+    bool opened() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_open;
+    }
+
+    bool dead() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_dead;
+    }
+
+  private:
+    void keepLocked(const WsEvent& event) {
+        if (m_dead) {
+            return;
+        }
+        if (!m_claimed) {
+            if (event.type == WS_EVENT_OPEN) {
+                m_open = true;
+                return;
+            }
+            // nobody would see the error or the reconnection, let the pool replace the connection
+            if (event.type == WS_EVENT_CLOSE || event.type == WS_EVENT_ERROR ||
+                m_backlog_bytes + event.len > MAX_BACKLOG_BYTES) {
+                m_dead = true;
+                m_backlog.clear();
+                return;
+            }
+        }
+        // claimed but not handed over yet: everything is kept for the stream
+        m_backlog.emplace_back(event);
+        m_backlog_bytes += event.len;
+    }
+
+    // copy of an event, whose pointers are only valid during the callback
+    class StoredEvent {
+      public:
+        explicit StoredEvent(const WsEvent& event)
+            : m_event(event), m_data(event.data ? std::string(event.data, event.len) : std::string()),
+              m_reason(event.reason ? event.reason : "") {}
+
+        WsEvent event() const {
+            WsEvent event = m_event;
+            event.data = m_event.data ? m_data.c_str() : nullptr;
+            event.reason = m_event.reason ? m_reason.c_str() : nullptr;
+            return event;
+        }
+
+      private:
+        WsEvent m_event;
+        std::string m_data;
+        std::string m_reason;
+    };
+
+    std::mutex m_mutex;
+    WsEventHandler m_handler;
+    bool m_direct = false; // the replay is over, events go to m_handler
+    std::vector<StoredEvent> m_backlog;
+    size_t m_backlog_bytes = 0;
+    bool m_open = false;
+    bool m_dead = false;
+    bool m_claimed = false;
+};
+
+// Connection of the pool adopted by a stream.
+class PooledTransport : public WsTransport {
+  public:
+    PooledTransport(std::unique_ptr<WsTransport> transport, std::shared_ptr<Link> link, WsEventHandler handler)
+        : m_transport(std::move(transport)), m_link(std::move(link)), m_handler(std::move(handler)) {}
+
+    // already connected, catches the stream up with what the connection received so far
+    void start() override {
+        m_link->adopt(std::move(m_handler));
+    }
+
+    void stop(std::function<void()> on_stopped) override {
+        m_transport->stop(std::move(on_stopped));
+    }
+
+    bool is_open() const override {
+        return m_transport->is_open();
+    }
+
+    bool send_text(const char *data, size_t len) override {
+        return m_transport->send_text(data, len);
+    }
+
+    bool send_binary(const void *data, size_t len) override {
+        return m_transport->send_binary(data, len);
+    }
+
+    size_t buffered_amount() const override {
+        return m_transport->buffered_amount();
+    }
+
+  private:
+    std::unique_ptr<WsTransport> m_transport;
+    std::shared_ptr<Link> m_link;
+    WsEventHandler m_handler;
+};
+
+// Closes a connection nobody uses anymore, in the background.
+void discard(std::unique_ptr<WsTransport> transport) {
+    WsTransport *raw = transport.release();
+    raw->stop([raw] { delete raw; });
+}
+
+std::string profile_key(const WsTransportOptions& options) {
+    std::string key;
+    key.reserve(256);
+    key += options.url;
+    for (const auto& header : options.headers) {
+        key += '\n';
+        key += header.first;
+        key += ':';
+        key += header.second;
+    }
+    key += '\n';
+    key += options.tls_cafile;
+    key += '\n';
+    key += options.tls_keyfile;
+    key += '\n';
+    key += options.tls_certfile;
+    key += '\n';
+    key += std::to_string(options.tls_disable_hostname_validation) + std::to_string(options.per_message_deflate) +
+           std::to_string(options.auto_reconnect) + std::to_string(options.ping_interval_secs);
+    return key;
+}
+
+class Pool {
+  public:
+    static Pool& instance() {
+        static Pool pool;
+        return pool;
+    }
+
+    void configure(size_t min_idle, uint32_t max_age_secs) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_min_idle = min_idle;
+        if (max_age_secs > 0) {
+            m_max_age = std::chrono::seconds(max_age_secs);
+        }
+        m_stopping = false;
+    }
+
+    std::unique_ptr<WsTransport> acquire(const WsTransportOptions& options, WsEventHandler& handler) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_min_idle == 0 || m_stopping) {
+            return nullptr;
+        }
+
+        const Clock::time_point now = Clock::now();
+        Profile& profile = m_profiles[profile_key(options)];
+        profile.last_used = now;
+        if (profile.options.url.empty()) {
+            profile.options = options;
+        }
+
+        // the oldest ready connection first, the others keep more of their life for the next calls
+        for (auto it = profile.idle.begin(); it != profile.idle.end(); ++it) {
+            if (now - it->created < m_max_age && it->link->claim()) {
+                std::unique_ptr<WsTransport> transport(
+                    new PooledTransport(std::move(it->transport), std::move(it->link), std::move(handler)));
+                profile.idle.erase(it);
+                m_idle--;
+                m_hits.fetch_add(1, std::memory_order_relaxed);
+                startLocked();
+                m_wakeup.notify_one();
+                return transport;
+            }
+        }
+
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        startLocked();
+        m_wakeup.notify_one(); // a new profile, or one running short
+        return nullptr;
+    }
+
+    void shutdown() {
+        std::vector<std::unique_ptr<WsTransport>> closing;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+            m_wakeup.notify_one();
+            for (auto& entry : m_profiles) {
+                for (auto& idle : entry.second.idle) {
+                    closing.push_back(std::move(idle.transport));
+                }
+            }
+            m_profiles.clear();
+            m_idle = 0;
+        }
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+        for (auto& transport : closing) {
+            discard(std::move(transport));
+        }
+    }
+
+    WsConnectionPoolStats stats() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return WsConnectionPoolStats{m_hits.load(std::memory_order_relaxed), m_misses.load(std::memory_order_relaxed),
+                                     m_idle};
+    }
+
+  private:
+    struct Idle {
+        std::unique_ptr<WsTransport> transport;
+        std::shared_ptr<Link> link;
+        Clock::time_point created;
+    };
+
+    struct Profile {
+        WsTransportOptions options;
+        std::deque<Idle> idle; // oldest first
+        Clock::time_point last_used;
+        Clock::time_point retry_at;
+        int failures = 0;
+    };
+
+    Pool() = default;
+    ~Pool() {
+        shutdown();
+    }
+
+    void startLocked() {
+        if (m_thread.joinable()) {
+            return;
+        }
+        try {
+            m_thread = std::thread(&Pool::run, this);
+        } catch (const std::exception&) {
+            // streams just connect on their own
+        }
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_stopping) {
+            std::vector<std::unique_ptr<WsTransport>> closing;
+            maintainLocked(Clock::now(), closing);
+
+            // stopping connections may take a lock of the transport, never do it under ours
+            lock.unlock();
+            for (auto& transport : closing) {
+                discard(std::move(transport));
+            }
+            lock.lock();
+
+            m_wakeup.wait_for(lock, MAINTENANCE_INTERVAL);
+        }
+    }
+
+    void maintainLocked(Clock::time_point now, std::vector<std::unique_ptr<WsTransport>>& closing) {
+        for (auto it = m_profiles.begin(); it != m_profiles.end();) {
+            Profile& profile = it->second;
+
+            for (auto idle = profile.idle.begin(); idle != profile.idle.end();) {
+                bool dead = idle->link->dead();
+                if (dead && !idle->link->opened()) {
+                    // could not connect, do not hammer the server with a pool full of failing attempts
+                    profile.failures = std::min(profile.failures + 1, 30);
+                    int wait = std::min(1 << std::min(profile.failures, 6), MAX_RETRY_WAIT_SECS);
+                    profile.retry_at = now + std::chrono::seconds(wait);
+                } else if (idle->link->opened()) {
+                    profile.failures = 0;
+                }
+                if (dead || now - idle->created >= m_max_age) {
+                    closing.push_back(std::move(idle->transport));
+                    idle = profile.idle.erase(idle);
+                    m_idle--;
+                } else {
+                    ++idle;
+                }
+            }
+
+            if (now - profile.last_used >= PROFILE_IDLE_TIMEOUT) {
+                for (auto& idle : profile.idle) {
+                    closing.push_back(std::move(idle.transport));
+                    m_idle--;
+                }
+                it = m_profiles.erase(it);
+                continue;
+            }
+
+            while (profile.idle.size() < m_min_idle && now >= profile.retry_at) {
+                std::shared_ptr<Link> link = std::make_shared<Link>();
+                std::unique_ptr<WsTransport> transport =
+                    ws_transport_create(profile.options, [link](const WsEvent& event) { link->onEvent(event); });
+                transport->start();
+                profile.idle.push_back(Idle{std::move(transport), std::move(link), now});
+                m_idle++;
+            }
+            ++it;
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::unordered_map<std::string, Profile> m_profiles;
+    size_t m_min_idle = 0;
+    std::chrono::seconds m_max_age{120};
+    uint64_t m_idle = 0;
+    bool m_stopping = false;
+    std::thread m_thread;
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+};
+
+} // namespace
+
+void ws_connection_pool_configure(size_t min_idle, uint32_t max_age_secs) {
+    Pool::instance().configure(min_idle, max_age_secs);
+}
+
+std::unique_ptr<WsTransport> ws_connection_pool_acquire(const WsTransportOptions& options, WsEventHandler handler) {
+    std::unique_ptr<WsTransport> transport = Pool::instance().acquire(options, handler);
+    if (transport) {
+        return transport;
+    }
+    return ws_transport_create(options, std::move(handler));
+}
+
+void ws_connection_pool_shutdown() {
+    Pool::instance().shutdown();
+}
+
+WsConnectionPoolStats ws_connection_pool_stats() {
+    return Pool::instance().stats();
+}
@@ -0,0 +1,45 @@
+#ifndef WS_CONNECTION_POOL_H
+#define WS_CONNECTION_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "ws_transport.h"
+
+//
+// Module wide pool of websocket connections opened ahead of the calls.
+//
+// Connections are grouped by profile: every WsTransportOptions field (url,
+// headers with the API key, TLS files...) must match for a stream to adopt
+// one. A profile is learnt from the first stream that uses it, and is kept at
+// min_idle ready connections by a maintenance thread until no stream has used
+// it for a while. Idle connections older than max_age are replaced, since the
+// server session starts ticking when the socket opens.
+//
+// Messages the server sends while a connection is idle (session.created) are
+// kept and replayed, after the open event, when a stream adopts it, so a
+// stream sees the same sequence as with a connection of its own. An idle
+// connection that closes, fails or receives too much is discarded.
+//
+
+// Enables the pool; min_idle 0 (the default) disables it.
+void ws_connection_pool_configure(size_t min_idle, uint32_t max_age_secs);
+
+// Returns a transport for the stream: an open connection of the pool when one
+// is ready, else a new one from ws_transport_create(). The handler receives
+// the events of the connection once start() is called.
+std::unique_ptr<WsTransport> ws_connection_pool_acquire(const WsTransportOptions& options, WsEventHandler handler);
+
+// Closes the idle connections and stops the maintenance thread.
+void ws_connection_pool_shutdown();
+
+struct WsConnectionPoolStats {
+    uint64_t hits;   // streams that adopted a pooled connection
+    uint64_t misses; // streams that had to connect, pool enabled
+    uint64_t idle;   // connections ready or connecting
+};
+
+WsConnectionPoolStats ws_connection_pool_stats();
+
+#endif // WS_CONNECTION_POOL_H
@@ -0,0 +1,1321 @@
+#include "ws_event_loop.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+#include <openssl/ssl.h>
+
+#include "base64_simd.h"
+#include "tls_session_cache.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const int TICK_MS = 100; // timers (handshake timeouts, heart beats, reconnections) resolution
+const int MAX_EVENTS = 256;
+const size_t READ_SIZE = 64 * 1024;
+const int MAX_READS_PER_EVENT = 4; // keeps one busy socket from starving the others on the loop
+const size_t MAX_MESSAGE_SIZE = 64 * 1024 * 1024;
+const size_t MAX_UPGRADE_RESPONSE_SIZE = 16 * 1024;
+const std::chrono::seconds HANDSHAKE_TIMEOUT(10);
+const std::chrono::seconds CLOSE_TIMEOUT(2);
+const double MAX_RECONNECT_WAIT_MS = 10000; // same backoff as ix::WebSocket
+const char WS_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+enum Opcode { OP_CONTINUATION = 0x0, OP_TEXT = 0x1, OP_BINARY = 0x2, OP_CLOSE = 0x8, OP_PING = 0x9, OP_PONG = 0xa };
+
+struct Url {
+    bool tls = false;
+    std::string host;
+    std::string port;
+    std::string target; // path and query
+    std::string host_header;
+};
+
+bool parse_url(const std::string& url, Url *out) {
+    size_t pos;
+    if (url.compare(0, 5, "ws://") == 0) {
+        pos = 5;
+    } else if (url.compare(0, 6, "wss://") == 0) {
+        out->tls = true;
+        pos = 6;
+    } else {
+        return false;
+    }
+
+    size_t path = url.find_first_of("/?", pos);
+    std::string authority = url.substr(pos, path == std::string::npos ? std::string::npos : path - pos);
+    out->target = path == std::string::npos ? "/" : url.substr(path);
+    if (out->target[0] == '?') {
+        out->target.insert(0, "/");
+    }
+
+    std::string port;
+    if (!authority.empty() && authority[0] == '[') { // [ipv6]:port
+        size_t close = authority.find(']');
+        if (close == std::string::npos) {
+            return false;
+        }
+        out->host = authority.substr(1, close - 1);
+        if (close + 1 < authority.size() && authority[close + 1] == ':') {
+            port = authority.substr(close + 2);
+        }
+    } else {
+        size_t colon = authority.rfind(':');
+        out->host = authority.substr(0, colon);
+        if (colon != std::string::npos) {
+            port = authority.substr(colon + 1);
+        }
+    }
+    const char *default_port = out->tls ? "443" : "80";
+    out->port = port.empty() ? default_port : port;
+    out->host_header = authority.empty() || port == default_port ? out->host : authority;
+    return !out->host.empty();
+}
+
+bool header_equals(const std::string& header, size_t len, const char *name) {
+    return len == strlen(name) && strncasecmp(header.c_str(), name, len) == 0;
+}
+
+struct Address {
+    sockaddr_storage addr;
+    socklen_t len;
+};
+
+class Loop;
+
+// One websocket client connection. State is owned by the loop thread; send() and the
+// atomics are the only parts touched by other threads.
+class Connection : public std::enable_shared_from_this<Connection> {
+  public:
+    Connection(Loop& loop, const WsTransportOptions& options, WsEventHandler handler)
+        : m_loop(loop), m_options(options), m_handler(std::move(handler)) {
+        if (RAND_bytes(reinterpret_cast<unsigned char *>(&m_mask_state), sizeof(m_mask_state)) != 1 ||
+            !m_mask_state) {
+            m_mask_state = static_cast<uint64_t>(Clock::now().time_since_epoch().count()) | 1;
+        }
+    }
+
+    ~Connection() {
+        closeSocket();
+    }
+
+    Loop& loop() {
+        return m_loop;
+    }
+
+    // any thread
+    void start();
+    void stop(std::function<void()> on_stopped);
+    bool send(Opcode opcode, const void *data, size_t len);
+
+    bool isOpen() const {
+        return m_open.load(std::memory_order_acquire);
+    }
+
+    size_t bufferedAmount() const {
+        return m_buffered.load(std::memory_order_relaxed);
+    }
+
+    // loop thread
+    void onEvents(uint32_t events);
+    void onTick(Clock::time_point now);
+    void flush();
+    void shutdownNow();
+
+  private:
+    enum State { IDLE, RESOLVING, CONNECTING, TLS_HANDSHAKE, UPGRADING, OPEN, CLOSING, CLOSED };
+
+    void connect();
+    void onResolved(uint32_t attempt, int error, std::vector<Address>&& addresses);
+    void connectNext();
+    void onConnected();
+    void tlsHandshake();
+    void sendUpgrade();
+    void readInput();
+    bool parseUpgrade();
+    void parseFrames();
+    bool handleFrame(bool fin, int opcode, char *payload, size_t len);
+    void deliverMessage(int opcode, char *payload, size_t len);
+    bool enqueueFrame(Opcode opcode, const void *data, size_t len, bool only_if_open = false);
+    void fail(const std::string& reason, int http_status = 0);
+    void dropped(uint16_t code, const std::string& reason);
+    void retire();
+    void scheduleReconnect();
+    void closeSocket();
+    void updateEvents();
+    void emit(const WsEvent& event);
+    uint32_t nextMask();
+
+    // >0 bytes transferred, 0 would block, -1 closed or failed
+    ssize_t ioRead(char *buf, size_t len);
+    ssize_t ioWrite(const char *buf, size_t len);
+
+    Loop& m_loop;
+    const WsTransportOptions m_options;
+    WsEventHandler m_handler; // cleared by stop(), no callback runs after that
+    Url m_url;
+
+    State m_state = IDLE;
+    bool m_stopping = false;
+    bool m_retired = false; // handed back to the loop, see retire()
+    int m_fd = -1;
+    uint32_t m_events = 0; // epoll interest of m_fd
+    SSL *m_ssl = nullptr;
+    bool m_tls_want_write = false;
+    std::vector<Address> m_addresses;
+    size_t m_next_address = 0;
+    std::string m_key; // Sec-WebSocket-Key of the pending upgrade
+    Clock::time_point m_deadline;
+    Clock::time_point m_reconnect_at;
+    Clock::time_point m_last_write;
+    uint32_t m_retries = 0;
+    uint32_t m_attempt = 0; // matches resolver answers with the attempt that asked
+    uint64_t m_mask_state;
+
+    std::string m_in;        // received bytes not yet parsed
+    std::string m_fragments; // fragmented message being reassembled
+    int m_fragment_opcode = -1;
+    bool m_close_sent = false;
+
+    std::string m_sending; // loop thread: bytes being written
+    size_t m_send_offset = 0;
+
+    std::mutex m_out_mutex;
+    std::string m_out;            // frames queued by send(), guarded by m_out_mutex
+    bool m_flush_pending = false; // a flush is scheduled on the loop, guarded by m_out_mutex
+
+    std::atomic<bool> m_open{false};
+    std::atomic<size_t> m_buffered{0}; // bytes in m_out and m_sending not written yet
+};
+
+class Loop {
+  public:
+    explicit Loop(int cpu) : m_cpu(cpu) {}
+
+    ~Loop() {
+        stop();
+    }
+
+    bool start() {
+        m_epoll = epoll_create1(EPOLL_CLOEXEC);
+        m_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_epoll < 0 || m_wakeup < 0) {
+            return false;
+        }
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &ev);
+        try {
+            m_thread = std::thread(&Loop::run, this);
+        } catch (const std::exception&) {
+            return false;
+        }
+        return true;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        wake();
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+        if (m_wakeup >= 0) {
+            close(m_wakeup);
+            m_wakeup = -1;
+        }
+        if (m_epoll >= 0) {
+            close(m_epoll);
+            m_epoll = -1;
+        }
+    }
+
+    // Runs task on the loop thread. Once the loop has stopped, runs it right away.
+    void post(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_stopped) {
+                m_tasks.push_back(std::move(task));
+                if (!m_woken) {
+                    m_woken = true;
+                    wake();
+                }
+                return;
+            }
+        }
+        task();
+    }
+
+    // Cheaper post() for the send path: no allocation, one wake up per loop iteration.
+    void scheduleFlush(std::shared_ptr<Connection>&& connection) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopped) {
+            return;
+        }
+        m_flushes.push_back(std::move(connection));
+        if (!m_woken) {
+            m_woken = true;
+            wake();
+        }
+    }
+
+    // loop thread
+    char *readBuffer() {
+        return m_read_buffer;
+    }
+
+    void adopt(const std::shared_ptr<Connection>& connection) {
+        m_connections.insert(connection);
+    }
+
+    void retire(const std::shared_ptr<Connection>& connection) {
+        m_retired.push_back(connection);
+    }
+
+    bool watch(int fd, Connection *connection, uint32_t events, int op) {
+        epoll_event ev = {};
+        ev.events = events;
+        ev.data.ptr = connection;
+        return epoll_ctl(m_epoll, op, fd, &ev) == 0;
+    }
+
+    void unwatch(int fd) {
+        epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    std::atomic<size_t> load{0}; // streams assigned to this loop
+
+  private:
+    void wake() {
+        uint64_t one = 1;
+        if (m_wakeup >= 0 && write(m_wakeup, &one, sizeof(one)) < 0) {
+            // already signalled
+        }
+    }
+
+    void run() {
+        if (m_cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(m_cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+
+        epoll_event events[MAX_EVENTS];
+        std::vector<std::function<void()>> tasks;
+        std::vector<std::shared_ptr<Connection>> flushes;
+        Clock::time_point next_tick = Clock::now() + std::chrono::milliseconds(TICK_MS);
+
+        for (;;) {
+            int timeout = static_cast<int>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(next_tick - Clock::now()).count());
+            int n = epoll_wait(m_epoll, events, MAX_EVENTS, std::max(timeout, 0));
+            for (int i = 0; i < n; i++) {
+                auto *connection = static_cast<Connection *>(events[i].data.ptr);
+                if (connection) {
+                    connection->onEvents(events[i].events);
+                } else {
+                    uint64_t value;
+                    while (read(m_wakeup, &value, sizeof(value)) > 0) {
+                    }
+                }
+            }
+
+            bool stopping;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                tasks.swap(m_tasks);
+                flushes.swap(m_flushes);
+                m_woken = false;
+                stopping = m_stopping;
+            }
+            for (auto& task : tasks) {
+                task();
+            }
+            tasks.clear();
+            for (auto& connection : flushes) {
+                connection->flush();
+            }
+            flushes.clear();
+
+            Clock::time_point now = Clock::now();
+            if (now >= next_tick) {
+                for (auto& connection : m_connections) {
+                    connection->onTick(now);
+                }
+                next_tick = now + std::chrono::milliseconds(TICK_MS);
+            }
+
+            for (auto& connection : m_retired) {
+                m_connections.erase(connection);
+            }
+            m_retired.clear();
+
+            if (stopping) {
+                break;
+            }
+        }
+
+        // module shutdown: close whatever is left, without waiting for the peers
+        for (auto& connection : m_connections) {
+            connection->shutdownNow();
+        }
+        m_connections.clear();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopped = true;
+            tasks.swap(m_tasks);
+            m_flushes.clear();
+        }
+        for (auto& task : tasks) {
+            task();
+        }
+    }
+
+    int m_cpu;
+    int m_epoll = -1;
+    int m_wakeup = -1;
+    std::thread m_thread;
+
+    std::mutex m_mutex;
+    std::vector<std::function<void()>> m_tasks;
+    std::vector<std::shared_ptr<Connection>> m_flushes;
+    bool m_woken = false;
+    bool m_stopping = false;
+    bool m_stopped = false;
+
+    // loop thread only
+    char m_read_buffer[READ_SIZE]; // shared by the connections, received bytes are appended to their own input
+    std::unordered_set<std::shared_ptr<Connection>> m_connections;
+    std::vector<std::shared_ptr<Connection>> m_retired;
+};
+
+// The loops, the resolver thread and the TLS contexts shared by all connections.
+class Pool {
+  public:
+    static Pool& instance() {
+        static Pool pool;
+        return pool;
+    }
+
+    void configure(size_t threads, const std::vector<int>& cpus) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_threads = threads;
+        m_cpus = cpus;
+    }
+
+    bool enabled() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_threads > 0;
+    }
+
+    // The least loaded loop, starting the loops on first use.
+    Loop *pick() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_shut_down) {
+            return nullptr;
+        }
+        if (m_loops.empty()) {
+            for (size_t i = 0; i < m_threads; i++) {
+                int cpu = m_cpus.empty() ? -1 : m_cpus[i % m_cpus.size()];
+                std::unique_ptr<Loop> loop(new Loop(cpu));
+                if (!loop->start()) {
+                    break;
+                }
+                m_loops.push_back(std::move(loop));
+            }
+            if (m_loops.empty()) {
+                return nullptr;
+            }
+        }
+        Loop *best = m_loops[0].get();
+        for (auto& loop : m_loops) {
+            if (loop->load.load(std::memory_order_relaxed) < best->load.load(std::memory_order_relaxed)) {
+                best = loop.get();
+            }
+        }
+        best->load.fetch_add(1, std::memory_order_relaxed);
+        return best;
+    }
+
+    void resolve(const std::string& host, const std::string& port,
+                 std::function<void(int, std::vector<Address>&&)> done) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_resolver.joinable()) {
+            m_resolver_stopping = false;
+            m_resolver = std::thread(&Pool::runResolver, this);
+        }
+        m_resolves.push_back(Resolve{host, port, std::move(done)});
+        m_resolver_wakeup.notify_one();
+    }
+
+    // The loops are stopped but not freed: transports that outlive the module shutdown
+    // still point to them.
+    void shutdown() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_shut_down) {
+                return;
+            }
+            m_shut_down = true;
+            m_resolver_stopping = true;
+            m_resolver_wakeup.notify_one();
+        }
+        if (m_resolver.joinable()) {
+            m_resolver.join();
+        }
+        for (auto& loop : m_loops) {
+            loop->stop();
+        }
+    }
+
+  private:
+    struct Resolve {
+        std::string host;
+        std::string port;
+        std::function<void(int, std::vector<Address>&&)> done;
+    };
+
+    void runResolver() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;) {
+            m_resolver_wakeup.wait(lock, [this] { return m_resolver_stopping || !m_resolves.empty(); });
+            if (m_resolver_stopping) {
+                break;
+            }
+            Resolve job = std::move(m_resolves.front());
+            m_resolves.pop_front();
+            lock.unlock();
+
+            addrinfo hints = {};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo *result = nullptr;
+            int error = getaddrinfo(job.host.c_str(), job.port.c_str(), &hints, &result);
+            std::vector<Address> addresses;
+            for (addrinfo *ai = result; ai; ai = ai->ai_next) {
+                Address address;
+                memcpy(&address.addr, ai->ai_addr, ai->ai_addrlen);
+                address.len = ai->ai_addrlen;
+                addresses.push_back(address);
+            }
+            if (result) {
+                freeaddrinfo(result);
+            }
+            job.done(error, std::move(addresses));
+
+            lock.lock();
+        }
+        m_resolves.clear();
+    }
+
+    std::mutex m_mutex;
+    size_t m_threads = 0;
+    std::vector<int> m_cpus;
+    std::vector<std::unique_ptr<Loop>> m_loops;
+    bool m_shut_down = false;
+
+    std::thread m_resolver;
+    std::condition_variable m_resolver_wakeup;
+    std::deque<Resolve> m_resolves;
+    bool m_resolver_stopping = false;
+};
+
+void Connection::start() {
+    auto self = shared_from_this();
+    m_loop.post([self] {
+        self->m_loop.adopt(self);
+        self->connect();
+    });
+}
+
+void Connection::stop(std::function<void()> on_stopped) {
+    auto self = shared_from_this();
+    m_loop.post([self, on_stopped] {
+        self->m_handler = nullptr;
+        self->m_stopping = true;
+        if (self->m_state == OPEN) {
+            // close handshake in the background, the stream is gone already
+            self->m_open = false;
+            self->enqueueFrame(OP_CLOSE, "\x03\xe8", 2); // 1000, normal closure
+            self->m_close_sent = true;
+            self->m_state = CLOSING;
+            self->m_deadline = Clock::now() + CLOSE_TIMEOUT;
+            self->flush();
+        } else {
+            self->closeSocket();
+            self->m_state = CLOSED;
+        }
+        if (self->m_state == CLOSED) {
+            self->retire();
+        }
+        on_stopped();
+    });
+}
+
+bool Connection::send(Opcode opcode, const void *data, size_t len) {
+    if (!isOpen()) {
+        return false;
+    }
+    return enqueueFrame(opcode, data, len, true);
+}
+
+// Frames are built straight into the output queue: header, then the payload masked in place. With
+// only_if_open the frame is dropped, and false returned, if the socket closed since the caller checked:
+// closeSocket() clears the queue under the same lock, a late frame would go out ahead of the next upgrade.
+bool Connection::enqueueFrame(Opcode opcode, const void *data, size_t len, bool only_if_open) {
+    uint8_t header[14];
+    size_t header_len = 2;
+    header[0] = 0x80 | opcode;
+    if (len < 126) {
+        header[1] = 0x80 | static_cast<uint8_t>(len);
+    } else if (len <= 0xffff) {
+        header[1] = 0x80 | 126;
+        header[2] = static_cast<uint8_t>(len >> 8);
+        header[3] = static_cast<uint8_t>(len);
+        header_len = 4;
+    } else {
+        header[1] = 0x80 | 127;
+        for (int i = 0; i < 8; i++) {
+            header[2 + i] = static_cast<uint8_t>(static_cast<uint64_t>(len) >> (56 - 8 * i));
+        }
+        header_len = 10;
+    }
+
+    bool schedule;
+    {
+        std::lock_guard<std::mutex> lock(m_out_mutex);
+        if (only_if_open && !m_open.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        const uint32_t mask = nextMask();
+        memcpy(header + header_len, &mask, 4);
+        header_len += 4;
+
+        m_out.append(reinterpret_cast<const char *>(header), header_len);
+        m_buffered.fetch_add(header_len + len, std::memory_order_relaxed);
+        size_t start = m_out.size();
+        m_out.append(static_cast<const char *>(data), len);
+        uint8_t *payload = reinterpret_cast<uint8_t *>(&m_out[start]);
+        const uint64_t mask64 = static_cast<uint64_t>(mask) << 32 | mask;
+        size_t i = 0;
+        for (; i + 8 <= len; i += 8) {
+            uint64_t chunk;
+            memcpy(&chunk, payload + i, 8);
+            chunk ^= mask64;
+            memcpy(payload + i, &chunk, 8);
+        }
+        const uint8_t *mask_bytes = header + header_len - 4;
+        for (; i < len; i++) {
+            payload[i] ^= mask_bytes[i & 3];
+        }
+
+        schedule = !m_flush_pending;
+        m_flush_pending = true;
+    }
+    if (schedule) {
+        m_loop.scheduleFlush(shared_from_this());
+    }
+    return true;
+}
+
+// xorshift64, seeded from the OpenSSL random generator
+uint32_t Connection::nextMask() {
+    m_mask_state ^= m_mask_state << 13;
+    m_mask_state ^= m_mask_state >> 7;
+    m_mask_state ^= m_mask_state << 17;
+    return static_cast<uint32_t>(m_mask_state);
+}
+
+void Connection::connect() {
+    if (m_stopping) {
+        return;
+    }
+    if (!parse_url(m_options.url, &m_url)) {
+        fail("invalid url " + m_options.url);
+        return;
+    }
+    m_state = RESOLVING;
+    m_deadline = Clock::now() + HANDSHAKE_TIMEOUT;
+    const uint32_t attempt = ++m_attempt;
+    std::weak_ptr<Connection> weak = shared_from_this();
+    Loop *loop = &m_loop;
+    Pool::instance().resolve(m_url.host, m_url.port,
+                             [weak, loop, attempt](int error, std::vector<Address>&& addresses) {
+                                 auto result = std::make_shared<std::vector<Address>>(std::move(addresses));
+                                 loop->post([weak, attempt, error, result] {
+                                     if (auto self = weak.lock()) {
+                                         self->onResolved(attempt, error, std::move(*result));
+                                     }
+                                 });
+                             });
+}
+
+void Connection::onResolved(uint32_t attempt, int error, std::vector<Address>&& addresses) {
+    if (attempt != m_attempt || m_state != RESOLVING || m_stopping) {
+        return; // timed out or stopped meanwhile
+    }
+    if (error != 0 || addresses.empty()) {
+        fail(std::string("cannot resolve ") + m_url.host + ": " + gai_strerror(error));
+        return;
+    }
+    m_addresses = std::move(addresses);
+    m_next_address = 0;
+    connectNext();
+}
+
+void Connection::connectNext() {
+    closeSocket();
+    while (m_next_address < m_addresses.size()) {
+        const Address& address = m_addresses[m_next_address++];
+        m_fd = socket(address.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (m_fd < 0) {
+            continue;
+        }
+        int one = 1;
+        setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (::connect(m_fd, reinterpret_cast<const sockaddr *>(&address.addr), address.len) == 0 ||
+            errno == EINPROGRESS) {
+            m_state = CONNECTING;
+            m_events = EPOLLOUT;
+            if (m_loop.watch(m_fd, this, m_events, EPOLL_CTL_ADD)) {
+                return;
+            }
+        }
+        close(m_fd);
+        m_fd = -1;
+    }
+    fail(std::string("cannot connect to ") + m_url.host + ":" + m_url.port + ": " + strerror(errno));
+}
+
+void Connection::onConnected() {
+    if (!m_url.tls) {
+        sendUpgrade();
+        return;
+    }
+
+    std::string error;
+    SSL_CTX *ctx = tls_client_context(m_options.tls_cafile, m_options.tls_certfile, m_options.tls_keyfile, &error);
+    if (!ctx || !(m_ssl = SSL_new(ctx))) {
+        fail(ctx ? "cannot create TLS session" : error);
+        return;
+    }
+    SSL_set_fd(m_ssl, m_fd);
+    SSL_set_tlsext_host_name(m_ssl, m_url.host.c_str());
+    if (m_options.tls_cafile != "NONE" && !m_options.tls_disable_hostname_validation) {
+        SSL_set1_host(m_ssl, m_url.host.c_str());
+    }
+    // resumes the session of the previous connection to the same server, if still valid
+    tls_session_attach(ctx, m_ssl, m_url.host + ":" + m_url.port);
+    m_state = TLS_HANDSHAKE;
+    tlsHandshake();
+}
+
+void Connection::tlsHandshake() {
+    ERR_clear_error();
+    int ret = SSL_connect(m_ssl);
+    if (ret == 1) {
+        m_tls_want_write = false;
+        tls_session_handshake_done(m_ssl);
+        sendUpgrade();
+        return;
+    }
+    int error = SSL_get_error(m_ssl, ret);
+    if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+        m_tls_want_write = error == SSL_ERROR_WANT_WRITE;
+        updateEvents();
+        return;
+    }
+    char reason[256];
+    ERR_error_string_n(ERR_get_error(), reason, sizeof(reason));
+    fail(std::string("TLS handshake failed: ") + reason);
+}
+
+void Connection::sendUpgrade() {
+    unsigned char nonce[16];
+    if (RAND_bytes(nonce, sizeof(nonce)) != 1) {
+        fail("cannot generate the websocket key");
+        return;
+    }
+    m_key.resize(base64_encoded_size(sizeof(nonce)));
+    base64_encode_into(nonce, sizeof(nonce), &m_key[0]);
+
+    std::string request;
+    request.reserve(512);
+    request += "GET " + m_url.target + " HTTP/1.1\r\n";
+    request += "Host: " + m_url.host_header + "\r\n";
+    request += "Upgrade: websocket\r\nConnection: Upgrade\r\n";
+    request += "Sec-WebSocket-Key: " + m_key + "\r\n";
+    request += "Sec-WebSocket-Version: 13\r\n";
+    request += "User-Agent: mod_openai_audio_stream\r\n";
+    for (const auto& header : m_options.headers) {
+        request += header.first + ": " + header.second + "\r\n";
+    }
+    request += "\r\n";
+
+    m_state = UPGRADING;
+    {
+        std::lock_guard<std::mutex> lock(m_out_mutex);
+        m_out += request;
+        m_buffered.fetch_add(request.size(), std::memory_order_relaxed);
+    }
+    flush();
+}
+
+bool Connection::parseUpgrade() {
+    size_t end = m_in.find("\r\n\r\n");
+    if (end == std::string::npos) {
+        if (m_in.size() > MAX_UPGRADE_RESPONSE_SIZE) {
+            fail("upgrade response too large");
+        }
+        return false;
+    }
+
+    int status = 0;
+    if (sscanf(m_in.c_str(), "HTTP/1.%*d %d", &status) != 1 || status != 101) {
+        fail("websocket upgrade refused", status);
+        return false;
+    }
+
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    std::string accept_input = m_key + WS_GUID;
+    SHA1(reinterpret_cast<const unsigned char *>(accept_input.data()), accept_input.size(), digest);
+    std::string expected(base64_encoded_size(sizeof(digest)), '\0');
+    base64_encode_into(digest, sizeof(digest), &expected[0]);
+
+    bool accepted = false;
+    size_t line = m_in.find("\r\n") + 2;
+    while (line < end) {
+        size_t next = m_in.find("\r\n", line);
+        size_t colon = m_in.find(':', line);
+        if (colon != std::string::npos && colon < next) {
+            std::string name = m_in.substr(line, colon - line);
+            if (header_equals(name, name.size(), "sec-websocket-accept")) {
+                size_t value = m_in.find_first_not_of(" \t", colon + 1);
+                accepted = value < next && m_in.compare(value, next - value, expected) == 0;
+            } else if (header_equals(name, name.size(), "sec-websocket-extensions")) {
+                fail("unexpected websocket extension");
+                return false;
+            }
+        }
+        line = next + 2;
+    }
+    if (!accepted) {
+        fail("invalid Sec-WebSocket-Accept", status);
+        return false;
+    }
+
+    m_in.erase(0, end + 4);
+    m_state = OPEN;
+    m_retries = 0;
+    m_last_write = Clock::now();
+    m_open = true;
+    WsEvent event = {};
+    event.type = WS_EVENT_OPEN;
+    emit(event);
+    return true;
+}
+
+void Connection::onEvents(uint32_t events) {
+    if (m_fd < 0) {
+        return; // closed earlier in this batch
+    }
+    switch (m_state) {
+        case CONNECTING: {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &error, &len);
+            if (error != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+                errno = error;
+                connectNext();
+                return;
+            }
+            onConnected();
+            return;
+        }
+        case TLS_HANDSHAKE:
+            tlsHandshake();
+            return;
+        default:
+            break;
+    }
+
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        readInput();
+    }
+    if (m_fd >= 0 && (events & EPOLLOUT)) {
+        flush();
+    }
+}
+
+void Connection::readInput() {
+    char *buffer = m_loop.readBuffer();
+    for (int i = 0; m_fd >= 0; i++) {
+        ssize_t n = ioRead(buffer, READ_SIZE);
+        if (n < 0) {
+            dropped(1006, "connection lost");
+            return;
+        }
+        if (n == 0) {
+            break;
+        }
+        m_in.append(buffer, n);
+        if (m_state == UPGRADING && !parseUpgrade()) {
+            continue; // incomplete, or failed and closed
+        }
+        if (m_state == OPEN || m_state == CLOSING) {
+            parseFrames();
+        }
+        // records already decrypted by OpenSSL raise no epoll event, they must be drained now
+        if (m_ssl && SSL_pending(m_ssl) > 0) {
+            continue;
+        }
+        if (static_cast<size_t>(n) < READ_SIZE || i + 1 >= MAX_READS_PER_EVENT) {
+            break;
+        }
+    }
+    // TLS may need to write to make progress on a read, and data may wait for a writable socket
+    if (m_fd >= 0) {
+        flush();
+    }
+}
+
+void Connection::parseFrames() {
+    size_t pos = 0;
+    while (m_fd >= 0) {
+        const size_t available = m_in.size() - pos;
+        if (available < 2) {
+            break;
+        }
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(m_in.data()) + pos;
+        const bool fin = p[0] & 0x80;
+        const int opcode = p[0] & 0x0f;
+        const bool masked = p[1] & 0x80;
+        uint64_t len = p[1] & 0x7f;
+        size_t header = 2;
+        if (len == 126) {
+            if (available < 4) {
+                break;
+            }
+            len = static_cast<uint64_t>(p[2]) << 8 | p[3];
+            header = 4;
+        } else if (len == 127) {
+            if (available < 10) {
+                break;
+            }
+            len = 0;
+            for (int i = 0; i < 8; i++) {
+                len = len << 8 | p[2 + i];
+            }
+            header = 10;
+        }
+        if (masked) {
+            header += 4;
+        }
+        if (len > MAX_MESSAGE_SIZE) {
+            dropped(1009, "message too big");
+            return;
+        }
+        if (available < header + len) {
+            break;
+        }
+
+        char *payload = &m_in[pos + header];
+        if (masked) { // servers must not mask, but tolerate it
+            const uint8_t *mask = p + header - 4;
+            for (size_t i = 0; i < len; i++) {
+                payload[i] ^= mask[i & 3];
+            }
+        }
+        pos += header + len;
+        if (!handleFrame(fin, opcode, payload, len)) {
+            return; // the connection is closed, m_in was reset
+        }
+    }
+    m_in.erase(0, pos);
+}
+
+bool Connection::handleFrame(bool fin, int opcode, char *payload, size_t len) {
+    switch (opcode) {
+        case OP_TEXT:
+        case OP_BINARY:
+            if (m_fragment_opcode >= 0) {
+                dropped(1002, "unexpected data frame in fragmented message");
+                return false;
+            }
+            if (fin) {
+                deliverMessage(opcode, payload, len);
+            } else {
+                m_fragment_opcode = opcode;
+                m_fragments.assign(payload, len);
+            }
+            return true;
+        case OP_CONTINUATION:
+            if (m_fragment_opcode < 0) {
+                dropped(1002, "unexpected continuation frame");
+                return false;
+            }
+            if (m_fragments.size() + len > MAX_MESSAGE_SIZE) {
+                dropped(1009, "message too big");
+                return false;
+            }
+            m_fragments.append(payload, len);
+            if (fin) {
+                int fragment_opcode = m_fragment_opcode;
+                m_fragment_opcode = -1;
+                deliverMessage(fragment_opcode, &m_fragments[0], m_fragments.size());
+                m_fragments.clear();
+            }
+            return true;
+        case OP_PING:
+            if (m_state == OPEN) {
+                enqueueFrame(OP_PONG, payload, len);
+            }
+            return true;
+        case OP_PONG:
+            return true;
+        case OP_CLOSE: {
+            uint16_t code = len >= 2 ? static_cast<uint16_t>(static_cast<uint8_t>(payload[0]) << 8 |
+                                                             static_cast<uint8_t>(payload[1]))
+                                     : 1005;
+            std::string reason = len > 2 ? std::string(payload + 2, len - 2) : std::string();
+            if (!m_close_sent) {
+                enqueueFrame(OP_CLOSE, payload, std::min<size_t>(len, 2));
+                m_close_sent = true;
+                flush();
+            }
+            dropped(code, reason);
+            return false;
+        }
+        default:
+            dropped(1002, "unknown opcode");
+            return false;
+    }
+}
+
+// Text is handed over NUL terminated without a copy: the byte after the payload is
+// borrowed for the duration of the callback.
+void Connection::deliverMessage(int opcode, char *payload, size_t len) {
+    WsEvent event = {};
+    event.type = opcode == OP_TEXT ? WS_EVENT_TEXT : WS_EVENT_BINARY;
+    event.data = payload;
+    event.len = len;
+
+    char *end = payload + len;
+    const bool borrowed = end != m_fragments.data() + m_fragments.size() && end != m_in.data() + m_in.size();
+    char saved = 0;
+    if (borrowed) {
+        saved = *end;
+        *end = '\0';
+    }
+    emit(event);
+    if (borrowed) {
+        *end = saved;
+    }
+}
+
+void Connection::flush() {
+    if (m_fd < 0 || m_state == CONNECTING || m_state == TLS_HANDSHAKE) {
+        std::lock_guard<std::mutex> lock(m_out_mutex);
+        m_flush_pending = false;
+        return;
+    }
+    for (;;) {
+        if (m_send_offset == m_sending.size()) {
+            m_sending.clear();
+            m_send_offset = 0;
+            std::lock_guard<std::mutex> lock(m_out_mutex);
+            if (m_out.empty()) {
+                m_flush_pending = false;
+                break;
+            }
+            m_sending.swap(m_out);
+        }
+        ssize_t n = ioWrite(m_sending.data() + m_send_offset, m_sending.size() - m_send_offset);
+        if (n < 0) {
+            dropped(1006, "connection lost");
+            return;
+        }
+        if (n == 0) {
+            break; // EPOLLOUT resumes
+        }
+        m_send_offset += n;
+        m_buffered.fetch_sub(n, std::memory_order_relaxed);
+        m_last_write = Clock::now();
+    }
+    updateEvents();
+}
+
+void Connection::onTick(Clock::time_point now) {
+    switch (m_state) {
+        case RESOLVING:
+        case CONNECTING:
+        case TLS_HANDSHAKE:
+        case UPGRADING:
+            if (now >= m_deadline) {
+                fail("connection timed out");
+            }
+            break;
+        case OPEN:
+            if (m_options.ping_interval_secs > 0 &&
+                now - m_last_write >= std::chrono::seconds(m_options.ping_interval_secs)) {
+                m_last_write = now;
+                enqueueFrame(OP_PING, "", 0);
+            }
+            break;
+        case CLOSING:
+            if (now >= m_deadline) {
+                dropped(1006, "close timed out");
+            }
+            break;
+        case CLOSED:
+            if (!m_stopping && m_options.auto_reconnect && now >= m_reconnect_at) {
+                connect();
+            }
+            break;
+        case IDLE:
+            break;
+    }
+}
+
+// The connection could not be established.
+void Connection::fail(const std::string& reason, int http_status) {
+    closeSocket();
+    m_state = CLOSED;
+    if (m_stopping) {
+        return;
+    }
+    m_retries++;
+    WsEvent event = {};
+    event.type = WS_EVENT_ERROR;
+    event.retries = m_retries;
+    event.wait_time = std::min(std::pow(2.0, m_retries) * 100, MAX_RECONNECT_WAIT_MS);
+    event.http_status = http_status;
+    event.reason = reason.c_str();
+    scheduleReconnect();
+    m_reconnect_at = Clock::now() + std::chrono::milliseconds(static_cast<int64_t>(event.wait_time));
+    emit(event);
+}
+
+// An established connection went away.
+void Connection::dropped(uint16_t code, const std::string& reason) {
+    const bool was_open = m_state == OPEN || m_state == CLOSING;
+    closeSocket();
+    m_state = CLOSED;
+    if (m_stopping) {
+        retire();
+        return;
+    }
+    if (!was_open) {
+        fail(reason);
+        return;
+    }
+    scheduleReconnect();
+    m_reconnect_at = Clock::now();
+    WsEvent event = {};
+    event.type = WS_EVENT_CLOSE;
+    event.close_code = code;
+    event.reason = reason.c_str();
+    emit(event);
+}
+
+// Once the stream stopped and the socket is closed. Only the first call counts: stop() may find
+// the connection closed by a flush that already failed and retired it.
+void Connection::retire() {
+    if (m_retired) {
+        return;
+    }
+    m_retired = true;
+    m_loop.retire(shared_from_this());
+    m_loop.load.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void Connection::scheduleReconnect() {
+    m_addresses.clear();
+    m_in.clear();
+    m_fragments.clear();
+    m_fragment_opcode = -1;
+    m_close_sent = false;
+}
+
+void Connection::shutdownNow() {
+    m_handler = nullptr;
+    m_stopping = true;
+    closeSocket();
+    m_state = CLOSED;
+}
+
+void Connection::closeSocket() {
+    {
+        // senders check m_open under the lock, nothing is queued past this point
+        std::lock_guard<std::mutex> lock(m_out_mutex);
+        m_open = false;
+        m_out.clear();
+    }
+    if (m_ssl) {
+        SSL_free(m_ssl);
+        m_ssl = nullptr;
+    }
+    if (m_fd >= 0) {
+        m_loop.unwatch(m_fd);
+        close(m_fd);
+        m_fd = -1;
+    }
+    m_events = 0;
+    m_tls_want_write = false;
+    m_sending.clear();
+    m_send_offset = 0;
+    m_buffered.store(0, std::memory_order_relaxed);
+}
+
+void Connection::updateEvents() {
+    if (m_fd < 0) {
+        return;
+    }
+    uint32_t events = EPOLLIN;
+    if (m_tls_want_write || m_send_offset < m_sending.size()) {
+        events |= EPOLLOUT;
+    }
+    if (events != m_events) {
+        m_events = events;
+        m_loop.watch(m_fd, this, events, EPOLL_CTL_MOD);
+    }
+}
+
+void Connection::emit(const WsEvent& event) {
+    if (m_handler) {
+        m_handler(event);
+    }
+}
+
+ssize_t Connection::ioRead(char *buf, size_t len) {
+    if (!m_ssl) {
+        ssize_t n = recv(m_fd, buf, len, 0);
+        if (n > 0) {
+            return n;
+        }
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+    ERR_clear_error();
+    int n = SSL_read(m_ssl, buf, static_cast<int>(std::min<size_t>(len, INT32_MAX)));
+    if (n > 0) {
+        return n;
+    }
+    int error = SSL_get_error(m_ssl, n);
+    if (error == SSL_ERROR_WANT_READ) {
+        return 0;
+    }
+    if (error == SSL_ERROR_WANT_WRITE) {
+        m_tls_want_write = true;
+        return 0;
+    }
+    return -1;
+}
+
+ssize_t Connection::ioWrite(const char *buf, size_t len) {
+    if (!m_ssl) {
+        ssize_t n = ::send(m_fd, buf, len, MSG_NOSIGNAL);
+        if (n >= 0) {
+            return n;
+        }
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    }
+    ERR_clear_error();
+    int n = SSL_write(m_ssl, buf, static_cast<int>(std::min<size_t>(len, INT32_MAX)));
+    if (n > 0) {
+        m_tls_want_write = false;
+        return n;
+    }
+    int error = SSL_get_error(m_ssl, n);
+    if (error == SSL_ERROR_WANT_WRITE || error == SSL_ERROR_WANT_READ) {
+        m_tls_want_write = error == SSL_ERROR_WANT_WRITE;
+        return 0;
+    }
+    return -1;
+}
+
+class EventLoopTransport : public WsTransport {
+  public:
+    explicit EventLoopTransport(std::shared_ptr<Connection> connection) : m_connection(std::move(connection)) {}
+
+    void start() override {
+        m_connection->start();
+    }
+
+    void stop(std::function<void()> on_stopped) override {
+        m_connection->stop(std::move(on_stopped));
+    }
+
+    bool is_open() const override {
+        return m_connection->isOpen();
+    }
+
+    bool send_text(const char *data, size_t len) override {
+        return m_connection->send(OP_TEXT, data, len);
+    }
+
+    bool send_binary(const void *data, size_t len) override {
+        return m_connection->send(OP_BINARY, data, len);
+    }
+
+    size_t buffered_amount() const override {
+        return m_connection->bufferedAmount();
+    }
+
+  private:
+    std::shared_ptr<Connection> m_connection;
+};
+
+} // namespace
+
+bool ws_event_loop_enabled() {
+    return Pool::instance().enabled();
+}
+
+std::unique_ptr<WsTransport> ws_event_loop_transport_create(const WsTransportOptions& options,
+                                                            WsEventHandler handler) {
+    Loop *loop = Pool::instance().pick();
+    if (!loop) {
+        return nullptr;
+    }
+    auto connection = std::make_shared<Connection>(*loop, options, std::move(handler));
+    return std::unique_ptr<WsTransport>(new EventLoopTransport(std::move(connection)));
+}
+
+void ws_event_loop_configure(size_t threads, const std::vector<int>& cpus) {
+    Pool::instance().configure(threads, cpus);
+}
+
+void ws_event_loop_shutdown() {
+    Pool::instance().shutdown();
+}
@@ -0,0 +1,24 @@
+#ifndef WS_EVENT_LOOP_H
+#define WS_EVENT_LOOP_H
+
+#include <memory>
+
+#include "ws_transport.h"
+
+//
+// Websocket client multiplexed on a small pool of epoll threads. Each stream is
+// assigned to the least loaded loop when it starts and stays there; the loop
+// does the connect, TLS and upgrade handshakes, framing, heart beats and
+// reconnections of all its streams, and runs their callbacks.
+//
+// Host names are resolved by one extra thread shared by all loops, since
+// getaddrinfo() blocks. Per message deflate is never negotiated. TLS sessions
+// are resumed across connections to the same server (tls_session_cache.h).
+//
+
+bool ws_event_loop_enabled();
+
+std::unique_ptr<WsTransport> ws_event_loop_transport_create(const WsTransportOptions& options,
+                                                            WsEventHandler handler);
+
+#endif // WS_EVENT_LOOP_H
@@ -0,0 +1,122 @@
+#include "ws_transport.h"
+
+#include <ixwebsocket/IXWebSocket.h>
+
+#include "teardown_queue.h"
+#include "ws_event_loop.h"
+
+namespace {
+
+// Set while an ix socket thread runs a handler, which may close its own stream.
+thread_local bool t_in_socket_thread = false;
+
+// One ix::WebSocket and its thread per stream.
+class IxTransport : public WsTransport {
+  public:
+    IxTransport(const WsTransportOptions& options, WsEventHandler handler) : m_handler(std::move(handler)) {
+        m_ws.setUrl(options.url);
+
+        // tls_cafile may hold the special values NONE, which disables validation,
+        // and SYSTEM which uses the system CAs bundle
+        ix::SocketTLSOptions tlsOptions;
+        tlsOptions.caFile = options.tls_cafile;
+        tlsOptions.keyFile = options.tls_keyfile;
+        tlsOptions.certFile = options.tls_certfile;
+        tlsOptions.disable_hostname_validation = options.tls_disable_hostname_validation;
+        m_ws.setTLSOptions(tlsOptions);
+
+        if (options.ping_interval_secs)
+            m_ws.setPingInterval(options.ping_interval_secs);
+
+        if (!options.per_message_deflate)
+            m_ws.disablePerMessageDeflate();
+
+        if (!options.headers.empty())
+            m_ws.setExtraHeaders(ix::WebSocketHttpHeaders(options.headers.begin(), options.headers.end()));
+
+        if (!options.auto_reconnect)
+            m_ws.disableAutomaticReconnection();
+
+        m_ws.setOnMessageCallback([this](const ix::WebSocketMessagePtr& msg) { dispatch(msg); });
+    }
+
+    void start() override {
+        m_ws.start();
+    }
+
+    // ix::WebSocket::stop() waits for the close handshake and joins the socket thread,
+    // which may be the caller (a callback closing the stream), so it runs on the teardown queue.
+    // A socket thread neither waits for room there nor runs the stop itself.
+    void stop(std::function<void()> on_stopped) override {
+        TeardownQueue::instance().post(
+            [this, on_stopped] {
+                m_ws.stop();
+                on_stopped();
+            },
+            !t_in_socket_thread);
+    }
+
+    bool is_open() const override {
+        return m_ws.getReadyState() == ix::ReadyState::Open;
+    }
+
+    bool send_text(const char *data, size_t len) override {
+        return m_ws.sendUtf8Text(ix::IXWebSocketSendData(data, len)).success;
+    }
+
+    bool send_binary(const void *data, size_t len) override {
+        return m_ws.sendBinary(ix::IXWebSocketSendData(static_cast<const char *>(data), len)).success;
+    }
+
+    size_t buffered_amount() const override {
+        return m_ws.bufferedAmount();
+    }
+
+  private:
+    void dispatch(const ix::WebSocketMessagePtr& msg) {
+        WsEvent event = {};
+        switch (msg->type) {
+            case ix::WebSocketMessageType::Message:
+                event.type = msg->binary ? WS_EVENT_BINARY : WS_EVENT_TEXT;
+                event.data = msg->str.c_str();
+                event.len = msg->str.size();
+                break;
+            case ix::WebSocketMessageType::Open:
+                event.type = WS_EVENT_OPEN;
+                break;
+            case ix::WebSocketMessageType::Error:
+                event.type = WS_EVENT_ERROR;
+                event.retries = msg->errorInfo.retries;
+                event.wait_time = msg->errorInfo.wait_time;
+                event.http_status = msg->errorInfo.http_status;
+                event.reason = msg->errorInfo.reason.c_str();
+                break;
+            case ix::WebSocketMessageType::Close:
+                event.type = WS_EVENT_CLOSE;
+                event.close_code = msg->closeInfo.code;
+                event.reason = msg->closeInfo.reason.c_str();
+                break;
+            default:
+                return; // ping, pong and fragments are handled by ix
+        }
+        t_in_socket_thread = true;
+        m_handler(event);
+        t_in_socket_thread = false;
+    }
+
+    WsEventHandler m_handler;
+    ix::WebSocket m_ws;
+};
+
+} // namespace
+
+std::unique_ptr<WsTransport> ws_transport_create(const WsTransportOptions& options, WsEventHandler handler) {
+    if (ws_event_loop_enabled()) {
+        std::unique_ptr<WsTransport> transport = ws_event_loop_transport_create(options, handler);
+        if (transport) {
+            return transport;
+        }
+        // the loops could not start or are shut down, fall back to a thread of our own
+    }
+    return std::unique_ptr<WsTransport>(new IxTransport(options, std::move(handler)));
+}
@@ -0,0 +1,83 @@
+#ifndef WS_TRANSPORT_H
+#define WS_TRANSPORT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+//
+// Client websocket of a stream. There are two implementations:
+//  - one ix::WebSocket per stream, each with its own thread (the default);
+//  - a shared event loop that multiplexes the sockets of all streams on a few epoll
+//    threads, selected with ws_event_loop_configure().
+//
+// Callbacks of one transport never run concurrently. The send methods can be called
+// from any thread.
+//
+
+struct WsTransportOptions {
+    std::string url;
+    std::map<std::string, std::string> headers; // extra headers of the upgrade request
+    std::string tls_cafile = "SYSTEM";          // CA file, "SYSTEM" for the system bundle, "NONE" to not verify
+    std::string tls_keyfile;
+    std::string tls_certfile;
+    bool tls_disable_hostname_validation = false;
+    int ping_interval_secs = 0; // heart beat when idle, 0 disables it
+    bool per_message_deflate = true;
+    bool auto_reconnect = true;
+};
+
+enum WsEventType { WS_EVENT_OPEN, WS_EVENT_CLOSE, WS_EVENT_ERROR, WS_EVENT_TEXT, WS_EVENT_BINARY };
+
+struct WsEvent {
+    WsEventType type;
+    const char *data; // message payload, text is NUL terminated
+    size_t len;
+    // WS_EVENT_ERROR
+    uint32_t retries;
+    double wait_time; // ms before the next connection attempt
+    int http_status;
+    // WS_EVENT_CLOSE
+    uint16_t close_code;
+    // WS_EVENT_ERROR and WS_EVENT_CLOSE
+    const char *reason;
+};
+
+typedef std::function<void(const WsEvent&)> WsEventHandler;
+
+class WsTransport {
+  public:
+    virtual ~WsTransport() {}
+
+    // Connects in the background, progress is reported to the handler.
+    virtual void start() = 0;
+
+    // Closes the connection. on_stopped runs, possibly on another thread, once no callback
+    // is running or will run again; it may destroy the transport.
+    virtual void stop(std::function<void()> on_stopped) = 0;
+
+    virtual bool is_open() const = 0;
+    virtual bool send_text(const char *data, size_t len) = 0;
+    virtual bool send_binary(const void *data, size_t len) = 0;
+
+    // Bytes accepted by the send methods and not handed to the socket yet. It grows when
+    // the link cannot keep up; callers use it to hold back data that would arrive stale.
+    virtual size_t buffered_amount() const = 0;
+};
+
+// Creates the transport currently selected for new streams.
+std::unique_ptr<WsTransport> ws_transport_create(const WsTransportOptions& options, WsEventHandler handler);
+
+// Makes new streams share event loop threads instead of owning one thread each,
+// 0 goes back to a thread per stream. If cpus is not empty, loop i is pinned to
+// cpus[i % cpus.size()]. Meant to be called at module load, before any stream starts.
+void ws_event_loop_configure(size_t threads, const std::vector<int>& cpus);
+
+// Closes the connections still on the event loop and joins its threads.
+void ws_event_loop_shutdown();
+
+#endif // WS_TRANSPORT_H